@@ -0,0 +1,55 @@
+#pragma once
+
+namespace daf
+{
+#ifdef DAF_HEADLESS
+	class SyntheticActor;
+#endif
+
+	// What an alias of a rule set reads from an actor
+	enum class InputType : uint8_t
+	{
+		kNone = 0,
+		kActorValue = 1 << 0,
+		kWornKeyword = 1 << 1,
+		kNPCKeyword = 1 << 2,
+		kMorph = 1 << 3,
+		kAny = kActorValue | kWornKeyword | kNPCKeyword | kMorph
+	};
+
+	// An alias EditorID resolved by a provider, read back by the same provider on every acquisition
+	struct InputReference
+	{
+		InputType        type{ InputType::kNone };
+		uint32_t         formID{ 0 };  // ActorValueInfo or BGSKeyword, 0 for morphs
+		uint32_t         index{ 0 };   // Provider-defined slot, e.g. the KeywordIndex bit of a keyword
+		std::string_view editorID;     // Owned by the rule set
+	};
+
+	// Source of every value rules read from actors. Rule sets only reach actors through their provider,
+	// so the rule engine can run without the game, see SyntheticActorProvider and bench/RuleHarness.cpp.
+	class ActorDataProvider
+	{
+	public:
+#ifdef DAF_HEADLESS
+		using Actor = SyntheticActor;
+#else
+		using Actor = RE::Actor;
+#endif
+
+		virtual ~ActorDataProvider() = default;
+
+		// Resolves a_editorID to the first of a_types it names, tried in the order of InputType.
+		// Called while loading, possibly for several rule sets at once.
+		virtual std::optional<InputReference> Resolve(std::string_view a_editorID, InputType a_types) = 0;
+
+		// Resolves an input written to the rule set cache by an earlier session,
+		// nullopt if a_formID no longer names a form of that type
+		virtual std::optional<InputReference> Restore(std::string_view a_editorID, InputType a_type, uint32_t a_formID) = 0;
+
+		// Must run where the actor is safe to read, concurrently for different actors
+		virtual float Acquire(Actor* a_actor, const InputReference& a_input) const = 0;
+
+		virtual uint32_t GetFormID(const Actor* a_actor) const = 0;
+	};
+}
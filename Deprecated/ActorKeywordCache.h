@@ -0,0 +1,175 @@
+#pragma once
+#include "SFEventHandler.h"
+#include "Singleton.h"
+#include "DenseBitset.h"
+
+namespace daf
+{
+	using KeywordBitset = DenseBitset;
+
+	// Dense bit positions for every keyword referenced by any loaded rule set
+	class KeywordIndex : public utils::SingletonBase<KeywordIndex>
+	{
+		friend class utils::SingletonBase<KeywordIndex>;
+
+	public:
+		static constexpr uint32_t InvalidBit = UINT32_MAX;
+
+		// Returns the existing bit if the keyword is already indexed
+		uint32_t Register(RE::BGSKeyword* a_keyword)
+		{
+			tbb::concurrent_hash_map<RE::BGSKeyword*, uint32_t>::accessor acc;
+			if (m_bits.insert(acc, a_keyword)) {
+				acc->second = m_num_bits++;
+			}
+			return acc->second;
+		}
+
+		uint32_t Find(RE::BGSKeyword* a_keyword) const
+		{
+			tbb::concurrent_hash_map<RE::BGSKeyword*, uint32_t>::const_accessor acc;
+			if (m_bits.find(acc, a_keyword)) {
+				return acc->second;
+			}
+			return InvalidBit;
+		}
+
+		uint32_t Size() const
+		{
+			return m_num_bits.load(std::memory_order_acquire);
+		}
+
+	private:
+		KeywordIndex() = default;
+
+		tbb::concurrent_hash_map<RE::BGSKeyword*, uint32_t> m_bits;
+		std::atomic<uint32_t>                               m_num_bits{ 0 };
+	};
+
+	// Worn and NPC keywords of an actor as KeywordIndex bitsets, built in one equipment pass
+	// and kept until the actor equips or unequips something
+	class ActorKeywordCache :
+		public utils::SingletonBase<ActorKeywordCache>,
+		public events::ArmorOrApparelEquippedEventDispatcher::Listener
+	{
+		friend class utils::SingletonBase<ActorKeywordCache>;
+
+	public:
+		virtual ~ActorKeywordCache() = default;
+
+		void OnEvent(const events::ArmorOrApparelEquippedEvent& a_event, events::EventDispatcher<events::ArmorOrApparelEquippedEvent>* a_dispatcher) override
+		{
+			if (a_event.actor) {
+				Invalidate(a_event.actor->formID);
+			}
+		}
+
+		void Register()
+		{
+			events::ArmorOrApparelEquippedEventDispatcher::GetSingleton()->AddStaticListener(this);
+		}
+
+		bool HasWornKeyword(RE::Actor* a_actor, uint32_t a_bit)
+		{
+			return _test(a_actor, a_bit, [](const Entry& a_entry) -> const KeywordBitset& { return a_entry.worn; });
+		}
+
+		bool HasNPCKeyword(RE::Actor* a_actor, uint32_t a_bit)
+		{
+			return _test(a_actor, a_bit, [](const Entry& a_entry) -> const KeywordBitset& { return a_entry.npc; });
+		}
+
+		void Invalidate(RE::TESFormID a_formID)
+		{
+			m_entries.erase(a_formID);
+		}
+
+		void Clear()
+		{
+			m_entries.clear();
+		}
+
+	private:
+		ActorKeywordCache() = default;
+
+		struct Entry
+		{
+			KeywordBitset worn;
+			KeywordBitset npc;
+			uint32_t      num_bits{ 0 };  // KeywordIndex size when built, later keywords need a rebuild
+		};
+
+		using Entries_T = tbb::concurrent_hash_map<RE::TESFormID, Entry>;
+
+		template <class _Selector>
+		bool _test(RE::Actor* a_actor, uint32_t a_bit, _Selector a_selector)
+		{
+			{
+				Entries_T::const_accessor acc;
+				if (m_entries.find(acc, a_actor->formID) && a_bit < acc->second.num_bits) {
+					return a_selector(acc->second).Test(a_bit);
+				}
+			}
+
+			Entries_T::accessor acc;
+			m_entries.insert(acc, a_actor->formID);
+			if (a_bit >= acc->second.num_bits) {
+				Build(a_actor, acc->second);
+			}
+			return a_selector(acc->second).Test(a_bit);
+		}
+
+		static void Build(RE::Actor* a_actor, Entry& a_entry)
+		{
+			auto& index = KeywordIndex::GetSingleton();
+
+			a_entry.num_bits = index.Size();
+			a_entry.worn.Clear();
+			a_entry.npc.Clear();
+
+			auto mark = [&index](KeywordBitset& a_bitset, RE::BGSKeyword* a_keyword) {
+				if (!a_keyword) {
+					return;
+				}
+				if (auto bit = index.Find(a_keyword); bit != KeywordIndex::InvalidBit) {
+					a_bitset.Set(bit);
+				}
+			};
+
+			a_actor->ForEachEquippedItem([&a_entry, &mark](const RE::BGSInventoryItem& a_item) -> RE::BSContainer::ForEachResult {
+				if (!a_item.object || !a_item.object->Is<RE::TESObjectARMO>()) {
+					return RE::BSContainer::ForEachResult::kContinue;
+				}
+
+				auto armor = a_item.object->As<RE::TESObjectARMO>();
+				for (auto& kw : armor->keywords) {
+					mark(a_entry.worn, kw);
+				}
+
+				auto instance_data = a_item.instanceData.get();
+				if (!instance_data) {
+					return RE::BSContainer::ForEachResult::kContinue;
+				}
+
+				auto instance_data_kw_form = instance_data->GetKeywordData();
+				if (!instance_data_kw_form) {
+					return RE::BSContainer::ForEachResult::kContinue;
+				}
+
+				for (auto& kw : instance_data_kw_form->keywords) {
+					mark(a_entry.worn, kw);
+				}
+
+				return RE::BSContainer::ForEachResult::kContinue;
+			});
+
+			if (auto npc = a_actor->GetNPC(); npc) {
+				for (auto& kw : npc->keywords) {
+					mark(a_entry.npc, kw);
+				}
+			}
+		}
+
+		Entries_T m_entries;
+	};
+}
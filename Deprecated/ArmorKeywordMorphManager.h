@@ -43,9 +43,8 @@ namespace DEPRECATED
 					else if (parser.hasAdd()) {
 						mode = Mode::kAdd;
 					} else {
-						std::string error_msg = std::format("Failed to parse morph keyword script: kw:{}, script:{}, error:{}", utils::make_str(a_keyword), script, "No --add or --set specified");
-						logger::c_error(error_msg.c_str());
-						logger::error(error_msg.c_str());
+						logger::c_error_limited("Failed to parse morph keyword script: kw:{}, script:{}, error:{}", utils::make_str(a_keyword), script, "No --add or --set specified");
+						logger::error_limited("Failed to parse morph keyword script: kw:{}, script:{}, error:{}", utils::make_str(a_keyword), script, "No --add or --set specified");
 						is_active = false;
 						return;
 					}
@@ -54,9 +53,8 @@ namespace DEPRECATED
 					morph_name = parser.getMorphName();
 					priority = parser.getPriority();
 				} else {
-					std::string error_msg = std::format("Failed to parse morph keyword script: kw:{}, script:{}, error:{}", utils::make_str(a_keyword), script, parser.getLastError());
-					logger::c_error(error_msg.c_str());
-					logger::error(error_msg.c_str());
+					logger::c_error_limited("Failed to parse morph keyword script: kw:{}, script:{}, error:{}", utils::make_str(a_keyword), script, parser.getLastError());
+					logger::error_limited("Failed to parse morph keyword script: kw:{}, script:{}, error:{}", utils::make_str(a_keyword), script, parser.getLastError());
 					is_active = false;
 					return;
 				}
@@ -212,6 +210,7 @@ namespace DEPRECATED
 		bool ReevaluateActorMorph(RE::Actor* a_actor)
 		{
 			// Critical section
+			daf::MorphMirror::GetSingleton().Sync(a_actor);  // The session reads the mirror
 			daf::DynamicMorphSession manager(daf::tokens::general_offset, a_actor);
 			// End of critical section
 
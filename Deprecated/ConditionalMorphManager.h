@@ -5,12 +5,15 @@
 #include "Singleton.h"
 
 #include "ChargenUtils.h"
+#include "RebuildTelemetry.h"
+#include "TraceBuffer.h"
 
 namespace daf
 {
 	extern constexpr time_t MenuActorUpdateInterval_ms = 300;
 	extern constexpr time_t ActorUpdateInterval_ms = 200;
 	extern constexpr float  DiffThreshold = 0.05f;
+	extern constexpr float  MorphTransition_s = 1.5f;  // Menu actors are updated at once
 
 	namespace tokens
 	{
@@ -24,6 +27,7 @@ namespace daf
 		public events::GameDataLoadedEventDispatcher::Listener,
 		public events::EventDispatcher<events::ActorUpdateEvent>::Listener,
 		public events::EventDispatcher<events::ActorFirstUpdateEvent>::Listener,
+		public events::EventDispatcher<daf::RuleSetReloadedEvent>::Listener,
 		public RE::BSTEventSink<RE::SaveLoadEvent>
 	{
 		friend class utils::SingletonBase<ConditionalMorphManager>;
@@ -71,9 +75,7 @@ namespace daf
 			auto actor = a_event.actor;
 			if (utils::IsActorMenuActor(a_event.actor) && a_event.when() - menu_actor_last_update_time > MenuActorUpdateInterval_ms) {
 				menu_actor_last_update_time = a_event.when();
-				if (this->ReevaluateActorMorph(actor)) {
-					actor->UpdateChargenAppearance();
-				}
+				this->GatherActorMorph(actor);
 				return;
 			}
 
@@ -87,9 +89,7 @@ namespace daf
 				if (m_actors_pending_reevaluation.contains(actor)) {
 					std::lock_guard lock(m_actors_pending_reevaluation_erase_lock);
 					acc->second = a_event.when();
-					if (this->ReevaluateActorMorph(actor)) {
-						actor->UpdateChargenAppearance();
-					}
+					this->GatherActorMorph(actor);
 					m_actors_pending_reevaluation.unsafe_erase(actor);
 					return;
 				}
@@ -97,9 +97,7 @@ namespace daf
 				// Update if the actor has not been updated for a certain interval
 				if (a_event.when() - acc->second > ActorUpdateInterval_ms) {
 					acc->second = a_event.when();
-					if (this->ReevaluateActorMorph(actor)) {
-						actor->UpdateChargenAppearance();
-					}
+					this->GatherActorMorph(actor);
 					return;
 				}
 			}
@@ -117,12 +115,39 @@ namespace daf
 				}
 
 				acc->second = a_event.when();
-				if (this->ReevaluateActorMorph(actor)) {
-					actor->UpdateChargenAppearance();
-				}
+				this->GatherActorMorph(actor, true);
 			}
 		}
 
+		// Watched actors of the reloaded races are reevaluated on their next update, batched through the pipeline.
+		// Only the watchlist is scanned on the game thread, the replaced rule sets are deleted in the background.
+		void OnEvent(const daf::RuleSetReloadedEvent& a_event, events::EventDispatcher<daf::RuleSetReloadedEvent>* a_dispatcher) override
+		{
+			SFSE::GetTaskInterface()->AddTask([this, rulesets = a_event.rulesets]() {
+				std::vector<RE::TESFormID> watched;
+				{
+					std::lock_guard lock(m_actor_watchlist_lock);  // TBB maps can't be iterated while inserted into or erased from
+					for (auto& [formID, last_update] : m_actor_watchlist) {
+						watched.push_back(formID);
+					}
+				}
+
+				for (auto formID : watched) {
+					auto form = RE::TESForm::LookupByID(formID);
+					auto actor = form ? form->As<RE::Actor>() : nullptr;
+					auto npc = actor ? actor->GetNPC() : nullptr;
+					if (!npc) {
+						continue;
+					}
+					if (std::find(rulesets.begin(), rulesets.end(), std::pair{ npc->formRace, npc->GetSex() }) != rulesets.end()) {
+						m_actors_pending_reevaluation.insert(actor);
+					}
+				}
+
+				daf::MorphRuleSetManager::GetSingleton().CollectRetired();
+			});
+		}
+
 		RE::BSEventNotifyControl ProcessEvent(const RE::SaveLoadEvent& a_event, RE::BSTEventSource<RE::SaveLoadEvent>* a_storage) override
 		{
 			logger::info("Save loaded.");
@@ -133,8 +158,10 @@ namespace daf
 		void Watch(RE::Actor* a_actor)
 		{
 			if (a_actor) {
-				tbb::concurrent_hash_map<RE::TESFormID, time_t>::accessor acc;
-				m_actor_watchlist.insert(acc, { a_actor->formID, 0 });
+				{
+					std::lock_guard lock(m_actor_watchlist_lock);
+					m_actor_watchlist.insert({ a_actor->formID, 0 });
+				}
 				m_actors_pending_reevaluation.insert(a_actor);
 			}
 		}
@@ -142,59 +169,274 @@ namespace daf
 		void Unwatch(RE::Actor* a_actor)
 		{
 			if (a_actor) {
-				std::lock_guard lock(m_actor_watchlist_erase_lock);
+				std::lock_guard lock(m_actor_watchlist_lock);
 				m_actor_watchlist.erase(a_actor->formID);
+				daf::ActorKeywordCache::GetSingleton().Invalidate(a_actor->formID);
+				m_sessions.Drop(a_actor->formID);
+				daf::MorphMirror::GetSingleton().Drop(a_actor->formID);
+				auto guard = daf::MorphRuleSetManager::GetSingleton().PinRulesets();
+				if (auto ruleSet = daf::MorphRuleSetManager::GetSingleton().GetForActor(a_actor, false); ruleSet) {
+					ruleSet->DropActorCache(a_actor->formID);
+				}
 			}
 		}
 
 		void Register()
 		{
+			daf::ActorKeywordCache::GetSingleton().Register();
+			daf::MorphMirror::GetSingleton().Register();
+			daf::MorphAnimator::GetSingleton().Register();
 			events::ArmorOrApparelEquippedEventDispatcher::GetSingleton()->AddStaticListener(this);
 			events::GameDataLoadedEventDispatcher::GetSingleton()->AddStaticListener(this);
 			events::ActorUpdatedEventDispatcher::GetSingleton()->EventDispatcher<events::ActorUpdateEvent>::AddStaticListener(this);
 			events::ActorUpdatedEventDispatcher::GetSingleton()->EventDispatcher<events::ActorFirstUpdateEvent>::AddStaticListener(this);
+			daf::MorphRuleSetManager::GetSingleton().AddStaticListener(this);
 
 			RE::SaveLoadEvent::GetEventSource()->RegisterSink(this);
 		}
 
-		bool ReevaluateActorMorph(RE::Actor* a_actor)
+		//
+		// Reevaluation pipeline:
+		//   1. GatherActorMorph, on the thread delivering the actor event: acquire rule inputs and snapshot morphs
+		//   2. EvaluateGatheredJobs, on m_arena: evaluate rules and diff morphs of all gathered actors in parallel
+		//   3. A single SFSE task on the game thread: apply the staged morphs and rebuild appearances
+		//
+
+		// a_force re-evaluates every rule and commits even if no input changed since the last evaluation
+		void GatherActorMorph(RE::Actor* a_actor, bool a_force = false)
+		{
+			auto& rs_manager = daf::MorphRuleSetManager::GetSingleton();
+
+			auto guard = rs_manager.PinRulesets();
+			auto ruleSet = rs_manager.GetForActor(a_actor);
+			if (!ruleSet) {
+				return;
+			}
+
+			auto job = m_jobs.Acquire();
+			job->guard = std::move(guard);
+			job->actor = RE::NiPointer<RE::Actor>(a_actor);
+			job->rule_set = ruleSet;
+			job->force = a_force;
+			job->animate = !utils::IsActorMenuActor(a_actor);
+
+			// Morph inputs and the session read the mirror, synced once here. The chargen menu writes the morphs
+			// of its actor in place, which only a verifying sync sees.
+			daf::MorphMirror::GetSingleton().Sync(a_actor, a_force || !job->animate);
+			ruleSet->AcquireInputs(a_actor, job->inputs);
+			if (!a_force && !ruleSet->HasChangedInputs(a_actor->formID, job->inputs)) {
+				trace::Write(trace::Event::kReevaluationSkipped, a_actor->formID);
+				_recycle(job);
+				return;
+			}
+			trace::Write(trace::Event::kReevaluationGathered, a_actor->formID, a_force);
+
+			job->session = m_sessions.Acquire(a_actor);
+
+			job->next = m_gathered_jobs.load(std::memory_order_relaxed);
+			while (!m_gathered_jobs.compare_exchange_weak(job->next, job, std::memory_order_release, std::memory_order_relaxed)) {}
+			if (!m_evaluation_scheduled.exchange(true)) {
+				m_arena.enqueue([this]() { this->EvaluateGatheredJobs(); });
+			}
+		}
+
+		// Synchronous version of the pipeline, must run on the game thread
+		// a_force re-evaluates every rule and commits even if no input changed since the last call
+		bool ReevaluateActorMorph(RE::Actor* a_actor, bool a_force = false)
 		{
 			auto& rs_manager = daf::MorphRuleSetManager::GetSingleton();
 
+			auto guard = rs_manager.PinRulesets();
 			auto ruleSet = rs_manager.GetForActor(a_actor);
 			if (!ruleSet) {
 				return false;
 			}
 
-			daf::MorphEvaluationRuleSet::ResultTable results;
+			thread_local daf::MorphEvaluationRuleSet::ResultTable results;
+
+			daf::MorphMirror::GetSingleton().Sync(a_actor, a_force || utils::IsActorMenuActor(a_actor));
+			if (!ruleSet->EvaluateIncremental(a_actor, results, a_force)) {
+				trace::Write(trace::Event::kReevaluationSkipped, a_actor->formID);
+				return false;  // Nothing changed, skip the commit entirely
+			}
+
+			auto session = m_sessions.Acquire(a_actor);
+
+			session->RestoreMorph();
+			results.ForEach([ruleSet, &session](daf::MorphEvaluationRuleSet::MorphID a_morph, const daf::MorphEvaluationRuleSet::Result& a_result) {
+				if (a_result.is_setter) {
+					session->MorphTargetCommit(ruleSet->GetMorphName(a_morph), a_result.value);
+				} else {
+					session->MorphOffsetCommit(ruleSet->GetMorphName(a_morph), a_result.value);
+				}
+			});
+
+			const float diff = session->PushCommits();
+			trace::Write(trace::Event::kReevaluationStaged, a_actor->formID, static_cast<uint32_t>(diff * 1000.f), diff > DiffThreshold);
+			return diff > DiffThreshold;
+		}
+
+	private:
+		ConditionalMorphManager(){};
 
-			daf::DynamicMorphSession session(daf::tokens::conditional_morph_manager, a_actor);
+		// Objects handed out again once released, keeping the buffers they grew. Never freed.
+		template <class T>
+		class Recycler
+		{
+		public:
+			T* Acquire()
+			{
+				std::lock_guard lock(m_lock);
+				if (m_free.empty()) {
+					return m_objects.emplace_back(std::make_unique<T>()).get();
+				}
+				auto object = m_free.back();
+				m_free.pop_back();
+				return object;
+			}
 
+			void Release(T* a_object)
 			{
-				std::lock_guard<std::mutex> rule_set_lock(ruleSet->m_ruleset_mutex);
-				ruleSet->Snapshot(a_actor);
-				ruleSet->Evaluate(results);
+				std::lock_guard lock(m_lock);
+				m_free.push_back(a_object);
+			}
+
+		private:
+			std::mutex                      m_lock;
+			std::vector<std::unique_ptr<T>> m_objects;
+			std::vector<T*>                 m_free;
+		};
+
+		struct ReevaluationJob
+		{
+			MorphRuleSetManager::Guard            guard;  // Keeps rule_set alive across a reload
+			RE::NiPointer<RE::Actor>              actor;
+			const MorphEvaluationRuleSet*         rule_set{ nullptr };
+			MorphEvaluationRuleSet::InputSnapshot inputs;   // Keeps its capacity when recycled
+			DynamicMorphSessionPool::Lease        session;  // Back to the pool once the job is applied
+			ReevaluationJob*                      next{ nullptr };  // In m_gathered_jobs
+			bool                                  force{ false };
+			bool                                  needs_update{ false };
+			bool                                  animate{ false };
+		};
+
+		struct JobBatch
+		{
+			std::vector<ReevaluationJob*>                  jobs;  // Keeps its capacity when recycled
+			telemetry::RebuildTelemetry::Clock::time_point queued;
+		};
+
+		void EvaluateGatheredJobs()
+		{
+			auto batch = m_batches.Acquire();
+			for (auto job = m_gathered_jobs.exchange(nullptr, std::memory_order_acquire); job; job = job->next) {
+				batch->jobs.push_back(job);
+			}
+
+			// Jobs pushed between the drain and the reset would otherwise wait for the next push
+			m_evaluation_scheduled = false;
+			if (m_gathered_jobs.load(std::memory_order_relaxed) && !m_evaluation_scheduled.exchange(true)) {
+				m_arena.enqueue([this]() { this->EvaluateGatheredJobs(); });
+			}
+
+			if (batch->jobs.empty()) {
+				m_batches.Release(batch);
+				return;
+			}
+
+			tbb::parallel_for(size_t(0), batch->jobs.size(), [batch](size_t i) {
+				EvaluateJob(*batch->jobs[i]);
+			});
+
+			batch->queued = telemetry::RebuildTelemetry::Clock::now();
+			SFSE::GetTaskInterface()->AddTask([this, batch]() {
+				ApplyBatch(*batch);
+				for (auto job : batch->jobs) {
+					_recycle(job);
+				}
+				batch->jobs.clear();
+				m_batches.Release(batch);
+			});
+		}
+
+		// On the game thread
+		static void ApplyBatch(const JobBatch& a_batch)
+		{
+			for (auto job : a_batch.jobs) {
+				if (!job->session->HasStagedCommits()) {
+					continue;
+				}
+				// Nothing to show or animate before the actor has 3D, its morphs wait for it
+				if (job->session->DeferStagedCommits(chargen::PendingAppearance::GetSingleton(), job->needs_update)) {
+					continue;
+				}
+				// The animator rebuilds appearances itself, at its own rate
+				if (job->animate && job->session->AnimateStagedCommits(MorphAnimator::GetSingleton(), MorphTransition_s, MorphAnimator::Easing::EaseInOut, job->needs_update)) {
+					continue;
+				}
+				job->session->ApplyStagedCommits();
+				if (job->needs_update) {
+					telemetry::RebuildTelemetry::GetSingleton().Execute(telemetry::RebuildType::kChargen, job->actor->formID, a_batch.queued, [&]() {
+						job->actor->UpdateChargenAppearance();
+					});
+				}
 			}
+		}
 
+		// Releases what the job holds, but not its buffers, and hands it out again
+		void _recycle(ReevaluationJob* a_job)
+		{
+			a_job->guard.Release();
+			a_job->actor.reset();
+			a_job->rule_set = nullptr;
+			a_job->session.Release();
+			a_job->next = nullptr;
+			a_job->force = false;
+			a_job->needs_update = false;
+			a_job->animate = false;
+			m_jobs.Release(a_job);
+		}
+
+		// Touches no game object, runs on the worker threads
+		static void EvaluateJob(ReevaluationJob& a_job)
+		{
+			thread_local daf::MorphEvaluationRuleSet::ResultTable results;  // Keeps its buffers across jobs
+
+			if (!a_job.rule_set->EvaluateIncremental(a_job.actor->formID, a_job.inputs, results, a_job.force)) {
+				trace::Write(trace::Event::kReevaluationSkipped, a_job.actor->formID);
+				a_job.guard.Release();
+				return;
+			}
+
+			auto& session = *a_job.session;
 			session.RestoreMorph();
-			for (auto& [morph_name, result] : results) {
-				if (result.is_setter) {
-					session.MorphTargetCommit(std::string(morph_name), result.value);
+			results.ForEach([rule_set = a_job.rule_set, &session](daf::MorphEvaluationRuleSet::MorphID a_morph, const daf::MorphEvaluationRuleSet::Result& a_result) {
+				if (a_result.is_setter) {
+					session.MorphTargetCommit(rule_set->GetMorphName(a_morph), a_result.value);
 				} else {
-					session.MorphOffsetCommit(std::string(morph_name), result.value);
+					session.MorphOffsetCommit(rule_set->GetMorphName(a_morph), a_result.value);
 				}
-			}
+			});
 
-			return session.PushCommits() > DiffThreshold;
+			const float diff = session.StageCommits();
+			a_job.needs_update = diff > DiffThreshold;
+			trace::Write(trace::Event::kReevaluationStaged, a_job.actor->formID, static_cast<uint32_t>(diff * 1000.f), a_job.needs_update);
+			a_job.guard.Release();
 		}
 
-	private:
-		ConditionalMorphManager(){};
+		// Leave a core to the game
+		tbb::task_arena                m_arena{ std::max(1, tbb::info::default_concurrency() - 1) };
+		std::atomic<ReevaluationJob*>  m_gathered_jobs{ nullptr };  // Intrusive stack, drained whole
+		std::atomic<bool>              m_evaluation_scheduled{ false };
+		Recycler<ReevaluationJob>      m_jobs;
+		Recycler<JobBatch>             m_batches;
+
+		DynamicMorphSessionPool m_sessions{ tokens::conditional_morph_manager };
 
 		std::mutex                                m_actors_pending_reevaluation_erase_lock;
 		tbb::concurrent_unordered_set<RE::Actor*> m_actors_pending_reevaluation;
 
-		std::mutex                                      m_actor_watchlist_erase_lock;
+		std::mutex                                      m_actor_watchlist_lock;  // Inserts, erases and scans, finds take none
 		tbb::concurrent_hash_map<RE::TESFormID, time_t> m_actor_watchlist{ { 0x14, 0 } };  // Player_ref
 
 		time_t menu_actor_last_update_time = 0;
@@ -0,0 +1,58 @@
+#pragma once
+
+namespace daf
+{
+	// Growable bitset over dense integer IDs
+	class DenseBitset
+	{
+	public:
+		inline void Resize(size_t a_numBits)
+		{
+			m_words.resize((a_numBits + 63) / 64, 0);
+		}
+
+		inline void Set(uint32_t a_bit)
+		{
+			if (a_bit / 64 >= m_words.size()) {
+				m_words.resize(a_bit / 64 + 1, 0);
+			}
+			m_words[a_bit / 64] |= uint64_t(1) << (a_bit % 64);
+		}
+
+		inline void Reset(uint32_t a_bit)
+		{
+			if (a_bit / 64 < m_words.size()) {
+				m_words[a_bit / 64] &= ~(uint64_t(1) << (a_bit % 64));
+			}
+		}
+
+		inline bool Test(uint32_t a_bit) const
+		{
+			return a_bit / 64 < m_words.size() && (m_words[a_bit / 64] >> (a_bit % 64)) & 1;
+		}
+
+		// Unsets every bit, keeps the capacity
+		inline void Clear()
+		{
+			std::fill(m_words.begin(), m_words.end(), 0);
+		}
+
+		inline bool Any() const
+		{
+			return std::any_of(m_words.begin(), m_words.end(), [](uint64_t a_word) { return a_word != 0; });
+		}
+
+		template <class _Func>
+		void ForEachSetBit(_Func&& a_func) const
+		{
+			for (size_t i = 0; i < m_words.size(); ++i) {
+				for (uint64_t word = m_words[i]; word; word &= word - 1) {
+					a_func(static_cast<uint32_t>(i * 64 + std::countr_zero(word)));
+				}
+			}
+		}
+
+	private:
+		std::vector<uint64_t> m_words;
+	};
+}
@@ -1,22 +1,67 @@
 #pragma once
 #include "SFEventHandler.h"
 #include "ChargenUtils.h"
+#include "MorphMirror.h"
+#include "MorphAnimator.h"
+#include "PendingAppearance.h"
 
 namespace daf
 {
-	static constexpr std::string_view overweightMorphName{ "Overweight" };
-	static constexpr std::string_view strongMorphName{ "Strong" };
-	static constexpr std::string_view thinMorphName{ "Thin" };
-
-	namespace tokens
+	namespace detail
 	{
-		inline constexpr std::string general_offset{ "ECOffset_" };
+		// Reductions over |a_evaluated - a_snapshot|, four morphs per instruction where SSE2 is available.
+		// Like std::max, a NaN difference never becomes the maximum.
+		inline float MaxAbsDiff(const float* a_evaluated, const float* a_snapshot, size_t a_size)
+		{
+			float  result = 0.f;
+			size_t i = 0;
+#ifdef DAF_MORPH_SSE2
+			const __m128 sign = _mm_set1_ps(-0.f);
+			__m128       acc = _mm_setzero_ps();
+			for (; i + 4 <= a_size; i += 4) {
+				__m128 diff = _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(a_evaluated + i), _mm_loadu_ps(a_snapshot + i)));
+				acc = _mm_max_ps(diff, acc);  // Keeps acc if diff is NaN
+			}
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, acc);
+			result = std::max({ lanes[0], lanes[1], lanes[2], lanes[3] });
+#endif
+			for (; i < a_size; ++i) {
+				result = std::max(result, std::abs(a_evaluated[i] - a_snapshot[i]));
+			}
+			return result;
+		}
+
+		// a_squared sums the squares instead of the absolute values
+		inline float SumDiff(const float* a_evaluated, const float* a_snapshot, size_t a_size, bool a_squared)
+		{
+			float  result = 0.f;
+			size_t i = 0;
+#ifdef DAF_MORPH_SSE2
+			const __m128 sign = _mm_set1_ps(-0.f);
+			__m128       acc = _mm_setzero_ps();
+			for (; i + 4 <= a_size; i += 4) {
+				__m128 diff = _mm_sub_ps(_mm_loadu_ps(a_evaluated + i), _mm_loadu_ps(a_snapshot + i));
+				acc = _mm_add_ps(acc, a_squared ? _mm_mul_ps(diff, diff) : _mm_andnot_ps(sign, diff));
+			}
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, acc);
+			result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+			for (; i < a_size; ++i) {
+				float diff = a_evaluated[i] - a_snapshot[i];
+				result += a_squared ? diff * diff : std::abs(diff);
+			}
+			return result;
+		}
 	}
 
 	// A mini git session for actor morphs
 	class DynamicMorphSession
 	{
 	public:
+		using NameID = MorphNameTable::NameID;
+
 		enum class DiffMode
 		{
 			Max_Norm,
@@ -24,131 +69,122 @@ namespace daf
 			L2_Norm
 		};
 
-		struct MorphValue
-		{
-			MorphValue() = default;
-			MorphValue(float snapshot) :
-				snapshot(snapshot), evaluated(snapshot) {}
-
-			float snapshot{ 0.f };
-			float evaluated{ 0.f };
-
-			float Diff()
-			{
-				return evaluated - snapshot;
-			}
-
-			float DiffAbs()
-			{
-				return std::abs(Diff());
-			}
-		};
-
 		DynamicMorphSession(std::string a_token, RE::Actor* a_actor, DiffMode a_diffMode = DiffMode::Max_Norm) :
-			offsetPrefix(a_token),
-			diffMode(a_diffMode)
+			DynamicMorphSession(MorphNameTable::Get(a_token), a_actor, a_diffMode)
+		{}
+
+		DynamicMorphSession(MorphNameTable& a_names, RE::Actor* a_actor, DiffMode a_diffMode = DiffMode::Max_Norm) :
+			diffMode(a_diffMode),
+			m_names(a_names),
+			m_mirrored(&a_names == &MorphMirror::GetSingleton().GetNames())
 		{
 			Snapshot(a_actor);
 		}
 
-		~DynamicMorphSession()
+		inline std::string_view GetOffsetName(std::string_view morph_name)
 		{
-			for (auto& ptr : _new_strings) {
-				delete[] ptr;
-			}
+			return m_names.GetName(m_names.GetOffset(m_names.Intern(morph_name)));
 		}
 
-		inline std::string_view GetOffsetName(std::string_view morph_name)
+		const std::string& GetOffsetPrefix() const
 		{
-			auto offset_name = offsetPrefix + morph_name.data();
-			if (auto it = m_morph_offset_names.find(offset_name); it != m_morph_offset_names.end()) {
-				return it->first;
-			}
-			return _find_or_alloc(offset_name);
+			return m_names.GetPrefix();
 		}
 
-		void MorphOffsetCommit(std::string morph_name, float offset)
+		void MorphOffsetCommit(std::string_view morph_name, float offset)
 		{
-			auto offset_name = GetOffsetName(morph_name);
-			auto morph_name_sv = _find_or_alloc(morph_name);
+			auto name = m_names.Intern(morph_name);
 
-			m_morph_snapshot[offset_name].evaluated += offset;
-			m_morph_snapshot[morph_name_sv].evaluated += offset;
-
-			m_morph_offset_names[offset_name] = morph_name_sv;
+			m_evaluated[_get(m_names.GetOffset(name))] += offset;
+			m_evaluated[_get(name)] += offset;
 		}
 
-		void MorphTargetCommit(std::string morph_name, float target)
+		void MorphTargetCommit(std::string_view morph_name, float target)
 		{
-			auto& entry = m_morph_snapshot[morph_name];
+			auto name = m_names.Intern(morph_name);
+			auto i = _get(name);
 
-			entry.evaluated = target;
+			m_evaluated[i] = target;
 
-			if (float diff = entry.Diff(); diff != 0.f) {
-				auto offset_name = GetOffsetName(morph_name);
-				auto morph_name_sv = _find_or_alloc(morph_name);
-				m_morph_snapshot[offset_name].evaluated += diff;
-				m_morph_offset_names[offset_name] = morph_name_sv;
+			if (float diff = m_evaluated[i] - m_snapshot[i]; diff != 0.f) {
+				m_evaluated[_get(m_names.GetOffset(name))] += diff;
 			}
 		}
 
 		void RevertCommits()
 		{
-			for (auto& [morph_name, target] : m_morph_snapshot) {
-				target.evaluated = target.snapshot;
-			}
+			m_evaluated = m_snapshot;
 		}
 
 		// Revert all morph offsets
 		void RestoreMorph()
 		{
-			for (auto& [offset_name, morph_name] : m_morph_offset_names) {
-				auto& entry = m_morph_snapshot[offset_name];
-				m_morph_snapshot[morph_name].evaluated -= entry.evaluated;
-				entry.evaluated = 0;
+			// _get may append, entries are revisited by index
+			for (size_t i = 0; i < m_entry_names.size(); ++i) {
+				auto base = m_names.GetBase(m_entry_names[i]);
+				if (base == MorphNameTable::InvalidName) {
+					continue;
+				}
+				float offset = m_evaluated[i];
+				m_evaluated[_get(base)] -= offset;
+				m_evaluated[i] = 0;
 			}
 		}
 
-		float Diff()
+		float Diff() const
 		{
-			float diff = 0.f;
 			switch (diffMode) {
 			case DiffMode::Max_Norm:
-				for (auto& [morph_name, target] : m_morph_snapshot) {
-					diff = std::max(diff, target.DiffAbs());
-				}
-				return diff;
+				return detail::MaxAbsDiff(m_evaluated.data(), m_snapshot.data(), m_evaluated.size());
 			case DiffMode::L1_Norm:
-				for (auto& [morph_name, target] : m_morph_snapshot) {
-					diff += target.DiffAbs();
-				}
-				return diff;
+				return detail::SumDiff(m_evaluated.data(), m_snapshot.data(), m_evaluated.size(), false);
 			case DiffMode::L2_Norm:
-				for (auto& [morph_name, target] : m_morph_snapshot) {
-					diff += target.Diff() * target.Diff();
-				}
-				return std::sqrt(diff);
+				return std::sqrt(detail::SumDiff(m_evaluated.data(), m_snapshot.data(), m_evaluated.size(), true));
 			}
+			return 0.f;
 		}
 
 		// Reduce resource occupation time and avoid race condition
 		float PushCommits()
 		{
-			float diff = Diff();
+			float diff = StageCommits();
+			ApplyStagedCommits();
+			return diff;
+		}
 
-			std::unordered_map<std::string_view, float> commit_batch;
+		// Collects the changed morphs without touching the actor, safe off the game thread
+		float StageCommits()
+		{
+			float diff = Diff();
 
-			for (auto& [morph_name, morph_value] : m_morph_snapshot) {
-				if (morph_value.Diff() != 0.f) {
-					commit_batch[morph_name] = morph_value.evaluated;
-					morph_value.snapshot = morph_value.evaluated;
+			for (size_t i = 0; i < m_entry_names.size(); ++i) {
+				if (m_evaluated[i] != m_snapshot[i]) {
+					m_commit_batch.emplace_back(m_entry_names[i], m_evaluated[i]);
+					m_snapshot[i] = m_evaluated[i];
 				}
 			}
 
-			
+			return diff;
+		}
+
+		bool HasStagedCommits() const
+		{
+			return !m_commit_batch.empty();
+		}
+
+		// Writes the staged morphs to the actor, must run on the game thread
+		void ApplyStagedCommits()
+		{
+			if (m_mirrored) {
+				MorphMirror::GetSingleton().Write(m_actor, m_commit_batch, m_mirror_version);
+				m_commit_batch.clear();
+				return;
+			}
+
 			{ // Critical section
 				auto npc = m_actor->GetNPC();
-				for (auto& [morph_name, target] : commit_batch) {
+				for (auto& [name, target] : m_commit_batch) {
+					auto morph_name = m_names.GetName(name);
 					if (morph_name == overweightMorphName) {
 						npc->morphWeight.fat = target;
 					} else if (morph_name == strongMorphName) {
@@ -164,26 +200,67 @@ namespace daf
 					}
 				}
 			} // End of critical section
-			
 
-			return diff;
+			m_commit_batch.clear();
 		}
 
-		DiffMode          diffMode = DiffMode::Max_Norm;
-		const std::string offsetPrefix;
+		// Hands the staged morphs to a_animator instead of writing them at once, must run on the game thread.
+		// False if they were written at once, a_animator being full or the session not over the MorphMirror names.
+		bool AnimateStagedCommits(MorphAnimator& a_animator, float a_duration, MorphAnimator::Easing a_easing, bool a_rebuild)
+		{
+			if (!m_mirrored || !a_animator.Animate(m_actor, m_commit_batch, a_duration, a_easing, a_rebuild)) {
+				ApplyStagedCommits();
+				return false;
+			}
 
-	private:
-		RE::Actor*                                             m_actor;
-		std::unordered_map<std::string_view, MorphValue>       m_morph_snapshot;
-		std::unordered_map<std::string_view, std::string_view> m_morph_offset_names;
-		std::vector<char*>                                     _new_strings;
+			m_commit_batch.clear();
+			return true;
+		}
 
-		std::unordered_set<std::string> m_string_pool;
+		// Hands the staged morphs to a_pending while the 3D of the actor isn't loaded, rebuilding once it is if a_rebuild.
+		// False if the 3D is loaded and nothing was taken.
+		bool DeferStagedCommits(chargen::PendingAppearance& a_pending, bool a_rebuild)
+		{
+			thread_local std::vector<std::pair<std::string_view, float>> morphs;
+			morphs.clear();
+			for (auto& [name, target] : m_commit_batch) {
+				morphs.emplace_back(m_names.GetName(name), target);
+			}
 
-		// Reduce resource occupation time and avoid race condition
+			std::optional<telemetry::RebuildType> rebuild;
+			if (a_rebuild) {
+				rebuild = telemetry::RebuildType::kChargen;
+			}
+			if (!a_pending.Defer(m_actor, morphs, rebuild)) {
+				return false;
+			}
+
+			m_commit_batch.clear();
+			return true;
+		}
+
+		// Starts over from the current morphs of a_actor. Keeps every buffer, so a pooled session
+		// reused for the same actor allocates nothing once it has seen all of its morph names.
+		// Over the names of the MorphMirror, only the morphs written since the last snapshot are copied, from the
+		// mirror as of its last Sync.
 		bool Snapshot(RE::Actor* a_actor)
 		{
+			// Staged commits never applied left snapshot values the actor doesn't have
+			if (a_actor != m_actor || !m_commit_batch.empty()) {
+				m_mirror_version = 0;
+			}
 			m_actor = a_actor;
+			m_commit_batch.clear();
+
+			if (m_mirrored) {
+				RevertCommits();
+				return MorphMirror::GetSingleton().CatchUp(
+					m_actor, m_mirror_version,
+					[this]() { _reset(); },
+					[this](NameID a_name, float a_value) { _set(a_name, a_value); });
+			}
+
+			_reset();
 
 			{ // Critical section
 				auto npc = m_actor->GetNPC();
@@ -191,34 +268,166 @@ namespace daf
 					return false;
 				}
 
-				m_morph_snapshot[overweightMorphName] = npc->morphWeight.fat;
-				m_morph_snapshot[strongMorphName] = npc->morphWeight.muscular;
-				m_morph_snapshot[thinMorphName] = npc->morphWeight.thin;
+				_set(m_names.Intern(overweightMorphName), npc->morphWeight.fat);
+				_set(m_names.Intern(strongMorphName), npc->morphWeight.muscular);
+				_set(m_names.Intern(thinMorphName), npc->morphWeight.thin);
 
 				if (npc->shapeBlendData) {
 					auto& morph_data = *npc->shapeBlendData;
 					for (auto& [morph_name, offset] : morph_data) {
-						m_morph_snapshot[morph_name] = offset;
+						_set(m_names.Intern(morph_name), offset);
 					}
 				}
 			} // End of critical section
 
-			for (auto& [morph_name, target] : m_morph_snapshot) {
-				if (morph_name.starts_with(offsetPrefix)) {
-					m_morph_offset_names[morph_name] = morph_name.data() + offsetPrefix.size();
+			return true;
+		}
+
+		RE::Actor* GetActor() const
+		{
+			return m_actor;
+		}
+
+		DiffMode diffMode = DiffMode::Max_Norm;
+
+	private:
+		MorphNameTable&                       m_names;
+		const bool                            m_mirrored;  // m_names is the table of the MorphMirror
+		uint64_t                              m_mirror_version{ 0 };
+		RE::Actor*                            m_actor{ nullptr };
+		std::vector<NameID>                   m_entry_names;  // Morphs of the snapshot, then the ones committed
+		std::vector<float>                    m_snapshot;     // By entry, contiguous for the diff passes
+		std::vector<float>                    m_evaluated;
+		std::vector<uint32_t>                 m_slots;  // Entry index + 1 by NameID, 0 if absent
+		std::vector<std::pair<NameID, float>> m_commit_batch;
+
+		// Index of the entry of a_name, appended if absent
+		uint32_t _get(NameID a_name)
+		{
+			if (a_name >= m_slots.size()) {
+				m_slots.resize(m_names.Size(), 0);
+			}
+			auto& slot = m_slots[a_name];
+			if (!slot) {
+				m_entry_names.push_back(a_name);
+				m_snapshot.push_back(0.f);
+				m_evaluated.push_back(0.f);
+				slot = static_cast<uint32_t>(m_entry_names.size());
+			}
+			return slot - 1;
+		}
+
+		void _set(NameID a_name, float a_value)
+		{
+			auto i = _get(a_name);
+			m_snapshot[i] = m_evaluated[i] = a_value;
+		}
+
+		void _reset()
+		{
+			for (auto name : m_entry_names) {
+				m_slots[name] = 0;
+			}
+			m_entry_names.clear();
+			m_snapshot.clear();
+			m_evaluated.clear();
+		}
+	};
+
+	// Sessions kept per actor between reevaluations, so their buffers are reused instead of rebuilt
+	class DynamicMorphSessionPool
+	{
+	public:
+		// Returns its session to the pool when destroyed
+		class Lease
+		{
+		public:
+			Lease() = default;
+			Lease(DynamicMorphSessionPool* a_pool, RE::TESFormID a_formID, std::unique_ptr<DynamicMorphSession> a_session) :
+				m_pool(a_pool), m_formID(a_formID), m_session(std::move(a_session)) {}
+
+			Lease(Lease&&) = default;
+			Lease& operator=(Lease&& a_rhs)
+			{
+				if (this != &a_rhs) {
+					Release();
+					m_pool = std::exchange(a_rhs.m_pool, nullptr);
+					m_formID = a_rhs.m_formID;
+					m_session = std::move(a_rhs.m_session);
 				}
+				return *this;
 			}
 
-			return true;
+			~Lease()
+			{
+				Release();
+			}
+
+			void Release()
+			{
+				if (m_pool && m_session) {
+					m_pool->_return(m_formID, std::move(m_session));
+				}
+				m_session.reset();
+			}
+
+			DynamicMorphSession* operator->() const { return m_session.get(); }
+			DynamicMorphSession& operator*() const { return *m_session; }
+			explicit operator bool() const { return m_session != nullptr; }
+
+		private:
+			DynamicMorphSessionPool*             m_pool{ nullptr };
+			RE::TESFormID                        m_formID{ 0 };
+			std::unique_ptr<DynamicMorphSession> m_session;
+		};
+
+		explicit DynamicMorphSessionPool(std::string_view a_token, DynamicMorphSession::DiffMode a_diffMode = DynamicMorphSession::DiffMode::Max_Norm) :
+			m_names(MorphNameTable::Get(a_token)),
+			m_diff_mode(a_diffMode)
+		{}
+
+		// The pooled session of the actor, snapshotted. Concurrent leases of the same actor get a temporary session.
+		Lease Acquire(RE::Actor* a_actor)
+		{
+			std::unique_ptr<DynamicMorphSession> session;
+			{
+				Sessions_T::accessor acc;
+				m_sessions.insert(acc, a_actor->formID);
+				session = std::move(acc->second);
+			}
+
+			if (session) {
+				session->Snapshot(a_actor);
+			} else {
+				session = std::make_unique<DynamicMorphSession>(m_names, a_actor, m_diff_mode);
+			}
+			return Lease(this, a_actor->formID, std::move(session));
+		}
+
+		// Frees the session of an actor no longer reevaluated
+		void Drop(RE::TESFormID a_formID)
+		{
+			m_sessions.erase(a_formID);
 		}
 
-		std::string_view _find_or_alloc(std::string& _str)
+		void Clear()
 		{
-			auto it = m_string_pool.find(_str);
-			if (it != m_string_pool.end()) {
-				return *it;
+			m_sessions.clear();
+		}
+
+	private:
+		using Sessions_T = tbb::concurrent_hash_map<RE::TESFormID, std::unique_ptr<DynamicMorphSession>>;
+
+		void _return(RE::TESFormID a_formID, std::unique_ptr<DynamicMorphSession> a_session)
+		{
+			Sessions_T::accessor acc;
+			if (m_sessions.find(acc, a_formID) && !acc->second) {
+				acc->second = std::move(a_session);
 			}
-			return *m_string_pool.insert(_str).first;
 		}
+
+		MorphNameTable&               m_names;
+		DynamicMorphSession::DiffMode m_diff_mode;
+		Sessions_T                    m_sessions;  // Empty while leased
 	};
 }
\ No newline at end of file
@@ -0,0 +1,129 @@
+#pragma once
+
+namespace daf
+{
+	// Deferred deletion of objects that readers may still hold raw pointers to (RCU style).
+	// Readers pin the current epoch with a Guard while they use a published object; writers unpublish an object
+	// and Retire it, it is deleted once every reader that could have seen it has released its guard.
+	// Entering and leaving a guard are two atomic increments and never block.
+	template <class T>
+	class EpochReclaimer
+	{
+	public:
+		class Guard
+		{
+		public:
+			Guard() = default;
+
+			Guard(EpochReclaimer* a_reclaimer, uint32_t a_slot) :
+				m_reclaimer(a_reclaimer), m_slot(a_slot) {}
+
+			Guard(Guard&& a_rhs) noexcept :
+				m_reclaimer(std::exchange(a_rhs.m_reclaimer, nullptr)), m_slot(a_rhs.m_slot) {}
+
+			Guard& operator=(Guard&& a_rhs) noexcept
+			{
+				if (this != &a_rhs) {
+					Release();
+					m_reclaimer = std::exchange(a_rhs.m_reclaimer, nullptr);
+					m_slot = a_rhs.m_slot;
+				}
+				return *this;
+			}
+
+			Guard(const Guard&) = delete;
+			Guard& operator=(const Guard&) = delete;
+
+			~Guard()
+			{
+				Release();
+			}
+
+			void Release()
+			{
+				if (m_reclaimer) {
+					m_reclaimer->m_readers[m_slot].fetch_sub(1, std::memory_order_release);
+					m_reclaimer = nullptr;
+				}
+			}
+
+		private:
+			EpochReclaimer* m_reclaimer{ nullptr };
+			uint32_t        m_slot{ 0 };
+		};
+
+		~EpochReclaimer()
+		{
+			std::lock_guard lock(m_retired_lock);
+			m_retired.clear();
+		}
+
+		Guard Enter()
+		{
+			while (true) {
+				auto epoch = m_epoch.load(std::memory_order_acquire);
+				auto slot = static_cast<uint32_t>(epoch & 1);
+				m_readers[slot].fetch_add(1, std::memory_order_seq_cst);
+				// The epoch may have advanced past the slot before the increment was visible
+				if (m_epoch.load(std::memory_order_seq_cst) == epoch) {
+					return Guard(this, slot);
+				}
+				m_readers[slot].fetch_sub(1, std::memory_order_release);
+			}
+		}
+
+		// a_object must already be unreachable for new readers
+		void Retire(std::unique_ptr<T> a_object)
+		{
+			if (!a_object) {
+				return;
+			}
+			{
+				std::lock_guard lock(m_retired_lock);
+				m_retired.emplace_back(m_epoch.load(std::memory_order_seq_cst), std::move(a_object));
+			}
+			Collect();
+		}
+
+		// Advances the epoch as far as readers allow and deletes what no reader can reference anymore
+		void Collect()
+		{
+			std::vector<std::unique_ptr<T>> reclaimed;
+			{
+				std::lock_guard lock(m_retired_lock);
+				for (int i = 0; i < 2; ++i) {
+					auto epoch = m_epoch.load(std::memory_order_seq_cst);
+					// Readers of epoch - 1 share the slot of epoch + 1
+					if (m_readers[(epoch + 1) & 1].load(std::memory_order_seq_cst) != 0) {
+						break;
+					}
+					m_epoch.store(epoch + 1, std::memory_order_seq_cst);
+				}
+
+				// Advancing to E required every reader of E - 2 and earlier to be gone
+				auto epoch = m_epoch.load(std::memory_order_seq_cst);
+				auto it = std::partition(m_retired.begin(), m_retired.end(), [epoch](const Retired& a_retired) { return a_retired.first + 2 > epoch; });
+				for (auto reclaim = it; reclaim != m_retired.end(); ++reclaim) {
+					reclaimed.emplace_back(std::move(reclaim->second));
+				}
+				m_retired.erase(it, m_retired.end());
+			}
+			// Destroyed outside of the lock
+		}
+
+		size_t NumRetired()
+		{
+			std::lock_guard lock(m_retired_lock);
+			return m_retired.size();
+		}
+
+	private:
+		using Retired = std::pair<uint64_t, std::unique_ptr<T>>;
+
+		std::atomic<uint64_t> m_epoch{ 2 };
+		std::atomic<uint32_t> m_readers[2]{};
+
+		std::mutex           m_retired_lock;
+		std::vector<Retired> m_retired;
+	};
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "Singleton.h"
+#include "ActorDataProvider.h"
+#include "ActorKeywordCache.h"
+#include "MorphMirror.h"
+
+namespace daf
+{
+	// Reads rule inputs from game actors: actor values, cached keyword bitsets and mirrored NPC morphs
+	class GameActorDataProvider :
+		public utils::SingletonBase<GameActorDataProvider>,
+		public ActorDataProvider
+	{
+		friend class utils::SingletonBase<GameActorDataProvider>;
+
+	public:
+		std::optional<InputReference> Resolve(std::string_view a_editorID, InputType a_types) override
+		{
+			if (Includes(a_types, InputType::kActorValue)) {
+				if (auto avi = RE::TESObjectREFR::LookupByEditorID<RE::ActorValueInfo>(a_editorID); avi) {
+					return _make_actor_value(avi, a_editorID);
+				}
+			}
+			if (Includes(a_types, InputType::kWornKeyword) || Includes(a_types, InputType::kNPCKeyword)) {
+				if (auto keyword = RE::TESObjectREFR::LookupByEditorID<RE::BGSKeyword>(a_editorID); keyword) {
+					auto type = Includes(a_types, InputType::kWornKeyword) ? InputType::kWornKeyword : InputType::kNPCKeyword;
+					return _make_keyword(keyword, type, a_editorID);
+				}
+			}
+			if (Includes(a_types, InputType::kMorph)) {
+				return _make_morph(a_editorID);
+			}
+			return std::nullopt;
+		}
+
+		std::optional<InputReference> Restore(std::string_view a_editorID, InputType a_type, uint32_t a_formID) override
+		{
+			if (a_type == InputType::kMorph) {
+				return _make_morph(a_editorID);
+			}
+
+			auto form = RE::TESForm::LookupByID(a_formID);
+			if (!form) {
+				return std::nullopt;
+			}
+			if (a_type == InputType::kActorValue) {
+				if (auto avi = form->As<RE::ActorValueInfo>(); avi) {
+					return _make_actor_value(avi, a_editorID);
+				}
+			} else if (auto keyword = form->As<RE::BGSKeyword>(); keyword) {
+				return _make_keyword(keyword, a_type, a_editorID);
+			}
+			return std::nullopt;
+		}
+
+		float Acquire(Actor* a_actor, const InputReference& a_input) const override
+		{
+			switch (a_input.type) {
+			case InputType::kActorValue:
+				return a_actor->GetActorValue(*m_actor_values[a_input.index]);
+			case InputType::kWornKeyword:
+				return ActorKeywordCache::GetSingleton().HasWornKeyword(a_actor, a_input.index) ? 1.f : 0.f;
+			case InputType::kNPCKeyword:
+				return ActorKeywordCache::GetSingleton().HasNPCKeyword(a_actor, a_input.index) ? 1.f : 0.f;
+			case InputType::kMorph:
+				return MorphMirror::GetSingleton().Get(a_actor, a_input.index);
+			default:
+				return 0.f;
+			}
+		}
+
+		uint32_t GetFormID(const Actor* a_actor) const override
+		{
+			return a_actor->formID;
+		}
+
+	private:
+		GameActorDataProvider() = default;
+
+		static bool Includes(InputType a_types, InputType a_type)
+		{
+			return std::to_underlying(a_types) & std::to_underlying(a_type);
+		}
+
+		// Actor values are indexed like keywords, so acquisition needs no form lookup
+		InputReference _make_actor_value(RE::ActorValueInfo* a_info, std::string_view a_editorID)
+		{
+			tbb::concurrent_hash_map<RE::ActorValueInfo*, uint32_t>::accessor acc;
+			if (m_actor_value_indices.insert(acc, a_info)) {
+				acc->second = static_cast<uint32_t>(m_actor_values.push_back(a_info) - m_actor_values.begin());
+			}
+			return { InputType::kActorValue, a_info->GetFormID(), acc->second, a_editorID };
+		}
+
+		static InputReference _make_keyword(RE::BGSKeyword* a_keyword, InputType a_type, std::string_view a_editorID)
+		{
+			return { a_type, a_keyword->GetFormID(), KeywordIndex::GetSingleton().Register(a_keyword), a_editorID };
+		}
+
+		// Morphs are read from the MorphMirror by NameID, neither hashing nor comparing their name
+		static InputReference _make_morph(std::string_view a_editorID)
+		{
+			return { InputType::kMorph, 0, MorphMirror::GetSingleton().GetNames().Intern(a_editorID), a_editorID };
+		}
+
+		tbb::concurrent_vector<RE::ActorValueInfo*>             m_actor_values;  // Grows while loading, read by any thread
+		tbb::concurrent_hash_map<RE::ActorValueInfo*, uint32_t> m_actor_value_indices;
+	};
+}
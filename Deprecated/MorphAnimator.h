@@ -0,0 +1,398 @@
+#pragma once
+#include "SFEventHandler.h"
+#include "Singleton.h"
+#include "MorphMirror.h"
+#include "RebuildTelemetry.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#	include <emmintrin.h>
+#	define DAF_MORPH_SSE2
+#endif
+
+namespace daf
+{
+	// Eases morphs of actors towards their targets instead of setting them at once.
+	//
+	// Transitions of every actor are interpolated together, in one pass over contiguous arrays per tick, and written
+	// through the MorphMirror. Appearances are rebuilt at a reduced rate per actor, staggered so actors animating
+	// together don't all rebuild on the same frame, and at most max_rebuilds_per_tick times per tick. A tick runs as
+	// a single task on the game thread, queued by actor updates while anything is animating.
+	class MorphAnimator :
+		public utils::SingletonBase<MorphAnimator>,
+		public events::EventDispatcher<events::ActorUpdateEvent>::Listener
+	{
+		friend class utils::SingletonBase<MorphAnimator>;
+
+	public:
+		using NameID = MorphNameTable::NameID;
+
+		enum class Easing : uint8_t
+		{
+			Linear,
+			EaseIn,
+			EaseOut,
+			EaseInOut  // Smoothstep
+		};
+
+		struct Settings
+		{
+			float    rebuild_rate_hz{ 10.f };      // Appearance rebuilds per second of each animating actor
+			uint32_t max_rebuilds_per_tick{ 4 };    // Due rebuilds past it wait for the next tick
+			uint32_t max_transitions{ 8192 };       // Morphs animating at once, past it morphs are set at once
+			float    max_tick_interval_s{ 0.25f };  // Longer gaps between ticks, e.g. loading, don't advance transitions
+		};
+
+		virtual ~MorphAnimator() = default;
+
+		void Register()
+		{
+			events::ActorUpdatedEventDispatcher::GetSingleton()->EventDispatcher<events::ActorUpdateEvent>::AddStaticListener(this);
+		}
+
+		// Must run on the game thread
+		void SetSettings(const Settings& a_settings)
+		{
+			m_settings = a_settings;
+		}
+
+		// Starts the transitions of a_actor towards a_targets, NameIDs of the MorphMirror, from their current values.
+		// A morph already animating is retargeted from where it is, unless its target is unchanged. Without a_rebuild,
+		// the appearance of a_actor is only rebuilt if other transitions of the actor asked for it.
+		// Returns false, writing nothing, if a_duration is not positive or the transitions would not fit.
+		// Must run on the game thread.
+		bool Animate(RE::Actor* a_actor, std::span<const std::pair<NameID, float>> a_targets, float a_duration, Easing a_easing = Easing::EaseInOut, bool a_rebuild = true)
+		{
+			if (a_duration <= 0.f || m_to.size() + a_targets.size() > m_settings.max_transitions) {
+				return false;
+			}
+			if (a_targets.empty()) {
+				return true;
+			}
+
+			const float now = _now();
+			const auto& curve = Curves[static_cast<size_t>(a_easing)];
+			const auto  track = _get_track(a_actor, now);
+			m_tracks[track].rebuild |= a_rebuild;
+
+			bool read = MorphMirror::GetSingleton().Read(a_actor, [&](const ActorMorphMirror& a_mirror) {
+				for (auto& [name, target] : a_targets) {
+					uint32_t lane;
+					if (auto it = m_lanes.find(_lane_key(a_actor->formID, name)); it != m_lanes.end()) {
+						lane = it->second;
+						if (m_to[lane] == target) {
+							continue;
+						}
+						m_from[lane] = m_value[lane];
+					} else {
+						lane = _push_lane(track, name, a_mirror.Get(name));
+					}
+
+					m_to[lane] = target;
+					m_start[lane] = now;
+					m_inv_duration[lane] = 1.f / a_duration;
+					m_curve_a[lane] = curve[0];
+					m_curve_b[lane] = curve[1];
+					m_curve_c[lane] = curve[2];
+				}
+			});
+
+			m_active = m_to.size() + m_tracks.size();
+			return read;
+		}
+
+		// Jumps the transitions of a_actor to their targets, must run on the game thread
+		void Finish(RE::Actor* a_actor)
+		{
+			auto it = m_track_indices.find(a_actor->formID);
+			if (it == m_track_indices.end()) {
+				return;
+			}
+
+			for (size_t lane = 0; lane < m_to.size(); ++lane) {
+				if (m_track[lane] == it->second) {
+					m_start[lane] = -std::numeric_limits<float>::infinity();
+				}
+			}
+			Tick();
+		}
+
+		// One step of every transition, from a task queued at a_queued. Must run on the game thread.
+		void Tick(telemetry::RebuildTelemetry::Clock::time_point a_queued = telemetry::RebuildTelemetry::Clock::now())
+		{
+			m_tick_scheduled = false;
+
+			const float now = _now();
+			_interpolate(now);
+
+			// Finished morphs are written at their exact target, then dropped
+			size_t finished = 0;
+			for (size_t lane = 0; lane < m_to.size(); ++lane) {
+				bool done = m_progress[lane] >= 1.f;
+				m_tracks[m_track[lane]].batch.emplace_back(m_name[lane], done ? m_to[lane] : m_value[lane]);
+				finished += done;
+			}
+
+			for (auto& track : m_tracks) {
+				if (!track.batch.empty()) {
+					MorphMirror::GetSingleton().Write(track.actor.get(), track.batch, track.mirror_version);
+					track.batch.clear();
+					track.dirty |= track.rebuild;
+				}
+			}
+
+			if (finished) {
+				_drop_finished_lanes();
+			}
+			_rebuild_appearances(now, a_queued);
+			_drop_idle_tracks();
+
+			m_active = m_to.size() + m_tracks.size();
+		}
+
+		void OnEvent(const events::ActorUpdateEvent& a_event, events::EventDispatcher<events::ActorUpdateEvent>* a_dispatcher) override
+		{
+			if (m_active && !m_tick_scheduled.exchange(true)) {
+				SFSE::GetTaskInterface()->AddTask([this, queued = telemetry::RebuildTelemetry::Clock::now()]() { this->Tick(queued); });
+			}
+		}
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		static constexpr float RebaseAfter_s = 600.f;
+
+		// ((a * t + b) * t + c) * t of each Easing, every curve is a cubic through (0, 0) and (1, 1)
+		static constexpr std::array<std::array<float, 3>, 4> Curves{ {
+			{ 0.f, 0.f, 1.f },   // t
+			{ 0.f, 1.f, 0.f },   // t^2
+			{ 0.f, -1.f, 2.f },  // 1 - (1 - t)^2
+			{ -2.f, 3.f, 0.f },  // 3t^2 - 2t^3
+		} };
+
+		// An animating actor
+		struct Track
+		{
+			RE::NiPointer<RE::Actor>              actor;
+			uint32_t                              lanes{ 0 };
+			float                                 next_rebuild{ 0.f };
+			bool                                  rebuild{ false };  // Some transition asked for appearance rebuilds
+			bool                                  dirty{ false };    // Written since its last rebuild
+			uint64_t                              mirror_version{ 0 };
+			std::vector<std::pair<NameID, float>> batch;
+		};
+
+		MorphAnimator() = default;
+
+		static uint64_t _lane_key(RE::TESFormID a_formID, NameID a_name)
+		{
+			return (uint64_t(a_formID) << 32) | a_name;
+		}
+
+		// Seconds since m_epoch, which follows the clock so floats stay precise
+		float _now()
+		{
+			auto now = Clock::now();
+			if (m_to.empty() && m_tracks.empty()) {
+				m_epoch = now;
+				m_last_tick = 0.f;
+			}
+
+			float seconds = std::chrono::duration<float>(now - m_epoch).count();
+			if (float pause = seconds - m_last_tick - m_settings.max_tick_interval_s; pause > 0.f) {
+				// Paused or loading, the transitions resume where they were
+				m_epoch += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(pause));
+				seconds -= pause;
+			}
+			if (seconds > RebaseAfter_s) {
+				_rebase(seconds);
+				seconds = 0.f;
+			}
+			m_last_tick = seconds;
+			return seconds;
+		}
+
+		// Moves m_epoch a_seconds later, keeping every transition where it is
+		void _rebase(float a_seconds)
+		{
+			m_epoch += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(a_seconds));
+			for (auto& start : m_start) {
+				start -= a_seconds;
+			}
+			for (auto& track : m_tracks) {
+				track.next_rebuild -= a_seconds;
+			}
+		}
+
+		uint32_t _get_track(RE::Actor* a_actor, float a_now)
+		{
+			auto [it, inserted] = m_track_indices.try_emplace(a_actor->formID, static_cast<uint32_t>(m_tracks.size()));
+			if (inserted) {
+				// Spreads the first rebuilds of actors starting together over one rebuild interval
+				float phase = static_cast<float>((a_actor->formID * 2654435761u) >> 22) / 1024.f;
+				auto& track = m_tracks.emplace_back();
+				track.actor = RE::NiPointer<RE::Actor>(a_actor);
+				track.next_rebuild = a_now + phase / m_settings.rebuild_rate_hz;
+			}
+			return it->second;
+		}
+
+		uint32_t _push_lane(uint32_t a_track, NameID a_name, float a_from)
+		{
+			auto lane = static_cast<uint32_t>(m_to.size());
+			m_lanes.emplace(_lane_key(m_tracks[a_track].actor->formID, a_name), lane);
+			++m_tracks[a_track].lanes;
+
+			m_track.push_back(a_track);
+			m_name.push_back(a_name);
+			m_from.push_back(a_from);
+			m_value.push_back(a_from);
+			m_progress.push_back(0.f);
+			m_to.push_back(a_from);
+			m_start.push_back(0.f);
+			m_inv_duration.push_back(0.f);
+			m_curve_a.push_back(0.f);
+			m_curve_b.push_back(0.f);
+			m_curve_c.push_back(0.f);
+			return lane;
+		}
+
+		// The value and progress of every lane at a_now, four lanes per instruction where SSE2 is available
+		void _interpolate(float a_now)
+		{
+			const size_t size = m_to.size();
+			size_t       i = 0;
+#ifdef DAF_MORPH_SSE2
+			const __m128 now = _mm_set1_ps(a_now);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.f);
+			for (; i + 4 <= size; i += 4) {
+				__m128 t = _mm_mul_ps(_mm_sub_ps(now, _mm_loadu_ps(&m_start[i])), _mm_loadu_ps(&m_inv_duration[i]));
+				t = _mm_min_ps(_mm_max_ps(t, zero), one);
+				__m128 eased = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_curve_a[i]), t), _mm_loadu_ps(&m_curve_b[i]));
+				eased = _mm_add_ps(_mm_mul_ps(eased, t), _mm_loadu_ps(&m_curve_c[i]));
+				eased = _mm_mul_ps(eased, t);
+				__m128 from = _mm_loadu_ps(&m_from[i]);
+				__m128 value = _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&m_to[i]), from), eased));
+				_mm_storeu_ps(&m_value[i], value);
+				_mm_storeu_ps(&m_progress[i], t);
+			}
+#endif
+			for (; i < size; ++i) {
+				float t = std::clamp((a_now - m_start[i]) * m_inv_duration[i], 0.f, 1.f);
+				float eased = ((m_curve_a[i] * t + m_curve_b[i]) * t + m_curve_c[i]) * t;
+				m_value[i] = m_from[i] + (m_to[i] - m_from[i]) * eased;
+				m_progress[i] = t;
+			}
+		}
+
+		// Keeps the order of the remaining lanes
+		void _drop_finished_lanes()
+		{
+			size_t kept = 0;
+			for (size_t lane = 0; lane < m_to.size(); ++lane) {
+				auto key = _lane_key(m_tracks[m_track[lane]].actor->formID, m_name[lane]);
+				if (m_progress[lane] >= 1.f) {
+					m_lanes.erase(key);
+					--m_tracks[m_track[lane]].lanes;
+					continue;
+				}
+				if (kept != lane) {
+					m_track[kept] = m_track[lane];
+					m_name[kept] = m_name[lane];
+					m_from[kept] = m_from[lane];
+					m_value[kept] = m_value[lane];
+					m_progress[kept] = m_progress[lane];
+					m_to[kept] = m_to[lane];
+					m_start[kept] = m_start[lane];
+					m_inv_duration[kept] = m_inv_duration[lane];
+					m_curve_a[kept] = m_curve_a[lane];
+					m_curve_b[kept] = m_curve_b[lane];
+					m_curve_c[kept] = m_curve_c[lane];
+					m_lanes[key] = static_cast<uint32_t>(kept);
+				}
+				++kept;
+			}
+
+			for (auto* lanes : { &m_from, &m_value, &m_progress, &m_to, &m_start, &m_inv_duration, &m_curve_a, &m_curve_b, &m_curve_c }) {
+				lanes->resize(kept);
+			}
+			m_track.resize(kept);
+			m_name.resize(kept);
+		}
+
+		// Due actors first come first served from where the last tick stopped, finished actors are due at once
+		void _rebuild_appearances(float a_now, telemetry::RebuildTelemetry::Clock::time_point a_queued)
+		{
+			const float  interval = 1.f / m_settings.rebuild_rate_hz;
+			uint32_t     budget = m_settings.max_rebuilds_per_tick;
+			const size_t start = m_rebuild_cursor;
+			for (size_t n = 0; n < m_tracks.size() && budget; ++n) {
+				auto& track = m_tracks[(start + n) % m_tracks.size()];
+				if (!track.dirty || (track.lanes && a_now < track.next_rebuild)) {
+					continue;
+				}
+
+				telemetry::RebuildTelemetry::GetSingleton().Execute(telemetry::RebuildType::kChargen, track.actor->formID, a_queued, [&]() {
+					track.actor->UpdateChargenAppearance();
+				});
+				track.dirty = false;
+				track.next_rebuild = std::max(track.next_rebuild + interval, a_now);
+				m_rebuild_cursor = (start + n + 1) % m_tracks.size();
+				--budget;
+			}
+		}
+
+		void _drop_idle_tracks()
+		{
+			std::vector<uint32_t> remap(m_tracks.size());
+			size_t                kept = 0;
+			for (size_t track = 0; track < m_tracks.size(); ++track) {
+				if (!m_tracks[track].lanes && !m_tracks[track].dirty) {
+					continue;
+				}
+				remap[track] = static_cast<uint32_t>(kept);
+				if (kept != track) {
+					m_tracks[kept] = std::move(m_tracks[track]);
+				}
+				++kept;
+			}
+			if (kept == m_tracks.size()) {
+				return;
+			}
+
+			m_tracks.resize(kept);
+			m_rebuild_cursor = 0;
+			for (auto& track : m_track) {
+				track = remap[track];
+			}
+			m_track_indices.clear();
+			for (size_t track = 0; track < m_tracks.size(); ++track) {
+				m_track_indices.emplace(m_tracks[track].actor->formID, static_cast<uint32_t>(track));
+			}
+		}
+
+		Settings            m_settings;
+		std::atomic<size_t> m_active{ 0 };  // Lanes and tracks, read by the actor update threads
+		std::atomic<bool>   m_tick_scheduled{ false };
+		Clock::time_point   m_epoch{ Clock::now() };
+		float               m_last_tick{ 0.f };
+		size_t              m_rebuild_cursor{ 0 };
+
+		std::vector<Track>                          m_tracks;
+		std::unordered_map<RE::TESFormID, uint32_t> m_track_indices;
+		std::unordered_map<uint64_t, uint32_t>      m_lanes;  // Lane by formID and NameID
+
+		// One lane per animating morph, the float arrays are contiguous for _interpolate
+		std::vector<uint32_t> m_track;
+		std::vector<NameID>   m_name;
+		std::vector<float>    m_from;
+		std::vector<float>    m_value;
+		std::vector<float>    m_progress;  // 0 to 1 before easing, finished at 1
+		std::vector<float>    m_to;
+		std::vector<float>    m_start;
+		std::vector<float>    m_inv_duration;
+		std::vector<float>    m_curve_a;
+		std::vector<float>    m_curve_b;
+		std::vector<float>    m_curve_c;
+	};
+}
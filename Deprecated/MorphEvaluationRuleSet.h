@@ -1,9 +1,22 @@
 #pragma once
+#ifndef DAF_HEADLESS
 #include "LogWrapper.h"
 #include "Singleton.h"
+#include "SFEventHandler.h"
+#include "GameActorDataProvider.h"
+#endif
+#include "ActorDataProvider.h"
+#include "DenseBitset.h"
+#include "RuleSetCache.h"
+#include "RuleProfiler.h"
+#include "EpochReclaimer.h"
+#include "RuleOptimizer.h"
+#include "RuleVM.h"
 
 namespace daf
 {
+	// Compiled rules of a race/sex. Immutable once loaded: all per-evaluation state lives in an
+	// EvaluationContext, so any number of threads can evaluate the same rule set concurrently.
 	class MorphEvaluationRuleSet
 	{
 	public:
@@ -12,7 +25,12 @@ namespace daf
 		using SymbolTable = exprtk::symbol_table<float>;
 		using Symbol = std::string_view;
 
-		using AcquisitionFunction = std::function<float(RE::Actor*, RE::TESNPC*)>;
+		// Dense IDs resolved while parsing, names are only kept for loading and diagnostics
+		using SymbolID = uint32_t;
+		using MorphID = uint32_t;
+
+		using Actor = ActorDataProvider::Actor;
+		using FormID = uint32_t;
 
 		enum class CollisionBehavior : uint8_t
 		{
@@ -20,22 +38,21 @@ namespace daf
 			kAppend
 		};
 
+		// How rules are compiled, selected per rule set with the "Backend" key of a script
+		enum class Backend : uint8_t
+		{
+			kExprtk,
+			kVM  // Register bytecode, rules the VM does not support still use exprtk
+		};
+
 		class Alias
 		{
 		public:
-			enum class Type : uint8_t
-			{
-				kNone = 0,
-				kActorValue = 1 << 0,
-				kWornKeyword = 1 << 1,
-				kNPCKeyword = 1 << 2,
-				kMorph = 1 << 3,
-				kAny = kActorValue | kWornKeyword | kNPCKeyword | kMorph
-			};
+			using Type = InputType;
 
 			Alias() = default;
-			Alias(std::string_view a_symbol, std::string_view a_editorID, Type a_type, AcquisitionFunction a_acquisition_func) :
-				symbol(a_symbol), editorID(a_editorID), type(a_type), acquisition_func(a_acquisition_func) {}
+			Alias(std::string_view a_symbol, const InputReference& a_input) :
+				symbol(a_symbol), editorID(a_input.editorID), type(a_input.type), input(a_input) {}
 
 			inline bool is_same_as(const Alias& a_rhs) const
 			{
@@ -47,22 +64,33 @@ namespace daf
 				return (std::to_underlying(type) & std::to_underlying(a_type)) && editorID == a_editorID;
 			}
 
-			Symbol             symbol;
-			std::string_view   editorID;
-			Type               type{ Type::kNone };
-			AcquisitionFunction acquisition_func;
+			Symbol           symbol;
+			std::string_view editorID;
+			Type             type{ Type::kNone };
+			InputReference   input;  // Resolved by the provider of the rule set
+			SymbolID         id{ 0 };  // Slot of the value in snapshots, shared by equivalent symbols
+			float            default_value{ 0.f };
 
 			std::vector<Symbol> equivalent_symbols;
 		};
 
+		class EvaluationContext;
+
 		class Rule
 		{
 		public:
 			MorphEvaluationRuleSet* parent_rule_set{ nullptr };
 
 			std::string_view target_morph_name;
-			Expression       expr;
+			MorphID          target_morph{ 0 };
+			std::string      expr_str;
+			std::string      compiled_str;  // Rewritten by Optimize, empty to compile expr_str as written
+			size_t           index{ 0 };    // Slot of the compiled expression in every EvaluationContext
 			bool             is_setter{ false };
+			bool             is_pruned{ false };  // Adder that always evaluates to zero, see Optimize
+
+			std::vector<uint32_t> intermediates;  // Read by compiled_str
+			uint32_t              chunk{ vm::Program::kNoChunk };  // Bytecode of compiled_str, see CompileProgram
 
 			std::vector<Alias*>      external_symbols;
 			std::vector<std::string> internal_symbols;
@@ -74,10 +102,14 @@ namespace daf
 			Rule(MorphEvaluationRuleSet* a_parentRuleSet, bool a_isSetter) :
 				parent_rule_set(a_parentRuleSet), is_setter(a_isSetter) {}
 
-			bool Parse(const std::string& expr_str, SymbolTable& symbol_table)
+			// Compiles against the rule set's symbol table only to validate and collect symbols,
+			// evaluation uses the expressions compiled by each EvaluationContext
+			bool Parse(const std::string& a_exprStr, SymbolTable& symbol_table)
 			{
+				Expression expr;
 				expr.register_symbol_table(symbol_table);
 				Parser parser(Parser::settings_t::e_collect_vars);
+				expr_str = a_exprStr;
 				if (!parser.compile(expr_str, expr)) {
 					compiler_error = parser.error();
 					return false;
@@ -85,8 +117,10 @@ namespace daf
 				auto& all_symbols = parser.dec().symbol_list();
 				for (auto& symbol : all_symbols) {
 					if (symbol.second == Parser::symbol_type::e_st_variable) {
-						if (auto it = parent_rule_set->m_aliases.find(symbol.first); it != parent_rule_set->m_aliases.end()) {
-							external_symbols.emplace_back(&it->second);
+						if (auto alias = parent_rule_set->FindAliasBySymbol(symbol.first); alias) {
+							if (std::find(external_symbols.begin(), external_symbols.end(), alias) == external_symbols.end()) {
+								external_symbols.emplace_back(alias);
+							}
 						} else {
 							internal_symbols.emplace_back(symbol.first);
 						}
@@ -96,12 +130,25 @@ namespace daf
 				return true;
 			}
 
-			float Evaluate()
+			bool IsActive() const
+			{
+				return is_valid && !is_pruned;
+			}
+
+			const std::string& GetCompiledString() const
 			{
-				if (!is_valid) {
+				return compiled_str.empty() ? expr_str : compiled_str;
+			}
+
+			float Evaluate(const EvaluationContext& a_context) const
+			{
+				if (!IsActive()) {
 					return 0.f;
 				}
-				return expr.value();
+				if (chunk != vm::Program::kNoChunk) {
+					return a_context.rule_set.m_program.Run(chunk, a_context.values.data());
+				}
+				return a_context.expressions[index].value();
 			}
 
 			const std::string& GetCompilerError() const
@@ -110,20 +157,212 @@ namespace daf
 			}
 		};
 
+		// Subexpression shared by several rules, see Optimize.
+		// Its value is stored after the alias values of a context, at m_symbols.size() + its index.
+		struct Intermediate
+		{
+			std::string           symbol;
+			std::string           expr_str;
+			std::vector<SymbolID> external_symbols;
+			std::vector<uint32_t> intermediates;  // Always lower indices
+			uint32_t              chunk{ vm::Program::kNoChunk };
+		};
+
+		// Step of batch evaluation, see _plan_batches
+		struct BatchStep
+		{
+			uint32_t chunk{ vm::Program::kNoChunk };  // None if exprtk evaluates the step lane by lane
+			uint32_t target{ 0 };                     // Index of the intermediate, or MorphID of the rule
+			uint32_t expression{ 0 };                 // Rule::index, for exprtk steps of rules
+			uint32_t first_input{ 0 };                // Registers exprtk steps read, in m_batch_inputs
+			uint32_t num_inputs{ 0 };
+			bool     is_intermediate{ false };
+			bool     is_setter{ false };
+			bool     is_first{ false };  // First rule of its morph
+			bool     is_last{ false };   // Last rule evaluated for its morph
+		};
+
 		struct Result
 		{
 			bool  is_setter{ false };
 			float value{ 0.f };
+
+			bool operator==(const Result&) const = default;
+		};
+
+		// Dense results indexed by MorphID, see GetMorphName for the names
+		struct ResultTable
+		{
+			std::vector<float> values;
+			DenseBitset        is_setter;
+			DenseBitset        has_effect;  // Setter or non-zero offset, morphs without effect are not committed
+			DenseBitset        dirty;       // Changed by the last evaluation
+
+			void Reset(size_t a_numMorphs)
+			{
+				values.assign(a_numMorphs, 0.f);
+				for (auto bitset : { &is_setter, &has_effect, &dirty }) {
+					bitset->Clear();
+					bitset->Resize(a_numMorphs);
+				}
+			}
+
+			void Set(MorphID a_morph, const Result& a_result)
+			{
+				values[a_morph] = a_result.value;
+				a_result.is_setter ? is_setter.Set(a_morph) : is_setter.Reset(a_morph);
+				has_effect.Set(a_morph);
+			}
+
+			void Erase(MorphID a_morph)
+			{
+				values[a_morph] = 0.f;
+				is_setter.Reset(a_morph);
+				has_effect.Reset(a_morph);
+			}
+
+			bool Contains(MorphID a_morph) const
+			{
+				return has_effect.Test(a_morph);
+			}
+
+			Result Get(MorphID a_morph) const
+			{
+				return { is_setter.Test(a_morph), values[a_morph] };
+			}
+
+			// Visits morphs with an effect in MorphID order
+			template <class _Func>
+			void ForEach(_Func&& a_func) const
+			{
+				has_effect.ForEachSetBit([this, &a_func](uint32_t a_morph) { a_func(a_morph, Get(a_morph)); });
+			}
+		};
+
+		// Alias values indexed by SymbolID
+		using InputSnapshot = std::vector<float>;
+
+		// Structure-of-arrays symbol values for a batch of actors, one column of num_actors values per SymbolID
+		struct BatchInput
+		{
+			size_t             num_actors{ 0 };
+			std::vector<float> values;
+
+			float* Column(SymbolID a_symbol)
+			{
+				return values.data() + a_symbol * num_actors;
+			}
+
+			const float* Column(SymbolID a_symbol) const
+			{
+				return values.data() + a_symbol * num_actors;
+			}
+		};
+
+		// Dense result matrix, one row per actor and one column per MorphID
+		struct BatchResult
+		{
+			size_t                        num_actors{ 0 };
+			std::vector<std::string_view> morphs;
+			std::vector<uint8_t>          is_setter;
+			std::vector<float>            values;
+
+			float* Row(size_t a_actor)
+			{
+				return values.data() + a_actor * morphs.size();
+			}
+
+			float& At(size_t a_actor, size_t a_morph)
+			{
+				return values[a_actor * morphs.size() + a_morph];
+			}
 		};
 
-		using ResultTable = std::unordered_map<std::string_view, Result>;
+		// Per-thread symbol storage and expressions bound to it
+		class EvaluationContext
+		{
+		public:
+			EvaluationContext(const MorphEvaluationRuleSet& a_ruleSet) :
+				rule_set(a_ruleSet)
+			{
+				symbol_table.add_constants();
+
+				// Sized once, bound references stay valid
+				values.resize(std::max<size_t>(a_ruleSet.m_symbols.size() + a_ruleSet.m_intermediates.size(), a_ruleSet.m_program.GetNumRegisters()));
+				a_ruleSet.m_program.InitRegisters(values.data());
+				if (!a_ruleSet.m_batch_steps.empty()) {
+					lanes.resize(a_ruleSet.m_program.GetNumRegisters());
+					a_ruleSet.m_program.InitRegisters(lanes.data());
+				}
+				for (auto alias : a_ruleSet.m_symbols) {
+					auto& value = values[alias->id];
+					value = alias->default_value;
+					symbol_table.add_variable(alias->symbol.data(), value);
+					for (auto& equivalent : alias->equivalent_symbols) {
+						symbol_table.add_variable(equivalent.data(), value);
+					}
+				}
+				for (size_t i = 0; i < a_ruleSet.m_intermediates.size(); ++i) {
+					symbol_table.add_variable(a_ruleSet.m_intermediates[i].symbol, values[a_ruleSet.m_symbols.size() + i]);
+				}
+
+				Parser parser;
+				intermediate_expressions.resize(a_ruleSet.m_intermediates.size());
+				for (size_t i = 0; i < a_ruleSet.m_intermediates.size(); ++i) {
+					if (a_ruleSet.m_intermediates[i].chunk != vm::Program::kNoChunk) {
+						continue;
+					}
+					auto& expr = intermediate_expressions[i];
+					expr.register_symbol_table(symbol_table);
+					if (!parser.compile(a_ruleSet.m_intermediates[i].expr_str, expr)) {
+						logger::error("When binding intermediate '{}': {}", a_ruleSet.m_intermediates[i].symbol, parser.error());
+					}
+				}
+
+				expressions.resize(a_ruleSet.m_num_rule_slots);
+				for (MorphID morph = 0; morph < a_ruleSet.m_rules.size(); ++morph) {
+					for (auto& rule : a_ruleSet.m_rules[morph]) {
+						if (!rule.IsActive() || rule.chunk != vm::Program::kNoChunk) {
+							continue;
+						}
+						auto& expr = expressions[rule.index];
+						expr.register_symbol_table(symbol_table);
+						if (!parser.compile(rule.GetCompiledString(), expr)) {
+							logger::error("When binding Rule for '{}': {}", a_ruleSet.m_morph_names[morph], parser.error());
+						}
+					}
+				}
+			}
+
+			EvaluationContext(const EvaluationContext&) = delete;
+			EvaluationContext& operator=(const EvaluationContext&) = delete;
+
+			const MorphEvaluationRuleSet& rule_set;
+			mutable std::vector<float>    values;  // Indexed by SymbolID, then intermediates. Also the VM's registers.
+			SymbolTable                   symbol_table;
+			std::vector<Expression>       expressions;  // Rules compiled to bytecode are left empty
+			std::vector<Expression>       intermediate_expressions;
+			DenseBitset                   pending_intermediates;  // Scratch
+			std::vector<vm::Lanes>        lanes;  // VM registers for batch evaluation
+		};
+
+#ifndef DAF_HEADLESS
+		MorphEvaluationRuleSet() :
+			MorphEvaluationRuleSet(GameActorDataProvider::GetSingleton())
+		{}
+#endif
 
-		MorphEvaluationRuleSet()
+		// a_provider resolves the aliases and reads them from actors, it must outlive the rule set
+		explicit MorphEvaluationRuleSet(ActorDataProvider& a_provider) :
+			m_provider(&a_provider)
 		{
 			m_symbol_table.add_constants();
 		}
 
-		~MorphEvaluationRuleSet() = default;
+		~MorphEvaluationRuleSet()
+		{
+			delete m_actor_profiles.load();
+		}
 
 		void Clear()
 		{
@@ -131,10 +370,26 @@ namespace daf
 			//m_keyword_symbols.clear();
 			//m_morph_symbols.clear();
 			m_aliases.clear();
+			m_symbols.clear();
 			m_rules.clear();
+			m_morph_names.clear();
+			m_morph_ids.clear();
 			m_symbol_table.clear();
-			m_value_snapshot.clear();
+			m_default_values.clear();
+			m_symbol_dependents.clear();
+			m_intermediates.clear();
+			m_morph_intermediates.clear();
+			m_optimization_report = {};
+			m_program = {};
+			m_batch_steps.clear();
+			m_batch_inputs.clear();
+			m_backend = Backend::kExprtk;
+			m_load_messages.clear();
+			m_actor_caches.clear();
+			m_contexts.clear();
+			m_num_rule_slots = 0;
 			m_loaded = false;
+			_resize_profile();
 		}
 
 		bool ParseScript(std::string a_filename, bool a_clearExisting, CollisionBehavior a_behavior = CollisionBehavior::kOverwrite)
@@ -165,8 +420,23 @@ namespace daf
 				Clear();
 			}
 
+			// Contexts and caches were compiled against the previous rules
+			m_contexts.clear();
+			m_actor_caches.clear();
+
 			bool success = true;
 
+			if (j.contains("Backend")) {
+				auto backend = j["Backend"].get<std::string>();
+				if (backend == "vm") {
+					m_backend = Backend::kVM;
+				} else if (backend == "exprtk") {
+					m_backend = Backend::kExprtk;
+				} else {
+					_load_message(false, std::format("Unknown Backend: '{}', using '{}'.", backend, m_backend == Backend::kVM ? "vm" : "exprtk"));
+				}
+			}
+
 			// Parse aliases
 			if (j.contains("Aliases")) {
 				auto& aliases = j["Aliases"];
@@ -177,7 +447,7 @@ namespace daf
 					if (alias_obj.contains("EditorID")) {
 						editorID = alias_obj["EditorID"].get<std::string>();
 					} else {
-						logger::error("When parsing Alias '{}': No EditorID found in definition.", alias);
+						_load_message(true, std::format("When parsing Alias '{}': No EditorID found in definition.", alias));
 					}
 					if (alias_obj.contains("Type")) {
 						auto type_str = alias_obj["Type"].get<std::string>();
@@ -190,14 +460,14 @@ namespace daf
 						} else if (type_str == "morph") {
 							alias_type = Alias::Type::kMorph;
 						} else {
-							logger::warn("When parsing Alias '{}': Unknown Alias type: '{}', using automatic type.", alias, type_str);
+							_load_message(false, std::format("When parsing Alias '{}': Unknown Alias type: '{}', using automatic type.", alias, type_str));
 						}
 					}
 					if (alias_obj.contains("Default")) {
 						default_to = alias_obj["Default"].get<float>();
 					}
 					if (!ParseAlias(alias, editorID, alias_type, default_to)) {
-						logger::error("When parsing Alias '{}': {}", alias, last_error);
+						_load_message(true, std::format("When parsing Alias '{}': {}", alias, last_error));
 						success = false;
 					}
 				}
@@ -211,7 +481,7 @@ namespace daf
 					auto& adder = rules["Adders"];
 					for (auto& [morph_name, expr_str] : adder.items()) {
 						if (!ParseRule(morph_name, expr_str, false, a_behavior)) {
-							logger::error("When parsing Rule for '{}': {}", morph_name, last_error);
+							_load_message(true, std::format("When parsing Rule for '{}': {}", morph_name, last_error));
 							success = false;
 						}
 					}
@@ -221,13 +491,14 @@ namespace daf
 					auto& setter = rules["Setters"];
 					for (auto& [morph_name, expr_str] : setter.items()) {
 						if (!ParseRule(morph_name, expr_str, true, CollisionBehavior::kOverwrite)) {
-							logger::error("When parsing Rule for '{}': {}", morph_name, last_error);
+							_load_message(true, std::format("When parsing Rule for '{}': {}", morph_name, last_error));
 							success = false;
 						}
 					}
 				}
 			}
 
+			_resize_profile();
 			return success;
 		}
 
@@ -238,73 +509,27 @@ namespace daf
 
 			if (auto same_alias = FindSameAlias(editorID, a_aliasType); same_alias) {  // Collapse aliases referencing same actorValue/keword/morph
 				same_alias->equivalent_symbols.emplace_back(alias);
-				if (!m_symbol_table.add_variable(alias.data(), m_value_snapshot[same_alias->symbol])) {
+				if (!m_symbol_table.add_variable(alias.data(), m_default_values[same_alias->symbol])) {
 					last_error = std::format("Symbol redefinition or illegal symbol name: '{}'.", alias);
 					return false;
 				}
 				return true;
 			}
 
-			m_value_snapshot[alias] = defaultTo;
-			if (!m_symbol_table.add_variable(alias.data(), m_value_snapshot[alias])) {
-				m_value_snapshot.erase(alias);
+			m_default_values[alias] = defaultTo;
+			if (!m_symbol_table.add_variable(alias.data(), m_default_values[alias])) {
+				m_default_values.erase(alias);
 				last_error = std::format("Symbol redefinition or illegal symbol name: '{}'.", alias);
 				//logger::error(last_error.c_str());
 				return false;
 			}
 
-			if (auto avi = ParseSymbolAsActorValue(editorID); (std::to_underlying(a_aliasType) & std::to_underlying(Alias::Type::kActorValue)) && avi) {
-				//m_actor_value_symbols[alias] = avi;
-				m_aliases[alias] = { 
-					alias, 
-					editorID, 
-					Alias::Type::kActorValue, 
-					[avi](RE::Actor* actor, RE::TESNPC* npc) -> float {
-						return AcquireActorValue(actor, npc, avi);
-					}
-				};
-				m_loaded = true;
-				return true;
-			} else if (auto keyword = ParseSymbolAsKeyword(editorID); (std::to_underlying(a_aliasType) & std::to_underlying(Alias::Type::kWornKeyword)) && keyword) {
-				//m_keyword_symbols[alias] = keyword;
-				m_aliases[alias] = {
-					alias,
-					editorID,
-					Alias::Type::kWornKeyword,
-					[keyword](RE::Actor* actor, RE::TESNPC* npc) -> float {
-						return AcquireWornKeywordValue(actor, npc, keyword);
-					}
-				};
-				m_loaded = true;
-				return true;
-			} else if (auto keyword = ParseSymbolAsKeyword(editorID); (std::to_underlying(a_aliasType) & std::to_underlying(Alias::Type::kNPCKeyword)) && keyword) {
-				//m_keyword_symbols[alias] = keyword;
-				m_aliases[alias] = {
-					alias,
-					editorID,
-					Alias::Type::kNPCKeyword,
-					[keyword](RE::Actor* actor, RE::TESNPC* npc) -> float {
-						return AcquireNPCKeywordValue(actor, npc, keyword);
-					}
-				};
-				m_loaded = true;
-				return true;
-			} else if (std::to_underlying(a_aliasType) & std::to_underlying(Alias::Type::kMorph)) {
-				//m_morph_symbols[alias] = editorID;
-				m_aliases[alias] = {
-					alias,
-					editorID,
-					Alias::Type::kMorph,
-					[editorID](RE::Actor* actor, RE::TESNPC* npc) -> float {
-						return AcquireMorphValue(actor, npc, editorID);
-					}
-				};
-				m_loaded = true;
-				return true;
+			if (auto input = m_provider->Resolve(editorID, a_aliasType); input) {
+				return _add_alias(alias, *input, defaultTo);
 			}
 
 			m_symbol_table.remove_variable(alias.data());
-			m_value_snapshot.erase(alias);
+			m_default_values.erase(alias);
 			if (std::to_underlying(a_aliasType) & std::to_underlying(Alias::Type::kActorValue)) {
 				last_error = std::format("Cannot parse as ActorValue: Alias: '{}' EditorID: '{}'", alias, editorID);
 			} else if (std::to_underlying(a_aliasType) & std::to_underlying(Alias::Type::kNPCKeyword) || 
@@ -327,6 +552,7 @@ namespace daf
 
 			Rule rule(this, a_isSetter);
 			rule.target_morph_name = target_morph_name;
+			rule.index = m_num_rule_slots;
 			if (!rule.Parse(a_exprStr, m_symbol_table)) {
 				last_error = rule.GetCompilerError();
 				//logger::error(last_error.c_str());
@@ -337,18 +563,29 @@ namespace daf
 				//logger::error(last_error.c_str());
 				return false;
 			}
+			++m_num_rule_slots;
 
-			if (!m_rules.contains(target_morph_name)) {
-				m_rules[target_morph_name] = std::vector<Rule>{ rule };
+			auto [id_it, is_new_morph] = m_morph_ids.try_emplace(target_morph_name, static_cast<MorphID>(m_rules.size()));
+			rule.target_morph = id_it->second;
+			if (is_new_morph) {
+				m_morph_names.emplace_back(target_morph_name);
+				m_rules.emplace_back(std::vector<Rule>{ rule });
 			} else if (a_behavior == CollisionBehavior::kOverwrite) {
-				m_rules[target_morph_name].clear();
-				m_rules[target_morph_name].emplace_back(rule);
-			} else if (!m_rules[target_morph_name].empty()) {
-				if (m_rules[target_morph_name].back().is_setter) {
-					m_rules[target_morph_name].clear();
-					m_rules[target_morph_name].emplace_back(rule);
+				m_rules[rule.target_morph].clear();
+				m_rules[rule.target_morph].emplace_back(rule);
+			} else if (!m_rules[rule.target_morph].empty()) {
+				if (m_rules[rule.target_morph].back().is_setter) {
+					m_rules[rule.target_morph].clear();
+					m_rules[rule.target_morph].emplace_back(rule);
+				}
+				m_rules[rule.target_morph].emplace_back(rule);
+			}
+
+			for (auto alias : rule.external_symbols) {
+				auto& dependents = m_symbol_dependents[alias->id];
+				if (std::find(dependents.begin(), dependents.end(), rule.target_morph) == dependents.end()) {
+					dependents.emplace_back(rule.target_morph);
 				}
-				m_rules[target_morph_name].emplace_back(rule);
 			}
 
 			m_loaded = true;
@@ -363,316 +600,1625 @@ namespace daf
 			return last_error;
 		}
 
-		void Snapshot(RE::Actor* a_actor) {
-			auto npc = a_actor->GetNPC();
-			{
-				std::lock_guard<std::mutex> lock(m_snapshot_mutex);
-				for (auto& [symbol, alias] : m_aliases) {
-					m_value_snapshot[symbol] = alias.acquisition_func(a_actor, npc);
-				}
+		// Context of the calling thread, created and compiled on first use
+		EvaluationContext& GetContext() const
+		{
+			auto& context = m_contexts.local();
+			if (!context) {
+				context = std::make_unique<EvaluationContext>(*this);
+			}
+			return *context;
+		}
+
+		void Snapshot(EvaluationContext& a_context, Actor* a_actor) const
+		{
+			for (auto alias : m_symbols) {
+				a_context.values[alias->id] = _acquire(*alias, a_actor);
 			}
 		}
 
+		void Snapshot(Actor* a_actor) const
+		{
+			Snapshot(GetContext(), a_actor);
+		}
+
 		template <typename _arithmetic_t>
 		requires std::is_arithmetic_v<_arithmetic_t>
-		bool SetSymbolSnapshot(Symbol a_symbol, _arithmetic_t a_value)
+		bool SetSymbolSnapshot(EvaluationContext& a_context, Symbol a_symbol, _arithmetic_t a_value) const
 		{
-			std::lock_guard<std::mutex> lock(m_snapshot_mutex);
-			if (!m_value_snapshot.contains(a_symbol)) {
+			auto alias = FindAliasBySymbol(a_symbol);
+			if (!alias) {
 				return false;
 			}
-			m_value_snapshot[a_symbol] = static_cast<float>(a_value);
+			a_context.values[alias->id] = static_cast<float>(a_value);
 			return true;
 		}
 
-		std::unordered_map<Symbol, float> GetSnapshot()
+		// Named copy of the snapshot, for diagnostics
+		std::unordered_map<Symbol, float> GetSnapshot(const EvaluationContext& a_context) const
 		{
-			std::lock_guard<std::mutex> lock(m_snapshot_mutex);
-			return m_value_snapshot;
+			std::unordered_map<Symbol, float> snapshot;
+			for (auto alias : m_symbols) {
+				snapshot[alias->symbol] = a_context.values[alias->id];
+			}
+			return snapshot;
 		}
 
-		bool HasSymbol(Symbol a_symbol)
+		bool HasSymbol(Symbol a_symbol) const
 		{
-			std::lock_guard<std::mutex> lock(m_snapshot_mutex);
-			return m_value_snapshot.contains(a_symbol);
+			return m_default_values.contains(a_symbol);
 		}
 
-		void Evaluate(std::unordered_map<std::string_view, Result>& evaluated_values)
+		void Evaluate(EvaluationContext& a_context, ResultTable& evaluated_values) const
 		{
-			evaluated_values.clear();
-
-			std::lock_guard<std::mutex> lock(m_snapshot_mutex);
-			for (auto& [morph_name, rules] : m_rules) {
-				bool is_setter = false;
-				float value = 0.f;
-				for (auto& rule : rules) {
-					if (!rule.is_valid) {
-						continue;
-					}
-
-					if (rule.is_setter) {
-						is_setter = true;
-						value = rule.Evaluate();
-						break;
-					} else {
-						value += rule.Evaluate();
-					}
-				}
+			evaluated_values.Reset(m_rules.size());
+			EvaluateIntermediates(a_context);
 
-				if (!is_setter && value == 0.f) {
-					continue;
+			for (MorphID morph = 0; morph < m_rules.size(); ++morph) {
+				Result result;
+				if (EvaluateMorph(a_context, m_rules[morph], result)) {
+					evaluated_values.Set(morph, result);
 				}
-
-				evaluated_values[morph_name] = { is_setter, value };
 			}
 		}
 
-		bool IsLoaded() const
+		void Evaluate(ResultTable& evaluated_values) const
 		{
-			return m_loaded;
+			Evaluate(GetContext(), evaluated_values);
 		}
 
-		std::mutex m_ruleset_mutex;
-
-	private:
-		// Per actor
-		std::mutex                        m_snapshot_mutex;
-		std::unordered_map<Symbol, float> m_value_snapshot;
-
-		// Shared
-		std::unordered_map<std::string_view, std::vector<Rule>> m_rules;
-		std::unordered_map<Symbol, Alias>          m_aliases;
-
-		std::string last_error;
-		SymbolTable m_symbol_table;
-
-		bool m_loaded{ false };
+		// Reads every alias of the actor, must run where game objects are safe to read
+		void AcquireInputs(Actor* a_actor, InputSnapshot& a_inputs) const
+		{
+			const bool profiling = RuleProfiler::IsEnabled();
+			const auto start = profiling ? RuleProfiler::Clock::now() : RuleProfiler::Clock::time_point{};
 
-		std::unordered_set<std::string> m_string_pool;
+			a_inputs.resize(m_symbols.size());
+			for (auto alias : m_symbols) {
+				a_inputs[alias->id] = _acquire(*alias, a_actor);
+			}
 
-		std::string_view _get_string_view(const std::string& str)
-		{
-			auto it = m_string_pool.find(str);
-			if (it != m_string_pool.end()) {
-				return *it;
+			if (profiling) {
+				_actor_profile(m_provider->GetFormID(a_actor), [&](ActorProfile& a_profile) {
+					a_profile.acquisition.Add(RuleProfiler::ElapsedNs(start));
+				});
 			}
-			return *m_string_pool.insert(str).first;
 		}
 
-		Alias* IsMorphLoopRule_Impl(const Rule& a_rule, const std::string_view& target_morph_name) const
+		// True if the inputs differ from the ones last evaluated for this actor
+		bool HasChangedInputs(FormID a_formID, const InputSnapshot& a_inputs) const
 		{
-			auto& external_symbols = a_rule.external_symbols;
-			for (auto alias : external_symbols) {
-				if (std::to_underlying(alias->type) & std::to_underlying(Alias::Type::kMorph)) {
-					auto& morph_name = alias->editorID;
-					if (morph_name == target_morph_name) {
-						return alias;
-					} else {
-						auto it = m_rules.find(morph_name);
-						if (it != m_rules.end()) {
-							for (auto& r : it->second) {
-								if (IsMorphLoopRule_Impl(r, target_morph_name)) {
-									return alias;
-								}
-							}
-						}
-					}
-				}
+			ActorCache_T::const_accessor acc;
+			if (!m_actor_caches.find(acc, a_formID) || !acc->second.valid) {
+				return true;
 			}
-			return nullptr;
+			return acc->second.snapshot != a_inputs;
 		}
 
-		static bool IsSymbolConstant(std::string_view symbol)
+		bool EvaluateIncremental(Actor* a_actor, ResultTable& a_results, bool a_force = false) const
 		{
-			return	symbol == "pi"sv || 
-					symbol == "epsilon"sv || 
-					symbol == "inf"sv;
+			thread_local InputSnapshot inputs;  // Keeps its capacity across calls
+			AcquireInputs(a_actor, inputs);
+			return EvaluateIncremental(m_provider->GetFormID(a_actor), inputs, a_results, a_force);
 		}
 
-		static inline RE::BGSKeyword* ParseSymbolAsKeyword(std::string_view symbol)
+		// Recomputes only the morphs whose inputs changed since the previous call for the same actor.
+		// Returns false when no result changed, in which case there is nothing to commit.
+		// a_results always receives the full result table of the actor.
+		// Touches no game object, safe to call concurrently from any thread.
+		bool EvaluateIncremental(FormID a_formID, const InputSnapshot& a_inputs, ResultTable& a_results, bool a_force = false) const
 		{
-			return RE::TESObjectREFR::LookupByEditorID<RE::BGSKeyword>(symbol);
+			if (RuleProfiler::IsEnabled()) {
+				const auto start = RuleProfiler::Clock::now();
+				bool       changed = _evaluate_incremental(a_formID, a_inputs, a_results, a_force);
+				const auto elapsed = RuleProfiler::ElapsedNs(start);
+
+				_actor_profile(a_formID, [&](ActorProfile& a_profile) {
+					a_profile.evaluation.Add(elapsed);
+				});
+				return changed;
+			}
+			return _evaluate_incremental(a_formID, a_inputs, a_results, a_force);
 		}
 
-		static inline RE::ActorValueInfo* ParseSymbolAsActorValue(std::string_view symbol)
+		void DropActorCache(FormID a_formID) const
 		{
-			return RE::TESObjectREFR::LookupByEditorID<RE::ActorValueInfo>(symbol);
+			m_actor_caches.erase(a_formID);
 		}
 
-		static inline float AcquireNPCKeywordValue(RE::Actor* actor, RE::TESNPC* npc, RE::BGSKeyword* keyword)
+		// Computes the intermediates from the alias values of the context, before any rule reads them
+		void EvaluateIntermediates(EvaluationContext& a_context) const
 		{
-			if (npc->HasKeyword(keyword->formEditorID)) {
-				return 1.f;
+			auto slots = a_context.values.data() + m_symbols.size();
+			for (uint32_t i = 0; i < m_intermediates.size(); ++i) {
+				slots[i] = _evaluate_intermediate(a_context, i);
 			}
-			return 0.f;
 		}
 
-		static inline float AcquireWornKeywordValue(RE::Actor* actor, RE::TESNPC* npc, RE::BGSKeyword* keyword)
+		// Only the intermediates read by a_morphs
+		void EvaluateIntermediates(EvaluationContext& a_context, const DenseBitset& a_morphs) const
 		{
-			if (actor->WornHasKeyword(keyword)) {
-				return 1.f;
+			if (m_intermediates.empty()) {
+				return;
 			}
 
-			return 0.f;
-		}
+			auto& pending = a_context.pending_intermediates;
+			pending.Clear();
+			a_morphs.ForEachSetBit([this, &pending](uint32_t a_morph) {
+				for (auto intermediate : m_morph_intermediates[a_morph]) {
+					pending.Set(intermediate);
+				}
+			});
 
-		static inline float AcquireActorValue(RE::Actor* actor, RE::TESNPC* npc, RE::ActorValueInfo* actor_value_info)
-		{
-			return actor->GetActorValue(*actor_value_info);
+			auto slots = a_context.values.data() + m_symbols.size();
+			pending.ForEachSetBit([this, &a_context, slots](uint32_t a_intermediate) {
+				slots[a_intermediate] = _evaluate_intermediate(a_context, a_intermediate);
+			});
 		}
 
-		static inline float AcquireMorphValue(RE::Actor* actor, RE::TESNPC* npc, std::string_view morph_name)
+		// Returns false if the morph has no effect (no setter and a zero offset).
+		// The intermediates of the context must be up to date, see EvaluateIntermediates.
+		bool EvaluateMorph(const EvaluationContext& a_context, const std::vector<Rule>& a_rules, Result& a_result) const
 		{
-			if (morph_name == overweightMorphName) {
-				return npc->morphWeight.fat;
-			}
-			else if (morph_name == strongMorphName) {
-				return npc->morphWeight.muscular;
-			}
-			else if (morph_name == thinMorphName) {
-				return npc->morphWeight.thin;
-			}
-			else {
-				if (!npc->shapeBlendData) {
-					return 0.f;
+			a_result = {};
+			for (auto& rule : a_rules) {
+				if (!rule.IsActive()) {
+					continue;
 				}
 
-				auto& morph_data = *npc->shapeBlendData;
-				auto it = morph_data.find(morph_name);
-				if (it != morph_data.end()) {
-					return it->value;
+				if (rule.is_setter) {
+					a_result.is_setter = true;
+					a_result.value = _evaluate_rule(rule, a_context);
+					break;
+				} else {
+					a_result.value += _evaluate_rule(rule, a_context);
 				}
-				return 0.f;
 			}
-		}
 
-		Alias* FindSameAlias(const Alias& a_alias)
-		{
-			for (auto& [symbol, alias] : m_aliases) {
-				if (alias.is_same_as(a_alias)) {
-					return &alias;
-				}
-			}
-			return nullptr;
+			return a_result.is_setter || a_result.value != 0.f;
 		}
 
-		Alias* FindSameAlias(std::string_view a_editorID, Alias::Type a_type)
+		// Acquire the aliases of every actor into columns, must run where game objects are safe to read
+		void SnapshotBatch(std::span<Actor* const> a_actors, BatchInput& a_input) const
 		{
-			for (auto& [symbol, alias] : m_aliases) {
-				if (alias.is_same_reference(a_editorID, a_type)) {
-					return &alias;
-				}
-			}
-			return nullptr;
-		}
-	};
+			a_input.num_actors = a_actors.size();
+			a_input.values.assign(m_symbols.size() * a_actors.size(), 0.f);
 
-	class MorphRuleSetManager :
-		public utils::SingletonBase<MorphRuleSetManager>
-	{
-		friend class utils::SingletonBase<MorphRuleSetManager>;
-	public:
-		using RuleSetCollection_T = tbb::concurrent_hash_map<RE::TESRace*, std::array<std::unique_ptr<MorphEvaluationRuleSet>, 2>>;
-
-		RuleSetCollection_T m_per_race_sex_ruleset;
- 
-		MorphEvaluationRuleSet* Get(RE::TESRace* a_race, const RE::SEX a_sex)
-		{
-			RuleSetCollection_T::accessor acc;
-			if (m_per_race_sex_ruleset.find(acc, a_race)) {
-				return acc->second[static_cast<std::size_t>(a_sex)].get();
+			for (size_t i = 0; i < a_actors.size(); ++i) {
+				auto actor = a_actors[i];
+				for (auto alias : m_symbols) {
+					a_input.Column(alias->id)[i] = _acquire(*alias, actor);
+				}
 			}
-			return nullptr;
 		}
-
-		MorphEvaluationRuleSet* GetForActor(RE::Actor* a_actor)
+		// Evaluates each rule across all actors of the batch before moving to the next rule,
+		// so only the symbols used by that rule are rebound per actor
+		void EvaluateBatch(const BatchInput& a_input, BatchResult& a_result) const
 		{
-			auto npc = a_actor->GetNPC();
-			return Get(npc->formRace, npc->GetSex());
-		}
+			const size_t num_actors = a_input.num_actors;
 
-		void ClearAllRulesets()
-		{
-			m_per_race_sex_ruleset.clear();
-		}
+			a_result.num_actors = num_actors;
+			a_result.morphs = m_morph_names;
+			a_result.is_setter.assign(m_rules.size(), false);
+			a_result.values.assign(num_actors * m_rules.size(), 0.f);
 
-		void LoadRulesets(std::string a_rootFolder)
-		{
-			std::filesystem::path root_path(a_rootFolder);
-			if (!std::filesystem::exists(root_path)) {
-				logger::error("Root folder does not exist: {}", a_rootFolder);
+			auto& context = GetContext();
+			if (!m_batch_steps.empty()) {
+				_evaluate_batch_lanes(context, a_input, a_result);
 				return;
 			}
 
-			ClearAllRulesets();
+			std::vector<std::pair<float*, const float*>> bindings;
 
-			// For each subfolder in root folder, the folder name is the editorID of the race
-			for (auto& entry : std::filesystem::directory_iterator(root_path)) {
-				if (!entry.is_directory()) {
-					continue;
-				}
+			const bool has_columns = a_input.values.size() >= m_symbols.size() * num_actors;
 
-				auto folder_name = entry.path().filename().string();
+			// Columns of intermediates, computed once per actor and rebound like the aliases
+			std::vector<float> intermediate_values(m_intermediates.size() * num_actors);
+			auto intermediate_slot = [&](uint32_t a_intermediate) { return &context.values[m_symbols.size() + a_intermediate]; };
+			auto intermediate_column = [&](uint32_t a_intermediate) { return intermediate_values.data() + a_intermediate * num_actors; };
 
-				RE::TESRace* race = RE::TESObjectREFR::LookupByEditorID<RE::TESRace>(folder_name);
+			for (uint32_t k = 0; k < m_intermediates.size(); ++k) {
+				auto& intermediate = m_intermediates[k];
 
-				if (!race) {
-					logger::warn("Folder name '{}' doesn't resolve to any race editorID.", folder_name);
-					continue;
+				bindings.clear();
+				if (has_columns) {
+					for (auto symbol : intermediate.external_symbols) {
+						bindings.emplace_back(&context.values[symbol], a_input.Column(symbol));
+					}
+				}
+				for (auto nested : intermediate.intermediates) {
+					bindings.emplace_back(intermediate_slot(nested), intermediate_column(nested));
 				}
 
-				std::string           race_master_file;
-				std::filesystem::path male_entry;
-				std::filesystem::path female_entry;
+				auto column = intermediate_column(k);
+				for (size_t i = 0; i < num_actors; ++i) {
+					for (auto& [slot, source] : bindings) {
+						*slot = source[i];
+					}
+					column[i] = _evaluate_intermediate(context, k);
+				}
+			}
 
-				// For each subfolder in race folder, find "male" or "female" folder
-				for (auto& sex_entry : std::filesystem::directory_iterator(entry.path())) {
-					if (!sex_entry.is_directory()) {
-						auto master_name = sex_entry.path().filename().string();
-						if (utils::caseInsensitiveCompare(master_name, "race_master.json")) {
-							race_master_file = sex_entry.path().string();
-						}
+			for (MorphID morph_index = 0; morph_index < m_rules.size(); ++morph_index) {
+				for (auto& rule : m_rules[morph_index]) {
+					if (!rule.IsActive()) {
 						continue;
 					}
 
-					auto sex_folder_name = sex_entry.path().filename().string();
-					std::transform(sex_folder_name.begin(), sex_folder_name.end(), sex_folder_name.begin(), [](unsigned char c) { return std::tolower(c); });
+					bindings.clear();
+					if (has_columns) {
+						for (auto alias : rule.external_symbols) {
+							bindings.emplace_back(&context.values[alias->id], a_input.Column(alias->id));
+						}
+					}
+					for (auto intermediate : rule.intermediates) {
+						bindings.emplace_back(intermediate_slot(intermediate), intermediate_column(intermediate));
+					}
 
-					if (sex_folder_name == "male") {
-						male_entry = sex_entry.path();
-					} else if (sex_folder_name == "female") {
-						female_entry = sex_entry.path();
+					for (size_t i = 0; i < num_actors; ++i) {
+						for (auto& [slot, column] : bindings) {
+							*slot = column[i];
+						}
+
+						auto& value = a_result.At(i, morph_index);
+						if (rule.is_setter) {
+							value = _evaluate_rule(rule, context);
+						} else {
+							value += _evaluate_rule(rule, context);
+						}
 					}
-				}
 
-				if (!race_master_file.empty()) {
-					bool is_new;
-					auto male_ruleset = GetOrCreate(race, RE::SEX::kMale, is_new);
-					auto female_ruleset = GetOrCreate(race, RE::SEX::kFemale, is_new);
-					logger::info("Loading race master for race '{}' for males: '{}'", folder_name, race_master_file);
-					male_ruleset->ParseScript(race_master_file, true);
-					logger::info("Loading race master for race '{}' for females: '{}'", folder_name, race_master_file);
-					female_ruleset->ParseScript(race_master_file, true);
-				} else {
-					logger::warn("No race master ruleset found for race '{}'", folder_name);
+					if (rule.is_setter) {
+						a_result.is_setter[morph_index] = true;
+						break;
+					}
+				}
+			}
+		}
+
+		// Rule-set-level pass, run once loaded: folds constants, prunes adders that are always zero and hoists
+		// subexpressions repeated across rules into intermediates evaluated once per snapshot, see optimizer::Optimize.
+		// Rules keep expr_str as written for reports, contexts compile compiled_str. The cache holds the output of this
+		// pass and the bytecode, so rule sets loaded from it skip it.
+		void Optimize()
+		{
+			m_contexts.clear();
+			m_actor_caches.clear();
+			m_intermediates.clear();
+
+			std::vector<Rule*>                 rules;
+			std::vector<optimizer::RuleSource> sources;
+			for (auto& morph_rules : m_rules) {
+				for (auto& rule : morph_rules) {
+					rule.compiled_str.clear();
+					rule.intermediates.clear();
+					rule.is_pruned = false;
+					if (rule.is_valid) {
+						rules.push_back(&rule);
+						sources.push_back({ rule.expr_str, rule.is_setter });
+					}
+				}
+			}
+
+			// Collapsed aliases read the same value, so they are the same variable
+			auto resolve = [this](std::string_view a_symbol) -> std::optional<std::string> {
+				if (auto alias = FindAliasBySymbol(a_symbol); alias) {
+					return std::string(alias->symbol);
+				}
+				return std::nullopt;
+			};
+
+			// Symbols are case insensitive in exprtk
+			std::string prefix = "daf_cse_";
+			auto        is_taken = [&prefix](const auto& a_entry) {
+				return a_entry.first.size() >= prefix.size() && utils::caseInsensitiveCompare(std::string(a_entry.first.substr(0, prefix.size())), prefix.c_str());
+			};
+			while (std::any_of(m_default_values.begin(), m_default_values.end(), is_taken)) {
+				prefix += '_';
+			}
+
+			auto result = optimizer::Optimize(sources, resolve, prefix);
+
+			for (auto& optimized : result.intermediates) {
+				auto& intermediate = m_intermediates.emplace_back();
+				intermediate.symbol = std::move(optimized.symbol);
+				intermediate.expr_str = std::move(optimized.expr_str);
+				intermediate.intermediates = std::move(optimized.intermediates);
+				for (auto& variable : optimized.variables) {
+					if (auto alias = FindAliasBySymbol(variable); alias) {
+						intermediate.external_symbols.push_back(alias->id);
+					}
+				}
+			}
+
+			for (size_t i = 0; i < rules.size(); ++i) {
+				auto& optimized = result.rules[i];
+				if (!optimized.optimized) {
+					continue;
+				}
+				rules[i]->is_pruned = optimized.pruned;
+				rules[i]->compiled_str = std::move(optimized.expr_str);
+				rules[i]->intermediates = std::move(optimized.intermediates);
+			}
+
+			_index_dependents();
+
+			m_optimization_report = result.report;
+			if (auto& report = m_optimization_report; report.rules) {
+				logger::info("Optimized {} of {} rules: {} constants folded, {} rules pruned, {} shared subexpressions, {} -> {} operations per evaluation ({:.1f}% saved).",
+					report.optimized_rules, report.rules, report.folded_constants, report.pruned_rules, report.intermediates,
+					report.operations_before, report.operations_after, report.SavedFraction() * 100.0);
+			}
+
+			CompileProgram();
+		}
+
+		const optimizer::Report& GetOptimizationReport() const
+		{
+			return m_optimization_report;
+		}
+
+		void SetBackend(Backend a_backend)
+		{
+			m_backend = a_backend;
+		}
+
+		Backend GetBackend() const
+		{
+			return m_backend;
+		}
+
+		// With the VM backend, compiles the rules and intermediates to bytecode. The ones the VM does not support
+		// are compiled with exprtk by each context. Run by Optimize, since it compiles the rewritten rules.
+		void CompileProgram()
+		{
+			m_contexts.clear();
+			m_program = {};
+			m_batch_steps.clear();
+			m_batch_inputs.clear();
+			for (auto& intermediate : m_intermediates) {
+				intermediate.chunk = vm::Program::kNoChunk;
+			}
+			for (auto& morph_rules : m_rules) {
+				for (auto& rule : morph_rules) {
+					rule.chunk = vm::Program::kNoChunk;
+				}
+			}
+			if (m_backend != Backend::kVM) {
+				return;
+			}
+
+			std::unordered_map<std::string_view, vm::Register> intermediate_registers;
+			for (size_t i = 0; i < m_intermediates.size(); ++i) {
+				intermediate_registers[m_intermediates[i].symbol] = static_cast<vm::Register>(m_symbols.size() + i);
+			}
+
+			const auto  num_inputs = static_cast<uint32_t>(m_symbols.size() + m_intermediates.size());
+			vm::Compiler compiler(num_inputs, [this, &intermediate_registers](std::string_view a_symbol) -> std::optional<vm::Register> {
+				if (auto alias = FindAliasBySymbol(a_symbol); alias) {
+					return static_cast<vm::Register>(alias->id);
+				}
+				if (auto it = intermediate_registers.find(a_symbol); it != intermediate_registers.end()) {
+					return it->second;
+				}
+				return std::nullopt;
+			});
+
+			size_t num_compiled = 0;
+			size_t num_rules = 0;
+			for (auto& intermediate : m_intermediates) {
+				intermediate.chunk = compiler.Add(intermediate.expr_str);
+				if (intermediate.chunk == vm::Program::kNoChunk) {
+					_load_message(false, std::format("Intermediate '{}' not supported by the VM, evaluated by exprtk: {}", intermediate.symbol, intermediate.expr_str));
+				}
+			}
+			for (MorphID morph = 0; morph < m_rules.size(); ++morph) {
+				for (auto& rule : m_rules[morph]) {
+					if (!rule.IsActive()) {
+						continue;
+					}
+					rule.chunk = compiler.Add(rule.GetCompiledString());
+					num_rules += 1;
+					if (rule.chunk != vm::Program::kNoChunk) {
+						num_compiled += 1;
+					} else {
+						_load_message(false, std::format("Rule for '{}' not supported by the VM, evaluated by exprtk: {}", m_morph_names[morph], rule.expr_str));
+					}
+				}
+			}
+
+			auto program = num_inputs <= std::numeric_limits<vm::Register>::max() ? compiler.Finish() : std::nullopt;
+			if (!program) {
+				logger::error("Ruleset needs more registers than the VM addresses, using exprtk.");
+				m_backend = Backend::kExprtk;
+				CompileProgram();
+				return;
+			}
+			m_program = std::move(*program);
+			_plan_batches();
+
+			logger::info("Compiled {} of {} rules to bytecode: {} instructions, {} registers, {} bytes.",
+				num_compiled, num_rules, m_program.GetNumInstructions(), m_program.GetNumRegisters(), m_program.GetMemoryUsage());
+		}
+
+		bool IsLoaded() const
+		{
+			return m_loaded;
+		}
+
+		size_t GetNumMorphs() const
+		{
+			return m_rules.size();
+		}
+
+		size_t GetNumSymbols() const
+		{
+			return m_symbols.size();
+		}
+
+		std::string_view GetMorphName(MorphID a_morph) const
+		{
+			return m_morph_names[a_morph];
+		}
+
+		// Writes the validated and optimized rule set: aliases with resolved form IDs, intermediates, rules with their
+		// symbol IDs and rewritten text, the bytecode and load messages
+		void Serialize(cache::BinaryWriter& a_writer) const
+		{
+			a_writer.Write<uint32_t>(static_cast<uint32_t>(m_symbols.size()));
+			for (auto alias : m_symbols) {
+				a_writer.Write(alias->symbol);
+				a_writer.Write(alias->editorID);
+				a_writer.Write(alias->type);
+				a_writer.Write(alias->input.formID);
+				a_writer.Write(alias->default_value);
+				a_writer.Write<uint32_t>(static_cast<uint32_t>(alias->equivalent_symbols.size()));
+				for (auto equivalent : alias->equivalent_symbols) {
+					a_writer.Write(equivalent);
+				}
+			}
+
+			a_writer.Write<uint32_t>(static_cast<uint32_t>(m_intermediates.size()));
+			for (auto& intermediate : m_intermediates) {
+				a_writer.Write(std::string_view(intermediate.symbol));
+				a_writer.Write(std::string_view(intermediate.expr_str));
+				a_writer.Write<uint32_t>(static_cast<uint32_t>(intermediate.external_symbols.size()));
+				for (auto symbol : intermediate.external_symbols) {
+					a_writer.Write(symbol);
+				}
+				a_writer.Write<uint32_t>(static_cast<uint32_t>(intermediate.intermediates.size()));
+				for (auto nested : intermediate.intermediates) {
+					a_writer.Write(nested);
+				}
+				a_writer.Write(intermediate.chunk);
+			}
+
+			a_writer.Write<uint32_t>(static_cast<uint32_t>(m_rules.size()));
+			for (MorphID morph = 0; morph < m_rules.size(); ++morph) {
+				a_writer.Write(m_morph_names[morph]);
+				a_writer.Write<uint32_t>(static_cast<uint32_t>(m_rules[morph].size()));
+				for (auto& rule : m_rules[morph]) {
+					a_writer.Write(std::string_view(rule.expr_str));
+					a_writer.Write<uint64_t>(rule.index);
+					a_writer.Write(rule.is_setter);
+					a_writer.Write(rule.is_valid);
+					a_writer.Write<uint32_t>(static_cast<uint32_t>(rule.external_symbols.size()));
+					for (auto alias : rule.external_symbols) {
+						a_writer.Write(alias->id);
+					}
+					a_writer.Write<uint32_t>(static_cast<uint32_t>(rule.internal_symbols.size()));
+					for (auto& internal : rule.internal_symbols) {
+						a_writer.Write(std::string_view(internal));
+					}
+					a_writer.Write(std::string_view(rule.compiled_str));
+					a_writer.Write(rule.is_pruned);
+					a_writer.Write<uint32_t>(static_cast<uint32_t>(rule.intermediates.size()));
+					for (auto intermediate : rule.intermediates) {
+						a_writer.Write(intermediate);
+					}
+					a_writer.Write(rule.chunk);
+				}
+			}
+
+			a_writer.Write<uint64_t>(m_num_rule_slots);
+			a_writer.Write(m_loaded);
+			a_writer.Write(m_backend);
+
+			a_writer.Write<uint64_t>(m_optimization_report.rules);
+			a_writer.Write<uint64_t>(m_optimization_report.optimized_rules);
+			a_writer.Write<uint64_t>(m_optimization_report.folded_constants);
+			a_writer.Write<uint64_t>(m_optimization_report.pruned_rules);
+			a_writer.Write<uint64_t>(m_optimization_report.intermediates);
+			a_writer.Write<uint64_t>(m_optimization_report.operations_before);
+			a_writer.Write<uint64_t>(m_optimization_report.operations_after);
+			m_program.Serialize(a_writer);
+
+			a_writer.Write<uint32_t>(static_cast<uint32_t>(m_load_messages.size()));
+			for (auto& [is_error, message] : m_load_messages) {
+				a_writer.Write(is_error);
+				a_writer.Write(std::string_view(message));
+			}
+		}
+
+		// Restores a rule set written by Serialize without parsing, form lookups by editorID, Optimize or CompileProgram.
+		// Returns false and leaves the rule set cleared if the data is corrupted or a form no longer resolves.
+		bool Deserialize(cache::BinaryReader& a_reader)
+		{
+			Clear();
+			if (!_deserialize(a_reader)) {
+				Clear();
+				return false;
+			}
+
+			for (auto& [is_error, message] : m_load_messages) {
+				if (is_error) {
+					logger::error("{}", message);
+				} else {
+					logger::warn("{}", message);
+				}
+			}
+			_resize_profile();
+			return true;
+		}
+
+		// Zeroes every profile counter, safe to run concurrently with evaluation. The per actor profiles can't be
+		// erased while evaluations insert, so they are swapped for an empty map and the previous one is retired.
+		void ResetProfile()
+		{
+			for (size_t i = 0; i < m_num_rule_counters; ++i) {
+				m_rule_counters[i].Reset();
+			}
+			for (auto& counter : m_acquisition_counters) {
+				counter.Reset();
+			}
+			auto previous = m_actor_profiles.exchange(new ActorProfile_T(), std::memory_order_acq_rel);
+			m_profile_reclaimer.Retire(std::unique_ptr<ActorProfile_T>(previous));
+		}
+
+		// Appends the profile of every rule, alias type and actor, labelled with a_label
+		void CollectProfile(std::string_view a_label, std::vector<RuleProfiler::Row>& a_rows) const
+		{
+			for (MorphID morph = 0; morph < m_rules.size(); ++morph) {
+				for (auto& rule : m_rules[morph]) {
+					if (rule.index >= m_num_rule_counters) {
+						continue;
+					}
+					auto& counter = m_rule_counters[rule.index];
+					if (!counter.count) {
+						continue;
+					}
+					a_rows.push_back({ std::string(a_label), "rule", std::string(m_morph_names[morph]),
+						std::format("{} {}", rule.is_setter ? "setter" : "adder", rule.expr_str), counter.count, counter.total_ns, counter.max_ns });
+				}
+			}
+
+			constexpr std::array<std::string_view, 4> type_names{ "ActorValue", "WornKeyword", "NPCKeyword", "Morph" };
+			for (size_t i = 0; i < m_acquisition_counters.size(); ++i) {
+				auto& counter = m_acquisition_counters[i];
+				if (!counter.count) {
+					continue;
+				}
+				a_rows.push_back({ std::string(a_label), "acquisition", std::string(type_names[i]), "", counter.count, counter.total_ns, counter.max_ns });
+			}
+
+			auto guard = m_profile_reclaimer.Enter();
+			for (auto& [formID, profile] : *m_actor_profiles.load(std::memory_order_acquire)) {
+				const uint64_t acquisition_ns = profile.acquisition.total_ns;
+				const uint64_t evaluation_ns = profile.evaluation.total_ns;
+				a_rows.push_back({ std::string(a_label), "actor", std::format("{:08X}", formID),
+					std::format("acquisition {:.1f} us, evaluation {:.1f} us", acquisition_ns / 1000.0, evaluation_ns / 1000.0),
+					profile.evaluation.count, acquisition_ns + evaluation_ns, profile.evaluation.max_ns });
+			}
+		}
+
+	private:
+		// Per thread
+		mutable tbb::enumerable_thread_specific<std::unique_ptr<EvaluationContext>> m_contexts;
+
+		// Previous snapshot and results of each actor, for incremental evaluation
+		struct ActorCache
+		{
+			InputSnapshot snapshot;
+			ResultTable   results;
+			DenseBitset   pending_morphs;  // Scratch, morphs reading a changed symbol
+			bool          valid{ false };
+		};
+		using ActorCache_T = tbb::concurrent_hash_map<FormID, ActorCache>;
+
+		mutable ActorCache_T m_actor_caches;
+
+		// Profiling, only written while RuleProfiler is enabled
+		struct ActorProfile
+		{
+			RuleProfiler::Counter acquisition;
+			RuleProfiler::Counter evaluation;
+		};
+		// Inserts and traversal may run concurrently, erasing may not
+		using ActorProfile_T = tbb::concurrent_unordered_map<FormID, ActorProfile>;
+
+		std::unique_ptr<RuleProfiler::Counter[]>     m_rule_counters;         // Indexed by Rule::index, sized only while loading
+		size_t                                       m_num_rule_counters{ 0 };
+		mutable std::array<RuleProfiler::Counter, 4> m_acquisition_counters;  // Indexed by the bit of Alias::Type
+		std::atomic<ActorProfile_T*>                 m_actor_profiles{ new ActorProfile_T() };  // Swapped by ResetProfile
+		mutable EpochReclaimer<ActorProfile_T>       m_profile_reclaimer;
+
+		// Shared
+		std::vector<std::vector<Rule>>                m_rules;        // Indexed by MorphID
+		std::vector<std::string_view>                 m_morph_names;  // Indexed by MorphID
+		std::unordered_map<std::string_view, MorphID> m_morph_ids;    // Only used while loading
+		std::unordered_map<Symbol, Alias>             m_aliases;      // Node-based, m_symbols points into it
+		std::vector<Alias*>                           m_symbols;      // Indexed by SymbolID
+
+		// SymbolID -> target morphs of the rules reading it
+		std::vector<std::vector<MorphID>> m_symbol_dependents;
+
+		std::vector<Intermediate>          m_intermediates;        // See Optimize
+		std::vector<std::vector<uint32_t>> m_morph_intermediates;  // MorphID -> intermediates it reads, ascending
+		optimizer::Report                  m_optimization_report;
+
+		Backend     m_backend{ Backend::kExprtk };
+		vm::Program m_program;  // See CompileProgram
+
+		std::vector<BatchStep>    m_batch_steps;   // See _plan_batches
+		std::vector<vm::Register> m_batch_inputs;  // Indexed by BatchStep::first_input
+
+		std::string                               last_error;
+		std::vector<std::pair<bool, std::string>> m_load_messages;  // Errors (true) and warnings of ParseScript, replayed when loaded from cache
+		SymbolTable                               m_symbol_table;   // Bound to m_default_values, only used to validate rules while loading
+
+		std::unordered_map<Symbol, float> m_default_values;
+		size_t                            m_num_rule_slots{ 0 };
+
+		bool m_loaded{ false };
+
+		ActorDataProvider* m_provider{ nullptr };
+
+		std::unordered_set<std::string> m_string_pool;
+
+		// Sizes the per rule counters to the rules loaded. Evaluations index them without a lock, so only loading may.
+		void _resize_profile()
+		{
+			if (m_num_rule_counters != m_num_rule_slots) {
+				m_rule_counters = std::make_unique<RuleProfiler::Counter[]>(m_num_rule_slots);
+				m_num_rule_counters = m_num_rule_slots;
+			}
+			ResetProfile();
+		}
+
+		// Runs a_func on the profile of the actor, in the map current at the time even if ResetProfile swaps it meanwhile
+		template <class F>
+		void _actor_profile(FormID a_formID, F&& a_func) const
+		{
+			auto guard = m_profile_reclaimer.Enter();
+			a_func((*m_actor_profiles.load(std::memory_order_acquire))[a_formID]);
+		}
+
+		float _evaluate_rule(const Rule& a_rule, const EvaluationContext& a_context) const
+		{
+			if (!RuleProfiler::IsEnabled() || a_rule.index >= m_num_rule_counters) {
+				return a_rule.Evaluate(a_context);
+			}
+			const auto start = RuleProfiler::Clock::now();
+			float      value = a_rule.Evaluate(a_context);
+			m_rule_counters[a_rule.index].Add(RuleProfiler::ElapsedNs(start));
+			return value;
+		}
+
+		float _evaluate_intermediate(const EvaluationContext& a_context, uint32_t a_intermediate) const
+		{
+			if (auto chunk = m_intermediates[a_intermediate].chunk; chunk != vm::Program::kNoChunk) {
+				return m_program.Run(chunk, a_context.values.data());
+			}
+			return a_context.intermediate_expressions[a_intermediate].value();
+		}
+
+		// Flattens the intermediates and active rules into the steps batch evaluation runs, in order, so batches
+		// don't walk the Rule objects for every group of lanes. Steps without bytecode keep the registers their
+		// exprtk expression reads. Only with the VM backend and something compiled, else lanes gain nothing.
+		void _plan_batches()
+		{
+			m_batch_steps.clear();
+			m_batch_inputs.clear();
+			if (m_backend != Backend::kVM) {
+				return;
+			}
+
+			// a_symbolID maps the elements of a_symbols, SymbolIDs of intermediates or aliases of rules
+			auto add_inputs = [this](BatchStep& a_step, const auto& a_symbols, auto&& a_symbolID, const std::vector<uint32_t>& a_intermediates) {
+				if (a_step.chunk != vm::Program::kNoChunk) {
+					return;
+				}
+				a_step.first_input = static_cast<uint32_t>(m_batch_inputs.size());
+				for (auto& symbol : a_symbols) {
+					m_batch_inputs.push_back(static_cast<vm::Register>(a_symbolID(symbol)));
+				}
+				for (auto intermediate : a_intermediates) {
+					m_batch_inputs.push_back(static_cast<vm::Register>(m_symbols.size() + intermediate));
+				}
+				a_step.num_inputs = static_cast<uint32_t>(m_batch_inputs.size()) - a_step.first_input;
+			};
+
+			for (uint32_t k = 0; k < m_intermediates.size(); ++k) {
+				auto& step = m_batch_steps.emplace_back(BatchStep{ .chunk = m_intermediates[k].chunk, .target = k, .is_intermediate = true });
+				add_inputs(step, m_intermediates[k].external_symbols, [](SymbolID a_symbol) { return a_symbol; }, m_intermediates[k].intermediates);
+			}
+			for (MorphID morph = 0; morph < m_rules.size(); ++morph) {
+				const size_t first = m_batch_steps.size();
+				for (auto& rule : m_rules[morph]) {
+					if (!rule.IsActive()) {
+						continue;
+					}
+					auto& step = m_batch_steps.emplace_back(BatchStep{ .chunk = rule.chunk, .target = morph, .expression = rule.index,
+						.is_setter = rule.is_setter, .is_first = m_batch_steps.size() == first });
+					add_inputs(step, rule.external_symbols, [](const Alias* a_alias) { return a_alias->id; }, rule.intermediates);
+					if (rule.is_setter) {
+						break;
+					}
+				}
+				if (m_batch_steps.size() != first) {
+					m_batch_steps.back().is_last = true;
+				}
+			}
+
+			if (std::none_of(m_batch_steps.begin(), m_batch_steps.end(), [](const BatchStep& a_step) { return a_step.chunk != vm::Program::kNoChunk; })) {
+				m_batch_steps.clear();
+				m_batch_inputs.clear();
+			}
+		}
+
+		// Batch evaluation with the VM: vm::kLanes actors per pass through the program. Steps without bytecode rebind
+		// their inputs and run their exprtk expression once per lane. The rules of a morph are summed in registers,
+		// each row of the result is written once per morph.
+		void _evaluate_batch_lanes(EvaluationContext& a_context, const BatchInput& a_input, BatchResult& a_result) const
+		{
+			const size_t num_actors = a_input.num_actors;
+			const size_t num_morphs = m_rules.size();
+			const bool   has_columns = a_input.values.size() >= m_symbols.size() * num_actors;
+
+			for (auto& step : m_batch_steps) {
+				if (step.is_setter) {
+					a_result.is_setter[step.target] = true;
+				}
+			}
+
+			auto lanes = a_context.lanes.data();
+			if (!has_columns) {
+				for (SymbolID symbol = 0; symbol < m_symbols.size(); ++symbol) {
+					std::fill(std::begin(lanes[symbol].v), std::end(lanes[symbol].v), a_context.values[symbol]);
+				}
+			}
+
+			vm::Lanes sum;
+			vm::Lanes fallback;
+			for (size_t first = 0; first < num_actors; first += vm::kLanes) {
+				const size_t count = std::min(vm::kLanes, num_actors - first);
+
+				// The unused lanes of the last group repeat its last actor
+				for (SymbolID symbol = 0; has_columns && symbol < m_symbols.size(); ++symbol) {
+					auto column = a_input.Column(symbol) + first;
+					for (size_t lane = 0; lane < vm::kLanes; ++lane) {
+						lanes[symbol].v[lane] = column[std::min(lane, count - 1)];
+					}
+				}
+
+				auto row = a_result.Row(first);
+				for (auto& step : m_batch_steps) {
+					const vm::Lanes* result = &fallback;
+					if (step.chunk != vm::Program::kNoChunk) {
+						m_program.Run(step.chunk, lanes);
+						result = &lanes[m_program.GetChunk(step.chunk).result];
+					} else {
+						_evaluate_exprtk_lanes(a_context, step, count, fallback);
+					}
+					if (step.is_intermediate) {
+						lanes[m_symbols.size() + step.target] = *result;
+						continue;
+					}
+
+					if (step.is_first || step.is_setter) {
+						sum = *result;
+					} else {
+						for (size_t lane = 0; lane < vm::kLanes; ++lane) {
+							sum.v[lane] += result->v[lane];
+						}
+					}
+					if (step.is_last) {
+						for (size_t lane = 0; lane < count; ++lane) {
+							row[lane * num_morphs + step.target] = sum.v[lane];
+						}
+					}
+				}
+			}
+		}
+
+		// Runs the exprtk expression of a_step for the first a_count lanes, the others repeat the last one like their inputs
+		void _evaluate_exprtk_lanes(EvaluationContext& a_context, const BatchStep& a_step, size_t a_count, vm::Lanes& a_result) const
+		{
+			auto  lanes = a_context.lanes.data();
+			auto  inputs = std::span(m_batch_inputs).subspan(a_step.first_input, a_step.num_inputs);
+			auto& expression = a_step.is_intermediate ? a_context.intermediate_expressions[a_step.target] : a_context.expressions[a_step.expression];
+			for (size_t lane = 0; lane < a_count; ++lane) {
+				for (auto input : inputs) {
+					a_context.values[input] = lanes[input].v[lane];
+				}
+				a_result.v[lane] = expression.value();
+			}
+			std::fill(std::begin(a_result.v) + a_count, std::end(a_result.v), a_result.v[a_count - 1]);
+		}
+
+		float _acquire(const Alias& a_alias, Actor* a_actor) const
+		{
+			if (!RuleProfiler::IsEnabled() || a_alias.type == Alias::Type::kNone) {
+				return m_provider->Acquire(a_actor, a_alias.input);
+			}
+			const auto start = RuleProfiler::Clock::now();
+			float      value = m_provider->Acquire(a_actor, a_alias.input);
+			m_acquisition_counters[std::countr_zero(std::to_underlying(a_alias.type))].Add(RuleProfiler::ElapsedNs(start));
+			return value;
+		}
+
+		bool _evaluate_incremental(FormID a_formID, const InputSnapshot& a_inputs, ResultTable& a_results, bool a_force) const
+		{
+			ActorCache_T::accessor acc;
+			m_actor_caches.insert(acc, a_formID);
+			auto& cache = acc->second;
+
+			bool full = a_force || !cache.valid || cache.snapshot.size() != a_inputs.size();
+
+			auto& pending = cache.pending_morphs;
+			pending.Clear();
+			if (full) {
+				cache.snapshot = a_inputs;
+				cache.results.Reset(m_rules.size());
+			} else {
+				for (SymbolID symbol = 0; symbol < a_inputs.size(); ++symbol) {
+					if (cache.snapshot[symbol] == a_inputs[symbol]) {
+						continue;
+					}
+					cache.snapshot[symbol] = a_inputs[symbol];
+					for (auto morph : m_symbol_dependents[symbol]) {
+						pending.Set(morph);
+					}
+				}
+
+				if (!pending.Any()) {
+					cache.results.dirty.Clear();
+					a_results = cache.results;
+					return false;
+				}
+			}
+
+			auto& context = GetContext();
+			std::copy(cache.snapshot.begin(), cache.snapshot.end(), context.values.begin());
+			if (full) {
+				EvaluateIntermediates(context);
+			} else {
+				EvaluateIntermediates(context, pending);
+			}
+
+			bool changed = false;
+			cache.results.dirty.Clear();
+			auto evaluate_morph = [&](MorphID a_morph) {
+				Result result;
+				bool   has_result = EvaluateMorph(context, m_rules[a_morph], result);
+				bool   had_result = cache.results.Contains(a_morph);
+				if (!has_result && !had_result) {
+					return;
+				}
+				if (!has_result) {
+					cache.results.Erase(a_morph);
+				} else if (!had_result || cache.results.Get(a_morph) != result) {
+					cache.results.Set(a_morph, result);
+				} else {
+					return;
+				}
+				cache.results.dirty.Set(a_morph);
+				changed = true;
+			};
+
+			if (full) {
+				for (MorphID morph = 0; morph < m_rules.size(); ++morph) {
+					evaluate_morph(morph);
+				}
+			} else {
+				pending.ForEachSetBit(evaluate_morph);
+			}
+
+			cache.valid = true;
+			a_results = cache.results;
+			return changed || a_force;
+		}
+
+		bool _add_alias(Symbol a_symbol, const InputReference& a_input, float a_default)
+		{
+			auto& alias = m_aliases[a_symbol];
+			alias = { a_symbol, a_input };
+			alias.id = static_cast<SymbolID>(m_symbols.size());
+			alias.default_value = a_default;
+			m_symbols.emplace_back(&alias);
+			m_symbol_dependents.emplace_back();
+			m_loaded = true;
+			return true;
+		}
+
+		// Symbols and intermediates each morph reads through its active rules, pruned rules no longer count
+		void _index_dependents()
+		{
+			m_symbol_dependents.assign(m_symbols.size(), {});
+			m_morph_intermediates.assign(m_rules.size(), {});
+			for (MorphID morph = 0; morph < m_rules.size(); ++morph) {
+				auto& intermediates = m_morph_intermediates[morph];
+				for (auto& rule : m_rules[morph]) {
+					if (!rule.IsActive()) {
+						continue;
+					}
+					for (auto alias : rule.external_symbols) {
+						auto& dependents = m_symbol_dependents[alias->id];
+						if (std::find(dependents.begin(), dependents.end(), morph) == dependents.end()) {
+							dependents.emplace_back(morph);
+						}
+					}
+					intermediates.insert(intermediates.end(), rule.intermediates.begin(), rule.intermediates.end());
+				}
+
+				// Every intermediate the morph reads directly or through other intermediates, in evaluation order
+				std::sort(intermediates.begin(), intermediates.end());
+				intermediates.erase(std::unique(intermediates.begin(), intermediates.end()), intermediates.end());
+				for (size_t i = 0; i < intermediates.size(); ++i) {
+					for (auto nested : m_intermediates[intermediates[i]].intermediates) {
+						if (std::find(intermediates.begin(), intermediates.end(), nested) == intermediates.end()) {
+							intermediates.push_back(nested);
+						}
+					}
+				}
+				std::sort(intermediates.begin(), intermediates.end());
+			}
+		}
+
+		bool _deserialize(cache::BinaryReader& a_reader)
+		{
+			std::string str;
+			auto read_string_view = [this, &a_reader, &str](std::string_view& a_out) {
+				if (!a_reader.Read(str)) {
+					return false;
+				}
+				a_out = _get_string_view(str);
+				return true;
+			};
+
+			auto num_symbols = a_reader.Get<uint32_t>();
+			for (uint32_t i = 0; i < num_symbols && a_reader.Good(); ++i) {
+				Symbol           symbol;
+				std::string_view editorID;
+				Alias::Type      type{ Alias::Type::kNone };
+				FormID           formID{ 0 };
+				float            default_value{ 0.f };
+				if (!read_string_view(symbol) || !read_string_view(editorID) || !a_reader.Read(type) || !a_reader.Read(formID) || !a_reader.Read(default_value)) {
+					return false;
+				}
+
+				auto input = m_provider->Restore(editorID, type, formID);
+				if (!input) {
+					logger::warn("Cached Alias '{}' no longer resolves to '{}' ({:X}).", symbol, editorID, formID);
+					return false;
+				}
+
+				m_default_values[symbol] = default_value;
+				m_symbol_table.add_variable(symbol.data(), m_default_values[symbol]);
+				_add_alias(symbol, *input, default_value);
+
+				auto num_equivalents = a_reader.Get<uint32_t>();
+				for (uint32_t j = 0; j < num_equivalents && a_reader.Good(); ++j) {
+					Symbol equivalent;
+					if (!read_string_view(equivalent)) {
+						return false;
+					}
+					m_aliases[symbol].equivalent_symbols.emplace_back(equivalent);
+					m_symbol_table.add_variable(equivalent.data(), m_default_values[symbol]);
+				}
+			}
+
+			auto num_intermediates = a_reader.Get<uint32_t>();
+			for (uint32_t i = 0; i < num_intermediates && a_reader.Good(); ++i) {
+				auto& intermediate = m_intermediates.emplace_back();
+				if (!a_reader.Read(intermediate.symbol) || !a_reader.Read(intermediate.expr_str)) {
+					return false;
+				}
+				auto num_external = a_reader.Get<uint32_t>();
+				for (uint32_t k = 0; k < num_external && a_reader.Good(); ++k) {
+					auto symbol = a_reader.Get<SymbolID>();
+					if (symbol >= m_symbols.size()) {
+						return false;
+					}
+					intermediate.external_symbols.push_back(symbol);
+				}
+				auto num_nested = a_reader.Get<uint32_t>();
+				for (uint32_t k = 0; k < num_nested && a_reader.Good(); ++k) {
+					auto nested = a_reader.Get<uint32_t>();
+					if (nested >= i) {
+						return false;
+					}
+					intermediate.intermediates.push_back(nested);
+				}
+				a_reader.Read(intermediate.chunk);
+			}
+
+			auto num_morphs = a_reader.Get<uint32_t>();
+			for (MorphID morph = 0; morph < num_morphs && a_reader.Good(); ++morph) {
+				std::string_view morph_name;
+				if (!read_string_view(morph_name)) {
+					return false;
+				}
+				m_morph_names.emplace_back(morph_name);
+				m_morph_ids[morph_name] = morph;
+
+				auto& rules = m_rules.emplace_back();
+				auto  num_rules = a_reader.Get<uint32_t>();
+				for (uint32_t j = 0; j < num_rules && a_reader.Good(); ++j) {
+					Rule rule(this, false);
+					rule.target_morph_name = morph_name;
+					rule.target_morph = morph;
+					if (!a_reader.Read(rule.expr_str)) {
+						return false;
+					}
+					rule.index = static_cast<size_t>(a_reader.Get<uint64_t>());
+					a_reader.Read(rule.is_setter);
+					a_reader.Read(rule.is_valid);
+
+					auto num_external = a_reader.Get<uint32_t>();
+					for (uint32_t k = 0; k < num_external && a_reader.Good(); ++k) {
+						auto symbol = a_reader.Get<SymbolID>();
+						if (symbol >= m_symbols.size()) {
+							return false;
+						}
+						rule.external_symbols.emplace_back(m_symbols[symbol]);
+					}
+
+					auto num_internal = a_reader.Get<uint32_t>();
+					for (uint32_t k = 0; k < num_internal && a_reader.Good(); ++k) {
+						if (!a_reader.Read(rule.internal_symbols.emplace_back())) {
+							return false;
+						}
+					}
+
+					if (!a_reader.Read(rule.compiled_str)) {
+						return false;
+					}
+					a_reader.Read(rule.is_pruned);
+					auto num_intermediates = a_reader.Get<uint32_t>();
+					for (uint32_t k = 0; k < num_intermediates && a_reader.Good(); ++k) {
+						auto intermediate = a_reader.Get<uint32_t>();
+						if (intermediate >= m_intermediates.size()) {
+							return false;
+						}
+						rule.intermediates.push_back(intermediate);
+					}
+					a_reader.Read(rule.chunk);
+					rules.emplace_back(std::move(rule));
+				}
+			}
+
+			m_num_rule_slots = static_cast<size_t>(a_reader.Get<uint64_t>());
+			a_reader.Read(m_loaded);
+			a_reader.Read(m_backend);
+
+			m_optimization_report.rules = static_cast<size_t>(a_reader.Get<uint64_t>());
+			m_optimization_report.optimized_rules = static_cast<size_t>(a_reader.Get<uint64_t>());
+			m_optimization_report.folded_constants = static_cast<size_t>(a_reader.Get<uint64_t>());
+			m_optimization_report.pruned_rules = static_cast<size_t>(a_reader.Get<uint64_t>());
+			m_optimization_report.intermediates = static_cast<size_t>(a_reader.Get<uint64_t>());
+			m_optimization_report.operations_before = static_cast<size_t>(a_reader.Get<uint64_t>());
+			m_optimization_report.operations_after = static_cast<size_t>(a_reader.Get<uint64_t>());
+
+			// Chunks index the program, whose inputs are the symbols then the intermediates
+			if (!m_program.Deserialize(a_reader)) {
+				return false;
+			}
+			const auto is_chunk = [this](uint32_t a_chunk) { return a_chunk == vm::Program::kNoChunk || a_chunk < m_program.GetNumChunks(); };
+			if (m_backend == Backend::kVM && m_program.GetNumInputs() != m_symbols.size() + m_intermediates.size()) {
+				return false;
+			}
+			for (auto& intermediate : m_intermediates) {
+				if (!is_chunk(intermediate.chunk)) {
+					return false;
+				}
+			}
+			for (auto& morph_rules : m_rules) {
+				for (auto& rule : morph_rules) {
+					if (!is_chunk(rule.chunk)) {
+						return false;
+					}
+				}
+			}
+			_index_dependents();
+			_plan_batches();
+
+			auto num_messages = a_reader.Get<uint32_t>();
+			for (uint32_t i = 0; i < num_messages && a_reader.Good(); ++i) {
+				auto& [is_error, message] = m_load_messages.emplace_back();
+				if (!a_reader.Read(is_error) || !a_reader.Read(message)) {
+					return false;
+				}
+			}
+
+			return a_reader.Good();
+		}
+
+		void _load_message(bool a_isError, std::string a_message)
+		{
+			if (a_isError) {
+				logger::error("{}", a_message);
+			} else {
+				logger::warn("{}", a_message);
+			}
+			m_load_messages.emplace_back(a_isError, std::move(a_message));
+		}
+
+		std::string_view _get_string_view(const std::string& str)
+		{
+			auto it = m_string_pool.find(str);
+			if (it != m_string_pool.end()) {
+				return *it;
+			}
+			return *m_string_pool.insert(str).first;
+		}
+
+		Alias* IsMorphLoopRule_Impl(const Rule& a_rule, const std::string_view& target_morph_name) const
+		{
+			auto& external_symbols = a_rule.external_symbols;
+			for (auto alias : external_symbols) {
+				if (std::to_underlying(alias->type) & std::to_underlying(Alias::Type::kMorph)) {
+					auto& morph_name = alias->editorID;
+					if (morph_name == target_morph_name) {
+						return alias;
+					} else {
+						auto it = m_morph_ids.find(morph_name);
+						if (it != m_morph_ids.end()) {
+							for (auto& r : m_rules[it->second]) {
+								if (IsMorphLoopRule_Impl(r, target_morph_name)) {
+									return alias;
+								}
+							}
+						}
+					}
+				}
+			}
+			return nullptr;
+		}
+
+		static bool IsSymbolConstant(std::string_view symbol)
+		{
+			return	symbol == "pi"sv || 
+					symbol == "epsilon"sv || 
+					symbol == "inf"sv;
+		}
+
+		// Resolves collapsed aliases to the alias that owns the snapshot value
+		const Alias* FindAliasBySymbol(std::string_view a_symbol) const
+		{
+			return const_cast<MorphEvaluationRuleSet*>(this)->FindAliasBySymbol(a_symbol);
+		}
+
+		Alias* FindAliasBySymbol(std::string_view a_symbol)
+		{
+			if (auto it = m_aliases.find(a_symbol); it != m_aliases.end()) {
+				return &it->second;
+			}
+			for (auto& [symbol, alias] : m_aliases) {
+				if (std::find(alias.equivalent_symbols.begin(), alias.equivalent_symbols.end(), a_symbol) != alias.equivalent_symbols.end()) {
+					return &alias;
+				}
+			}
+			return nullptr;
+		}
+
+		Alias* FindSameAlias(const Alias& a_alias)
+		{
+			for (auto& [symbol, alias] : m_aliases) {
+				if (alias.is_same_as(a_alias)) {
+					return &alias;
+				}
+			}
+			return nullptr;
+		}
+
+		Alias* FindSameAlias(std::string_view a_editorID, Alias::Type a_type)
+		{
+			for (auto& [symbol, alias] : m_aliases) {
+				if (alias.is_same_reference(a_editorID, a_type)) {
+					return &alias;
+				}
+			}
+			return nullptr;
+		}
+	};
+
+#ifndef DAF_HEADLESS
+	// Dispatched by MorphRuleSetManager once reloaded rule sets are published
+	class RuleSetReloadedEvent : public events::EventBase
+	{
+	public:
+		std::vector<std::pair<RE::TESRace*, RE::SEX>> rulesets;  // Replaced, added or removed
+	};
+
+	class MorphRuleSetManager :
+		public utils::SingletonBase<MorphRuleSetManager>,
+		public events::EventDispatcher<RuleSetReloadedEvent>
+	{
+		friend class utils::SingletonBase<MorphRuleSetManager>;
+	public:
+		// Rule set pointers returned by Get/GetForActor stay valid while a Guard from PinRulesets is held,
+		// rule sets replaced by a reload are only deleted after every guard that could see them is released
+		using Guard = EpochReclaimer<MorphEvaluationRuleSet>::Guard;
+
+		enum class LoadMode : uint8_t
+		{
+			kImmediate,  // Load every race/sex rule set in parallel
+			kLazy        // Only index the folders, load each rule set the first time it is requested
+		};
+
+		struct RuleSetScript
+		{
+			std::string                               file;
+			bool                                      clear_existing{ false };
+			MorphEvaluationRuleSet::CollisionBehavior behavior{ MorphEvaluationRuleSet::CollisionBehavior::kOverwrite };
+		};
+
+		// Everything needed to load the rule set of a race/sex
+		struct RuleSetSource
+		{
+			RE::TESRace*               race{ nullptr };
+			RE::SEX                    sex{ RE::SEX::kMale };
+			std::vector<RuleSetScript> scripts;
+			std::filesystem::path      cache_file;
+			uint64_t                   load_order_hash{ 0 };
+		};
+
+		using RuleSetCollection_T = tbb::concurrent_hash_map<RE::TESRace*, std::array<std::unique_ptr<MorphEvaluationRuleSet>, 2>>;
+		using PendingCollection_T = tbb::concurrent_hash_map<RE::TESRace*, std::array<std::unique_ptr<RuleSetSource>, 2>>;
+
+		RuleSetCollection_T m_per_race_sex_ruleset;
+		PendingCollection_T m_pending_rulesets;  // Lazy mode, indexed but not loaded yet
+ 
+		// A static singleton, joining or waiting here deadlocks on DLL unload: run Shutdown before. The watcher is only
+		// told to stop and detached, like the logger's sink thread, and the task groups are leaked rather than destroyed
+		// with tasks that may still be in flight.
+		virtual ~MorphRuleSetManager()
+		{
+			if (m_watcher.joinable()) {
+				m_watcher.request_stop();  // Wakes its wait on m_watcher_cv
+				m_watcher.detach();
+			}
+			(void)m_prewarm_tasks.release();
+			(void)m_reload_tasks.release();
+		}
+
+		// Stops watching and waits for the loads and reloads in flight, before unload
+		void Shutdown()
+		{
+			StopWatching();
+			m_prewarm_tasks->wait();
+			m_reload_tasks->wait();
+		}
+
+		Guard PinRulesets()
+		{
+			return m_reclaimer.Enter();
+		}
+
+		// Deletes replaced rule sets no guard can reference anymore. Runs with the reloads rather than on the caller,
+		// destroying whole rule sets is too slow for the game thread.
+		void CollectRetired()
+		{
+			m_reload_tasks->run([this]() { m_reclaimer.Collect(); });
+		}
+
+		// a_loadPending loads the rule set now if it is still pending in lazy mode
+		MorphEvaluationRuleSet* Get(RE::TESRace* a_race, const RE::SEX a_sex, bool a_loadPending = true)
+		{
+			{
+				RuleSetCollection_T::const_accessor acc;
+				if (m_per_race_sex_ruleset.find(acc, a_race) && acc->second[static_cast<std::size_t>(a_sex)]) {
+					return acc->second[static_cast<std::size_t>(a_sex)].get();
+				}
+			}
+			return a_loadPending ? LoadPending(a_race, a_sex) : nullptr;
+		}
+
+		MorphEvaluationRuleSet* GetForActor(RE::Actor* a_actor, bool a_loadPending = true)
+		{
+			auto npc = a_actor->GetNPC();
+			return Get(npc->formRace, npc->GetSex(), a_loadPending);
+		}
+
+		// Waits for the reloads and prewarming in flight, so none publishes a rule set once cleared
+		void ClearAllRulesets()
+		{
+			m_prewarm_tasks->wait();
+			m_reload_tasks->wait();
+			std::lock_guard lock(m_reload_lock);
+			_clear_all_rulesets();
+		}
+
+		// Loads the pending rule sets of the player's race in the background, so the first reevaluation doesn't stall
+		void PrewarmPlayerRace()
+		{
+			auto player = RE::PlayerCharacter::GetSingleton();
+			auto npc = player ? player->GetNPC() : nullptr;
+			if (!npc || !npc->formRace) {
+				return;
+			}
+
+			auto race = npc->formRace;
+			m_prewarm_tasks->run([this, race]() {
+				LoadPending(race, RE::SEX::kMale);
+				LoadPending(race, RE::SEX::kFemale);
+			});
+		}
+
+		// Profiling of every loaded rule set, see RuleProfiler. Meant to back a console command.
+		void SetProfilingEnabled(bool a_enabled)
+		{
+			RuleProfiler::SetEnabled(a_enabled);
+		}
+
+		// Safe while evaluations and reloads run
+		void ResetProfiles()
+		{
+			_for_each_ruleset([](RE::TESRace*, RE::SEX, MorphEvaluationRuleSet& a_ruleset) {
+				a_ruleset.ResetProfile();
+			});
+		}
+
+		// Rows of every rule set, hottest first
+		std::vector<RuleProfiler::Row> CollectProfiles() const
+		{
+			std::vector<RuleProfiler::Row> rows;
+			_for_each_ruleset([&](RE::TESRace* a_race, RE::SEX a_sex, MorphEvaluationRuleSet& a_ruleset) {
+				a_ruleset.CollectProfile(std::format("{}/{}", a_race->GetFormEditorID(), a_sex == RE::SEX::kFemale ? "female" : "male"), rows);
+			});
+			RuleProfiler::Sort(rows);
+			return rows;
+		}
+
+		void LogProfileReport(size_t a_maxRowsPerKind = 20) const
+		{
+			RuleProfiler::LogReport(CollectProfiles(), a_maxRowsPerKind);
+		}
+
+		bool ExportProfileCSV(const std::filesystem::path& a_path) const
+		{
+			return RuleProfiler::WriteCSV(CollectProfiles(), a_path);
+		}
+
+		// Evaluation work saved by MorphEvaluationRuleSet::Optimize, per rule set and in total
+		void LogOptimizationReport() const
+		{
+			optimizer::Report total;
+			_for_each_ruleset([&](RE::TESRace* a_race, RE::SEX a_sex, MorphEvaluationRuleSet& a_ruleset) {
+				auto& report = a_ruleset.GetOptimizationReport();
+				logger::info("  [{}/{}] {} of {} rules optimized, {} folded, {} pruned, {} shared, {} -> {} operations ({:.1f}% saved)",
+					a_race->GetFormEditorID(), a_sex == RE::SEX::kFemale ? "female" : "male", report.optimized_rules, report.rules, report.folded_constants,
+					report.pruned_rules, report.intermediates, report.operations_before, report.operations_after, report.SavedFraction() * 100.0);
+				total += report;
+			});
+			logger::info("Rule optimization: {} -> {} operations per evaluation of every rule set ({:.1f}% saved).",
+				total.operations_before, total.operations_after, total.SavedFraction() * 100.0);
+		}
+
+		// Rule sets are restored from <root>/.cache when neither their scripts nor the plugin load order changed
+		void LoadRulesets(std::string a_rootFolder, LoadMode a_mode = LoadMode::kImmediate)
+		{
+			std::filesystem::path root_path(a_rootFolder);
+			if (!std::filesystem::exists(root_path)) {
+				logger::error("Root folder does not exist: {}", a_rootFolder);
+				return;
+			}
+
+			auto sources = CollectSources(root_path);
+
+			// Cleared and switched to the new root at once, a reload requested in between loads the new root
+			m_prewarm_tasks->wait();
+			m_reload_tasks->wait();
+			{
+				std::lock_guard lock(m_reload_lock);
+				_clear_all_rulesets();
+				m_root_folder = root_path;
+				for (auto& source : sources) {
+					m_loaded_keys.emplace_back(source.race, source.sex);
+				}
+			}
+
+			if (a_mode == LoadMode::kLazy) {
+				for (auto& source : sources) {
+					PendingCollection_T::accessor acc;
+					m_pending_rulesets.insert(acc, source.race);
+					acc->second[static_cast<std::size_t>(source.sex)] = std::make_unique<RuleSetSource>(std::move(source));
+				}
+				logger::info("Indexed {} rulesets for lazy loading.", sources.size());
+				PrewarmPlayerRace();
+				return;
+			}
+
+			// Rule sets of different race/sex pairs share no state
+			tbb::parallel_for_each(sources.begin(), sources.end(), [this](const RuleSetSource& a_source) {
+				LoadRaceSexRuleset(a_source);
+			});
+		}
+
+		// Recompiles every rule set of the last loaded root folder on a background thread, then swaps them in.
+		// Evaluations never wait: they keep using the rule set they fetched until their guard is released.
+		// Reload requests made while one is running are coalesced into a single follow-up reload.
+		void ReloadRulesets()
+		{
+			if (m_reload_requested.exchange(true)) {
+				return;
+			}
+			m_reload_tasks->run([this]() {
+				while (m_reload_requested.exchange(false)) {
+					_reload_rulesets();
+				}
+			});
+		}
+
+		// Polls the root folder and reloads when a script is added, removed or modified
+		void StartWatching(std::chrono::milliseconds a_interval = std::chrono::milliseconds(1000))
+		{
+			StopWatching();
+			m_watcher = std::jthread([this, a_interval](std::stop_token a_stop) {
+				std::optional<uint64_t> last_seen;
+				std::optional<uint64_t> last_loaded;
+				while (!a_stop.stop_requested()) {
+					auto fingerprint = FingerprintRootFolder();
+					if (!last_loaded) {
+						last_loaded = fingerprint;
+					} else if (fingerprint != last_loaded && fingerprint == last_seen) {
+						// Stable for one interval, editors may write a file in several steps
+						logger::info("Ruleset scripts changed, reloading.");
+						last_loaded = fingerprint;
+						ReloadRulesets();
+					}
+					last_seen = fingerprint;
+
+					std::unique_lock lock(m_watcher_lock);
+					m_watcher_cv.wait_for(lock, a_stop, a_interval, [] { return false; });
+				}
+			});
+		}
+
+		void StopWatching()
+		{
+			if (m_watcher.joinable()) {
+				m_watcher.request_stop();
+				m_watcher.join();
+			}
+		}
+
+		// Blocks until the reloads requested so far are published
+		void WaitForReload()
+		{
+			m_reload_tasks->wait();
+		}
+
+	private:
+		MorphRuleSetManager() = default;
+
+		std::unique_ptr<tbb::task_group> m_prewarm_tasks{ std::make_unique<tbb::task_group>() };  // Heap allocated, task_group can throw on destruction
+		std::unique_ptr<tbb::task_group> m_reload_tasks{ std::make_unique<tbb::task_group>() };
+		std::atomic<bool>                m_reload_requested{ false };
+
+		mutable EpochReclaimer<MorphEvaluationRuleSet> m_reclaimer;
+
+		mutable std::mutex        m_published_lock;
+		std::vector<RE::TESRace*> m_published_races;  // Keys of m_per_race_sex_ruleset, never erased
+
+		std::mutex                                    m_reload_lock;  // Serializes reloads, guards the members below
+		std::filesystem::path                         m_root_folder;
+		std::vector<std::pair<RE::TESRace*, RE::SEX>> m_loaded_keys;  // Rule sets of the last load, to find removed ones
+
+		std::jthread                m_watcher;
+		std::mutex                  m_watcher_lock;
+		std::condition_variable_any m_watcher_cv;  // Wakes the watcher early on stop
+
+		// One source per race/sex folder pair found under a_rootPath
+		std::vector<RuleSetSource> CollectSources(const std::filesystem::path& a_rootPath)
+		{
+			const auto cache_folder = a_rootPath / ".cache";
+			const auto load_order_hash = GetLoadOrderFingerprint();
+
+			std::vector<RuleSetSource> sources;
+
+			// For each subfolder in root folder, the folder name is the editorID of the race
+			for (auto& entry : std::filesystem::directory_iterator(a_rootPath)) {
+				if (!entry.is_directory() || entry.path() == cache_folder) {
+					continue;
+				}
+
+				auto folder_name = entry.path().filename().string();
+
+				RE::TESRace* race = RE::TESObjectREFR::LookupByEditorID<RE::TESRace>(folder_name);
+
+				if (!race) {
+					logger::warn("Folder name '{}' doesn't resolve to any race editorID.", folder_name);
+					continue;
+				}
+
+				std::string           race_master_file;
+				std::filesystem::path male_entry;
+				std::filesystem::path female_entry;
+
+				// For each subfolder in race folder, find "male" or "female" folder
+				for (auto& sex_entry : std::filesystem::directory_iterator(entry.path())) {
+					if (!sex_entry.is_directory()) {
+						auto master_name = sex_entry.path().filename().string();
+						if (utils::caseInsensitiveCompare(master_name, "race_master.json")) {
+							race_master_file = sex_entry.path().string();
+						}
+						continue;
+					}
+
+					auto sex_folder_name = sex_entry.path().filename().string();
+					std::transform(sex_folder_name.begin(), sex_folder_name.end(), sex_folder_name.begin(), [](unsigned char c) { return std::tolower(c); });
+
+					if (sex_folder_name == "male") {
+						male_entry = sex_entry.path();
+					} else if (sex_folder_name == "female") {
+						female_entry = sex_entry.path();
+					}
+				}
+
+				std::vector<RuleSetScript> male_scripts;
+				std::vector<RuleSetScript> female_scripts;
+
+				if (!race_master_file.empty()) {
+					male_scripts.push_back({ race_master_file, true, MorphEvaluationRuleSet::CollisionBehavior::kOverwrite });
+					female_scripts.push_back({ race_master_file, true, MorphEvaluationRuleSet::CollisionBehavior::kOverwrite });
+				} else {
+					logger::warn("No race master ruleset found for race '{}'", folder_name);
 				}
 
 				if (!male_entry.empty()) {
-					LoadRaceSexRulesets(male_entry, race, RE::SEX::kMale);
+					CollectRaceSexScripts(male_entry, race_master_file.empty(), male_scripts);
 				} else {
 					logger::warn("No male folder found for race '{}'", folder_name);
 				}
 
 				if (!female_entry.empty()) {
-					LoadRaceSexRulesets(female_entry, race, RE::SEX::kFemale);
+					CollectRaceSexScripts(female_entry, race_master_file.empty(), female_scripts);
 				} else {
 					logger::warn("No female folder found for race '{}'", folder_name);
 				}
+
+				if (!male_scripts.empty()) {
+					sources.push_back({ race, RE::SEX::kMale, std::move(male_scripts), cache_folder / (folder_name + "_male.bin"), load_order_hash });
+				}
+				if (!female_scripts.empty()) {
+					sources.push_back({ race, RE::SEX::kFemale, std::move(female_scripts), cache_folder / (folder_name + "_female.bin"), load_order_hash });
+				}
+			}
+
+			return sources;
+		}
+
+
+		// Lazy mode. The write accessor on the pending entry makes concurrent requests for the same race wait for a single load.
+		MorphEvaluationRuleSet* LoadPending(RE::TESRace* a_race, RE::SEX a_sex)
+		{
+			PendingCollection_T::accessor acc;
+			if (!m_pending_rulesets.find(acc, a_race)) {
+				return nullptr;
+			}
+
+			auto& source = acc->second[static_cast<std::size_t>(a_sex)];
+			if (source) {
+				LoadRaceSexRuleset(*source);
+				source.reset();
 			}
+			return Get(a_race, a_sex, false);
 		}
 
 		// Loading order is always: master.json -> alphabetical order of other files
-		bool LoadRaceSexRulesets(std::filesystem::path a_sexFolder, RE::TESRace* a_race, RE::SEX a_sex)
+		bool CollectRaceSexScripts(std::filesystem::path a_sexFolder, bool a_clearExisting, std::vector<RuleSetScript>& a_scripts)
 		{
 			std::vector<std::string> ruleset_files;
 			std::string              master_file;
@@ -695,47 +2241,229 @@ namespace daf
 				return false;
 			}
 
-			bool is_new{ false };
-			logger::info("Loading master ruleset in: '{}'", master_file);
-			GetOrCreate(a_race, a_sex, is_new)->ParseScript(master_file, is_new);
-
+			a_scripts.push_back({ master_file, a_clearExisting, MorphEvaluationRuleSet::CollisionBehavior::kOverwrite });
 			for (auto& ruleset_file : ruleset_files) {
-				bool is_new{ false };
-				logger::info("Loading ruleset in: '{}'", ruleset_file);
-				GetOrCreate(a_race, a_sex, is_new)->ParseScript(ruleset_file, false, MorphEvaluationRuleSet::CollisionBehavior::kAppend);
+				a_scripts.push_back({ ruleset_file, false, MorphEvaluationRuleSet::CollisionBehavior::kAppend });
 			}
 
 			return true;
 		}
 
-	private:
-		MorphRuleSetManager() = default;
+		// The rule set is only published once fully loaded, so Get never returns a rule set being parsed
+		void LoadRaceSexRuleset(const RuleSetSource& a_source)
+		{
+			auto ruleset = std::make_unique<MorphEvaluationRuleSet>();
+			_load_race_sex_ruleset(*ruleset, a_source);
+			Publish(a_source.race, a_source.sex, std::move(ruleset));
+		}
+
+		// Replaces the rule set of a race/sex, the previous one is retired rather than deleted
+		void Publish(RE::TESRace* a_race, RE::SEX a_sex, std::unique_ptr<MorphEvaluationRuleSet> a_ruleset)
+		{
+			std::unique_ptr<MorphEvaluationRuleSet> previous;
+			{
+				RuleSetCollection_T::accessor acc;
+				if (m_per_race_sex_ruleset.insert(acc, a_race)) {
+					std::lock_guard lock(m_published_lock);
+					m_published_races.push_back(a_race);
+				}
+				previous = std::exchange(acc->second[static_cast<std::size_t>(a_sex)], std::move(a_ruleset));
+			}
+			m_reclaimer.Retire(std::move(previous));
+		}
+
+		// Calls a_func with every published rule set, pinned. Reloads and lazy loads may publish meanwhile, so the
+		// collection is never iterated: each race is looked up through an accessor.
+		template <class F>
+		void _for_each_ruleset(F&& a_func) const
+		{
+			std::vector<RE::TESRace*> races;
+			{
+				std::lock_guard lock(m_published_lock);
+				races = m_published_races;
+			}
+
+			auto guard = m_reclaimer.Enter();
+			for (auto race : races) {
+				std::array<MorphEvaluationRuleSet*, 2> rulesets{};
+				{
+					RuleSetCollection_T::const_accessor acc;
+					if (!m_per_race_sex_ruleset.find(acc, race)) {
+						continue;
+					}
+					rulesets = { acc->second[0].get(), acc->second[1].get() };
+				}
+				for (size_t sex = 0; sex < rulesets.size(); ++sex) {
+					if (rulesets[sex]) {
+						a_func(race, static_cast<RE::SEX>(sex), *rulesets[sex]);
+					}
+				}
+			}
+		}
+
+		// Retires the rule sets of the last load through accessors, as Get and lazy loads may run concurrently.
+		// A lazy load in progress holds the pending accessor, so it publishes before its rule set is retired.
+		// Requires m_reload_lock.
+		void _clear_all_rulesets()
+		{
+			for (auto& [race, sex] : m_loaded_keys) {
+				{
+					PendingCollection_T::accessor pending;
+					if (m_pending_rulesets.find(pending, race)) {
+						pending->second[static_cast<std::size_t>(sex)].reset();
+					}
+				}
+				Publish(race, sex, nullptr);
+			}
+			m_loaded_keys.clear();
+		}
 
-		// Always returns a valid ruleset, existing or new
-		MorphEvaluationRuleSet* GetOrCreate(RE::TESRace* a_race, const RE::SEX a_sex, bool& is_new)
+		void _reload_rulesets()
 		{
-			size_t sex_id = static_cast<std::size_t>(a_sex);
-			is_new = false;
+			std::lock_guard lock(m_reload_lock);
+			if (m_root_folder.empty() || !std::filesystem::exists(m_root_folder)) {
+				return;
+			}
 
-			RuleSetCollection_T::accessor acc;
-			if (m_per_race_sex_ruleset.find(acc, a_race)) {
-				if (!acc->second[sex_id]) {
-					acc->second[sex_id].reset(new MorphEvaluationRuleSet());
-					is_new = true;
+			auto sources = CollectSources(m_root_folder);
+
+			// Compiled off to the side, published only once all of them are ready
+			std::vector<std::unique_ptr<MorphEvaluationRuleSet>> rulesets(sources.size());
+			tbb::parallel_for(size_t(0), sources.size(), [&](size_t i) {
+				rulesets[i] = std::make_unique<MorphEvaluationRuleSet>();
+				_load_race_sex_ruleset(*rulesets[i], sources[i]);
+			});
+
+			RuleSetReloadedEvent event;
+			for (size_t i = 0; i < sources.size(); ++i) {
+				auto& source = sources[i];
+
+				// A lazy load of the same race/sex waits on this accessor, and finds nothing left to load
+				PendingCollection_T::accessor pending;
+				if (m_pending_rulesets.find(pending, source.race)) {
+					pending->second[static_cast<std::size_t>(source.sex)].reset();
+				}
+				Publish(source.race, source.sex, std::move(rulesets[i]));
+				event.rulesets.emplace_back(source.race, source.sex);
+			}
+
+			for (auto& [race, sex] : m_loaded_keys) {
+				if (std::find(event.rulesets.begin(), event.rulesets.end(), std::pair{ race, sex }) != event.rulesets.end()) {
+					continue;
+				}
+				PendingCollection_T::accessor pending;
+				if (m_pending_rulesets.find(pending, race)) {
+					pending->second[static_cast<std::size_t>(sex)].reset();
 				}
+				Publish(race, sex, nullptr);
+				event.rulesets.emplace_back(race, sex);
+			}
+			m_loaded_keys.assign(event.rulesets.begin(), event.rulesets.begin() + sources.size());
 
-				return acc->second[sex_id].get();
+			logger::info("Reloaded {} rulesets.", sources.size());
+			Dispatch(std::move(event));
+		}
 
-			} else {
-				m_per_race_sex_ruleset.insert(acc,
-					std::make_pair(a_race,
-						std::array < std::unique_ptr<MorphEvaluationRuleSet>, 2>{
-							nullptr,
-							nullptr }));
-				acc->second[sex_id].reset(new MorphEvaluationRuleSet());
-				is_new = true;
-				return acc->second[sex_id].get();
+		// Paths, sizes and modification times of every script under the root folder
+		uint64_t FingerprintRootFolder()
+		{
+			std::filesystem::path root;
+			{
+				std::lock_guard lock(m_reload_lock);
+				root = m_root_folder;
+			}
+
+			cache::Hasher   hasher;
+			std::error_code ec;
+			for (auto it = std::filesystem::recursive_directory_iterator(root, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+				if (it->path().filename() == ".cache") {
+					it.disable_recursion_pending();
+					continue;
+				}
+				if (!it->is_regular_file(ec) || it->path().extension() != ".json") {
+					continue;
+				}
+				hasher.Update(std::string_view(it->path().string()));
+				hasher.Update<uint64_t>(it->file_size(ec));
+				hasher.Update<int64_t>(it->last_write_time(ec).time_since_epoch().count());
+			}
+			return hasher.Digest();
+		}
+
+		// A cache hit restores the rule set optimized and compiled. A miss parses the scripts, runs Optimize, with
+		// its verification of every rewritten rule, then caches the result.
+		void _load_race_sex_ruleset(MorphEvaluationRuleSet& a_ruleset, const RuleSetSource& a_source)
+		{
+			auto& cache_file = a_source.cache_file;
+
+			auto content_hash = HashScripts(a_source.scripts);
+			cache::Key key{ content_hash.value_or(0), a_source.load_order_hash };
+
+			if (std::ifstream file(cache_file, std::ios::binary); content_hash && file.is_open()) {
+				cache::BinaryReader reader(file);
+				if (cache::ReadHeader(reader, key) && a_ruleset.Deserialize(reader)) {
+					logger::info("Loaded cached ruleset: '{}'", cache_file.string());
+					return;
+				}
+			}
+
+			for (auto& script : a_source.scripts) {
+				logger::info("Loading ruleset in: '{}'", script.file);
+				a_ruleset.ParseScript(script.file, script.clear_existing, script.behavior);
+			}
+			a_ruleset.Optimize();
+
+			// An unreadable script would be cached as missing
+			if (!content_hash) {
+				return;
+			}
+
+			std::error_code ec;
+			std::filesystem::create_directories(cache_file.parent_path(), ec);
+			std::ofstream file(cache_file, std::ios::binary | std::ios::trunc);
+			if (!file.is_open()) {
+				logger::warn("Failed to write ruleset cache: '{}'", cache_file.string());
+				return;
+			}
+
+			cache::BinaryWriter writer(file);
+			cache::WriteHeader(writer, key);
+			a_ruleset.Serialize(writer);
+		}
+
+		// Covers the content, order and loading options of every script of a rule set
+		static std::optional<uint64_t> HashScripts(const std::vector<RuleSetScript>& a_scripts)
+		{
+			cache::Hasher hasher;
+			for (auto& script : a_scripts) {
+				std::ifstream file(script.file, std::ios::binary);
+				if (!file.is_open()) {
+					return std::nullopt;
+				}
+				std::string content{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+				hasher.Update(std::string_view(script.file));
+				hasher.Update(script.clear_existing);
+				hasher.Update(script.behavior);
+				hasher.Update(std::string_view(content));
+			}
+			return hasher.Digest();
+		}
+
+		// Form IDs stored in the caches are only valid for the same plugins in the same order
+		static uint64_t GetLoadOrderFingerprint()
+		{
+			cache::Hasher hasher;
+			if (auto data_handler = RE::TESDataHandler::GetSingleton(); data_handler) {
+				for (auto file : data_handler->compiledFileCollection.files) {
+					hasher.Update(file->GetFilename());
+				}
+				for (auto file : data_handler->compiledFileCollection.smallFiles) {
+					hasher.Update(file->GetFilename());
+				}
 			}
+			return hasher.Digest();
 		}
 	};
-}
\ No newline at end of file
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,353 @@
+#pragma once
+#include "Singleton.h"
+#include "MorphNameTable.h"
+#include "MorphWriter.h"
+
+namespace daf
+{
+	// The morphs of one NPC by NameID of the general offset table, with the names written since the last full sync
+	class ActorMorphMirror
+	{
+	public:
+		using NameID = MorphNameTable::NameID;
+
+		static constexpr size_t JournalSize = 64;
+
+		float Get(NameID a_name) const
+		{
+			return a_name < m_values.size() ? m_values[a_name] : 0.f;
+		}
+
+		uint64_t GetVersion() const
+		{
+			return m_version;
+		}
+
+		// Brings a reader at a_version up to date: a_set for each name written since, or a_reset then a_set
+		// for every morph if the journal no longer covers a_version. 0 is never a valid version.
+		template <class _Reset, class _Set>
+		void CatchUp(uint64_t& a_version, _Reset&& a_reset, _Set&& a_set) const
+		{
+			if (a_version == m_version) {
+				return;
+			}
+
+			if (a_version && a_version >= m_resync_version && m_version - a_version <= JournalSize) {
+				for (auto version = a_version + 1; version <= m_version; ++version) {
+					auto name = m_journal[version % JournalSize];
+					a_set(name, m_values[name]);
+				}
+			} else {
+				a_reset();
+				for (auto name : m_present) {
+					a_set(name, m_values[name]);
+				}
+			}
+			a_version = m_version;
+		}
+
+	private:
+		friend class MorphMirror;
+
+		// Order independent, so a walk of the NPC's hash map and the incremental updates of _set agree
+		static uint64_t _term(uint64_t a_key, float a_value)
+		{
+			uint64_t x = a_key * 0x9E3779B97F4A7C15ull + std::bit_cast<uint32_t>(a_value);
+			x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+			x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+			return x ^ (x >> 31);
+		}
+
+		void _set(NameID a_name, uint64_t a_key, float a_value)
+		{
+			if (a_name >= m_values.size()) {
+				m_values.resize(a_name + 1, 0.f);
+				m_keys.resize(a_name + 1, 0);
+			}
+
+			if (m_keys[a_name]) {
+				m_checksum -= _term(m_keys[a_name], m_values[a_name]);
+			} else {
+				m_present.push_back(a_name);
+			}
+			m_keys[a_name] = a_key;
+			m_values[a_name] = a_value;
+			m_checksum += _term(a_key, a_value);
+		}
+
+		// _set, then journaled as the next version
+		void _record(NameID a_name, uint64_t a_key, float a_value)
+		{
+			_set(a_name, a_key, a_value);
+			m_journal[++m_version % JournalSize] = a_name;
+		}
+
+		void _clear()
+		{
+			for (auto name : m_present) {
+				m_keys[name] = 0;
+				m_values[name] = 0.f;
+			}
+			m_present.clear();
+			m_checksum = 0;
+		}
+
+		RE::TESNPC*                     m_npc{ nullptr };
+		std::vector<float>              m_values;   // By NameID, 0 if absent
+		std::vector<uint64_t>           m_keys;     // Identity of the NPC's key by NameID, 0 if absent
+		std::vector<NameID>             m_present;  // Names the NPC has, the three weights always
+		uint64_t                        m_checksum{ 0 };
+		const void*                     m_blend_data{ nullptr };  // shapeBlendData of the NPC and its size as last seen
+		size_t                          m_blend_count{ 0 };
+		uint64_t                        m_version{ 0 };
+		uint64_t                        m_resync_version{ 0 };  // The journal only covers the versions after it
+		std::array<NameID, JournalSize> m_journal{};            // Name written at each version, by version % JournalSize
+	};
+
+	// Dense copies of the morphs of NPCs, kept current by routing morph writes through Write, and told about the
+	// plugin's other writes (UI sliders, presets, deferred appearances) by chargen::MorphWriter. Anything else writing
+	// to an NPC's morphs is detected by Sync in constant time when it adds or removes a shape blend or changes a
+	// weight, and answered with a full resync. Replacing the value of a shape blend the NPC already has is only
+	// detected by a verifying Sync, which walks the NPC's morphs once: for the chargen menu actor and forced
+	// reevaluations.
+	class MorphMirror :
+		public utils::SingletonBase<MorphMirror>,
+		public events::EventDispatcher<chargen::MorphsWrittenEvent>::Listener
+	{
+		friend class utils::SingletonBase<MorphMirror>;
+
+	public:
+		using NameID = MorphNameTable::NameID;
+
+		// Names of the mirror, a session over the same table can use the IDs as is
+		MorphNameTable& GetNames() const
+		{
+			return m_names;
+		}
+
+		void Register()
+		{
+			chargen::MorphWriter::GetSingleton().AddStaticListener(this);
+		}
+
+		// Checks the mirror of a_actor against its NPC and rebuilds it if anything else wrote to its morphs, in
+		// constant time unless a_verify. Must run where the NPC is safe to read.
+		bool Sync(RE::Actor* a_actor, bool a_verify = false)
+		{
+			auto npc = a_actor->GetNPC();
+			if (!npc) {
+				return false;
+			}
+
+			Mirrors_T::accessor acc;
+			m_mirrors.insert(acc, a_actor->formID);
+			auto& mirror = acc->second;
+			if (!_matches(mirror, npc) || (a_verify && _checksum(npc) != mirror.m_checksum)) {
+				_resync(mirror, npc);
+			}
+			return true;
+		}
+
+		// Writes a_morphs to the NPC of a_actor and to its mirror, must run on the game thread.
+		// a_version follows the mirror if it was current before the write, readers skip their own writes.
+		void Write(RE::Actor* a_actor, std::span<const std::pair<NameID, float>> a_morphs, uint64_t& a_version)
+		{
+			auto npc = a_actor->GetNPC();
+			if (!npc) {
+				return;
+			}
+
+			Mirrors_T::accessor acc;
+			m_mirrors.insert(acc, a_actor->formID);
+			auto& mirror = acc->second;
+			if (!_matches(mirror, npc)) {
+				_resync(mirror, npc);
+			}
+
+			const bool current = a_version == mirror.m_version;
+			for (auto& [name, value] : a_morphs) {
+				mirror._record(name, _write(npc, name, value), value);
+			}
+			_stamp(mirror, npc);
+			if (current) {
+				a_version = mirror.m_version;
+			}
+		}
+
+		// Follows the plugin's writes outside of Write. Actors without a mirror are synced when first read.
+		void OnEvent(const chargen::MorphsWrittenEvent& a_event, events::EventDispatcher<chargen::MorphsWrittenEvent>* a_dispatcher) override
+		{
+			auto npc = a_event.actor->GetNPC();
+			Mirrors_T::accessor acc;
+			if (!npc || !m_mirrors.find(acc, a_event.actor->formID)) {
+				return;
+			}
+
+			auto& mirror = acc->second;
+			if (a_event.replaced || mirror.m_npc != npc || !mirror.m_version) {
+				_resync(mirror, npc);
+				return;
+			}
+			for (auto& [morph_name, value] : a_event.morphs) {
+				auto name = m_names.Intern(morph_name);
+				mirror._record(name, _key(name, morph_name), value);
+			}
+			_stamp(mirror, npc);
+		}
+
+		// Calls a_func with the mirror of a_actor as of the last Sync or Write, synced first if a_actor has none yet.
+		// The mirror is read locked for the duration of the call.
+		template <class _Func>
+		bool Read(RE::Actor* a_actor, _Func&& a_func)
+		{
+			{
+				Mirrors_T::const_accessor acc;
+				if (m_mirrors.find(acc, a_actor->formID)) {
+					a_func(std::as_const(acc->second));
+					return true;
+				}
+			}
+			if (!Sync(a_actor)) {
+				return false;
+			}
+
+			Mirrors_T::const_accessor acc;
+			if (!m_mirrors.find(acc, a_actor->formID)) {
+				return false;
+			}
+			a_func(std::as_const(acc->second));
+			return true;
+		}
+
+		float Get(RE::Actor* a_actor, NameID a_name)
+		{
+			float value = 0.f;
+			Read(a_actor, [&](const ActorMorphMirror& a_mirror) { value = a_mirror.Get(a_name); });
+			return value;
+		}
+
+		// Brings a reader up to date with the mirror as of the last Sync or Write, synced first if a_actor has none
+		// yet, see ActorMorphMirror::CatchUp. Callers sync once per reevaluation, before reading inputs.
+		template <class _Reset, class _Set>
+		bool CatchUp(RE::Actor* a_actor, uint64_t& a_version, _Reset&& a_reset, _Set&& a_set)
+		{
+			return Read(a_actor, [&](const ActorMorphMirror& a_mirror) {
+				a_mirror.CatchUp(a_version, std::forward<_Reset>(a_reset), std::forward<_Set>(a_set));
+			});
+		}
+
+		// Frees the mirror of an actor no longer reevaluated
+		void Drop(RE::TESFormID a_formID)
+		{
+			m_mirrors.erase(a_formID);
+		}
+
+	private:
+		using Mirrors_T = tbb::concurrent_hash_map<RE::TESFormID, ActorMorphMirror>;
+
+		// Keys of the weights, no string of the game's pool lives this low
+		static constexpr uint64_t FatKey = 1;
+		static constexpr uint64_t MuscularKey = 2;
+		static constexpr uint64_t ThinKey = 3;
+
+		MorphMirror() :
+			m_names(MorphNameTable::Get(tokens::general_offset)),
+			m_fat(m_names.Intern(overweightMorphName)),
+			m_muscular(m_names.Intern(strongMorphName)),
+			m_thin(m_names.Intern(thinMorphName))
+		{}
+
+		// Game strings are pooled, the address identifies a key without hashing it
+		static uint64_t _key(const RE::BSFixedStringCS& a_name)
+		{
+			return reinterpret_cast<uint64_t>(a_name.c_str());
+		}
+
+		uint64_t _key(NameID a_name, const RE::BSFixedStringCS& a_morphName) const
+		{
+			return a_name == m_fat      ? FatKey :
+			       a_name == m_muscular ? MuscularKey :
+			       a_name == m_thin     ? ThinKey :
+			                              _key(a_morphName);
+		}
+
+		// Constant time, see the class comment for what it misses
+		bool _matches(const ActorMorphMirror& a_mirror, RE::TESNPC* a_npc) const
+		{
+			auto same = [](float a_lhs, float a_rhs) { return std::bit_cast<uint32_t>(a_lhs) == std::bit_cast<uint32_t>(a_rhs); };
+			return a_mirror.m_npc == a_npc && a_mirror.m_version &&
+			       a_mirror.m_blend_data == a_npc->shapeBlendData &&
+			       a_mirror.m_blend_count == (a_npc->shapeBlendData ? a_npc->shapeBlendData->size() : 0) &&
+			       same(a_mirror.Get(m_fat), a_npc->morphWeight.fat) &&
+			       same(a_mirror.Get(m_muscular), a_npc->morphWeight.muscular) &&
+			       same(a_mirror.Get(m_thin), a_npc->morphWeight.thin);
+		}
+
+		static void _stamp(ActorMorphMirror& a_mirror, RE::TESNPC* a_npc)
+		{
+			a_mirror.m_blend_data = a_npc->shapeBlendData;
+			a_mirror.m_blend_count = a_npc->shapeBlendData ? a_npc->shapeBlendData->size() : 0;
+		}
+
+		// Walks the NPC's morphs, only for a verifying Sync
+		static uint64_t _checksum(RE::TESNPC* a_npc)
+		{
+			uint64_t checksum = ActorMorphMirror::_term(FatKey, a_npc->morphWeight.fat) +
+			                    ActorMorphMirror::_term(MuscularKey, a_npc->morphWeight.muscular) +
+			                    ActorMorphMirror::_term(ThinKey, a_npc->morphWeight.thin);
+			if (a_npc->shapeBlendData) {
+				for (auto& [morph_name, value] : *a_npc->shapeBlendData) {
+					checksum += ActorMorphMirror::_term(_key(morph_name), value);
+				}
+			}
+			return checksum;
+		}
+
+		// The only place names are looked up by string, once per external modification
+		void _resync(ActorMorphMirror& a_mirror, RE::TESNPC* a_npc)
+		{
+			a_mirror._clear();
+			a_mirror.m_npc = a_npc;
+			a_mirror._set(m_fat, FatKey, a_npc->morphWeight.fat);
+			a_mirror._set(m_muscular, MuscularKey, a_npc->morphWeight.muscular);
+			a_mirror._set(m_thin, ThinKey, a_npc->morphWeight.thin);
+
+			if (a_npc->shapeBlendData) {
+				for (auto& [morph_name, value] : *a_npc->shapeBlendData) {
+					a_mirror._set(m_names.Intern(morph_name), _key(morph_name), value);
+				}
+			}
+			_stamp(a_mirror, a_npc);
+			a_mirror.m_resync_version = ++a_mirror.m_version;
+		}
+
+		// Returns the key of a_name
+		uint64_t _write(RE::TESNPC* a_npc, NameID a_name, float a_value)
+		{
+			if (a_name == m_fat) {
+				a_npc->morphWeight.fat = a_value;
+				return FatKey;
+			} else if (a_name == m_muscular) {
+				a_npc->morphWeight.muscular = a_value;
+				return MuscularKey;
+			} else if (a_name == m_thin) {
+				a_npc->morphWeight.thin = a_value;
+				return ThinKey;
+			}
+
+			if (!a_npc->shapeBlendData) {
+				a_npc->shapeBlendData = new RE::BSTHashMap<RE::BSFixedStringCS, float>();
+			}
+
+			RE::BSFixedStringCS morph_name(m_names.GetName(a_name));
+			(*a_npc->shapeBlendData)[morph_name] = a_value;
+			return _key(morph_name);
+		}
+
+		MorphNameTable& m_names;
+		const NameID    m_fat;
+		const NameID    m_muscular;
+		const NameID    m_thin;
+		Mirrors_T       m_mirrors;
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+namespace daf
+{
+	static constexpr std::string_view overweightMorphName{ "Overweight" };
+	static constexpr std::string_view strongMorphName{ "Strong" };
+	static constexpr std::string_view thinMorphName{ "Thin" };
+
+	namespace tokens
+	{
+		inline constexpr std::string general_offset{ "ECOffset_" };
+	}
+
+	// Dense IDs of every morph name seen with an offset prefix, shared by all sessions using that prefix.
+	// Each name is linked to its offset name (prefix + name) or, for offset names, to the morph it offsets,
+	// so sessions never concatenate or compare prefixes. Names are only allocated the first time they are seen.
+	class MorphNameTable
+	{
+	public:
+		using NameID = uint32_t;
+		static constexpr NameID InvalidName = UINT32_MAX;
+
+		explicit MorphNameTable(std::string_view a_prefix) :
+			m_prefix(a_prefix) {}
+
+		MorphNameTable(const MorphNameTable&) = delete;
+		MorphNameTable& operator=(const MorphNameTable&) = delete;
+
+		// One table per prefix, lives until exit
+		static MorphNameTable& Get(std::string_view a_prefix)
+		{
+			static std::mutex                                                                        lock;
+			static std::unordered_map<std::string, std::unique_ptr<MorphNameTable>, Hash, std::equal_to<>> tables;
+
+			std::lock_guard guard(lock);
+			if (auto it = tables.find(a_prefix); it != tables.end()) {
+				return *it->second;
+			}
+			return *tables.emplace(a_prefix, std::make_unique<MorphNameTable>(a_prefix)).first->second;
+		}
+
+		NameID Intern(std::string_view a_name)
+		{
+			{
+				std::shared_lock lock(m_lock);
+				if (auto it = m_ids.find(a_name); it != m_ids.end()) {
+					return it->second;
+				}
+			}
+			std::unique_lock lock(m_lock);
+			return _intern(a_name);
+		}
+
+		// Safe without a lock: entries never move and are complete before their ID is handed out
+		std::string_view GetName(NameID a_name) const { return m_entries[a_name].name; }
+		NameID           GetOffset(NameID a_name) const { return m_entries[a_name].offset; }
+		NameID           GetBase(NameID a_name) const { return m_entries[a_name].base; }  // InvalidName if not an offset name
+		size_t           Size() const { return m_entries.size(); }
+
+		const std::string& GetPrefix() const { return m_prefix; }
+
+	private:
+		struct Entry
+		{
+			std::string name;
+			NameID      offset{ InvalidName };
+			NameID      base{ InvalidName };
+		};
+
+		struct Hash
+		{
+			using is_transparent = void;
+			size_t operator()(std::string_view a_name) const { return std::hash<std::string_view>{}(a_name); }
+		};
+
+		// Under the unique lock, readers only see the new entries once it is released
+		NameID _intern(std::string_view a_name)
+		{
+			if (auto it = m_ids.find(a_name); it != m_ids.end()) {
+				return it->second;
+			}
+
+			auto id = static_cast<NameID>(m_entries.size());
+			auto& entry = *m_entries.emplace_back(Entry{ std::string(a_name) });
+			m_ids.emplace(entry.name, id);
+
+			if (entry.name.starts_with(m_prefix)) {
+				entry.base = _intern(std::string_view(entry.name).substr(m_prefix.size()));
+			} else {
+				entry.offset = _intern(m_prefix + entry.name);
+			}
+			return id;
+		}
+
+		const std::string                                                   m_prefix;
+		std::shared_mutex                                                   m_lock;
+		tbb::concurrent_vector<Entry>                                       m_entries;
+		std::unordered_map<std::string_view, NameID, Hash, std::equal_to<>> m_ids;  // Views m_entries
+	};
+}
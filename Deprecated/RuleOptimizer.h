@@ -0,0 +1,703 @@
+#pragma once
+
+// Rule-set-level rewriting of rule expressions, see MorphEvaluationRuleSet::Optimize
+namespace daf::optimizer
+{
+	// Evaluation work of a rule set before and after optimization, counted in operators and function calls
+	struct Report
+	{
+		size_t rules{ 0 };
+		size_t optimized_rules{ 0 };  // Rules within the supported subset, the others are left untouched
+		size_t folded_constants{ 0 };
+		size_t pruned_rules{ 0 };
+		size_t intermediates{ 0 };
+		size_t operations_before{ 0 };
+		size_t operations_after{ 0 };
+
+		double SavedFraction() const
+		{
+			return operations_before ? 1.0 - static_cast<double>(operations_after) / operations_before : 0.0;
+		}
+
+		Report& operator+=(const Report& a_rhs)
+		{
+			rules += a_rhs.rules;
+			optimized_rules += a_rhs.optimized_rules;
+			folded_constants += a_rhs.folded_constants;
+			pruned_rules += a_rhs.pruned_rules;
+			intermediates += a_rhs.intermediates;
+			operations_before += a_rhs.operations_before;
+			operations_after += a_rhs.operations_after;
+			return *this;
+		}
+	};
+
+	// Input rule, in rule set order
+	struct RuleSource
+	{
+		std::string_view expr_str;
+		bool             is_setter{ false };
+	};
+
+	struct OptimizedRule
+	{
+		bool                  optimized{ false };  // False: evaluate expr_str as written
+		bool                  pruned{ false };     // Adder folded to a constant zero
+		std::string           expr_str;            // Refers to intermediates by their symbol
+		std::vector<uint32_t> intermediates;       // Referenced directly
+	};
+
+	// Subexpression shared by several rules, evaluated once per snapshot before the rules
+	struct Intermediate
+	{
+		std::string              symbol;
+		std::string              expr_str;
+		std::vector<std::string> variables;      // Canonical names, referenced directly
+		std::vector<uint32_t>    intermediates;  // Referenced directly, always lower indices
+	};
+
+	struct Result
+	{
+		std::vector<OptimizedRule> rules;
+		std::vector<Intermediate>  intermediates;
+		Report                     report;
+	};
+
+	// Maps a variable of an expression to the canonical name of the value it reads, nullopt if unknown
+	using VariableResolver = std::function<std::optional<std::string>(std::string_view)>;
+
+	// Hash-consed expression DAG shared by every rule of a rule set, so equal subexpressions are one node.
+	// Parses the pure arithmetic subset of exprtk with exprtk's precedence rules. Anything else
+	// (assignments, control flow, strings, implicit multiplication, unknown functions) is rejected.
+	class ExpressionGraph
+	{
+	public:
+		using NodeID = uint32_t;
+
+		enum class Kind : uint8_t
+		{
+			kConstant,
+			kVariable,
+			kUnary,
+			kBinary,
+			kTernary,
+			kCall
+		};
+
+		struct Node
+		{
+			Kind                kind{ Kind::kConstant };
+			std::string         name;  // Variable, operator or function
+			float               value{ 0.f };
+			std::vector<NodeID> children;
+		};
+
+		explicit ExpressionGraph(VariableResolver a_resolver) :
+			m_resolver(std::move(a_resolver)) {}
+
+		// Root of the expression, nullopt if it is outside the supported subset.
+		// a_aliases receives the variables as written, with their canonical names.
+		std::optional<NodeID> Parse(std::string_view a_expr, std::vector<std::pair<std::string, std::string>>& a_aliases)
+		{
+			m_tokens.clear();
+			m_pos = 0;
+			m_aliases = &a_aliases;
+			if (!Tokenize(a_expr)) {
+				return std::nullopt;
+			}
+			auto root = ParseExpression(0);
+			if (!root || Peek().type != TokenType::kEnd) {
+				return std::nullopt;
+			}
+			return root;
+		}
+
+		const Node& Get(NodeID a_node) const
+		{
+			return m_nodes[a_node];
+		}
+
+		bool IsLeaf(NodeID a_node) const
+		{
+			return m_nodes[a_node].kind == Kind::kConstant || m_nodes[a_node].kind == Kind::kVariable;
+		}
+
+		// Operators and function calls the parsed text contained, before folding
+		size_t GetParsedOperations() const
+		{
+			return m_parsed_operations;
+		}
+
+		size_t GetFoldedConstants() const
+		{
+			return m_folded_constants;
+		}
+
+		// Fully parenthesized, a_substitute names the nodes to print as a symbol instead
+		template <class _Func>
+		void Print(NodeID a_node, std::string& a_out, _Func&& a_substitute) const
+		{
+			if (auto symbol = a_substitute(a_node); symbol) {
+				a_out += *symbol;
+				return;
+			}
+			auto& node = m_nodes[a_node];
+			switch (node.kind) {
+			case Kind::kConstant:
+				a_out += FormatConstant(node.value);
+				break;
+			case Kind::kVariable:
+				a_out += node.name;
+				break;
+			case Kind::kUnary:
+				a_out += "(-";
+				Print(node.children[0], a_out, a_substitute);
+				a_out += ')';
+				break;
+			case Kind::kBinary:
+				a_out += '(';
+				Print(node.children[0], a_out, a_substitute);
+				a_out += ' ';
+				a_out += node.name;
+				a_out += ' ';
+				Print(node.children[1], a_out, a_substitute);
+				a_out += ')';
+				break;
+			case Kind::kTernary:
+				a_out += '(';
+				Print(node.children[0], a_out, a_substitute);
+				a_out += " ? ";
+				Print(node.children[1], a_out, a_substitute);
+				a_out += " : ";
+				Print(node.children[2], a_out, a_substitute);
+				a_out += ')';
+				break;
+			case Kind::kCall:
+				a_out += node.name;
+				a_out += '(';
+				for (size_t i = 0; i < node.children.size(); ++i) {
+					if (i) {
+						a_out += ", ";
+					}
+					Print(node.children[i], a_out, a_substitute);
+				}
+				a_out += ')';
+				break;
+			}
+		}
+
+		std::string Print(NodeID a_node) const
+		{
+			std::string out;
+			Print(a_node, out, [](NodeID) -> const std::string* { return nullptr; });
+			return out;
+		}
+
+		// Shortest text that reads back as the same float
+		static std::string FormatConstant(float a_value)
+		{
+			char buffer[32];
+			auto end = std::to_chars(buffer, buffer + sizeof(buffer), a_value, std::chars_format::general, 9).ptr;
+			std::string str(buffer, end);
+			return a_value < 0.f ? "(" + str + ")" : str;
+		}
+
+	private:
+		enum class TokenType : uint8_t
+		{
+			kEnd,
+			kNumber,
+			kIdentifier,
+			kOperator
+		};
+
+		struct Token
+		{
+			TokenType   type{ TokenType::kEnd };
+			std::string text;
+			float       value{ 0.f };
+		};
+
+		struct BinaryOperator
+		{
+			std::string_view name;
+			int              left;
+			int              right;
+		};
+
+		std::vector<Node>                       m_nodes;
+		std::unordered_map<std::string, NodeID> m_index;  // Structural key -> node
+
+		VariableResolver                                  m_resolver;
+		std::vector<std::pair<std::string, std::string>>* m_aliases{ nullptr };
+		std::vector<Token>                                m_tokens;
+		size_t                                            m_pos{ 0 };
+		size_t                                            m_parsed_operations{ 0 };
+		size_t                                            m_folded_constants{ 0 };
+
+		// Side-effect free exprtk functions, names are case insensitive like in exprtk
+		static bool IsPureFunction(std::string_view a_name)
+		{
+			static const std::unordered_set<std::string_view> functions{
+				"abs", "acos", "acosh", "asin", "asinh", "atan", "atan2", "atanh", "avg", "ceil", "clamp", "cos", "cosh",
+				"cot", "deg2rad", "erf", "erfc", "exp", "expm1", "floor", "frac", "hypot", "iclamp", "inrange", "log",
+				"log10", "log1p", "log2", "logn", "max", "min", "mul", "ncdf", "not", "pow", "rad2deg", "root", "round",
+				"roundn", "sec", "sgn", "sin", "sinc", "sinh", "sqrt", "sum", "tan", "tanh", "trunc"
+			};
+			return functions.contains(a_name);
+		}
+
+		// Levels of exprtk's parser::parse_expression, ternaries only at level 0
+		static std::optional<BinaryOperator> FindBinaryOperator(const Token& a_token)
+		{
+			static const std::unordered_map<std::string_view, BinaryOperator> operators{
+				{ "or", { "or", 1, 2 } }, { "nor", { "nor", 1, 2 } }, { "xor", { "xor", 1, 2 } }, { "xnor", { "xnor", 1, 2 } },
+				{ "and", { "and", 3, 4 } }, { "nand", { "nand", 3, 4 } },
+				{ "<", { "<", 5, 6 } }, { "<=", { "<=", 5, 6 } }, { ">", { ">", 5, 6 } }, { ">=", { ">=", 5, 6 } },
+				{ "==", { "==", 5, 6 } }, { "=", { "==", 5, 6 } }, { "!=", { "!=", 5, 6 } }, { "<>", { "!=", 5, 6 } },
+				{ "+", { "+", 7, 8 } }, { "-", { "-", 7, 8 } },
+				{ "*", { "*", 10, 11 } }, { "/", { "/", 10, 11 } }, { "%", { "%", 10, 11 } },
+				{ "^", { "^", 12, 12 } }
+			};
+			if (a_token.type != TokenType::kOperator && a_token.type != TokenType::kIdentifier) {
+				return std::nullopt;
+			}
+			if (auto it = operators.find(a_token.text); it != operators.end()) {
+				return it->second;
+			}
+			return std::nullopt;
+		}
+
+		static std::string ToLower(std::string_view a_str)
+		{
+			std::string out(a_str);
+			std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+			return out;
+		}
+
+		bool Tokenize(std::string_view a_expr)
+		{
+			size_t i = 0;
+			while (i < a_expr.size()) {
+				char c = a_expr[i];
+				if (std::isspace(static_cast<unsigned char>(c))) {
+					++i;
+				} else if (std::isdigit(static_cast<unsigned char>(c)) || (c == '.' && i + 1 < a_expr.size() && std::isdigit(static_cast<unsigned char>(a_expr[i + 1])))) {
+					size_t start = i;
+					while (i < a_expr.size() && (std::isdigit(static_cast<unsigned char>(a_expr[i])) || a_expr[i] == '.')) {
+						++i;
+					}
+					if (i < a_expr.size() && (a_expr[i] == 'e' || a_expr[i] == 'E')) {
+						size_t exponent = i + 1;
+						if (exponent < a_expr.size() && (a_expr[exponent] == '+' || a_expr[exponent] == '-')) {
+							++exponent;
+						}
+						if (exponent < a_expr.size() && std::isdigit(static_cast<unsigned char>(a_expr[exponent]))) {
+							i = exponent;
+							while (i < a_expr.size() && std::isdigit(static_cast<unsigned char>(a_expr[i]))) {
+								++i;
+							}
+						}
+					}
+					// Implicit multiplication such as "2x" or "2(x)"
+					if (i < a_expr.size() && (std::isalpha(static_cast<unsigned char>(a_expr[i])) || a_expr[i] == '_' || a_expr[i] == '(' || a_expr[i] == '.')) {
+						return false;
+					}
+					Token token{ TokenType::kNumber, std::string(a_expr.substr(start, i - start)) };
+					auto [end, ec] = std::from_chars(token.text.data(), token.text.data() + token.text.size(), token.value);
+					if (ec != std::errc() || end != token.text.data() + token.text.size()) {
+						return false;
+					}
+					m_tokens.push_back(std::move(token));
+				} else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+					size_t start = i;
+					while (i < a_expr.size() && (std::isalnum(static_cast<unsigned char>(a_expr[i])) || a_expr[i] == '_')) {
+						++i;
+					}
+					if (i < a_expr.size() && a_expr[i] == '.') {
+						return false;
+					}
+					m_tokens.push_back({ TokenType::kIdentifier, std::string(a_expr.substr(start, i - start)) });
+				} else {
+					static constexpr std::array<std::string_view, 6> two_char{ "<=", ">=", "==", "!=", "<>", ":=" };
+					std::string_view two = a_expr.substr(i, 2);
+					if (std::find(two_char.begin(), two_char.end(), two) != two_char.end()) {
+						if (two == ":=") {
+							return false;
+						}
+						m_tokens.push_back({ TokenType::kOperator, std::string(two) });
+						i += 2;
+					} else if (std::string_view("+-*/%^<>=()?:,").find(c) != std::string_view::npos) {
+						m_tokens.push_back({ TokenType::kOperator, std::string(1, c) });
+						++i;
+					} else {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		const Token& Peek() const
+		{
+			static const Token end;
+			return m_pos < m_tokens.size() ? m_tokens[m_pos] : end;
+		}
+
+		bool Accept(std::string_view a_operator)
+		{
+			if (Peek().type == TokenType::kOperator && Peek().text == a_operator) {
+				++m_pos;
+				return true;
+			}
+			return false;
+		}
+
+		// Precedence climbing, mirrors exprtk so the tree evaluates in the same order
+		std::optional<NodeID> ParseExpression(int a_precedence)
+		{
+			auto left = ParsePrimary();
+			while (left) {
+				auto op = FindBinaryOperator(Peek());
+				if (!op || op->left < a_precedence) {
+					break;
+				}
+				++m_pos;
+				auto right = ParseExpression(op->right);
+				if (!right) {
+					return std::nullopt;
+				}
+				++m_parsed_operations;
+				left = MakeNode({ Kind::kBinary, std::string(op->name), 0.f, { *left, *right } });
+			}
+			if (left && a_precedence == 0 && Accept("?")) {
+				auto consequent = ParseExpression(0);
+				if (!consequent || !Accept(":")) {
+					return std::nullopt;
+				}
+				auto alternative = ParseExpression(0);
+				if (!alternative) {
+					return std::nullopt;
+				}
+				++m_parsed_operations;
+				left = MakeNode({ Kind::kTernary, "?", 0.f, { *left, *consequent, *alternative } });
+			}
+			return left;
+		}
+
+		std::optional<NodeID> ParsePrimary()
+		{
+			auto token = Peek();
+			++m_pos;
+			switch (token.type) {
+			case TokenType::kNumber:
+				return MakeNode({ Kind::kConstant, {}, token.value, {} });
+			case TokenType::kIdentifier:
+				{
+					auto lowered = ToLower(token.text);
+					if (Accept("(")) {
+						if (!IsPureFunction(lowered)) {
+							return std::nullopt;
+						}
+						Node call{ Kind::kCall, lowered, 0.f, {} };
+						if (!Accept(")")) {
+							do {
+								auto argument = ParseExpression(0);
+								if (!argument) {
+									return std::nullopt;
+								}
+								call.children.push_back(*argument);
+							} while (Accept(","));
+							if (!Accept(")")) {
+								return std::nullopt;
+							}
+						}
+						++m_parsed_operations;
+						return MakeNode(std::move(call));
+					}
+					// exprtk's constants, registered by every symbol table of the rule set
+					if (lowered == "pi" || lowered == "epsilon" || lowered == "inf") {
+						return MakeNode({ Kind::kVariable, std::move(lowered), 0.f, {} });
+					}
+					auto canonical = m_resolver(token.text);
+					if (!canonical) {
+						return std::nullopt;
+					}
+					m_aliases->emplace_back(token.text, *canonical);
+					return MakeNode({ Kind::kVariable, std::move(*canonical), 0.f, {} });
+				}
+			case TokenType::kOperator:
+				if (token.text == "(") {
+					auto inner = ParseExpression(0);
+					if (!inner || !Accept(")")) {
+						return std::nullopt;
+					}
+					return inner;
+				} else if (token.text == "-") {
+					auto operand = ParseExpression(11);
+					if (!operand) {
+						return std::nullopt;
+					}
+					++m_parsed_operations;
+					return MakeNode({ Kind::kUnary, "-", 0.f, { *operand } });
+				} else if (token.text == "+") {
+					return ParseExpression(13);
+				}
+				return std::nullopt;
+			default:
+				return std::nullopt;
+			}
+		}
+
+		// Interns the node, folding it first if every operand is a constant
+		NodeID MakeNode(Node a_node)
+		{
+			if (a_node.kind != Kind::kConstant && a_node.kind != Kind::kVariable && !a_node.children.empty() &&
+				std::all_of(a_node.children.begin(), a_node.children.end(), [this](NodeID a_child) { return m_nodes[a_child].kind == Kind::kConstant; })) {
+				m_nodes.push_back(a_node);
+				auto folded = EvaluateConstant(Print(static_cast<NodeID>(m_nodes.size() - 1)));
+				m_nodes.pop_back();
+				if (folded) {
+					++m_folded_constants;
+					a_node = { Kind::kConstant, {}, *folded, {} };
+				}
+			}
+
+			std::string key;
+			key += static_cast<char>(a_node.kind);
+			key += a_node.name;
+			key += '|';
+			key.append(reinterpret_cast<const char*>(&a_node.value), sizeof(float));
+			for (auto child : a_node.children) {
+				key.append(reinterpret_cast<const char*>(&child), sizeof(NodeID));
+			}
+
+			auto [it, inserted] = m_index.try_emplace(std::move(key), static_cast<NodeID>(m_nodes.size()));
+			if (inserted) {
+				m_nodes.push_back(std::move(a_node));
+			}
+			return it->second;
+		}
+
+		// exprtk computes the folded value, so it matches what the rule would have evaluated to
+		static std::optional<float> EvaluateConstant(const std::string& a_expr)
+		{
+			exprtk::expression<float> expr;
+			exprtk::parser<float>     parser;
+			if (!parser.compile(a_expr, expr)) {
+				return std::nullopt;
+			}
+			float value = expr.value();
+			if (!std::isfinite(value)) {
+				return std::nullopt;
+			}
+			return value;
+		}
+	};
+
+	namespace detail
+	{
+		// Evaluates the original and the rewritten text of a rule on a few sample inputs
+		class Verifier
+		{
+		public:
+			bool Matches(std::string_view a_original, const std::string& a_rewritten, const std::vector<std::pair<std::string, std::string>>& a_aliases)
+			{
+				symbol_table.clear();
+				symbol_table.add_constants();
+				values.clear();
+				std::unordered_map<std::string, float*> slots;
+				for (auto& [written, canonical] : a_aliases) {
+					auto [it, inserted] = slots.try_emplace(canonical, nullptr);
+					if (inserted) {
+						it->second = &values.emplace_back(0.f);
+						symbol_table.add_variable(canonical, *it->second);
+					}
+					if (written != canonical && !symbol_table.symbol_exists(written)) {
+						symbol_table.add_variable(written, *it->second);
+					}
+				}
+
+				exprtk::expression<float> original, rewritten;
+				original.register_symbol_table(symbol_table);
+				rewritten.register_symbol_table(symbol_table);
+				if (!parser.compile(std::string(a_original), original) || !parser.compile(a_rewritten, rewritten)) {
+					return false;
+				}
+
+				uint32_t seed = 0x9E3779B9u;
+				for (int sample = 0; sample < 4; ++sample) {
+					for (auto& value : values) {
+						seed = seed * 1664525u + 1013904223u;
+						// Small integers hit keyword and comparison edges, fractions the morph range
+						value = sample < 2 ? static_cast<float>(seed >> 30) : static_cast<float>(seed >> 8) / static_cast<float>(1 << 24) * 4.f - 2.f;
+					}
+					float a = original.value();
+					float b = rewritten.value();
+					if (std::isnan(a) && std::isnan(b)) {
+						continue;
+					}
+					if (a != b && !(std::abs(a - b) <= 1e-4f * std::max(1.f, std::abs(a)))) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+		private:
+			exprtk::symbol_table<float> symbol_table;
+			exprtk::parser<float>       parser;
+			std::deque<float>           values;  // Bound by reference, stable on growth
+		};
+	}
+
+	// Folds constants, drops adders that fold to zero and hoists subexpressions found in several places
+	// into intermediates named a_symbolPrefix<index>. Rules that cannot be parsed are passed through as written.
+	inline Result Optimize(std::span<const RuleSource> a_rules, VariableResolver a_resolver, std::string_view a_symbolPrefix)
+	{
+		using NodeID = ExpressionGraph::NodeID;
+
+		Result          result;
+		ExpressionGraph graph(std::move(a_resolver));
+		detail::Verifier verifier;
+
+		result.rules.resize(a_rules.size());
+		result.report.rules = a_rules.size();
+
+		std::vector<std::optional<NodeID>> roots(a_rules.size());
+		std::vector<std::pair<std::string, std::string>> aliases;
+		for (size_t i = 0; i < a_rules.size(); ++i) {
+			aliases.clear();
+			size_t operations = graph.GetParsedOperations();
+			auto   root = graph.Parse(a_rules[i].expr_str, aliases);
+			if (!root || !verifier.Matches(a_rules[i].expr_str, graph.Print(*root), aliases)) {
+				continue;
+			}
+			roots[i] = root;
+			result.rules[i].optimized = true;
+			result.report.optimized_rules += 1;
+			result.report.operations_before += graph.GetParsedOperations() - operations;
+		}
+		result.report.folded_constants = graph.GetFoldedConstants();
+
+		// Occurrences of every operation in the rules, counting repeats inside a rule
+		std::unordered_map<NodeID, uint32_t> occurrences;
+		auto count = [&](auto&& a_self, NodeID a_node) -> void {
+			if (graph.IsLeaf(a_node)) {
+				return;
+			}
+			occurrences[a_node] += 1;
+			for (auto child : graph.Get(a_node).children) {
+				a_self(a_self, child);
+			}
+		};
+		for (auto root : roots) {
+			if (root) {
+				count(count, *root);
+			}
+		}
+
+		std::unordered_set<NodeID> hoisted;
+		for (auto& [node, n] : occurrences) {
+			if (n >= 2) {
+				hoisted.insert(node);
+			}
+		}
+
+		// A subexpression only used within one hoisted parent is evaluated once through it, so it no longer pays
+		// off on its own. Dropping a candidate only lowers the uses of others, so this settles.
+		while (true) {
+			std::unordered_map<NodeID, uint32_t> uses;
+			auto visit = [&](auto&& a_self, NodeID a_node) -> void {
+				if (hoisted.contains(a_node) && uses[a_node]++ > 0) {
+					return;
+				}
+				for (auto child : graph.Get(a_node).children) {
+					a_self(a_self, child);
+				}
+			};
+			for (auto root : roots) {
+				if (root) {
+					visit(visit, *root);
+				}
+			}
+
+			size_t dropped = std::erase_if(hoisted, [&uses](NodeID a_node) { return uses[a_node] < 2; });
+			if (!dropped) {
+				break;
+			}
+		}
+
+		// Numbered in post order, so an intermediate only refers to lower indices
+		std::unordered_map<NodeID, uint32_t> intermediate_ids;
+		auto substitute_all = [&](NodeID a_node) -> const std::string* {
+			auto it = intermediate_ids.find(a_node);
+			return it != intermediate_ids.end() ? &result.intermediates[it->second].symbol : nullptr;
+		};
+
+		// Counts the operations left once intermediates are symbols, and the symbols referenced
+		auto collect = [&](auto&& a_self, NodeID a_node, std::vector<uint32_t>& a_intermediates, std::vector<std::string>* a_variables) -> size_t {
+			if (auto it = intermediate_ids.find(a_node); it != intermediate_ids.end()) {
+				if (std::find(a_intermediates.begin(), a_intermediates.end(), it->second) == a_intermediates.end()) {
+					a_intermediates.push_back(it->second);
+				}
+				return 0;
+			}
+			auto& node = graph.Get(a_node);
+			if (node.kind == ExpressionGraph::Kind::kVariable && a_variables &&
+				std::find(a_variables->begin(), a_variables->end(), node.name) == a_variables->end()) {
+				a_variables->push_back(node.name);
+			}
+			size_t operations = graph.IsLeaf(a_node) ? 0 : 1;
+			for (auto child : node.children) {
+				operations += a_self(a_self, child, a_intermediates, a_variables);
+			}
+			return operations;
+		};
+
+		auto define = [&](auto&& a_self, NodeID a_node) -> void {
+			if (intermediate_ids.contains(a_node)) {
+				return;
+			}
+			for (auto child : graph.Get(a_node).children) {
+				a_self(a_self, child);
+			}
+			if (!hoisted.contains(a_node)) {
+				return;
+			}
+
+			Intermediate intermediate;
+			intermediate.symbol = std::string(a_symbolPrefix) + std::to_string(result.intermediates.size());
+			graph.Print(a_node, intermediate.expr_str, [&](NodeID a_child) { return a_child == a_node ? nullptr : substitute_all(a_child); });
+			for (auto child : graph.Get(a_node).children) {
+				result.report.operations_after += collect(collect, child, intermediate.intermediates, &intermediate.variables);
+			}
+			result.report.operations_after += 1;
+
+			intermediate_ids[a_node] = static_cast<uint32_t>(result.intermediates.size());
+			result.intermediates.push_back(std::move(intermediate));
+		};
+
+		for (size_t i = 0; i < a_rules.size(); ++i) {
+			if (!roots[i]) {
+				continue;
+			}
+			auto  root = *roots[i];
+			auto& rule = result.rules[i];
+			auto& node = graph.Get(root);
+
+			if (node.kind == ExpressionGraph::Kind::kConstant && node.value == 0.f && !a_rules[i].is_setter) {
+				rule.pruned = true;
+				result.report.pruned_rules += 1;
+				continue;
+			}
+
+			define(define, root);
+			graph.Print(root, rule.expr_str, substitute_all);
+			result.report.operations_after += collect(collect, root, rule.intermediates, nullptr);
+		}
+		result.report.intermediates = result.intermediates.size();
+
+		return result;
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+namespace daf
+{
+	// Optional instrumentation of rule evaluation and symbol acquisition.
+	// Disabled, every call site costs a relaxed load and a branch.
+	class RuleProfiler
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		static bool IsEnabled()
+		{
+			return s_enabled.load(std::memory_order_relaxed);
+		}
+
+		static void SetEnabled(bool a_enabled)
+		{
+			s_enabled.store(a_enabled, std::memory_order_relaxed);
+		}
+
+		static uint64_t ElapsedNs(Clock::time_point a_start)
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - a_start).count();
+		}
+
+		struct Counter
+		{
+			std::atomic<uint64_t> count{ 0 };
+			std::atomic<uint64_t> total_ns{ 0 };
+			std::atomic<uint64_t> max_ns{ 0 };
+
+			void Add(uint64_t a_ns)
+			{
+				count.fetch_add(1, std::memory_order_relaxed);
+				total_ns.fetch_add(a_ns, std::memory_order_relaxed);
+				auto prev = max_ns.load(std::memory_order_relaxed);
+				while (prev < a_ns && !max_ns.compare_exchange_weak(prev, a_ns, std::memory_order_relaxed)) {}
+			}
+
+			void Reset()
+			{
+				count = 0;
+				total_ns = 0;
+				max_ns = 0;
+			}
+		};
+
+		// One line of a report, rows of every kind share the columns
+		struct Row
+		{
+			std::string ruleset;
+			std::string kind;  // "rule", "acquisition" or "actor"
+			std::string name;
+			std::string detail;
+			uint64_t    count{ 0 };
+			uint64_t    total_ns{ 0 };
+			uint64_t    max_ns{ 0 };
+
+			double AverageUs() const
+			{
+				return count ? total_ns / 1000.0 / count : 0.0;
+			}
+		};
+
+		// Hottest first
+		static void Sort(std::vector<Row>& a_rows)
+		{
+			std::sort(a_rows.begin(), a_rows.end(), [](const Row& a_lhs, const Row& a_rhs) { return a_lhs.total_ns > a_rhs.total_ns; });
+		}
+
+		static void LogReport(const std::vector<Row>& a_rows, size_t a_maxRowsPerKind)
+		{
+			for (auto kind : { "rule"sv, "acquisition"sv, "actor"sv }) {
+				logger::info("Hottest {} entries:", kind);
+				size_t n = 0;
+				for (auto& row : a_rows) {
+					if (row.kind != kind) {
+						continue;
+					}
+					if (n++ >= a_maxRowsPerKind) {
+						break;
+					}
+					logger::info("  [{}] {} {}: count {}, total {:.1f} us, avg {:.2f} us, max {:.1f} us",
+						row.ruleset, row.name, row.detail, row.count, row.total_ns / 1000.0, row.AverageUs(), row.max_ns / 1000.0);
+				}
+			}
+		}
+
+		static bool WriteCSV(const std::vector<Row>& a_rows, const std::filesystem::path& a_path)
+		{
+			std::ofstream file(a_path, std::ios::trunc);
+			if (!file.is_open()) {
+				logger::error("Failed to open file: {}", a_path.string());
+				return false;
+			}
+
+			auto quoted = [](const std::string& a_str) {
+				std::string out = "\"";
+				for (auto c : a_str) {
+					out += c == '"' ? "\"\"" : std::string(1, c);
+				}
+				return out + "\"";
+			};
+
+			file << "ruleset,kind,name,detail,count,total_us,avg_us,max_us\n";
+			for (auto& row : a_rows) {
+				file << quoted(row.ruleset) << ',' << row.kind << ',' << quoted(row.name) << ',' << quoted(row.detail) << ','
+					 << row.count << ',' << row.total_ns / 1000.0 << ',' << row.AverageUs() << ',' << row.max_ns / 1000.0 << '\n';
+			}
+			return true;
+		}
+
+	private:
+		static inline std::atomic<bool> s_enabled{ false };
+	};
+}
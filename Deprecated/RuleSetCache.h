@@ -0,0 +1,143 @@
+#pragma once
+
+// Binary cache of parsed and validated rule sets, see MorphRuleSetManager::LoadRulesets
+namespace daf::cache
+{
+	inline constexpr uint32_t Magic = 0x52464144;  // "DAFR"
+	inline constexpr uint32_t Version = 4;  // 2: rule set backend, 3: optimizer output and bytecode, 4: batch plan and VM fallback warnings
+
+	// FNV-1a, 64 bit
+	class Hasher
+	{
+	public:
+		void Update(const void* a_data, size_t a_size)
+		{
+			auto bytes = static_cast<const uint8_t*>(a_data);
+			for (size_t i = 0; i < a_size; ++i) {
+				m_hash ^= bytes[i];
+				m_hash *= 1099511628211ull;
+			}
+		}
+
+		void Update(std::string_view a_str)
+		{
+			Update(a_str.data(), a_str.size());
+			Update<uint64_t>(a_str.size());  // Keeps "ab","c" apart from "a","bc"
+		}
+
+		template <class T>
+		requires std::is_trivially_copyable_v<T>
+		void Update(const T& a_value)
+		{
+			Update(&a_value, sizeof(T));
+		}
+
+		uint64_t Digest() const
+		{
+			return m_hash;
+		}
+
+	private:
+		uint64_t m_hash{ 14695981039346656037ull };
+	};
+
+	// Identifies the scripts a rule set was built from and the plugins its form IDs were resolved against
+	struct Key
+	{
+		uint64_t content_hash{ 0 };
+		uint64_t load_order_hash{ 0 };
+
+		bool operator==(const Key&) const = default;
+	};
+
+	class BinaryWriter
+	{
+	public:
+		BinaryWriter(std::ostream& a_stream) :
+			m_stream(a_stream) {}
+
+		template <class T>
+		requires std::is_trivially_copyable_v<T>
+		void Write(const T& a_value)
+		{
+			m_stream.write(reinterpret_cast<const char*>(&a_value), sizeof(T));
+		}
+
+		void Write(std::string_view a_str)
+		{
+			Write<uint32_t>(static_cast<uint32_t>(a_str.size()));
+			m_stream.write(a_str.data(), a_str.size());
+		}
+
+		bool Good() const
+		{
+			return m_stream.good();
+		}
+
+	private:
+		std::ostream& m_stream;
+	};
+
+	class BinaryReader
+	{
+	public:
+		// Guards allocations against corrupted files
+		static constexpr uint32_t MaxStringSize = 1 << 20;
+
+		BinaryReader(std::istream& a_stream) :
+			m_stream(a_stream) {}
+
+		template <class T>
+		requires std::is_trivially_copyable_v<T>
+		bool Read(T& a_value)
+		{
+			m_stream.read(reinterpret_cast<char*>(&a_value), sizeof(T));
+			return m_stream.good();
+		}
+
+		bool Read(std::string& a_str)
+		{
+			uint32_t size{ 0 };
+			if (!Read(size) || size > MaxStringSize) {
+				return false;
+			}
+			a_str.resize(size);
+			m_stream.read(a_str.data(), size);
+			return m_stream.good();
+		}
+
+		template <class T>
+		T Get()
+		{
+			T value{};
+			Read(value);
+			return value;
+		}
+
+		bool Good() const
+		{
+			return m_stream.good();
+		}
+
+	private:
+		std::istream& m_stream;
+	};
+
+	inline void WriteHeader(BinaryWriter& a_writer, const Key& a_key)
+	{
+		a_writer.Write(Magic);
+		a_writer.Write(Version);
+		a_writer.Write(a_key.content_hash);
+		a_writer.Write(a_key.load_order_hash);
+	}
+
+	inline bool ReadHeader(BinaryReader& a_reader, const Key& a_expected)
+	{
+		uint32_t magic{ 0 }, version{ 0 };
+		Key      key;
+		return a_reader.Read(magic) && magic == Magic &&
+		       a_reader.Read(version) && version == Version &&
+		       a_reader.Read(key.content_hash) && a_reader.Read(key.load_order_hash) &&
+		       key == a_expected;
+	}
+}
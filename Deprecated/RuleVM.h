@@ -0,0 +1,615 @@
+#pragma once
+#include "RuleOptimizer.h"
+#include "RuleSetCache.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#	include <emmintrin.h>
+#	define DAF_VM_SSE2
+#endif
+
+// Register bytecode backend for rule expressions, an alternative to compiling every rule with exprtk.
+// Only covers the arithmetic subset of exprtk that rules use, expressions outside of it stay on exprtk.
+namespace daf::vm
+{
+	enum class OpCode : uint8_t
+	{
+		kAdd,
+		kSub,
+		kMul,
+		kDiv,
+		kMod,
+		kPow,
+		kNeg,
+		kLt,
+		kLe,
+		kGt,
+		kGe,
+		kEq,
+		kNe,
+		kAnd,
+		kOr,
+		kNand,
+		kNor,
+		kXor,
+		kXnor,
+		kNot,
+		kSelect,  // a ? b : c
+		kMin,
+		kMax,
+		kClamp,  // exprtk argument order: clamp(lower, value, upper)
+		kAbs,
+		kSqrt,
+		kExp,
+		kLog,
+		kFloor,
+		kCeil,
+		kRound,
+		kTrunc,
+		kFrac,
+		kSgn,
+		kSin,
+		kCos,
+		kTan
+	};
+
+	using Register = uint16_t;
+
+	struct Instruction
+	{
+		OpCode   op;
+		Register dst;
+		Register a;
+		Register b;
+		Register c;
+	};
+
+	// Values of one register for kLanes actors
+	inline constexpr size_t kLanes = 8;
+
+	struct alignas(16) Lanes
+	{
+		float v[kLanes];
+	};
+
+	namespace detail
+	{
+		// Same results as exprtk's float operators and functions
+		inline bool IsTrue(float a_value)
+		{
+			return a_value != 0.f;
+		}
+
+		inline float Round(float a_value)
+		{
+			return a_value < 0.f ? std::ceil(a_value - 0.5f) : std::floor(a_value + 0.5f);
+		}
+
+		inline float Trunc(float a_value)
+		{
+			return static_cast<float>(static_cast<long long>(a_value));
+		}
+
+		inline float Sgn(float a_value)
+		{
+			return a_value > 0.f ? 1.f : (a_value < 0.f ? -1.f : 0.f);
+		}
+
+		inline float Apply(OpCode a_op, float a, float b, float c)
+		{
+			switch (a_op) {
+			case OpCode::kAdd:    return a + b;
+			case OpCode::kSub:    return a - b;
+			case OpCode::kMul:    return a * b;
+			case OpCode::kDiv:    return a / b;
+			case OpCode::kMod:    return std::fmod(a, b);
+			case OpCode::kPow:    return std::pow(a, b);
+			case OpCode::kNeg:    return -a;
+			case OpCode::kLt:     return a < b ? 1.f : 0.f;
+			case OpCode::kLe:     return a <= b ? 1.f : 0.f;
+			case OpCode::kGt:     return a > b ? 1.f : 0.f;
+			case OpCode::kGe:     return a >= b ? 1.f : 0.f;
+			case OpCode::kEq:     return a == b ? 1.f : 0.f;
+			case OpCode::kNe:     return a != b ? 1.f : 0.f;
+			case OpCode::kAnd:    return IsTrue(a) && IsTrue(b) ? 1.f : 0.f;
+			case OpCode::kOr:     return IsTrue(a) || IsTrue(b) ? 1.f : 0.f;
+			case OpCode::kNand:   return IsTrue(a) && IsTrue(b) ? 0.f : 1.f;
+			case OpCode::kNor:    return IsTrue(a) || IsTrue(b) ? 0.f : 1.f;
+			case OpCode::kXor:    return IsTrue(a) != IsTrue(b) ? 1.f : 0.f;
+			case OpCode::kXnor:   return IsTrue(a) == IsTrue(b) ? 1.f : 0.f;
+			case OpCode::kNot:    return IsTrue(a) ? 0.f : 1.f;
+			case OpCode::kSelect: return IsTrue(a) ? b : c;
+			case OpCode::kMin:    return std::min(a, b);
+			case OpCode::kMax:    return std::max(a, b);
+			case OpCode::kClamp:  return b < a ? a : (b > c ? c : b);
+			case OpCode::kAbs:    return a < 0.f ? -a : a;
+			case OpCode::kSqrt:   return std::sqrt(a);
+			case OpCode::kExp:    return std::exp(a);
+			case OpCode::kLog:    return std::log(a);
+			case OpCode::kFloor:  return std::floor(a);
+			case OpCode::kCeil:   return std::ceil(a);
+			case OpCode::kRound:  return Round(a);
+			case OpCode::kTrunc:  return Trunc(a);
+			case OpCode::kFrac:   return a - Trunc(a);
+			case OpCode::kSgn:    return Sgn(a);
+			case OpCode::kSin:    return std::sin(a);
+			case OpCode::kCos:    return std::cos(a);
+			case OpCode::kTan:    return std::tan(a);
+			}
+			return 0.f;
+		}
+
+#ifdef DAF_VM_SSE2
+		// Lanes where a_value is true in exprtk's sense, all bits set. NaN is true, like a_value != 0.f.
+		inline __m128 TrueMask(__m128 a_value)
+		{
+			return _mm_cmpneq_ps(a_value, _mm_setzero_ps());
+		}
+
+		// a_mask ? a_true : a_false per lane
+		inline __m128 Blend(__m128 a_mask, __m128 a_true, __m128 a_false)
+		{
+			return _mm_or_ps(_mm_and_ps(a_mask, a_true), _mm_andnot_ps(a_mask, a_false));
+		}
+
+		// a_func on every 4 lanes, a_func takes and returns __m128
+		template <class _Func>
+		inline void Map(const Lanes& a, const Lanes& b, const Lanes& c, Lanes& a_dst, _Func a_func)
+		{
+			for (size_t i = 0; i < kLanes; i += 4) {
+				_mm_store_ps(a_dst.v + i, a_func(_mm_load_ps(a.v + i), _mm_load_ps(b.v + i), _mm_load_ps(c.v + i)));
+			}
+		}
+
+		// The operators that map to a few SSE2 instructions per 4 lanes, false for the others.
+		// Dispatched once for all lanes, the switch mispredicts too often to run per 4 lanes.
+		inline bool ApplyLanes(OpCode a_op, const Lanes& a, const Lanes& b, const Lanes& c, Lanes& a_dst)
+		{
+			const __m128 one = _mm_set1_ps(1.f);
+			const __m128 sign = _mm_set1_ps(-0.f);
+			switch (a_op) {
+			case OpCode::kAdd:    Map(a, b, c, a_dst, [](__m128 x, __m128 y, __m128) { return _mm_add_ps(x, y); }); return true;
+			case OpCode::kSub:    Map(a, b, c, a_dst, [](__m128 x, __m128 y, __m128) { return _mm_sub_ps(x, y); }); return true;
+			case OpCode::kMul:    Map(a, b, c, a_dst, [](__m128 x, __m128 y, __m128) { return _mm_mul_ps(x, y); }); return true;
+			case OpCode::kDiv:    Map(a, b, c, a_dst, [](__m128 x, __m128 y, __m128) { return _mm_div_ps(x, y); }); return true;
+			case OpCode::kNeg:    Map(a, b, c, a_dst, [sign](__m128 x, __m128, __m128) { return _mm_xor_ps(x, sign); }); return true;
+			case OpCode::kLt:     Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_cmplt_ps(x, y), one); }); return true;
+			case OpCode::kLe:     Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_cmple_ps(x, y), one); }); return true;
+			case OpCode::kGt:     Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_cmpgt_ps(x, y), one); }); return true;
+			case OpCode::kGe:     Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_cmpge_ps(x, y), one); }); return true;
+			case OpCode::kEq:     Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_cmpeq_ps(x, y), one); }); return true;
+			case OpCode::kNe:     Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_cmpneq_ps(x, y), one); }); return true;
+			case OpCode::kAnd:    Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_and_ps(TrueMask(x), TrueMask(y)), one); }); return true;
+			case OpCode::kOr:     Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_or_ps(TrueMask(x), TrueMask(y)), one); }); return true;
+			case OpCode::kNand:   Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_andnot_ps(_mm_and_ps(TrueMask(x), TrueMask(y)), one); }); return true;
+			case OpCode::kNor:    Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_andnot_ps(_mm_or_ps(TrueMask(x), TrueMask(y)), one); }); return true;
+			case OpCode::kXor:    Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_and_ps(_mm_xor_ps(TrueMask(x), TrueMask(y)), one); }); return true;
+			case OpCode::kXnor:   Map(a, b, c, a_dst, [one](__m128 x, __m128 y, __m128) { return _mm_andnot_ps(_mm_xor_ps(TrueMask(x), TrueMask(y)), one); }); return true;
+			case OpCode::kNot:    Map(a, b, c, a_dst, [one](__m128 x, __m128, __m128) { return _mm_andnot_ps(TrueMask(x), one); }); return true;
+			case OpCode::kSelect: Map(a, b, c, a_dst, [](__m128 x, __m128 y, __m128 z) { return Blend(TrueMask(x), y, z); }); return true;
+			case OpCode::kMin:    Map(a, b, c, a_dst, [](__m128 x, __m128 y, __m128) { return _mm_min_ps(y, x); }); return true;  // std::min(x, y) keeps x unless y < x
+			case OpCode::kMax:    Map(a, b, c, a_dst, [](__m128 x, __m128 y, __m128) { return _mm_max_ps(y, x); }); return true;  // std::max(x, y) keeps x unless x < y
+			case OpCode::kClamp:  // b < a ? a : (b > c ? c : b), a is the lower bound and b the value
+				Map(a, b, c, a_dst, [](__m128 x, __m128 y, __m128 z) { return Blend(_mm_cmplt_ps(y, x), x, Blend(_mm_cmpgt_ps(y, z), z, y)); });
+				return true;
+			case OpCode::kAbs:    Map(a, b, c, a_dst, [sign](__m128 x, __m128, __m128) { return _mm_andnot_ps(sign, x); }); return true;
+			default:
+				return false;
+			}
+		}
+#endif
+	}
+
+	// Bytecode of every compiled expression of a rule set, one chunk per expression.
+	// Registers: the inputs first, then constants, then temporaries shared by all chunks.
+	class Program
+	{
+	public:
+		struct Chunk
+		{
+			uint32_t begin{ 0 };
+			uint32_t end{ 0 };
+			Register result{ 0 };  // Input or constant register when the chunk has no instruction
+		};
+
+		static constexpr uint32_t kNoChunk = std::numeric_limits<uint32_t>::max();
+
+		uint32_t GetNumInputs() const
+		{
+			return m_num_inputs;
+		}
+
+		uint32_t GetNumRegisters() const
+		{
+			return m_num_registers;
+		}
+
+		const Chunk& GetChunk(uint32_t a_chunk) const
+		{
+			return m_chunks[a_chunk];
+		}
+
+		size_t GetNumChunks() const
+		{
+			return m_chunks.size();
+		}
+
+		size_t GetNumInstructions() const
+		{
+			return m_code.size();
+		}
+
+		// Bytes of bytecode, constants and chunk table
+		size_t GetMemoryUsage() const
+		{
+			return m_code.size() * sizeof(Instruction) + m_constants.size() * sizeof(float) + m_chunks.size() * sizeof(Chunk);
+		}
+
+		// Writes the constants into a register file of GetNumRegisters() values, once per register file
+		void InitRegisters(float* a_registers) const
+		{
+			std::copy(m_constants.begin(), m_constants.end(), a_registers + m_num_inputs);
+		}
+
+		void InitRegisters(Lanes* a_registers) const
+		{
+			for (size_t i = 0; i < m_constants.size(); ++i) {
+				std::fill(std::begin(a_registers[m_num_inputs + i].v), std::end(a_registers[m_num_inputs + i].v), m_constants[i]);
+			}
+		}
+
+		float Run(uint32_t a_chunk, float* a_registers) const
+		{
+			auto& chunk = m_chunks[a_chunk];
+			auto  r = a_registers;
+			for (auto ip = m_code.data() + chunk.begin, end = m_code.data() + chunk.end; ip != end; ++ip) {
+				r[ip->dst] = detail::Apply(ip->op, r[ip->a], r[ip->b], r[ip->c]);
+			}
+			return r[chunk.result];
+		}
+
+		// Runs the chunk for kLanes actors at once, the result is left in a_registers[GetChunk(a_chunk).result]
+		void Run(uint32_t a_chunk, Lanes* a_registers) const
+		{
+			auto& chunk = m_chunks[a_chunk];
+			auto  r = a_registers;
+			for (auto ip = m_code.data() + chunk.begin, end = m_code.data() + chunk.end; ip != end; ++ip) {
+#ifdef DAF_VM_SSE2
+				if (detail::ApplyLanes(ip->op, r[ip->a], r[ip->b], r[ip->c], r[ip->dst])) {
+					continue;
+				}
+#endif
+				Lanes out;
+				for (size_t i = 0; i < kLanes; ++i) {
+					out.v[i] = detail::Apply(ip->op, r[ip->a].v[i], r[ip->b].v[i], r[ip->c].v[i]);
+				}
+				r[ip->dst] = out;
+			}
+		}
+
+		// Writes the bytecode, see MorphEvaluationRuleSet::Serialize
+		void Serialize(cache::BinaryWriter& a_writer) const
+		{
+			a_writer.Write(m_num_inputs);
+			a_writer.Write(m_num_registers);
+			a_writer.Write<uint32_t>(static_cast<uint32_t>(m_code.size()));
+			for (auto& [op, dst, a, b, c] : m_code) {
+				a_writer.Write(op);
+				a_writer.Write(dst);
+				a_writer.Write(a);
+				a_writer.Write(b);
+				a_writer.Write(c);
+			}
+			a_writer.Write<uint32_t>(static_cast<uint32_t>(m_constants.size()));
+			for (auto constant : m_constants) {
+				a_writer.Write(constant);
+			}
+			a_writer.Write<uint32_t>(static_cast<uint32_t>(m_chunks.size()));
+			for (auto& [begin, end, result] : m_chunks) {
+				a_writer.Write(begin);
+				a_writer.Write(end);
+				a_writer.Write(result);
+			}
+		}
+
+		// Reads a program written by Serialize. False if it is corrupted: a register past the register file, a chunk
+		// outside the code or an unknown operator, which Run would not survive.
+		bool Deserialize(cache::BinaryReader& a_reader)
+		{
+			*this = {};
+			if (!a_reader.Read(m_num_inputs) || !a_reader.Read(m_num_registers) ||
+				m_num_inputs > m_num_registers || m_num_registers > std::numeric_limits<Register>::max()) {
+				return false;
+			}
+
+			auto num_code = a_reader.Get<uint32_t>();
+			for (uint32_t i = 0; i < num_code && a_reader.Good(); ++i) {
+				auto& [op, dst, a, b, c] = m_code.emplace_back();
+				a_reader.Read(op);
+				a_reader.Read(dst);
+				a_reader.Read(a);
+				a_reader.Read(b);
+				a_reader.Read(c);
+				if (op > OpCode::kTan || dst >= m_num_registers || a >= m_num_registers || b >= m_num_registers || c >= m_num_registers) {
+					return false;
+				}
+			}
+
+			auto num_constants = a_reader.Get<uint32_t>();
+			if (num_constants > m_num_registers - m_num_inputs) {
+				return false;
+			}
+			m_constants.resize(num_constants);
+			for (auto& constant : m_constants) {
+				a_reader.Read(constant);
+			}
+
+			auto num_chunks = a_reader.Get<uint32_t>();
+			for (uint32_t i = 0; i < num_chunks && a_reader.Good(); ++i) {
+				auto& [begin, end, result] = m_chunks.emplace_back();
+				a_reader.Read(begin);
+				a_reader.Read(end);
+				a_reader.Read(result);
+				if (begin > end || end > m_code.size() || result >= m_num_registers) {
+					return false;
+				}
+			}
+			return a_reader.Good();
+		}
+
+	private:
+		friend class Compiler;
+
+		std::vector<Instruction> m_code;
+		std::vector<float>       m_constants;
+		std::vector<Chunk>       m_chunks;
+		uint32_t                 m_num_inputs{ 0 };
+		uint32_t                 m_num_registers{ 0 };
+	};
+
+	// Compiles expressions of the rule grammar, parsed by optimizer::ExpressionGraph, into a Program.
+	// Temporaries are allocated as a stack: an operation writes to the first register of its operands.
+	class Compiler
+	{
+	public:
+		using NodeID = optimizer::ExpressionGraph::NodeID;
+
+		// a_inputs maps a variable name to its input register, registers [0, a_numInputs)
+		Compiler(uint32_t a_numInputs, std::function<std::optional<Register>(std::string_view)> a_inputs) :
+			m_graph([this](std::string_view a_symbol) -> std::optional<std::string> {
+				if (!m_inputs(a_symbol)) {
+					return std::nullopt;
+				}
+				return std::string(a_symbol);
+			}),
+			m_inputs(std::move(a_inputs))
+		{
+			m_program.m_num_inputs = a_numInputs;
+		}
+
+		// Chunk index, or Program::kNoChunk if the expression is outside of what the VM supports
+		uint32_t Add(std::string_view a_expr)
+		{
+			std::vector<std::pair<std::string, std::string>> aliases;
+			auto root = m_graph.Parse(a_expr, aliases);
+			if (!root) {
+				return Program::kNoChunk;
+			}
+
+			auto code_size = m_code.size();
+			auto constants = m_constants.size();
+			auto result = Emit(*root, 0);
+			if (!result) {
+				m_code.resize(code_size);
+				m_constants.resize(constants);
+				return Program::kNoChunk;
+			}
+
+			m_chunks.push_back({ static_cast<uint32_t>(code_size), static_cast<uint32_t>(m_code.size()), *result });
+			return static_cast<uint32_t>(m_chunks.size() - 1);
+		}
+
+		// Resolves the temporary and constant registers now that their counts are known.
+		// nullopt if the program needs more registers than an instruction can address.
+		std::optional<Program> Finish()
+		{
+			const uint32_t constant_base = m_program.m_num_inputs;
+			const uint32_t temp_base = constant_base + static_cast<uint32_t>(m_constants.size());
+
+			auto resolve = [&](const Operand& a_operand) -> Register {
+				switch (a_operand.kind) {
+				case Operand::Kind::kConstant:  return static_cast<Register>(constant_base + a_operand.index);
+				case Operand::Kind::kTemporary: return static_cast<Register>(temp_base + a_operand.index);
+				default:                        return static_cast<Register>(a_operand.index);
+				}
+			};
+
+			m_program.m_code.reserve(m_code.size());
+			for (auto& [op, dst, a, b, c] : m_code) {
+				m_program.m_code.push_back({ op, resolve(dst), resolve(a), resolve(b), resolve(c) });
+			}
+			for (auto& chunk : m_chunks) {
+				m_program.m_chunks.push_back({ chunk.begin, chunk.end, resolve(chunk.result) });
+			}
+			m_program.m_constants = std::move(m_constants);
+			m_program.m_num_registers = temp_base + m_num_temporaries;
+
+			if (m_program.m_num_registers > std::numeric_limits<Register>::max()) {
+				return std::nullopt;
+			}
+			return std::move(m_program);
+		}
+
+	private:
+		struct Operand
+		{
+			enum class Kind : uint8_t
+			{
+				kInput,
+				kConstant,
+				kTemporary
+			};
+
+			Kind     kind{ Kind::kInput };
+			uint32_t index{ 0 };
+		};
+
+		struct PendingInstruction
+		{
+			OpCode  op;
+			Operand dst;
+			Operand a;
+			Operand b;
+			Operand c;
+		};
+
+		struct PendingChunk
+		{
+			uint32_t begin;
+			uint32_t end;
+			Operand  result;
+		};
+
+		optimizer::ExpressionGraph                               m_graph;
+		std::function<std::optional<Register>(std::string_view)> m_inputs;
+
+		Program                                m_program;
+		std::vector<PendingInstruction>        m_code;
+		std::vector<PendingChunk>              m_chunks;
+		std::vector<float>                     m_constants;
+		std::unordered_map<uint32_t, uint32_t> m_constant_index;  // Bits of the value -> constant
+		uint32_t                               m_num_temporaries{ 0 };
+
+		static std::optional<OpCode> FindOpCode(const optimizer::ExpressionGraph::Node& a_node)
+		{
+			static const std::unordered_map<std::string_view, OpCode> binary{
+				{ "+", OpCode::kAdd }, { "-", OpCode::kSub }, { "*", OpCode::kMul }, { "/", OpCode::kDiv }, { "%", OpCode::kMod },
+				{ "^", OpCode::kPow }, { "<", OpCode::kLt }, { "<=", OpCode::kLe }, { ">", OpCode::kGt }, { ">=", OpCode::kGe },
+				{ "==", OpCode::kEq }, { "!=", OpCode::kNe }, { "and", OpCode::kAnd }, { "or", OpCode::kOr }, { "nand", OpCode::kNand },
+				{ "nor", OpCode::kNor }, { "xor", OpCode::kXor }, { "xnor", OpCode::kXnor }
+			};
+			static const std::unordered_map<std::string_view, OpCode> functions{
+				{ "not", OpCode::kNot }, { "min", OpCode::kMin }, { "max", OpCode::kMax }, { "clamp", OpCode::kClamp },
+				{ "abs", OpCode::kAbs }, { "sqrt", OpCode::kSqrt }, { "exp", OpCode::kExp }, { "log", OpCode::kLog },
+				{ "floor", OpCode::kFloor }, { "ceil", OpCode::kCeil }, { "round", OpCode::kRound }, { "trunc", OpCode::kTrunc },
+				{ "frac", OpCode::kFrac }, { "sgn", OpCode::kSgn }, { "sin", OpCode::kSin }, { "cos", OpCode::kCos },
+				{ "tan", OpCode::kTan }, { "pow", OpCode::kPow }
+			};
+
+			using Kind = optimizer::ExpressionGraph::Kind;
+			switch (a_node.kind) {
+			case Kind::kUnary:
+				return OpCode::kNeg;
+			case Kind::kTernary:
+				return OpCode::kSelect;
+			case Kind::kBinary:
+				if (auto it = binary.find(a_node.name); it != binary.end()) {
+					return it->second;
+				}
+				return std::nullopt;
+			case Kind::kCall:
+				if (auto it = functions.find(a_node.name); it != functions.end()) {
+					return it->second;
+				}
+				return std::nullopt;
+			default:
+				return std::nullopt;
+			}
+		}
+
+		static size_t Arity(OpCode a_op)
+		{
+			switch (a_op) {
+			case OpCode::kNeg:
+			case OpCode::kNot:
+			case OpCode::kAbs:
+			case OpCode::kSqrt:
+			case OpCode::kExp:
+			case OpCode::kLog:
+			case OpCode::kFloor:
+			case OpCode::kCeil:
+			case OpCode::kRound:
+			case OpCode::kTrunc:
+			case OpCode::kFrac:
+			case OpCode::kSgn:
+			case OpCode::kSin:
+			case OpCode::kCos:
+			case OpCode::kTan:
+				return 1;
+			case OpCode::kSelect:
+			case OpCode::kClamp:
+				return 3;
+			default:
+				return 2;
+			}
+		}
+
+		Operand Constant(float a_value)
+		{
+			auto [it, inserted] = m_constant_index.try_emplace(std::bit_cast<uint32_t>(a_value), static_cast<uint32_t>(m_constants.size()));
+			if (inserted) {
+				m_constants.push_back(a_value);
+			}
+			return { Operand::Kind::kConstant, it->second };
+		}
+
+		// Emits a_node with its temporaries starting at a_base, returns where its value is
+		std::optional<Operand> Emit(NodeID a_node, uint32_t a_base)
+		{
+			using Kind = optimizer::ExpressionGraph::Kind;
+
+			auto& node = m_graph.Get(a_node);
+			if (node.kind == Kind::kConstant) {
+				return Constant(node.value);
+			}
+			if (node.kind == Kind::kVariable) {
+				if (node.name == "pi") {
+					return Constant(static_cast<float>(std::numbers::pi));
+				} else if (node.name == "inf") {
+					return Constant(std::numeric_limits<float>::infinity());
+				} else if (auto input = m_inputs(node.name); input) {
+					return Operand{ Operand::Kind::kInput, *input };
+				}
+				return std::nullopt;
+			}
+
+			auto op = FindOpCode(node);
+			if (!op) {
+				return std::nullopt;
+			}
+
+			// min and max take any number of arguments, folded left like exprtk
+			const bool variadic = *op == OpCode::kMin || *op == OpCode::kMax;
+			if (variadic ? node.children.empty() : node.children.size() != Arity(*op)) {
+				return std::nullopt;
+			}
+
+			std::vector<Operand> operands;
+			for (size_t i = 0; i < node.children.size(); ++i) {
+				auto operand = Emit(node.children[i], a_base + static_cast<uint32_t>(i));
+				if (!operand) {
+					return std::nullopt;
+				}
+				operands.push_back(*operand);
+			}
+
+			const Operand dst{ Operand::Kind::kTemporary, a_base };
+			m_num_temporaries = std::max(m_num_temporaries, a_base + 1);
+
+			if (variadic) {
+				if (operands.size() == 1) {
+					return operands[0];
+				}
+				auto accumulator = operands[0];
+				for (size_t i = 1; i < operands.size(); ++i) {
+					m_code.push_back({ *op, dst, accumulator, operands[i], operands[i] });
+					accumulator = dst;
+				}
+				return dst;
+			}
+
+			operands.resize(3, operands[0]);
+			m_code.push_back({ *op, dst, operands[0], operands[1], operands[2] });
+			return dst;
+		}
+	};
+}
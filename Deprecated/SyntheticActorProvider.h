@@ -0,0 +1,141 @@
+#pragma once
+#include "ActorDataProvider.h"
+#include "DenseBitset.h"
+
+namespace daf
+{
+	// Fake actor for headless runs, its tables are indexed by the InputReference::index of SyntheticActorProvider
+	class SyntheticActor
+	{
+	public:
+		uint32_t           formID{ 0 };
+		std::vector<float> actor_values;
+		DenseBitset        worn_keywords;
+		DenseBitset        npc_keywords;
+		std::vector<float> morphs;
+	};
+
+	// Resolves every EditorID, so real rule folders load without the game, and generates random actors
+	// reading the inputs registered by the loaded rule sets
+	class SyntheticActorProvider : public ActorDataProvider
+	{
+	public:
+		struct Settings
+		{
+			float    min_actor_value{ 0.f };
+			float    max_actor_value{ 100.f };
+			float    keyword_chance{ 0.25f };
+			float    morph_chance{ 0.5f };  // Of a non-zero morph, in [0, 1]
+			uint32_t seed{ 42 };
+		};
+
+		SyntheticActorProvider() = default;
+		explicit SyntheticActorProvider(Settings a_settings) :
+			m_settings(a_settings) {}
+
+		// Without any hint from the game, an untyped alias resolves to the first type of a_types
+		std::optional<InputReference> Resolve(std::string_view a_editorID, InputType a_types) override
+		{
+			for (auto type : { InputType::kActorValue, InputType::kWornKeyword, InputType::kNPCKeyword, InputType::kMorph }) {
+				if (std::to_underlying(a_types) & std::to_underlying(type)) {
+					return _register(a_editorID, type);
+				}
+			}
+			return std::nullopt;
+		}
+
+		std::optional<InputReference> Restore(std::string_view a_editorID, InputType a_type, uint32_t) override
+		{
+			return _register(a_editorID, a_type);
+		}
+
+		float Acquire(Actor* a_actor, const InputReference& a_input) const override
+		{
+			switch (a_input.type) {
+			case InputType::kActorValue:
+				return a_input.index < a_actor->actor_values.size() ? a_actor->actor_values[a_input.index] : 0.f;
+			case InputType::kWornKeyword:
+				return a_actor->worn_keywords.Test(a_input.index) ? 1.f : 0.f;
+			case InputType::kNPCKeyword:
+				return a_actor->npc_keywords.Test(a_input.index) ? 1.f : 0.f;
+			case InputType::kMorph:
+				return a_input.index < a_actor->morphs.size() ? a_actor->morphs[a_input.index] : 0.f;
+			default:
+				return 0.f;
+			}
+		}
+
+		uint32_t GetFormID(const Actor* a_actor) const override
+		{
+			return a_actor->formID;
+		}
+
+		// Actors with a value for every input registered so far, load the rule sets first
+		std::vector<SyntheticActor> GenerateActors(size_t a_count) const
+		{
+			std::lock_guard lock(m_lock);
+
+			std::mt19937                          rng(m_settings.seed);
+			std::uniform_real_distribution<float> actor_value(m_settings.min_actor_value, m_settings.max_actor_value);
+			std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+			std::vector<SyntheticActor> actors(a_count);
+			for (size_t i = 0; i < a_count; ++i) {
+				auto& actor = actors[i];
+				actor.formID = 0xFF000000 | static_cast<uint32_t>(i);
+
+				actor.actor_values.resize(m_num_inputs[Slot(InputType::kActorValue)]);
+				for (auto& value : actor.actor_values) {
+					value = actor_value(rng);
+				}
+				for (uint32_t bit = 0; bit < m_num_inputs[Slot(InputType::kWornKeyword)]; ++bit) {
+					if (unit(rng) < m_settings.keyword_chance) {
+						actor.worn_keywords.Set(bit);
+					}
+				}
+				for (uint32_t bit = 0; bit < m_num_inputs[Slot(InputType::kNPCKeyword)]; ++bit) {
+					if (unit(rng) < m_settings.keyword_chance) {
+						actor.npc_keywords.Set(bit);
+					}
+				}
+				actor.morphs.resize(m_num_inputs[Slot(InputType::kMorph)]);
+				for (auto& value : actor.morphs) {
+					value = unit(rng) < m_settings.morph_chance ? unit(rng) : 0.f;
+				}
+			}
+			return actors;
+		}
+
+		uint32_t GetNumInputs(InputType a_type) const
+		{
+			std::lock_guard lock(m_lock);
+			return m_num_inputs[Slot(a_type)];
+		}
+
+	private:
+		static size_t Slot(InputType a_type)
+		{
+			return std::countr_zero(std::to_underlying(a_type));
+		}
+
+		// Same EditorID and type, same slot, like the game resolves to the same form
+		InputReference _register(std::string_view a_editorID, InputType a_type)
+		{
+			std::lock_guard lock(m_lock);
+			auto [it, inserted] = m_inputs.try_emplace({ std::string(a_editorID), a_type });
+			if (inserted) {
+				it->second.type = a_type;
+				it->second.index = m_num_inputs[Slot(a_type)]++;
+				it->second.formID = a_type == InputType::kMorph ? 0 : 0x01000000 | static_cast<uint32_t>(m_inputs.size());
+			}
+			auto input = it->second;
+			input.editorID = a_editorID;  // Views the rule set's copy, like every InputReference
+			return input;
+		}
+
+		Settings                                                    m_settings;
+		mutable std::mutex                                          m_lock;
+		std::map<std::pair<std::string, InputType>, InputReference> m_inputs;
+		std::array<uint32_t, 4>                                     m_num_inputs{};
+	};
+}
@@ -0,0 +1,136 @@
+// Encodes a synthetic facial expression sequence with ExpressionClip (Plugin/src/ExpressionClip.h), then plays it back
+// on many actors: size and error of the encoding, and actors sampled per millisecond.
+//
+//   cmake -S Deprecated/bench -B build-bench -DCMAKE_BUILD_TYPE=Release && cmake --build build-bench
+//   ./build-bench/expression_clip_bench [num_actors] [num_clips]
+//
+// Actors are spread over the clips at random offsets and all advance by one 60 Hz frame per step, like NPCs of a
+// crowd played back on the same frame.
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <numbers>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "ExpressionClip.h"
+
+namespace
+{
+	using chargen::ExpressionClip;
+	using Clock = std::chrono::steady_clock;
+
+	double ElapsedMs(Clock::time_point a_start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - a_start).count();
+	}
+
+	// Smooth per morph curves, with a few fast blinks, 10 s at 30 fps
+	std::vector<std::array<float, ExpressionClip::NumChannels>> GenerateFrames(uint32_t a_seed, uint32_t a_numFrames)
+	{
+		std::mt19937                          rng(a_seed);
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+		std::array<float, ExpressionClip::NumChannels> frequency, phase, amplitude;
+		for (uint32_t i = 0; i < ExpressionClip::NumChannels; ++i) {
+			frequency[i] = 0.1f + unit(rng) * 1.5f;
+			phase[i] = unit(rng) * 2.f * std::numbers::pi_v<float>;
+			amplitude[i] = unit(rng) < 0.3f ? 0.f : unit(rng) * 0.5f;  // Most expressions leave many morphs alone
+		}
+
+		std::vector<std::array<float, ExpressionClip::NumChannels>> frames(a_numFrames);
+		for (uint32_t frame = 0; frame < a_numFrames; ++frame) {
+			const float time = frame / 30.f;
+			for (uint32_t i = 0; i < ExpressionClip::NumChannels; ++i) {
+				frames[frame][i] = amplitude[i] * (0.5f + 0.5f * std::sin(time * frequency[i] * 2.f * std::numbers::pi_v<float> + phase[i]));
+			}
+			frames[frame][0] = frame % 90 < 4 ? 1.f : 0.f;  // Blink
+		}
+		return frames;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t   num_actors = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000;
+	const size_t   num_clips = argc > 2 ? std::max<size_t>(1, std::strtoull(argv[2], nullptr, 10)) : 8;
+	const uint32_t num_frames = 300;
+
+	// Encoding
+	std::vector<std::shared_ptr<const ExpressionClip>> clips;
+	double                                             encode_ms = 0.0;
+	float                                              max_error = 0.f;
+	for (size_t c = 0; c < num_clips; ++c) {
+		auto frames = GenerateFrames(static_cast<uint32_t>(c), num_frames);
+
+		auto                    start = Clock::now();
+		ExpressionClip::Builder builder(30.f);
+		for (auto& frame : frames) {
+			builder.AddFrame(frame.data());
+		}
+		auto clip = builder.Build();
+		encode_ms += ElapsedMs(start);
+
+		// Round trip through the file format
+		std::stringstream stream;
+		clip->Write(stream);
+		clip = ExpressionClip::Read(stream);
+		if (!clip) {
+			std::printf("Round trip of clip %zu failed\n", c);
+			return 1;
+		}
+
+		std::array<float, ExpressionClip::NumChannels> sample;
+		for (uint32_t frame = 0; frame < num_frames; ++frame) {
+			clip->Sample(frame / 30.0, false, sample.data());
+			for (uint32_t i = 0; i < ExpressionClip::NumChannels; ++i) {
+				max_error = std::max(max_error, std::abs(sample[i] - frames[frame][i]));
+			}
+		}
+		clips.push_back(std::move(clip));
+	}
+
+	const size_t raw_bytes = num_frames * ExpressionClip::NumChannels * sizeof(float);
+	std::printf("Clip: %u frames, %zu bytes encoded, %zu raw (%.1fx), encoded in %.3f ms\n",
+		num_frames, clips[0]->GetNumBytes(), raw_bytes, double(raw_bytes) / clips[0]->GetNumBytes(), encode_ms / num_clips);
+	std::printf("Max error %.4f, quantization step %.4f\n", max_error, 1.f / ExpressionClip::MaxLevel);
+
+	// Playback
+	struct Actor
+	{
+		const ExpressionClip*                          clip;
+		double                                         time;
+		std::array<float, ExpressionClip::NumChannels> morphs;
+	};
+
+	std::mt19937                           rng(7);
+	std::uniform_real_distribution<double> offset(0.0, 0.5);
+	std::vector<Actor>                     actors(num_actors);
+	for (size_t i = 0; i < num_actors; ++i) {
+		actors[i].clip = clips[i % num_clips].get();
+		actors[i].time = offset(rng);  // Crowds start together, give or take a few frames
+	}
+
+	constexpr uint32_t Steps = 600;
+	constexpr double   Step_s = 1.0 / 60.0;
+
+	auto  start = Clock::now();
+	float checksum = 0.f;
+	for (uint32_t step = 0; step < Steps; ++step) {
+		for (auto& actor : actors) {
+			actor.time += Step_s;
+			actor.clip->Sample(actor.time, true, actor.morphs.data());
+		}
+		checksum += actors[step % num_actors].morphs[1];
+	}
+	const double ms = ElapsedMs(start);
+
+	std::printf("Playback: %zu actors on %zu clips, %u steps in %.2f ms, %.0f actors/ms, %.3f us per actor (checksum %.3f)\n",
+		num_actors, num_clips, Steps, ms, num_actors * Steps / ms, ms * 1000.0 / (num_actors * Steps), checksum);
+	return 0;
+}
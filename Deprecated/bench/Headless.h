@@ -0,0 +1,89 @@
+#pragma once
+
+// Stands in for the plugin's PCH when the rule engine is built without the game, see RuleHarness.cpp.
+// Only what MorphEvaluationRuleSet and its headers use outside of the game types.
+#ifndef DAF_HEADLESS
+#	define DAF_HEADLESS
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <tbb/concurrent_hash_map.h>
+#include <tbb/concurrent_unordered_map.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_for_each.h>
+#include <tbb/task_group.h>
+
+#include "exprtk.hpp"
+
+using namespace std::literals;
+
+namespace logger
+{
+	// Errors and warnings only, the harness prints its own report
+	inline std::atomic<bool> g_verbose{ false };
+
+	template <class... Args>
+	void info(const std::format_string<Args...> a_fmt, Args&&... a_args)
+	{
+		if (g_verbose) {
+			std::puts(std::format(a_fmt, std::forward<Args>(a_args)...).c_str());
+		}
+	}
+
+	template <class... Args>
+	void warn(const std::format_string<Args...> a_fmt, Args&&... a_args)
+	{
+		std::fprintf(stderr, "[warning] %s\n", std::format(a_fmt, std::forward<Args>(a_args)...).c_str());
+	}
+
+	template <class... Args>
+	void error(const std::format_string<Args...> a_fmt, Args&&... a_args)
+	{
+		std::fprintf(stderr, "[error] %s\n", std::format(a_fmt, std::forward<Args>(a_args)...).c_str());
+	}
+}
+
+namespace utils
+{
+	inline bool caseInsensitiveCompare(const std::string& str, const char* cstr)
+	{
+		return std::equal(str.begin(), str.end(), cstr, cstr + std::strlen(cstr), [](char a, char b) {
+			return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+		});
+	}
+}
@@ -0,0 +1,294 @@
+// Loads real rule folders with MorphEvaluationRuleSet and evaluates them across synthetic actors, without the game.
+//
+//   cmake -S Deprecated/bench -B build-bench -DCMAKE_BUILD_TYPE=Release && cmake --build build-bench
+//   ./build-bench/rule_harness <rules_folder> [num_actors] [--backend vm|exprtk] [--csv out.csv] [--baseline base.csv] [--verbose]
+//
+// rules_folder is laid out like the plugin's rules folder: one folder per race, with race_master.json
+// and male/female folders holding master.json and the other scripts. With --baseline, exits with 2 if
+// any rule set evaluates more than 10% slower than the same rule set in the baseline CSV.
+//
+// "batch (us)" is EvaluateBatch alone over every actor, from inputs already snapshot: with 500 actors, the
+// cost of a full reevaluation of the loaded NPCs.
+#include "Headless.h"
+#include "SyntheticActorProvider.h"
+#include "MorphEvaluationRuleSet.h"
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+	using RuleSet = daf::MorphEvaluationRuleSet;
+
+	constexpr double kRegressionTolerance = 0.1;
+
+	double ElapsedMs(Clock::time_point a_start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - a_start).count();
+	}
+
+	struct Script
+	{
+		std::string                file;
+		bool                       clear_existing{ false };
+		RuleSet::CollisionBehavior behavior{ RuleSet::CollisionBehavior::kOverwrite };
+	};
+
+	struct Source
+	{
+		std::string         name;  // <race>_<sex>
+		std::vector<Script> scripts;
+	};
+
+	struct Measurement
+	{
+		std::string name;
+		size_t      symbols{ 0 };
+		size_t      morphs{ 0 };
+		double      load_ms{ 0.0 };
+		double      actors_per_s{ 0.0 };        // AcquireInputs and EvaluateIncremental, forced
+		double      cached_actors_per_s{ 0.0 };  // Same, with unchanged inputs
+		double      batch_actors_per_s{ 0.0 };   // SnapshotBatch and EvaluateBatch
+		double      batch_us{ 0.0 };             // EvaluateBatch of every actor, on average
+		size_t      mismatches{ 0 };             // Batch results differing from incremental ones
+	};
+
+	bool IsNamed(const std::filesystem::path& a_path, const char* a_name)
+	{
+		return utils::caseInsensitiveCompare(a_path.filename().string(), a_name);
+	}
+
+	// Same layout and script order as MorphRuleSetManager::CollectSources, race folders are not resolved
+	std::vector<Source> CollectSources(const std::filesystem::path& a_rootPath)
+	{
+		std::vector<Source> sources;
+		for (auto& race_entry : std::filesystem::directory_iterator(a_rootPath)) {
+			if (!race_entry.is_directory() || race_entry.path().filename() == ".cache") {
+				continue;
+			}
+
+			std::string race_master_file;
+			for (auto& entry : std::filesystem::directory_iterator(race_entry.path())) {
+				if (entry.is_regular_file() && IsNamed(entry.path(), "race_master.json")) {
+					race_master_file = entry.path().string();
+				}
+			}
+
+			for (auto& sex_entry : std::filesystem::directory_iterator(race_entry.path())) {
+				if (!sex_entry.is_directory() || !(IsNamed(sex_entry.path(), "male") || IsNamed(sex_entry.path(), "female"))) {
+					continue;
+				}
+
+				Source source;
+				source.name = race_entry.path().filename().string() + "_" + sex_entry.path().filename().string();
+				if (!race_master_file.empty()) {
+					source.scripts.push_back({ race_master_file, true, RuleSet::CollisionBehavior::kOverwrite });
+				}
+
+				std::string              master_file;
+				std::vector<std::string> files;
+				for (auto& entry : std::filesystem::directory_iterator(sex_entry.path())) {
+					if (!entry.is_regular_file() || entry.path().extension() != ".json") {
+						continue;
+					}
+					if (IsNamed(entry.path(), "master.json")) {
+						master_file = entry.path().string();
+					} else {
+						files.push_back(entry.path().string());
+					}
+				}
+				if (master_file.empty()) {
+					logger::error("No master ruleset found in folder: '{}'", sex_entry.path().string());
+					continue;
+				}
+
+				std::sort(files.begin(), files.end());
+				source.scripts.push_back({ master_file, race_master_file.empty(), RuleSet::CollisionBehavior::kOverwrite });
+				for (auto& file : files) {
+					source.scripts.push_back({ file, false, RuleSet::CollisionBehavior::kAppend });
+				}
+				sources.push_back(std::move(source));
+			}
+		}
+
+		std::sort(sources.begin(), sources.end(), [](const Source& a_lhs, const Source& a_rhs) { return a_lhs.name < a_rhs.name; });
+		return sources;
+	}
+
+	// Runs a_pass until 300 ms have elapsed, returns actors per second
+	template <class _Pass>
+	double Throughput(size_t a_numActors, _Pass&& a_pass)
+	{
+		size_t     iterations = 0;
+		const auto start = Clock::now();
+		do {
+			a_pass();
+			++iterations;
+		} while (ElapsedMs(start) < 300.0);
+		return static_cast<double>(iterations * a_numActors) / (ElapsedMs(start) / 1000.0);
+	}
+
+	Measurement Measure(const RuleSet& a_ruleSet, std::vector<daf::SyntheticActor>& a_actors)
+	{
+		Measurement measurement;
+		measurement.symbols = a_ruleSet.GetNumSymbols();
+		measurement.morphs = a_ruleSet.GetNumMorphs();
+
+		RuleSet::InputSnapshot inputs;
+		RuleSet::ResultTable   results;
+		auto evaluate_all = [&](bool a_force) {
+			for (auto& actor : a_actors) {
+				a_ruleSet.AcquireInputs(&actor, inputs);
+				a_ruleSet.EvaluateIncremental(actor.formID, inputs, results, a_force);
+			}
+		};
+
+		measurement.actors_per_s = Throughput(a_actors.size(), [&] { evaluate_all(true); });
+		measurement.cached_actors_per_s = Throughput(a_actors.size(), [&] { evaluate_all(false); });
+
+		std::vector<daf::SyntheticActor*> pointers;
+		for (auto& actor : a_actors) {
+			pointers.push_back(&actor);
+		}
+
+		RuleSet::BatchInput  batch_input;
+		RuleSet::BatchResult batch_result;
+		measurement.batch_actors_per_s = Throughput(a_actors.size(), [&] {
+			a_ruleSet.SnapshotBatch(pointers, batch_input);
+			a_ruleSet.EvaluateBatch(batch_input, batch_result);
+		});
+		measurement.batch_us = 1e6 * a_actors.size() / Throughput(a_actors.size(), [&] { a_ruleSet.EvaluateBatch(batch_input, batch_result); });
+
+		// Unset morphs read 0 in both, setters and adders must agree with the incremental path
+		for (size_t i = 0; i < a_actors.size(); ++i) {
+			a_ruleSet.AcquireInputs(&a_actors[i], inputs);
+			a_ruleSet.EvaluateIncremental(a_actors[i].formID, inputs, results, true);
+			for (RuleSet::MorphID morph = 0; morph < measurement.morphs; ++morph) {
+				float expected = results.Contains(morph) ? results.values[morph] : 0.f;
+				float actual = batch_result.At(i, morph);
+				if (std::abs(expected - actual) > 1e-4f * std::max(1.f, std::abs(expected)) && !(std::isnan(expected) && std::isnan(actual))) {
+					++measurement.mismatches;
+				}
+			}
+		}
+		return measurement;
+	}
+
+	std::unordered_map<std::string, double> ReadBaseline(const char* a_path)
+	{
+		std::unordered_map<std::string, double> baseline;
+		std::ifstream                           file(a_path);
+		std::string                             line;
+		std::getline(file, line);  // Header
+		while (std::getline(file, line)) {
+			auto name_end = line.find(',');
+			auto rate_begin = line.rfind(',');
+			if (name_end == std::string::npos || rate_begin == name_end) {
+				continue;
+			}
+			// Last column is the forced per-actor throughput
+			baseline[line.substr(0, name_end)] = std::strtod(line.c_str() + rate_begin + 1, nullptr);
+		}
+		return baseline;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char*                     rules_folder = nullptr;
+	size_t                          num_actors = 4096;
+	const char*                     csv_path = nullptr;
+	const char*                     baseline_path = nullptr;
+	std::optional<RuleSet::Backend> backend;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string_view arg = argv[i];
+		if (arg == "--csv" && i + 1 < argc) {
+			csv_path = argv[++i];
+		} else if (arg == "--baseline" && i + 1 < argc) {
+			baseline_path = argv[++i];
+		} else if (arg == "--backend" && i + 1 < argc) {
+			backend = std::string_view(argv[++i]) == "vm" ? RuleSet::Backend::kVM : RuleSet::Backend::kExprtk;
+		} else if (arg == "--verbose") {
+			logger::g_verbose = true;
+		} else if (!rules_folder) {
+			rules_folder = argv[i];
+		} else {
+			num_actors = std::strtoul(argv[i], nullptr, 10);
+		}
+	}
+
+	if (!rules_folder || !std::filesystem::is_directory(rules_folder) || num_actors == 0) {
+		std::printf("usage: rule_harness <rules_folder> [num_actors] [--backend vm|exprtk] [--csv out.csv] [--baseline base.csv] [--verbose]\n");
+		return 1;
+	}
+
+	auto sources = CollectSources(rules_folder);
+	if (sources.empty()) {
+		std::printf("No race/sex rule folders in '%s'.\n", rules_folder);
+		return 1;
+	}
+
+	// Every rule set is loaded before the actors are generated, so they hold every input
+	daf::SyntheticActorProvider                                   provider;
+	std::vector<std::pair<std::unique_ptr<RuleSet>, Measurement>> rulesets;
+	for (auto& source : sources) {
+		auto       ruleset = std::make_unique<RuleSet>(provider);
+		const auto start = Clock::now();
+		for (auto& script : source.scripts) {
+			ruleset->ParseScript(script.file, script.clear_existing, script.behavior);
+		}
+		if (backend) {
+			ruleset->SetBackend(*backend);
+		}
+		ruleset->Optimize();
+
+		Measurement measurement;
+		measurement.name = source.name;
+		measurement.load_ms = ElapsedMs(start);
+		rulesets.emplace_back(std::move(ruleset), measurement);
+	}
+
+	auto actors = provider.GenerateActors(num_actors);
+	std::printf("%zu rule sets, %zu actors, inputs: %u actor values, %u worn keywords, %u NPC keywords, %u morphs\n",
+		rulesets.size(), num_actors,
+		provider.GetNumInputs(daf::InputType::kActorValue), provider.GetNumInputs(daf::InputType::kWornKeyword),
+		provider.GetNumInputs(daf::InputType::kNPCKeyword), provider.GetNumInputs(daf::InputType::kMorph));
+	std::printf("%-32s %8s %8s %10s %14s %14s %14s %10s %10s\n", "rule set", "symbols", "morphs", "load (ms)", "actors/s", "cached/s", "batch/s", "batch (us)", "mismatches");
+
+	size_t total_mismatches = 0;
+	for (auto& [ruleset, measurement] : rulesets) {
+		auto name = measurement.name;
+		auto load_ms = measurement.load_ms;
+		measurement = Measure(*ruleset, actors);
+		measurement.name = name;
+		measurement.load_ms = load_ms;
+		total_mismatches += measurement.mismatches;
+
+		std::printf("%-32s %8zu %8zu %10.2f %14.4e %14.4e %14.4e %10.1f %10zu\n", measurement.name.c_str(), measurement.symbols, measurement.morphs,
+			measurement.load_ms, measurement.actors_per_s, measurement.cached_actors_per_s, measurement.batch_actors_per_s, measurement.batch_us, measurement.mismatches);
+	}
+
+	if (csv_path) {
+		std::ofstream file(csv_path, std::ios::trunc);
+		file << "rule_set,symbols,morphs,load_ms,cached_actors_per_s,batch_actors_per_s,batch_us,actors_per_s\n";
+		for (auto& [ruleset, m] : rulesets) {
+			file << std::format("{},{},{},{:.3f},{:.1f},{:.1f},{:.1f},{:.1f}\n", m.name, m.symbols, m.morphs, m.load_ms, m.cached_actors_per_s, m.batch_actors_per_s, m.batch_us, m.actors_per_s);
+		}
+	}
+
+	int status = total_mismatches ? 1 : 0;
+	if (baseline_path) {
+		auto baseline = ReadBaseline(baseline_path);
+		for (auto& [ruleset, m] : rulesets) {
+			auto it = baseline.find(m.name);
+			if (it == baseline.end() || it->second <= 0.0) {
+				continue;
+			}
+			double change = m.actors_per_s / it->second - 1.0;
+			if (change < -kRegressionTolerance) {
+				std::printf("Regression in %s: %.4e actors/s, baseline %.4e (%.1f%%)\n", m.name.c_str(), m.actors_per_s, it->second, change * 100.0);
+				status = 2;
+			}
+		}
+	}
+	return status;
+}
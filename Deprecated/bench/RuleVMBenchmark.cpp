@@ -0,0 +1,307 @@
+// Compares exprtk and the rule VM (RuleVM.h) on the same rules: compile time, memory per rule and evaluation throughput.
+//
+//   cmake -S Deprecated/bench -B build-bench -DCMAKE_BUILD_TYPE=Release && cmake --build build-bench
+//   ./build-bench/rule_vm_bench [rules.txt] [num_actors]
+//
+// rules.txt holds one expression per line, by default a synthetic rule pack is generated.
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <malloc.h>
+#include <new>
+#include <numbers>
+#include <optional>
+#include <random>
+#include <set>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "exprtk.hpp"
+#include "RuleOptimizer.h"
+#include "RuleVM.h"
+
+// Live heap bytes, to measure what compiled expressions keep allocated
+static size_t g_heap_bytes = 0;
+
+void* operator new(size_t a_size)
+{
+	void* ptr = std::malloc(a_size ? a_size : 1);
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	g_heap_bytes += malloc_usable_size(ptr);
+	return ptr;
+}
+
+void operator delete(void* a_ptr) noexcept
+{
+	if (a_ptr) {
+		g_heap_bytes -= malloc_usable_size(a_ptr);
+		std::free(a_ptr);
+	}
+}
+
+void operator delete(void* a_ptr, size_t) noexcept
+{
+	operator delete(a_ptr);
+}
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	double ElapsedMs(Clock::time_point a_start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - a_start).count();
+	}
+
+	// Shaped like real rule packs: weighted sums of actor values and morphs, clamped, with keyword switches
+	std::vector<std::string> GenerateRules(size_t a_numRules, size_t a_numSymbols)
+	{
+		std::mt19937 rng(42);
+		auto symbol = [&] { return "v" + std::to_string(rng() % a_numSymbols); };
+		auto weight = [&] { return std::to_string((rng() % 100) / 100.0).substr(0, 4); };
+
+		std::vector<std::string> rules;
+		for (size_t i = 0; i < a_numRules; ++i) {
+			switch (rng() % 6) {
+			case 0:
+				rules.push_back("clamp(0, " + symbol() + " * " + weight() + " + " + symbol() + " * " + weight() + ", 1)");
+				break;
+			case 1:
+				rules.push_back("max(0, " + symbol() + " - 0.5) * 2 - min(" + symbol() + ", " + symbol() + ") * " + weight());
+				break;
+			case 2:
+				rules.push_back("(" + symbol() + " > 0.5 ? " + symbol() + " * " + weight() + " : 0) + " + symbol() + " * 0.1");
+				break;
+			case 3:
+				rules.push_back("(" + symbol() + " + " + symbol() + ") / 2 - " + symbol() + " * " + weight());
+				break;
+			case 4:
+				rules.push_back("abs(" + symbol() + " - " + symbol() + ") * " + weight() + " + (" + symbol() + " and " + symbol() + ") * 0.2");
+				break;
+			default:
+				rules.push_back("clamp(0, " + symbol() + " ^ 2 * " + weight() + " - " + symbol() + " / 3, 1)");
+				break;
+			}
+		}
+		return rules;
+	}
+
+	std::vector<std::string> ReadRules(const char* a_path)
+	{
+		std::vector<std::string> rules;
+		std::ifstream            file(a_path);
+		for (std::string line; std::getline(file, line);) {
+			if (!line.empty() && line[0] != '#') {
+				rules.push_back(line);
+			}
+		}
+		return rules;
+	}
+
+	std::vector<std::string> CollectSymbols(const std::vector<std::string>& a_rules)
+	{
+		std::set<std::string> symbols;
+		for (auto& rule : a_rules) {
+			std::vector<std::string> variables;
+			exprtk::collect_variables(rule, variables);
+			symbols.insert(variables.begin(), variables.end());
+		}
+		return { symbols.begin(), symbols.end() };
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const auto   rules = argc > 1 ? ReadRules(argv[1]) : GenerateRules(2000, 64);
+	const size_t num_actors = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4096;
+	const auto   symbols = CollectSymbols(rules);
+	if (rules.empty() || num_actors == 0) {
+		std::printf("No rules or actors.\n");
+		return 1;
+	}
+
+	std::unordered_map<std::string, uint32_t> symbol_ids;
+	for (uint32_t i = 0; i < symbols.size(); ++i) {
+		symbol_ids[symbols[i]] = i;
+	}
+
+	// Actor inputs, one row per actor
+	std::mt19937                          rng(7);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+	std::vector<float>                    inputs(num_actors * symbols.size());
+	for (auto& value : inputs) {
+		value = (rng() % 4 == 0) ? static_cast<float>(rng() % 2) : dist(rng);
+	}
+
+	// exprtk
+	std::vector<float>          exprtk_values(symbols.size());
+	exprtk::symbol_table<float> symbol_table;
+	symbol_table.add_constants();
+	for (uint32_t i = 0; i < symbols.size(); ++i) {
+		symbol_table.add_variable(symbols[i], exprtk_values[i]);
+	}
+
+	std::deque<exprtk::expression<float>> expressions;
+	size_t                                heap_before = g_heap_bytes;
+	auto                                  start = Clock::now();
+	{
+		exprtk::parser<float> parser;
+		for (auto& rule : rules) {
+			auto& expr = expressions.emplace_back();
+			expr.register_symbol_table(symbol_table);
+			if (!parser.compile(rule, expr)) {
+				std::printf("exprtk failed to compile '%s': %s\n", rule.c_str(), parser.error().c_str());
+				return 1;
+			}
+		}
+	}
+	const double exprtk_compile_ms = ElapsedMs(start);
+	const size_t exprtk_bytes = g_heap_bytes - heap_before;
+
+	// VM
+	heap_before = g_heap_bytes;
+	start = Clock::now();
+	std::vector<uint32_t>      chunks;
+	std::optional<daf::vm::Program> program;
+	{
+		daf::vm::Compiler compiler(static_cast<uint32_t>(symbols.size()), [&](std::string_view a_symbol) -> std::optional<daf::vm::Register> {
+			if (auto it = symbol_ids.find(std::string(a_symbol)); it != symbol_ids.end()) {
+				return static_cast<daf::vm::Register>(it->second);
+			}
+			return std::nullopt;
+		});
+		for (auto& rule : rules) {
+			chunks.push_back(compiler.Add(rule));
+		}
+		program = compiler.Finish();
+	}
+	const double vm_compile_ms = ElapsedMs(start);
+	const size_t vm_bytes = g_heap_bytes - heap_before;
+	if (!program) {
+		std::printf("Program needs too many registers.\n");
+		return 1;
+	}
+
+	const size_t num_compiled = std::count_if(chunks.begin(), chunks.end(), [](uint32_t a_chunk) { return a_chunk != daf::vm::Program::kNoChunk; });
+
+	std::vector<float> registers(program->GetNumRegisters());
+	program->InitRegisters(registers.data());
+
+	// Evaluates every rule for every actor, returns the checksum of the results
+	auto run_exprtk = [&](std::vector<float>* a_out) {
+		double sum = 0.0;
+		for (size_t actor = 0; actor < num_actors; ++actor) {
+			std::copy_n(inputs.data() + actor * symbols.size(), symbols.size(), exprtk_values.begin());
+			for (size_t i = 0; i < rules.size(); ++i) {
+				float value = expressions[i].value();
+				sum += value;
+				if (a_out) {
+					a_out->push_back(value);
+				}
+			}
+		}
+		return sum;
+	};
+
+	auto run_vm = [&](std::vector<float>* a_out) {
+		double sum = 0.0;
+		for (size_t actor = 0; actor < num_actors; ++actor) {
+			std::copy_n(inputs.data() + actor * symbols.size(), symbols.size(), registers.begin());
+			for (size_t i = 0; i < rules.size(); ++i) {
+				float value = chunks[i] != daf::vm::Program::kNoChunk ? program->Run(chunks[i], registers.data()) : expressions[i].value();
+				sum += value;
+				if (a_out) {
+					a_out->push_back(value);
+				}
+			}
+		}
+		return sum;
+	};
+
+	std::vector<daf::vm::Lanes> lanes(program->GetNumRegisters());
+	program->InitRegisters(lanes.data());
+
+	auto run_vm_lanes = [&](std::vector<float>* a_out) {
+		double sum = 0.0;
+		if (a_out) {
+			a_out->assign(num_actors * rules.size(), 0.f);
+		}
+		for (size_t first = 0; first < num_actors; first += daf::vm::kLanes) {
+			const size_t count = std::min(daf::vm::kLanes, num_actors - first);
+			for (size_t symbol = 0; symbol < symbols.size(); ++symbol) {
+				for (size_t lane = 0; lane < daf::vm::kLanes; ++lane) {
+					lanes[symbol].v[lane] = inputs[(first + std::min(lane, count - 1)) * symbols.size() + symbol];
+				}
+			}
+			for (size_t i = 0; i < rules.size(); ++i) {
+				if (chunks[i] == daf::vm::Program::kNoChunk) {
+					continue;
+				}
+				program->Run(chunks[i], lanes.data());
+				auto& result = lanes[program->GetChunk(chunks[i]).result];
+				for (size_t lane = 0; lane < count; ++lane) {
+					sum += result.v[lane];
+					if (a_out) {
+						(*a_out)[(first + lane) * rules.size() + i] = result.v[lane];
+					}
+				}
+			}
+		}
+		return sum;
+	};
+
+	// Results must match exprtk
+	std::vector<float> expected, scalar, batched;
+	run_exprtk(&expected);
+	run_vm(&scalar);
+	run_vm_lanes(&batched);
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < expected.size(); ++i) {
+		if (chunks[i % rules.size()] == daf::vm::Program::kNoChunk) {
+			continue;
+		}
+		for (float value : { scalar[i], batched[i] }) {
+			bool same = value == expected[i] || (std::isnan(value) && std::isnan(expected[i])) ||
+			            std::abs(value - expected[i]) <= 1e-5f * std::max(1.f, std::abs(expected[i]));
+			if (!same && mismatches++ < 10) {
+				std::printf("Mismatch in '%s': exprtk %g, vm %g\n", rules[i % rules.size()].c_str(), expected[i], value);
+			}
+		}
+	}
+
+	auto throughput = [&](auto&& a_run) {
+		volatile double sink = 0.0;
+		size_t          iterations = 0;
+		auto            begin = Clock::now();
+		do {
+			sink = sink + a_run(nullptr);
+			++iterations;
+		} while (ElapsedMs(begin) < 500.0);
+		return static_cast<double>(iterations * num_actors * rules.size()) / (ElapsedMs(begin) / 1000.0);
+	};
+
+	const double exprtk_rate = throughput(run_exprtk);
+	const double vm_rate = throughput(run_vm);
+	const double lanes_rate = throughput(run_vm_lanes);
+
+	std::printf("%zu rules, %zu symbols, %zu actors, %zu rules compiled to bytecode\n", rules.size(), symbols.size(), num_actors, num_compiled);
+	std::printf("%-12s %14s %16s %22s\n", "backend", "compile (ms)", "bytes per rule", "rule evaluations/s");
+	std::printf("%-12s %14.2f %16.1f %22.3e\n", "exprtk", exprtk_compile_ms, static_cast<double>(exprtk_bytes) / rules.size(), exprtk_rate);
+	std::printf("%-12s %14.2f %16.1f %22.3e\n", "vm", vm_compile_ms, static_cast<double>(program->GetMemoryUsage()) / rules.size(), vm_rate);
+	std::printf("%-12s %14s %16s %22.3e\n", "vm lanes", "", "", lanes_rate);
+	std::printf("vm compiler peak allocations: %zu bytes, mismatches: %zu\n", vm_bytes, mismatches);
+	return mismatches ? 1 : 0;
+}
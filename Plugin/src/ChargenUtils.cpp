@@ -1,4 +1,6 @@
 #include "ChargenUtils.h"
+#include "RebuildTelemetry.h"
+#include "PendingAppearance.h"
 
 //
 // Getters of NPC/Actor data
@@ -134,12 +136,20 @@ std::string chargen::getStringTypeFromAVM(RE::AVMData::Type type)
 
 void chargen::updateActorAppearance(RE::Actor* actor)
 {
-	static std::atomic<bool> updateQueued = false;
-	if (updateQueued.load())
+	static std::atomic<bool>          updateQueued = false;
+	static std::atomic<RE::TESFormID> queuedActor = 0;
+	auto&                             telemetry = telemetry::RebuildTelemetry::GetSingleton();
+	if (PendingAppearance::GetSingleton().DeferRebuild(actor, telemetry::RebuildType::kChargen)) {
 		return;
+	}
+	if (updateQueued.load()) {
+		telemetry.Skip(telemetry::RebuildType::kChargen, actor->formID, queuedActor == actor->formID);
+		return;
+	}
 
 	updateQueued = true;
-	SFSE::GetTaskInterface()->AddTask([actorSmartPtr = RE::NiPointer<RE::Actor>(actor)] {
+	queuedActor = actor->formID;
+	telemetry.Submit(telemetry::RebuildType::kChargen, actor, [actorSmartPtr = RE::NiPointer<RE::Actor>(actor)] {
 		actorSmartPtr->UpdateChargenAppearance();
 		updateQueued = false;
 	});
@@ -147,14 +157,16 @@ void chargen::updateActorAppearance(RE::Actor* actor)
 
 void chargen::updateActorAppearanceFully(RE::Actor* actor, bool updateBody, bool raceChange)
 {
-	static std::atomic<bool> updateQueued = false;
-	if (updateQueued.load())
+	auto type = raceChange ? telemetry::RebuildType::kAppearanceRace :
+	            updateBody ? telemetry::RebuildType::kAppearanceBody :
+	                         telemetry::RebuildType::kAppearance;
+	if (PendingAppearance::GetSingleton().DeferRebuild(actor, type)) {
 		return;
+	}
 
-	SFSE::GetTaskInterface()->AddTask(
+	telemetry::RebuildTelemetry::GetSingleton().Submit(type, actor,
 		[actorSmartPtr = RE::NiPointer<RE::Actor>(actor), updateBody, raceChange]() {
 			actorSmartPtr->UpdateAppearance(updateBody, 0u, raceChange);
-			updateQueued = false;
 		});
 }
 
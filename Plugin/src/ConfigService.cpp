@@ -0,0 +1,184 @@
+#include "ConfigService.h"
+#include "LogWrapper.h"
+#include "Utils.h"
+
+const char* config::GetFolderName(Folder a_folder)
+{
+	switch (a_folder) {
+	case Folder::kChargen:
+		return "Chargen";
+	case Folder::kPresets:
+		return "Presets";
+	case Folder::kExpressions:
+		return "Expressions";
+	default:
+		return "Unknown";
+	}
+}
+
+config::ConfigService::ConfigService()
+{
+	auto plugin_folder = utils::GetPluginFolder();
+	for (size_t i = 0; i < m_paths.size(); ++i) {
+		m_paths[i] = plugin_folder + "\\" + GetFolderName(static_cast<Folder>(i));
+	}
+	m_wake = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+}
+
+config::ConfigService::~ConfigService()
+{
+	// Never joined here, like the logger's sink thread. The watcher exits on its own, so m_wake stays open for it.
+	if (m_watcher.joinable()) {
+		m_watcher.request_stop();
+		SetEvent(m_wake);
+		m_watcher.detach();
+	}
+}
+
+void config::ConfigService::Start(std::chrono::milliseconds a_pollInterval)
+{
+	Stop();
+	for (size_t i = 0; i < m_paths.size(); ++i) {
+		Reload(static_cast<Folder>(i));
+	}
+	m_watcher = std::jthread([this, a_pollInterval](std::stop_token a_stop) {
+		this->_watch(a_stop, a_pollInterval);
+	});
+}
+
+void config::ConfigService::Stop()
+{
+	if (m_watcher.joinable()) {
+		m_watcher.request_stop();
+		SetEvent(m_wake);
+		m_watcher.join();
+	}
+}
+
+bool config::ConfigService::Reload(Folder a_folder)
+{
+	std::shared_ptr<const Snapshot> published;
+	size_t                          parsed = 0;
+	{
+		std::lock_guard lock(m_scan_lock);
+		auto&           path = m_paths[static_cast<size_t>(a_folder)];
+		auto            previous = Get(a_folder);
+
+		std::error_code ec;
+		if (!std::filesystem::exists(path, ec)) {
+			std::filesystem::create_directories(path, ec);
+		}
+
+		auto snapshot = std::make_shared<Snapshot>();
+		for (auto it = std::filesystem::directory_iterator(path, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+			if (!it->is_regular_file(ec)) {
+				continue;
+			}
+			const auto size = it->file_size(ec);
+			const auto write_time = it->last_write_time(ec);
+
+			// Unchanged files are shared with the previous snapshot
+			std::shared_ptr<const ConfigFile> file;
+			if (previous) {
+				auto match = std::find_if(previous->files.begin(), previous->files.end(), [&](const auto& a_file) { return a_file->path == it->path(); });
+				if (match != previous->files.end() && (*match)->size == size && (*match)->write_time == write_time) {
+					file = *match;
+				}
+			}
+			if (!file) {
+				file = _parse(it->path(), size, write_time);
+				++parsed;
+			}
+			snapshot->files.push_back(std::move(file));
+		}
+		std::sort(snapshot->files.begin(), snapshot->files.end(), [](const auto& a_lhs, const auto& a_rhs) {
+			return a_lhs->path.filename() < a_rhs->path.filename();
+		});
+
+		// Nothing parsed and as many files: none was added, changed or removed
+		if (previous && !parsed && previous->files.size() == snapshot->files.size()) {
+			return false;
+		}
+
+		snapshot->version = previous ? previous->version + 1 : 1;
+		published = snapshot;
+		m_snapshots[static_cast<size_t>(a_folder)].store(std::move(snapshot), std::memory_order_release);
+	}
+
+	logger::info("Loaded config folder '{}', {} files, {} parsed", GetFolderName(a_folder), published->files.size(), parsed);
+	ConfigChangedEvent event;
+	event.folder = a_folder;
+	event.snapshot = std::move(published);
+	Dispatch(std::move(event));
+	return true;
+}
+
+void config::ConfigService::_watch(std::stop_token a_stop, std::chrono::milliseconds a_pollInterval)
+{
+	// The wake event first, then one change notification per folder that can be watched
+	std::vector<HANDLE> handles{ m_wake };
+	std::vector<Folder> watched;
+	std::vector<Folder> polled;
+	for (size_t i = 0; i < m_paths.size(); ++i) {
+		auto handle = FindFirstChangeNotificationA(m_paths[i].c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+		if (handle == INVALID_HANDLE_VALUE) {
+			logger::warn("Can't watch config folder '{}', polling it every {} ms", m_paths[i], a_pollInterval.count());
+			polled.push_back(static_cast<Folder>(i));
+			continue;
+		}
+		handles.push_back(handle);
+		watched.push_back(static_cast<Folder>(i));
+	}
+
+	// Polled folders are due by time, watched folders signalling may keep waits from ever timing out
+	auto last_poll = std::chrono::steady_clock::now();
+	while (!a_stop.stop_requested()) {
+		DWORD timeout = INFINITE;
+		if (!polled.empty()) {
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(last_poll + a_pollInterval - std::chrono::steady_clock::now());
+			timeout = static_cast<DWORD>(std::max<int64_t>(remaining.count(), 0));
+		}
+		const DWORD result = WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE, timeout);
+		if (a_stop.stop_requested()) {
+			break;
+		}
+
+		if (!polled.empty() && std::chrono::steady_clock::now() - last_poll >= a_pollInterval) {
+			for (auto folder : polled) {
+				Reload(folder);
+			}
+			last_poll = std::chrono::steady_clock::now();
+		}
+
+		if (result > WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + handles.size()) {
+			std::this_thread::sleep_for(SettleTime);
+			FindNextChangeNotification(handles[result - WAIT_OBJECT_0]);  // Before reloading, so later writes signal again
+			Reload(watched[result - WAIT_OBJECT_0 - 1]);
+		} else if (result == WAIT_FAILED) {
+			logger::error("Stopped watching config folders, error {}", GetLastError());
+			break;
+		}
+	}
+
+	for (size_t i = 1; i < handles.size(); ++i) {
+		FindCloseChangeNotification(handles[i]);
+	}
+}
+
+std::shared_ptr<const config::ConfigFile> config::ConfigService::_parse(const std::filesystem::path& a_path, uintmax_t a_size, std::filesystem::file_time_type a_writeTime)
+{
+	auto file = std::make_shared<ConfigFile>();
+	file->path = a_path;
+	file->size = a_size;
+	file->write_time = a_writeTime;
+
+	std::ifstream ifs(a_path);
+	try {
+		file->data = nlohmann::json::parse(ifs);
+	} catch (nlohmann::json::parse_error& ex) {
+		logger::warn("Config '{}' isn't valid JSON: {}", a_path.string(), ex.what());
+		file->data = nlohmann::json();
+		file->data["Name"] = a_path.filename().string() + " PARSING ERROR";
+	}
+	return file;
+}
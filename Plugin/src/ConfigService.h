@@ -0,0 +1,99 @@
+#pragma once
+#include "EventDispatcher.h"
+#include "SingletonBase.h"
+
+#include <nlohmann/json.hpp>
+
+namespace config
+{
+	enum class Folder : uint8_t
+	{
+		kChargen,      // Tabs of the Custom chargen tab
+		kPresets,      // Presets of the Custom chargen tab
+		kExpressions,  // Poses of ExpressionBlender
+		kTotal
+	};
+
+	// Subfolder of the plugin folder
+	const char* GetFolderName(Folder a_folder);
+
+	// A parsed file, shared by every snapshot it is unchanged in
+	struct ConfigFile
+	{
+		std::filesystem::path           path;
+		std::filesystem::file_time_type write_time;
+		uintmax_t                       size{ 0 };
+		nlohmann::json                  data;  // Only a "Name" ending in PARSING ERROR if the file isn't valid JSON
+	};
+
+	// The files of a folder at the time of a scan, never modified once published
+	struct Snapshot
+	{
+		std::vector<std::shared_ptr<const ConfigFile>> files;  // By file name
+		uint64_t                                       version{ 0 };  // Of the folder, bumped by every change
+
+		size_t size() const { return files.size(); }
+
+		const nlohmann::json& operator[](size_t a_index) const { return files[a_index]->data; }
+	};
+
+	// Dispatched once a changed folder is published, on the thread that scanned it
+	class ConfigChangedEvent : public events::EventBase
+	{
+	public:
+		Folder                          folder{ Folder::kTotal };
+		std::shared_ptr<const Snapshot> snapshot;
+	};
+
+	// JSON files of the config folders, parsed once and kept up to date in the background.
+	//
+	// A watcher thread waits for change notifications of the folders, or polls the ones that can't be watched, and
+	// reparses only the files whose size or modification time changed. Each folder is published as an immutable
+	// snapshot, which readers like the UI load without waiting for scans and can keep as long as they need it.
+	class ConfigService :
+		public utils::SingletonBase<ConfigService>,
+		public events::EventDispatcher<ConfigChangedEvent>
+	{
+		friend class utils::SingletonBase<ConfigService>;
+
+	public:
+		static constexpr auto SettleTime = std::chrono::milliseconds(100);  // Editors may write a file in several steps
+
+		virtual ~ConfigService();
+
+		// Loads every folder, dispatching a ConfigChangedEvent for each, then starts watching them
+		void Start(std::chrono::milliseconds a_pollInterval = std::chrono::milliseconds(1000));
+
+		// Joins the watcher. The destructor only tells it to stop, as joining from a static destructor deadlocks on DLL unload.
+		void Stop();
+
+		// Empty until Start. Safe on any thread and never waits for a scan, but not lock free everywhere: MSVC's
+		// std::atomic<std::shared_ptr> takes an internal spinlock, held only to copy the pointer.
+		std::shared_ptr<const Snapshot> Get(Folder a_folder) const
+		{
+			return m_snapshots[static_cast<size_t>(a_folder)].load(std::memory_order_acquire);
+		}
+
+		// Rescans a_folder now, like after writing a file to it, returns whether it changed
+		bool Reload(Folder a_folder);
+
+		const std::string& GetPath(Folder a_folder) const
+		{
+			return m_paths[static_cast<size_t>(a_folder)];
+		}
+
+	private:
+		ConfigService();
+
+		void _watch(std::stop_token a_stop, std::chrono::milliseconds a_pollInterval);
+
+		static std::shared_ptr<const ConfigFile> _parse(const std::filesystem::path& a_path, uintmax_t a_size, std::filesystem::file_time_type a_writeTime);
+
+		std::array<std::string, static_cast<size_t>(Folder::kTotal)>                                  m_paths;
+		std::array<std::atomic<std::shared_ptr<const Snapshot>>, static_cast<size_t>(Folder::kTotal)> m_snapshots;
+
+		std::mutex   m_scan_lock;        // Reload runs on the watcher and on callers
+		HANDLE       m_wake{ nullptr };  // Signaled by Stop
+		std::jthread m_watcher;
+	};
+}
@@ -28,19 +28,28 @@ namespace events
 		std::vector<std::weak_ptr<Listener>> listeners;
 		std::vector<Listener*>               singleton_listeners;
 		std::mutex                           mtx;
+		std::atomic<uint32_t>                listener_count{ 0 };
 
 		void AddListener(std::shared_ptr<Listener> a_listener)
 		{
-			std::lock_guard lock(mtx);
-			listeners.emplace_back(a_listener);
+			{
+				std::lock_guard lock(mtx);
+				listeners.emplace_back(a_listener);
+				_update_listener_count();
+			}
+			_on_listener_added();
 		}
 
 		void AddStaticListener(Listener* a_listener)
 		{
-			std::lock_guard lock(mtx);
-			if (std::find(singleton_listeners.begin(), singleton_listeners.end(), a_listener) == singleton_listeners.end()) {
-				singleton_listeners.emplace_back(a_listener);
+			{
+				std::lock_guard lock(mtx);
+				if (std::find(singleton_listeners.begin(), singleton_listeners.end(), a_listener) == singleton_listeners.end()) {
+					singleton_listeners.emplace_back(a_listener);
+				}
+				_update_listener_count();
 			}
+			_on_listener_added();
 		}
 
 		void RemoveListener(Listener* a_listener)
@@ -63,6 +72,18 @@ namespace events
 				std::remove(singleton_listeners.begin(), singleton_listeners.end(), a_listener),
 				singleton_listeners.end()
 			);
+			_update_listener_count();
+		}
+
+		// Lock-free, may briefly lag behind Add/Remove on other threads
+		bool HasListeners() const
+		{
+			return listener_count.load(std::memory_order_relaxed) != 0;
+		}
+
+		uint32_t NumListeners() const
+		{
+			return listener_count.load(std::memory_order_relaxed);
 		}
 
 		void Dispatch(_Event_T a_event)
@@ -86,5 +107,15 @@ namespace events
 				singleton_listener->OnEvent(a_event, this);
 			}
 		}
+
+	protected:
+		// Called after a listener is added, outside of mtx
+		virtual void _on_listener_added() {}
+
+		// Expired weak listeners are still counted until removed, which only costs an empty dispatch
+		void _update_listener_count()
+		{
+			listener_count.store(static_cast<uint32_t>(listeners.size() + singleton_listeners.size()), std::memory_order_relaxed);
+		}
 	};
 }
\ No newline at end of file
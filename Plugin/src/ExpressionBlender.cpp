@@ -0,0 +1,192 @@
+#include "ExpressionBlender.h"
+#include "ChargenUtils.h"
+
+void chargen::ExpressionBlender::Register()
+{
+	events::ActorUpdatedEventDispatcher::GetSingleton()->EventDispatcher<events::ActorUpdateEvent>::AddStaticListener(this);
+	config::ConfigService::GetSingleton().AddStaticListener(this);
+}
+
+chargen::ExpressionBlender::PoseID chargen::ExpressionBlender::AddPose(std::string_view a_name, std::span<const float> a_morphs)
+{
+	std::unique_lock lock(m_poses_lock);
+	auto [it, inserted] = m_pose_ids.try_emplace(std::string(a_name), static_cast<PoseID>(m_poses.size()));
+	if (inserted) {
+		m_poses.push_back(std::make_unique<ExpressionPose>());
+	} else {
+		m_poses_version.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	auto& pose = *m_poses[it->second];
+	pose.morphs.fill(0.f);
+	std::copy_n(a_morphs.begin(), std::min(a_morphs.size(), pose.morphs.size()), pose.morphs.begin());
+	return it->second;
+}
+
+chargen::ExpressionBlender::PoseID chargen::ExpressionBlender::FindPose(std::string_view a_name)
+{
+	std::shared_lock lock(m_poses_lock);
+	auto             it = m_pose_ids.find(std::string(a_name));
+	return it != m_pose_ids.end() ? it->second : InvalidPose;
+}
+
+std::vector<std::string> chargen::ExpressionBlender::GetPoseNames()
+{
+	std::shared_lock         lock(m_poses_lock);
+	std::vector<std::string> names(m_poses.size());
+	for (auto& [name, id] : m_pose_ids) {
+		names[id] = name;
+	}
+	return names;
+}
+
+size_t chargen::ExpressionBlender::LoadPoses(const config::Snapshot& a_configs)
+{
+	size_t count = 0;
+	for (auto& file : a_configs.files) {
+		auto& data = file->data;
+		auto  name = data.value("Name", std::string("?"));
+		try {
+			auto morphs = data.at("Morphs").get<std::vector<float>>();
+			if (morphs.size() > ExpressionPose::NumMorphs) {
+				logger::warn("Expression '{}' has {} morphs, only the first {} are used", name, morphs.size(), ExpressionPose::NumMorphs);
+			}
+			AddPose(name, morphs);
+			++count;
+		} catch (nlohmann::json::exception& ex) {
+			logger::warn("Expression '{}' skipped: {}", name, ex.what());
+		}
+	}
+	logger::info("Loaded {} expressions", count);
+	return count;
+}
+
+void chargen::ExpressionBlender::SetWeight(RE::Actor* a_actor, PoseID a_pose, float a_weight)
+{
+	Actors_T::accessor acc;
+	if (a_weight == 0.f) {
+		if (!m_actors.find(acc, a_actor->formID)) {
+			return;
+		}
+	} else {
+		m_actors.insert(acc, a_actor->formID);
+	}
+
+	auto& layers = acc->second.layers;
+	auto  layer = std::find_if(layers.begin(), layers.end(), [&](const auto& a_layer) { return a_layer.first == a_pose; });
+	if (layer == layers.end()) {
+		if (a_weight == 0.f) {
+			return;
+		}
+		layers.emplace_back(a_pose, a_weight);
+	} else if (a_weight == 0.f) {
+		*layer = layers.back();
+		layers.pop_back();
+	} else {
+		layer->second = a_weight;
+	}
+	acc->second.poses_version = 0;
+}
+
+float chargen::ExpressionBlender::GetWeight(RE::Actor* a_actor, PoseID a_pose)
+{
+	Actors_T::const_accessor acc;
+	if (!m_actors.find(acc, a_actor->formID)) {
+		return 0.f;
+	}
+
+	for (auto& [pose, weight] : acc->second.layers) {
+		if (pose == a_pose) {
+			return weight;
+		}
+	}
+	return 0.f;
+}
+
+void chargen::ExpressionBlender::Clear(RE::Actor* a_actor)
+{
+	Actors_T::accessor acc;
+	if (m_actors.find(acc, a_actor->formID)) {
+		acc->second.layers.clear();
+		acc->second.poses_version = 0;
+	}
+}
+
+void chargen::ExpressionBlender::OnEvent(const events::ActorUpdateEvent& a_event, events::EventDispatcher<events::ActorUpdateEvent>* a_dispatcher)
+{
+	// Every actor update of the game comes through here, most of them with no expression at all
+	if (m_actors.empty()) {
+		return;
+	}
+
+	Actors_T::accessor acc;
+	if (!m_actors.find(acc, a_event.actor->formID)) {
+		return;
+	}
+
+	auto facegenMorphs = getPerformanceMorphs(a_event.actor);
+	if (facegenMorphs == nullptr) {
+		return;
+	}
+
+	auto& expression = acc->second;
+	if (expression.poses_version != m_poses_version.load(std::memory_order_relaxed)) {
+		_blend(expression);
+	}
+	std::memcpy(facegenMorphs, expression.blended.morphs.data(), sizeof(expression.blended.morphs));
+
+	// Cleared, the zeroed morphs are written once
+	if (expression.layers.empty()) {
+		m_actors.erase(acc);
+	}
+}
+
+void chargen::ExpressionBlender::OnEvent(const config::ConfigChangedEvent& a_event, events::EventDispatcher<config::ConfigChangedEvent>* a_dispatcher)
+{
+	if (a_event.folder == config::Folder::kExpressions) {
+		LoadPoses(*a_event.snapshot);
+	}
+}
+
+void chargen::ExpressionBlender::_blend(ActorExpression& a_expression)
+{
+	thread_local std::vector<const ExpressionPose*> poses;
+	thread_local std::vector<float>                 weights;
+	poses.clear();
+	weights.clear();
+
+	std::shared_lock lock(m_poses_lock);
+	a_expression.poses_version = m_poses_version.load(std::memory_order_relaxed);
+	for (auto& [pose, weight] : a_expression.layers) {
+		if (pose < m_poses.size()) {
+			poses.push_back(m_poses[pose].get());
+			weights.push_back(weight);
+		}
+	}
+	Blend(a_expression.blended, poses.data(), weights.data(), poses.size());
+}
+
+void chargen::ExpressionBlender::Blend(ExpressionPose& a_out, const ExpressionPose* const* a_poses, const float* a_weights, size_t a_count)
+{
+	static_assert(ExpressionPose::NumMorphs % 4 == 0);
+
+#ifdef EC_EXPRESSION_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	for (size_t i = 0; i < ExpressionPose::NumMorphs; i += 4) {
+		__m128 sum = zero;
+		for (size_t pose = 0; pose < a_count; ++pose) {
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(&a_poses[pose]->morphs[i]), _mm_set1_ps(a_weights[pose])));
+		}
+		_mm_store_ps(&a_out.morphs[i], _mm_min_ps(_mm_max_ps(sum, zero), one));
+	}
+#else
+	for (size_t i = 0; i < ExpressionPose::NumMorphs; ++i) {
+		float sum = 0.f;
+		for (size_t pose = 0; pose < a_count; ++pose) {
+			sum += a_poses[pose]->morphs[i] * a_weights[pose];
+		}
+		a_out.morphs[i] = std::clamp(sum, 0.f, 1.f);
+	}
+#endif
+}
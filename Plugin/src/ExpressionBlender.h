@@ -0,0 +1,91 @@
+#pragma once
+#include "SFEventHandler.h"
+#include "SingletonBase.h"
+#include "NiAVObject.h"
+#include "ConfigService.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#	include <emmintrin.h>
+#	define EC_EXPRESSION_SSE2
+#endif
+
+namespace chargen
+{
+	// A facial expression, one value per performance morph of BSFaceGenAnimationData
+	struct alignas(16) ExpressionPose
+	{
+		static constexpr size_t NumMorphs = RE::BSFaceGenAnimationData::morphSize;
+
+		std::array<float, NumMorphs> morphs{};
+	};
+
+	// Blends weighted expression poses of actors into their facegen performance morphs on every actor update.
+	//
+	// The morphs are written in place, so nothing is rebuilt and an expression costs the same for one actor or a
+	// crowd. The blend of an actor is recomputed only when its weights or a pose change, other updates copy it over
+	// whatever the game wrote, which keeps the expression held through the game's own facial animation.
+	class ExpressionBlender :
+		public utils::SingletonBase<ExpressionBlender>,
+		public events::EventDispatcher<events::ActorUpdateEvent>::Listener,
+		public events::EventDispatcher<config::ConfigChangedEvent>::Listener
+	{
+		friend class utils::SingletonBase<ExpressionBlender>;
+
+	public:
+		using PoseID = uint32_t;
+
+		static constexpr PoseID InvalidPose = std::numeric_limits<PoseID>::max();
+
+		void Register();
+
+		// Adds the pose a_name or replaces its morphs, the ones past a_morphs are 0
+		PoseID AddPose(std::string_view a_name, std::span<const float> a_morphs);
+
+		PoseID FindPose(std::string_view a_name);
+
+		std::vector<std::string> GetPoseNames();
+
+		// Adds the poses of the Expressions config folder, each file a "Name" and its "Morphs" array, returns their count.
+		// Loaded again whenever the folder changes, poses of removed files are kept.
+		size_t LoadPoses(const config::Snapshot& a_configs);
+
+		// Sets the weight of a_pose on a_actor, 0 removes it
+		void SetWeight(RE::Actor* a_actor, PoseID a_pose, float a_weight);
+
+		float GetWeight(RE::Actor* a_actor, PoseID a_pose);
+
+		// Removes every pose of a_actor, its morphs are zeroed on its next update
+		void Clear(RE::Actor* a_actor);
+
+		size_t GetNumActors() const
+		{
+			return m_actors.size();
+		}
+
+		void OnEvent(const events::ActorUpdateEvent& a_event, events::EventDispatcher<events::ActorUpdateEvent>* a_dispatcher) override;
+		void OnEvent(const config::ConfigChangedEvent& a_event, events::EventDispatcher<config::ConfigChangedEvent>* a_dispatcher) override;
+
+		// a_out = clamp(sum of a_weights[i] * a_poses[i], 0, 1), four morphs per instruction where SSE2 is available
+		static void Blend(ExpressionPose& a_out, const ExpressionPose* const* a_poses, const float* a_weights, size_t a_count);
+
+	private:
+		struct ActorExpression
+		{
+			std::vector<std::pair<PoseID, float>> layers;  // Non zero weights only
+			ExpressionPose                        blended;
+			uint64_t                              poses_version{ 0 };  // Of the poses blended, 0 if stale
+		};
+
+		using Actors_T = tbb::concurrent_hash_map<RE::TESFormID, ActorExpression>;
+
+		ExpressionBlender() = default;
+
+		void _blend(ActorExpression& a_expression);
+
+		std::shared_mutex                            m_poses_lock;
+		std::vector<std::unique_ptr<ExpressionPose>> m_poses;  // By PoseID, never freed so blends can hold them
+		std::unordered_map<std::string, PoseID>      m_pose_ids;
+		std::atomic<uint64_t>                        m_poses_version{ 1 };  // Bumped by every pose replaced
+		Actors_T                                     m_actors;
+	};
+}
@@ -0,0 +1,291 @@
+#include "ExpressionClip.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <mutex>
+#include <ostream>
+
+namespace
+{
+	constexpr char ClipMagic[4] = { 'E', 'C', 'X', 'P' };
+
+	// NaN is 0
+	int32_t Quantize(float a_value)
+	{
+		if (!(a_value > 0.f)) {
+			return 0;
+		}
+		if (a_value >= 1.f) {
+			return chargen::ExpressionClip::MaxLevel;
+		}
+		return static_cast<int32_t>(std::lround(a_value * chargen::ExpressionClip::MaxLevel));
+	}
+}
+
+void chargen::ExpressionClip::Builder::AddFrame(const float* a_morphs)
+{
+	const uint32_t block = m_num_frames / BlockFrames;
+	const uint32_t row = m_num_frames % BlockFrames;
+
+	if (row == 0) {
+		m_patch_offsets.push_back(static_cast<uint32_t>(m_patches.size()));
+		m_keys.resize(m_keys.size() + NumChannels);
+		m_deltas.resize(m_deltas.size() + (BlockFrames - 1) * NumChannels, 0);
+
+		auto key = &m_keys[block * NumChannels];
+		for (uint32_t i = 0; i < NumChannels; ++i) {
+			m_levels[i] = Quantize(a_morphs[i]);
+			key[i] = static_cast<uint16_t>(m_levels[i]);
+		}
+	} else {
+		auto deltas = &m_deltas[(block * (BlockFrames - 1) + row - 1) * NumChannels];
+		for (uint32_t i = 0; i < NumChannels; ++i) {
+			const int32_t level = Quantize(a_morphs[i]);
+			const int32_t delta = level - m_levels[i];
+			if (delta < -MaxDelta || delta > MaxDelta) {
+				deltas[i] = Escape;
+				m_patches.push_back({ static_cast<uint8_t>(row), static_cast<uint8_t>(i), static_cast<uint16_t>(level) });
+			} else {
+				deltas[i] = static_cast<int8_t>(delta);
+			}
+			m_levels[i] = level;
+		}
+	}
+
+	++m_num_frames;
+}
+
+std::shared_ptr<const chargen::ExpressionClip> chargen::ExpressionClip::Builder::Build()
+{
+	if (!m_num_frames) {
+		return nullptr;
+	}
+
+	std::shared_ptr<ExpressionClip> clip(new ExpressionClip());
+	clip->m_frame_rate = m_frame_rate;
+	clip->m_num_frames = m_num_frames;
+	clip->m_keys = std::move(m_keys);
+	clip->m_deltas = std::move(m_deltas);
+	clip->m_patches = std::move(m_patches);
+	clip->m_patch_offsets = std::move(m_patch_offsets);
+	clip->m_patch_offsets.push_back(static_cast<uint32_t>(clip->m_patches.size()));
+
+	m_num_frames = 0;
+	m_keys.clear();
+	m_deltas.clear();
+	m_patches.clear();
+	m_patch_offsets.clear();
+	return clip;
+}
+
+void chargen::ExpressionClip::DecodeBlock(uint32_t a_block, float* a_out) const
+{
+	static_assert(NumChannels % 8 == 0);
+
+	const uint16_t* key = &m_keys[a_block * NumChannels];
+	const int8_t*   deltas = &m_deltas[a_block * (BlockFrames - 1) * NumChannels];
+	const Patch*    patch = m_patches.data() + m_patch_offsets[a_block];
+	const Patch*    patches_end = m_patches.data() + m_patch_offsets[a_block + 1];
+
+	alignas(16) std::array<int16_t, NumChannels> levels;
+	std::memcpy(levels.data(), key, sizeof(levels));
+
+	for (uint32_t row = 0; row < BlockFrames; ++row) {
+		float* out = a_out + row * NumChannels;
+
+#ifdef EC_EXPRESSION_CLIP_SSE2
+		// Eight levels per instruction, widened to floats four at a time
+		const __m128i zero = _mm_setzero_si128();
+		if (row) {
+			const int8_t* row_deltas = deltas + (row - 1) * NumChannels;
+			const __m128i escape = _mm_set1_epi8(Escape);
+			for (uint32_t i = 0; i < NumChannels; i += 8) {
+				__m128i delta = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row_deltas + i));
+				delta = _mm_andnot_si128(_mm_cmpeq_epi8(delta, escape), delta);  // Patched below
+				delta = _mm_srai_epi16(_mm_unpacklo_epi8(delta, delta), 8);      // Sign extended to 16 bits
+				auto level = reinterpret_cast<__m128i*>(&levels[i]);
+				_mm_store_si128(level, _mm_add_epi16(_mm_load_si128(level), delta));
+			}
+		}
+		for (; patch != patches_end && patch->row == row; ++patch) {
+			levels[patch->channel] = static_cast<int16_t>(patch->level);
+		}
+
+		const __m128 scale = _mm_set1_ps(1.f / MaxLevel);
+		for (uint32_t i = 0; i < NumChannels; i += 8) {
+			const __m128i level = _mm_load_si128(reinterpret_cast<const __m128i*>(&levels[i]));
+			_mm_store_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(level, zero)), scale));
+			_mm_store_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(level, zero)), scale));
+		}
+#else
+		if (row) {
+			const int8_t* row_deltas = deltas + (row - 1) * NumChannels;
+			for (uint32_t i = 0; i < NumChannels; ++i) {
+				if (row_deltas[i] != Escape) {
+					levels[i] += row_deltas[i];
+				}
+			}
+		}
+		for (; patch != patches_end && patch->row == row; ++patch) {
+			levels[patch->channel] = static_cast<int16_t>(patch->level);
+		}
+
+		for (uint32_t i = 0; i < NumChannels; ++i) {
+			out[i] = static_cast<uint16_t>(levels[i]) * (1.f / MaxLevel);
+		}
+#endif
+	}
+}
+
+void chargen::ExpressionClip::Sample(double a_time, bool a_loop, float* a_out) const
+{
+	if (!m_num_frames) {
+		std::fill_n(a_out, NumChannels, 0.f);
+		return;
+	}
+
+	double position = a_time * m_frame_rate;
+	if (a_loop) {
+		position = std::fmod(position, static_cast<double>(m_num_frames));
+		if (position < 0.0) {
+			position += m_num_frames;
+		}
+	} else {
+		position = std::clamp(position, 0.0, static_cast<double>(m_num_frames - 1));
+	}
+
+	const uint32_t frame = std::min(static_cast<uint32_t>(position), m_num_frames - 1);
+	const float    t = static_cast<float>(position - frame);
+	const bool     wrap = a_loop && frame + 1 == m_num_frames;  // The next frame is the first, likely another block
+
+	{
+		std::shared_lock lock(m_cache_lock);
+		const float*     from = _find(frame);
+		const float*     to = !from ? nullptr : wrap ? _find(0) : from + NumChannels;
+		if (to) {
+			_lerp(from, to, t, a_out);
+			return;
+		}
+	}
+
+	std::unique_lock lock(m_cache_lock);
+	const float*     from = _decode(frame);
+	const float*     to = wrap ? _decode(0) : from + NumChannels;
+	_lerp(from, to, t, a_out);
+}
+
+const float* chargen::ExpressionClip::_find(uint32_t a_frame) const
+{
+	const uint32_t block = a_frame / BlockFrames;
+	for (auto& decoded : m_cache) {
+		if (decoded.block == block) {
+			decoded.used.store(m_cache_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return &decoded.frames[(a_frame % BlockFrames) * NumChannels];
+		}
+	}
+	return nullptr;
+}
+
+const float* chargen::ExpressionClip::_decode(uint32_t a_frame) const
+{
+	if (auto row = _find(a_frame)) {
+		return row;
+	}
+
+	auto& decoded = *std::min_element(m_cache.begin(), m_cache.end(), [](const auto& a_lhs, const auto& a_rhs) {
+		return a_lhs.used.load(std::memory_order_relaxed) < a_rhs.used.load(std::memory_order_relaxed);
+	});
+
+	const uint32_t block = a_frame / BlockFrames;
+	DecodeBlock(block, decoded.frames.data());
+
+	// The row after the last one, for interpolation across blocks
+	float* next = &decoded.frames[BlockFrames * NumChannels];
+	if (block + 1 < GetNumBlocks()) {
+		const uint16_t* key = &m_keys[(block + 1) * NumChannels];
+		for (uint32_t i = 0; i < NumChannels; ++i) {
+			next[i] = key[i] * (1.f / MaxLevel);
+		}
+	} else {
+		std::memcpy(next, next - NumChannels, NumChannels * sizeof(float));
+	}
+
+	decoded.block = block;
+	decoded.used.store(m_cache_clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	return &decoded.frames[(a_frame % BlockFrames) * NumChannels];
+}
+
+void chargen::ExpressionClip::_lerp(const float* a_from, const float* a_to, float a_t, float* a_out)
+{
+	static_assert(NumChannels % 4 == 0);
+
+#ifdef EC_EXPRESSION_CLIP_SSE2
+	const __m128 t = _mm_set1_ps(a_t);
+	for (uint32_t i = 0; i < NumChannels; i += 4) {
+		const __m128 from = _mm_load_ps(a_from + i);
+		const __m128 to = _mm_load_ps(a_to + i);
+		_mm_storeu_ps(a_out + i, _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(to, from), t)));
+	}
+#else
+	for (uint32_t i = 0; i < NumChannels; ++i) {
+		a_out[i] = a_from[i] + (a_to[i] - a_from[i]) * a_t;
+	}
+#endif
+}
+
+bool chargen::ExpressionClip::Write(std::ostream& a_stream) const
+{
+	a_stream.write(ClipMagic, sizeof(ClipMagic));
+	a_stream.write(reinterpret_cast<const char*>(&Version), sizeof(Version));
+	a_stream.write(reinterpret_cast<const char*>(&m_frame_rate), sizeof(m_frame_rate));
+	a_stream.write(reinterpret_cast<const char*>(&m_num_frames), sizeof(m_num_frames));
+	a_stream.write(reinterpret_cast<const char*>(m_keys.data()), m_keys.size() * sizeof(m_keys[0]));
+	a_stream.write(reinterpret_cast<const char*>(m_deltas.data()), m_deltas.size() * sizeof(m_deltas[0]));
+	a_stream.write(reinterpret_cast<const char*>(m_patch_offsets.data()), m_patch_offsets.size() * sizeof(m_patch_offsets[0]));
+	a_stream.write(reinterpret_cast<const char*>(m_patches.data()), m_patches.size() * sizeof(m_patches[0]));
+	return a_stream.good();
+}
+
+std::shared_ptr<const chargen::ExpressionClip> chargen::ExpressionClip::Read(std::istream& a_stream)
+{
+	char     magic[sizeof(ClipMagic)];
+	uint32_t version = 0;
+	float    frame_rate = 0.f;
+	uint32_t num_frames = 0;
+	a_stream.read(magic, sizeof(magic));
+	a_stream.read(reinterpret_cast<char*>(&version), sizeof(version));
+	a_stream.read(reinterpret_cast<char*>(&frame_rate), sizeof(frame_rate));
+	a_stream.read(reinterpret_cast<char*>(&num_frames), sizeof(num_frames));
+	if (!a_stream || std::memcmp(magic, ClipMagic, sizeof(magic)) || version != Version ||
+		!(frame_rate > 0.f) || !num_frames || num_frames > (1u << 24)) {
+		return nullptr;
+	}
+
+	const uint32_t                  num_blocks = (num_frames + BlockFrames - 1) / BlockFrames;
+	std::shared_ptr<ExpressionClip> clip(new ExpressionClip());
+	clip->m_frame_rate = frame_rate;
+	clip->m_num_frames = num_frames;
+	clip->m_keys.resize(num_blocks * NumChannels);
+	clip->m_deltas.resize(num_blocks * (BlockFrames - 1) * NumChannels);
+	a_stream.read(reinterpret_cast<char*>(clip->m_keys.data()), clip->m_keys.size() * sizeof(clip->m_keys[0]));
+	a_stream.read(reinterpret_cast<char*>(clip->m_deltas.data()), clip->m_deltas.size() * sizeof(clip->m_deltas[0]));
+	clip->m_patch_offsets.resize(num_blocks + 1);
+	a_stream.read(reinterpret_cast<char*>(clip->m_patch_offsets.data()), clip->m_patch_offsets.size() * sizeof(clip->m_patch_offsets[0]));
+	if (!a_stream || clip->m_patch_offsets[0] != 0 || !std::is_sorted(clip->m_patch_offsets.begin(), clip->m_patch_offsets.end()) ||
+		clip->m_patch_offsets.back() > num_blocks * (BlockFrames - 1) * NumChannels) {
+		return nullptr;
+	}
+
+	clip->m_patches.resize(clip->m_patch_offsets.back());
+	a_stream.read(reinterpret_cast<char*>(clip->m_patches.data()), clip->m_patches.size() * sizeof(clip->m_patches[0]));
+	if (!a_stream) {
+		return nullptr;
+	}
+	for (auto& patch : clip->m_patches) {
+		if (patch.row >= BlockFrames || patch.channel >= NumChannels || patch.level > MaxLevel) {
+			return nullptr;
+		}
+	}
+	return clip;
+}
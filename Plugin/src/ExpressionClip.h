@@ -0,0 +1,125 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#	include <emmintrin.h>
+#	define EC_EXPRESSION_CLIP_SSE2
+#endif
+
+namespace chargen
+{
+	// A recorded facial expression sequence: frames of the 104 performance morphs of BSFaceGenAnimationData at a
+	// fixed rate, quantized to 1/MaxLevel and delta encoded in blocks of BlockFrames frames. Each block stores its
+	// first frame as levels, then one signed byte per morph and frame, about a fourth of the size of raw floats.
+	// Changes too large for a byte, like blinks, are escaped and patched in with their level.
+	//
+	// Blocks are decoded whole, four to eight morphs per instruction, into a small cache shared by every reader
+	// of the clip, so actors playing the same clip at nearby times decode each block once between them.
+	// Sample is safe on any thread. Plain C++, the benchmark in Deprecated/bench builds it without the game.
+	class ExpressionClip
+	{
+	public:
+		static constexpr uint32_t NumChannels = 0x68;  // BSFaceGenAnimationData::morphSize
+		static constexpr uint32_t BlockFrames = 16;
+		static constexpr uint32_t MaxLevel = 1023;  // Quantization steps of 0 to 1
+		static constexpr int32_t  MaxDelta = 127;   // Larger changes between frames are escaped
+
+		// Level of a morph whose delta was escaped
+		struct Patch
+		{
+			uint8_t  row;  // In its block
+			uint8_t  channel;
+			uint16_t level;
+		};
+
+		// Quantizes and encodes frames as they come, allocating only as its buffer grows
+		class Builder
+		{
+		public:
+			explicit Builder(float a_frameRate) :
+				m_frame_rate(a_frameRate)
+			{}
+
+			// Appends a frame of NumChannels morphs, clamped to 0 to 1
+			void AddFrame(const float* a_morphs);
+
+			float    GetFrameRate() const { return m_frame_rate; }
+			uint32_t GetNumFrames() const { return m_num_frames; }
+
+			// Null if no frame was added. The builder is left empty.
+			std::shared_ptr<const ExpressionClip> Build();
+
+		private:
+			float                            m_frame_rate;
+			uint32_t                         m_num_frames{ 0 };
+			std::vector<uint16_t>            m_keys;
+			std::vector<int8_t>              m_deltas;
+			std::vector<Patch>               m_patches;
+			std::vector<uint32_t>            m_patch_offsets;
+			std::array<int32_t, NumChannels> m_levels{};  // Of the last frame, deltas are taken from it
+		};
+
+		float    GetFrameRate() const { return m_frame_rate; }
+		uint32_t GetNumFrames() const { return m_num_frames; }
+		float    GetDuration() const { return m_num_frames / m_frame_rate; }
+		uint32_t GetNumBlocks() const { return static_cast<uint32_t>(m_keys.size() / NumChannels); }
+
+		// Encoded size
+		size_t GetNumBytes() const
+		{
+			return m_keys.size() * sizeof(m_keys[0]) + m_deltas.size() * sizeof(m_deltas[0]) +
+			       m_patches.size() * sizeof(m_patches[0]) + m_patch_offsets.size() * sizeof(m_patch_offsets[0]);
+		}
+
+		// Writes the morphs at a_time in seconds to a_out, interpolated between the two nearest frames.
+		// Past the end a_loop wraps to the start, interpolating the last frame into the first, otherwise holds the last.
+		void Sample(double a_time, bool a_loop, float* a_out) const;
+
+		// Decodes the frames of a_block into a_out, BlockFrames rows of NumChannels, 16 byte aligned
+		void DecodeBlock(uint32_t a_block, float* a_out) const;
+
+		// Binary, no version upgrade: a clip of another version fails to read
+		bool Write(std::ostream& a_stream) const;
+		static std::shared_ptr<const ExpressionClip> Read(std::istream& a_stream);
+
+	private:
+		static constexpr uint32_t CacheBlocks = 4;
+		static constexpr int8_t   Escape = -128;
+		static constexpr uint32_t Version = 1;
+
+		struct DecodedBlock
+		{
+			alignas(16) std::array<float, (BlockFrames + 1) * NumChannels> frames;  // And the first frame of the next block
+			uint32_t                                                       block{ UINT32_MAX };
+			std::atomic<uint64_t>                                          used{ 0 };
+		};
+
+		ExpressionClip() = default;
+
+		// Decoded row of a_frame, null if its block isn't cached, under a shared or unique m_cache_lock
+		const float* _find(uint32_t a_frame) const;
+
+		// Decoded row of a_frame, decoding its block over the least recently used one, under a unique m_cache_lock
+		const float* _decode(uint32_t a_frame) const;
+
+		static void _lerp(const float* a_from, const float* a_to, float a_t, float* a_out);
+
+		float                 m_frame_rate{ 30.f };
+		uint32_t              m_num_frames{ 0 };
+		std::vector<uint16_t> m_keys;    // First frame of each block, as levels
+		std::vector<int8_t>   m_deltas;  // BlockFrames - 1 rows per block, zero past the last frame
+		std::vector<Patch>    m_patches;
+		std::vector<uint32_t> m_patch_offsets;  // First patch of each block, and the patch count
+
+		mutable std::shared_mutex                     m_cache_lock;
+		mutable std::array<DecodedBlock, CacheBlocks> m_cache;
+		mutable std::atomic<uint64_t>                 m_cache_clock{ 0 };
+	};
+}
@@ -0,0 +1,169 @@
+#include "ExpressionTimeline.h"
+#include "ChargenUtils.h"
+
+void chargen::ExpressionTimeline::Register()
+{
+	events::ActorUpdatedEventDispatcher::GetSingleton()->EventDispatcher<events::ActorUpdateEvent>::AddStaticListener(this);
+}
+
+void chargen::ExpressionTimeline::StartRecording(RE::Actor* a_actor, float a_frameRate)
+{
+	m_recordings.erase(a_actor->formID);
+	m_recordings.insert({ a_actor->formID, Recording{ ExpressionClip::Builder(a_frameRate) } });
+}
+
+std::shared_ptr<const chargen::ExpressionClip> chargen::ExpressionTimeline::StopRecording(RE::Actor* a_actor, const std::string& a_name)
+{
+	std::shared_ptr<const ExpressionClip> clip;
+	{
+		decltype(m_recordings)::accessor acc;
+		if (!m_recordings.find(acc, a_actor->formID)) {
+			return nullptr;
+		}
+		clip = acc->second.builder.Build();
+		m_recordings.erase(acc);
+	}
+
+	if (clip) {
+		AddClip(a_name, clip);
+		SaveClip(a_name);
+	}
+	return clip;
+}
+
+bool chargen::ExpressionTimeline::IsRecording(RE::Actor* a_actor)
+{
+	decltype(m_recordings)::const_accessor acc;
+	return m_recordings.find(acc, a_actor->formID);
+}
+
+bool chargen::ExpressionTimeline::Play(RE::Actor* a_actor, const std::string& a_name, bool a_loop, float a_speed)
+{
+	auto clip = GetClip(a_name);
+	if (!clip) {
+		return false;
+	}
+
+	decltype(m_playbacks)::accessor acc;
+	m_playbacks.insert(acc, a_actor->formID);
+	acc->second = { std::move(clip), 0.0, a_speed, a_loop };
+	return true;
+}
+
+void chargen::ExpressionTimeline::Stop(RE::Actor* a_actor)
+{
+	m_playbacks.erase(a_actor->formID);
+}
+
+void chargen::ExpressionTimeline::AddClip(const std::string& a_name, std::shared_ptr<const ExpressionClip> a_clip)
+{
+	std::lock_guard lock(m_clips_lock);
+	m_clips[a_name] = std::move(a_clip);
+}
+
+std::shared_ptr<const chargen::ExpressionClip> chargen::ExpressionTimeline::GetClip(const std::string& a_name)
+{
+	std::lock_guard lock(m_clips_lock);
+	auto            it = m_clips.find(a_name);
+	return it != m_clips.end() ? it->second : nullptr;
+}
+
+std::vector<std::string> chargen::ExpressionTimeline::GetClipNames()
+{
+	std::vector<std::string> names;
+	{
+		std::lock_guard lock(m_clips_lock);
+		for (auto& [name, clip] : m_clips) {
+			names.push_back(name);
+		}
+	}
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+std::string chargen::ExpressionTimeline::_get_folder()
+{
+	std::string folder = utils::GetPluginFolder() + "\\ExpressionClips";
+	if (!std::filesystem::exists(folder)) {
+		std::filesystem::create_directories(folder);
+	}
+	return folder;
+}
+
+bool chargen::ExpressionTimeline::SaveClip(const std::string& a_name)
+{
+	auto clip = GetClip(a_name);
+	if (!clip) {
+		return false;
+	}
+
+	std::ofstream file(_get_folder() + "\\" + a_name + ".ecx", std::ios::binary);
+	if (!clip->Write(file)) {
+		logger::error("Failed to save expression clip '{}'", a_name);
+		return false;
+	}
+	return true;
+}
+
+size_t chargen::ExpressionTimeline::LoadClips()
+{
+	size_t count = 0;
+	for (const auto& entry : std::filesystem::directory_iterator(_get_folder())) {
+		if (entry.path().extension() != ".ecx") {
+			continue;
+		}
+
+		std::ifstream file(entry.path(), std::ios::binary);
+		if (auto clip = ExpressionClip::Read(file); clip) {
+			AddClip(entry.path().stem().string(), std::move(clip));
+			++count;
+		} else {
+			logger::warn("Expression clip '{}' is not valid, skipped", entry.path().string());
+		}
+	}
+	logger::info("Loaded {} expression clips", count);
+	return count;
+}
+
+void chargen::ExpressionTimeline::OnEvent(const events::ActorUpdateEvent& a_event, events::EventDispatcher<events::ActorUpdateEvent>* a_dispatcher)
+{
+	// Every actor update of the game comes through here, most of them neither recorded nor played
+	if (m_recordings.empty() && m_playbacks.empty()) {
+		return;
+	}
+
+	const auto formID = a_event.actor->formID;
+
+	if (!m_recordings.empty()) {
+		decltype(m_recordings)::accessor acc;
+		if (m_recordings.find(acc, formID)) {
+			auto facegenMorphs = getPerformanceMorphs(a_event.actor);
+			auto& recording = acc->second;
+			if (facegenMorphs != nullptr) {
+				// Holds the morphs of this update over every frame due until the next one
+				const double frame_rate = recording.builder.GetFrameRate();
+				const double end = std::min(recording.time, static_cast<double>(MaxRecording_s));
+				while (recording.builder.GetNumFrames() <= end * frame_rate) {
+					recording.builder.AddFrame(facegenMorphs);
+				}
+			}
+			recording.time += a_event.deltaTime;
+		}
+	}
+
+	if (!m_playbacks.empty()) {
+		decltype(m_playbacks)::accessor acc;
+		if (m_playbacks.find(acc, formID)) {
+			auto facegenMorphs = getPerformanceMorphs(a_event.actor);
+			auto& playback = acc->second;
+			if (facegenMorphs != nullptr) {
+				playback.clip->Sample(playback.time, playback.loop, facegenMorphs);
+			}
+
+			playback.time += a_event.deltaTime * playback.speed;
+			if (!playback.loop && playback.time > playback.clip->GetDuration()) {
+				m_playbacks.erase(acc);
+			}
+		}
+	}
+}
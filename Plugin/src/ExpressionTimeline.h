@@ -0,0 +1,77 @@
+#pragma once
+#include "SFEventHandler.h"
+#include "SingletonBase.h"
+#include "ExpressionClip.h"
+
+namespace chargen
+{
+	// Records the performance morphs of actors into ExpressionClips and plays clips back on actors, on their updates.
+	//
+	// Clips are kept by name and saved to <plugin folder>\ExpressionClips as <name>.ecx. Recording samples at a
+	// fixed rate and playback interpolates at the exact time of each update, scaled by its speed. Actors playing the
+	// same clip share its decoded blocks, so a crowd costs one interpolation of 104 morphs per actor and update.
+	class ExpressionTimeline :
+		public utils::SingletonBase<ExpressionTimeline>,
+		public events::EventDispatcher<events::ActorUpdateEvent>::Listener
+	{
+		friend class utils::SingletonBase<ExpressionTimeline>;
+
+	public:
+		static constexpr float MaxRecording_s = 600.f;  // Frames past it are dropped
+
+		void Register();
+
+		// Samples the morphs of a_actor from its next update on, until StopRecording
+		void StartRecording(RE::Actor* a_actor, float a_frameRate = 30.f);
+
+		// Keeps what a_actor recorded as a_name, replacing a clip of that name and saving it, null if nothing was recorded
+		std::shared_ptr<const ExpressionClip> StopRecording(RE::Actor* a_actor, const std::string& a_name);
+
+		bool IsRecording(RE::Actor* a_actor);
+
+		// False if there is no clip a_name
+		bool Play(RE::Actor* a_actor, const std::string& a_name, bool a_loop, float a_speed = 1.f);
+
+		// Leaves the morphs of a_actor as they are
+		void Stop(RE::Actor* a_actor);
+
+		void                                  AddClip(const std::string& a_name, std::shared_ptr<const ExpressionClip> a_clip);
+		std::shared_ptr<const ExpressionClip> GetClip(const std::string& a_name);
+		std::vector<std::string>              GetClipNames();
+
+		bool   SaveClip(const std::string& a_name);
+		size_t LoadClips();
+
+		size_t GetNumPlaying() const
+		{
+			return m_playbacks.size();
+		}
+
+		void OnEvent(const events::ActorUpdateEvent& a_event, events::EventDispatcher<events::ActorUpdateEvent>* a_dispatcher) override;
+
+	private:
+		struct Recording
+		{
+			ExpressionClip::Builder builder;
+			double                  time{ 0.0 };
+		};
+
+		struct Playback
+		{
+			std::shared_ptr<const ExpressionClip> clip;
+			double                                time{ 0.0 };
+			float                                 speed{ 1.f };
+			bool                                  loop{ false };
+		};
+
+		ExpressionTimeline() = default;
+
+		static std::string _get_folder();
+
+		tbb::concurrent_hash_map<RE::TESFormID, Recording> m_recordings;
+		tbb::concurrent_hash_map<RE::TESFormID, Playback>  m_playbacks;
+
+		std::mutex                                                             m_clips_lock;
+		std::unordered_map<std::string, std::shared_ptr<const ExpressionClip>> m_clips;
+	};
+}
@@ -1,6 +1,44 @@
 #include "HookManager.h"
 
+#include <tlhelp32.h>
+
+std::vector<HANDLE> events::detail::UpdateOtherThreads()
+{
+	std::vector<HANDLE> threads;
+	auto                snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	if (snapshot == INVALID_HANDLE_VALUE) {
+		return threads;
+	}
+
+	const DWORD   process = GetCurrentProcessId();
+	const DWORD   current = GetCurrentThreadId();
+	THREADENTRY32 entry{ .dwSize = sizeof(THREADENTRY32) };
+	for (BOOL found = Thread32First(snapshot, &entry); found; found = Thread32Next(snapshot, &entry)) {
+		if (entry.th32OwnerProcessID != process || entry.th32ThreadID == current) {
+			continue;
+		}
+		if (auto thread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, entry.th32ThreadID); thread) {
+			if (DetourUpdateThread(thread) == NO_ERROR) {
+				threads.push_back(thread);
+			} else {
+				CloseHandle(thread);
+			}
+		}
+	}
+	CloseHandle(snapshot);
+	return threads;
+}
+
+void events::detail::CloseThreads(const std::vector<HANDLE>& a_threads)
+{
+	for (auto thread : a_threads) {
+		CloseHandle(thread);
+	}
+}
+
 namespace hooks
 {
 	const ActorUpdateFuncHook const* g_actorUpdateFuncHook{ ActorUpdateFuncHook::GetSingleton() };
+
+	std::vector<events::HookBase*> g_hooks;
 }
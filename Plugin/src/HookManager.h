@@ -1,5 +1,6 @@
 #pragma once
 #include "EventDispatcher.h"
+#include "TraceBuffer.h"
 #include <detours/detours.h>
 
 namespace events
@@ -21,12 +22,79 @@ namespace events
 		std::tuple<_Args...> args;
 	};
 
-	template<typename _Rtn_T, typename ..._Args>
+	// Call counters of a single hook, one slot per calling thread so the hot path never shares a cache line
+	class HookCallCounters
+	{
+	public:
+		struct alignas(64) Slot
+		{
+			std::atomic<uint64_t> calls{ 0 };
+			std::atomic<uint64_t> dispatches{ 0 };
+			std::atomic<uint64_t> dispatch_ns{ 0 };
+		};
+
+		struct Totals
+		{
+			uint64_t calls{ 0 };
+			uint64_t dispatches{ 0 };
+			uint64_t dispatch_ns{ 0 };
+			size_t   threads{ 0 };
+		};
+
+		// Called once per thread, slots are never freed so the thread_local pointer stays valid
+		Slot* AcquireSlot()
+		{
+			std::lock_guard lock(m_slots_mutex);
+			return &m_slots.emplace_back();
+		}
+
+		Totals Sum()
+		{
+			Totals totals;
+			std::lock_guard lock(m_slots_mutex);
+			for (auto& slot : m_slots) {
+				totals.calls += slot.calls.load(std::memory_order_relaxed);
+				totals.dispatches += slot.dispatches.load(std::memory_order_relaxed);
+				totals.dispatch_ns += slot.dispatch_ns.load(std::memory_order_relaxed);
+			}
+			totals.threads = m_slots.size();
+			return totals;
+		}
+
+	private:
+		std::mutex       m_slots_mutex;
+		std::deque<Slot> m_slots;
+	};
+
+	namespace detail
+	{
+		// Enlists every other thread of the process in the pending Detours transaction, which suspends them while it
+		// commits and moves those executing a patched prologue out of it. Close the handles once committed.
+		std::vector<HANDLE> UpdateOtherThreads();
+		void                CloseThreads(const std::vector<HANDLE>& a_threads);
+	}
+
+	// Type-erased view of a hook, used by the Debug tab
+	class HookBase
+	{
+	public:
+		virtual ~HookBase() = default;
+
+		virtual const char*              GetName() const = 0;
+		virtual bool                     IsHooked() const = 0;
+		virtual uint32_t                 NumListeners() const = 0;
+		virtual HookCallCounters::Totals GetCounters() = 0;
+	};
+
+	// _HookID is the REL::ID of the hooked function, it also keeps hooks with identical signatures apart
+	template<uint64_t _HookID, typename _Rtn_T, typename ..._Args>
 	class HookFuncCalledEventDispatcher : 
-		public events::EventDispatcher<events::HookFuncCalledEvent<_Args...>>
+		public events::EventDispatcher<events::HookFuncCalledEvent<_Args...>>,
+		public HookBase
 	{
 	public:
 		using _Func_T = _Rtn_T(*)(_Args...);
+		using _Dispatcher_T = events::EventDispatcher<events::HookFuncCalledEvent<_Args...>>;
 
 		static HookFuncCalledEventDispatcher* GetSingleton()
 		{
@@ -37,25 +105,61 @@ namespace events
 		static _Rtn_T DetourFunc(_Args... args)
 		{
 			auto dispatcher = HookFuncCalledEventDispatcher::GetSingleton();
+			auto counters = LocalCounters();
+			counters->calls.fetch_add(1, std::memory_order_relaxed);
+
+			// Fast path: nobody listens, go straight to the original
+			if (!dispatcher->_Dispatcher_T::HasListeners()) [[likely]] {
+				return ((_Func_T)dispatcher->m_originalFunc)(args...);
+			}
+
+			auto start = std::chrono::steady_clock::now();
 			dispatcher->Dispatch({ args... });
+			auto elapsed = std::chrono::steady_clock::now() - start;
+
+			const auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+			counters->dispatches.fetch_add(1, std::memory_order_relaxed);
+			counters->dispatch_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+			trace::Write(trace::Event::kHookDispatched, TracedFormID(args...), static_cast<uint32_t>(_HookID), static_cast<uint32_t>(elapsed_ns));
+
 			return ((_Func_T)dispatcher->m_originalFunc)(args...);
 		}
 
-		void Install(uintptr_t a_targetAddr)
+		void Install(const char* a_name)
+		{
+			Install((uintptr_t)REL::ID(_HookID).address(), a_name);
+		}
+
+		// Installs once the hook gets its first listener, or soon if it has one already. A hook is only free
+		// without listeners if its signature is right, one with an unverified signature stays out of the game until used.
+		// Listeners may be added from any thread while the game runs, so the install is queued to the main thread.
+		void InstallOnFirstListener(const char* a_name)
+		{
+			m_name = a_name;
+			m_install_on_listener = true;
+			if (_Dispatcher_T::HasListeners()) {
+				_on_listener_added();
+			}
+		}
+
+		void Install(uintptr_t a_targetAddr, const char* a_name)
 		{
 			if (IsHooked()) {
 				return;
 			}
+			m_name = a_name;
 			m_targetAddr = (void*)a_targetAddr;
 			m_originalFunc = (void*)a_targetAddr;
 			m_detourFunc = DetourFunc;
 
 			DetourTransactionBegin();
 			DetourUpdateThread(GetCurrentThread());
+			auto threads = detail::UpdateOtherThreads();
 
 			DetourAttach(&(PVOID&)m_originalFunc, m_detourFunc);
 
 			DetourTransactionCommit();
+			detail::CloseThreads(threads);
 		}
 
 		void Uninstall()
@@ -66,10 +170,12 @@ namespace events
 
 			DetourTransactionBegin();
 			DetourUpdateThread(GetCurrentThread());
+			auto threads = detail::UpdateOtherThreads();
 
 			DetourDetach(&(PVOID&)m_originalFunc, m_detourFunc);
 
 			DetourTransactionCommit();
+			detail::CloseThreads(threads);
 		}
 
 		virtual ~HookFuncCalledEventDispatcher()
@@ -77,14 +183,63 @@ namespace events
 			Uninstall();
 		}
 
-		bool IsHooked() const
+		bool IsHooked() const override
 		{
 			return m_originalFunc != m_targetAddr;
 		}
+
+		const char* GetName() const override
+		{
+			return m_name;
+		}
+
+		uint32_t NumListeners() const override
+		{
+			return _Dispatcher_T::NumListeners();
+		}
+
+		HookCallCounters::Totals GetCounters() override
+		{
+			return m_counters.Sum();
+		}
 		
 		void*   m_originalFunc{ nullptr };
 		void*   m_targetAddr{ nullptr };
 		_Func_T m_detourFunc{ nullptr };
+
+	protected:
+		void _on_listener_added() override
+		{
+			if (m_install_on_listener.exchange(false)) {
+				SFSE::GetTaskInterface()->AddTask([this]() {
+					Install(m_name);
+				});
+			}
+		}
+
+	private:
+		const char*       m_name{ "" };
+		HookCallCounters  m_counters;
+		std::atomic<bool> m_install_on_listener{ false };
+
+		static HookCallCounters::Slot* LocalCounters()
+		{
+			thread_local HookCallCounters::Slot* slot = GetSingleton()->m_counters.AcquireSlot();
+			return slot;
+		}
+
+		// Form the hooked function is called on, if its first argument is one
+		static uint32_t TracedFormID(_Args... args)
+		{
+			if constexpr (sizeof...(_Args) > 0) {
+				using _First_T = std::tuple_element_t<0, std::tuple<_Args...>>;
+				if constexpr (std::is_convertible_v<_First_T, const RE::TESForm*>) {
+					const RE::TESForm* form = std::get<0>(std::forward_as_tuple(args...));
+					return form ? form->formID : 0;
+				}
+			}
+			return 0;
+		}
 	};
 }
 
@@ -98,12 +253,40 @@ namespace hooks
 		inline constexpr REL::ID ActorUpdate_Func{ 151391 };
 	}
 
-	using ActorUpdateFuncHook = events::HookFuncCalledEventDispatcher<void, RE::Actor*, float>;
+	// Signatures of the MAYBE_ hooks are inferred, they are only installed once subscribed: keep them unsubscribed unless verified
+	using ActorInitializerFuncHook = events::HookFuncCalledEventDispatcher<addrs::MAYBE_ActorInitializer_Func.id(), void, RE::Actor*, bool, bool>;
+	using FormPostInitializedFuncHook = events::HookFuncCalledEventDispatcher<addrs::MAYBE_FormPostInitialized_Func.id(), void, RE::TESForm*>;
+	using ActorEquipAllItemsFuncHook = events::HookFuncCalledEventDispatcher<addrs::MAYBE_ActorEquipAllItems_Func.id(), void, RE::Actor*>;
+	using ActorUpdateFuncHook = events::HookFuncCalledEventDispatcher<addrs::ActorUpdate_Func.id(), void, RE::Actor*, float>;
 	extern ActorUpdateFuncHook const* g_actorUpdateFuncHook;
 
+	// All hooks, installed or waiting for their first listener, in installation order
+	extern std::vector<events::HookBase*> g_hooks;
+
+	template <class _Hook_T>
+	inline void InstallHook(const char* a_name)
+	{
+		auto hook = _Hook_T::GetSingleton();
+		hook->Install(a_name);
+		if (hook->IsHooked()) {
+			g_hooks.emplace_back(hook);
+		}
+	}
+
+	template <class _Hook_T>
+	inline void InstallHookOnFirstListener(const char* a_name)
+	{
+		auto hook = _Hook_T::GetSingleton();
+		hook->InstallOnFirstListener(a_name);
+		g_hooks.emplace_back(hook);
+	}
+
 	inline void InstallHooks()
 	{
-		ActorUpdateFuncHook::GetSingleton()->Install((uintptr_t)addrs::ActorUpdate_Func.address());
+		InstallHook<ActorUpdateFuncHook>("ActorUpdate");
+		InstallHookOnFirstListener<ActorInitializerFuncHook>("ActorInitializer");
+		InstallHookOnFirstListener<FormPostInitializedFuncHook>("FormPostInitialized");
+		InstallHookOnFirstListener<ActorEquipAllItemsFuncHook>("ActorEquipAllItems");
 	}
 
 }
\ No newline at end of file
@@ -6,6 +6,260 @@ namespace logger
 
 	std::recursive_mutex g_console_logger_mutex;
 
+	namespace
+	{
+		std::atomic<bool>                                      g_async{ false };
+		tbb::concurrent_queue<std::unique_ptr<detail::Record>> g_queue;
+		std::binary_semaphore                                  g_wake{ 0 };
+		std::atomic<bool>                                      g_sink_waiting{ false };  // Whoever clears it releases g_wake
+		std::atomic<std::thread::id>                           g_sink_id;
+		std::atomic<uint64_t>                                  g_enqueued{ 0 };
+		std::atomic<uint64_t>                                  g_written{ 0 };
+
+		std::atomic<uint32_t> g_burst{ 5 };
+		std::atomic<int64_t>  g_period_ms{ 10000 };
+
+		struct ThrottleKey
+		{
+			const char* file;
+			const char* fmt;
+			uint32_t    line;
+			uint32_t    column;
+
+			bool operator==(const ThrottleKey&) const = default;
+		};
+
+		struct ThrottleKeyHash
+		{
+			size_t operator()(const ThrottleKey& a_key) const
+			{
+				size_t hash = std::hash<const void*>{}(a_key.fmt);
+				hash ^= std::hash<const void*>{}(a_key.file) + 0x9E3779B9 + (hash << 6) + (hash >> 2);
+				return hash ^ ((size_t(a_key.line) << 16) | a_key.column);
+			}
+		};
+
+		// Never erased, one per call site
+		struct Throttle
+		{
+			std::mutex                            lock;
+			std::string_view                      fmt;
+			std::string_view                      file;
+			uint32_t                              line{ 0 };
+			LogLevel                              level{ LogLevel::kNone };
+			LogTarget                             target{ LogTarget::kFile };
+			std::chrono::steady_clock::time_point window_start{};
+			uint32_t                              passed{ 0 };
+			uint32_t                              suppressed{ 0 };
+		};
+
+		tbb::concurrent_unordered_map<ThrottleKey, Throttle, ThrottleKeyHash> g_throttles;
+
+		void Emit(LogLevel a_level, LogTarget a_target, std::string a_str)
+		{
+			const auto time = std::chrono::system_clock::now();
+			if (detail::is_async()) {
+				detail::enqueue(std::make_unique<detail::StringRecord>(std::move(a_str)), a_level, a_target, time);
+			} else {
+				detail::write(a_level, a_target, time, a_str);
+			}
+		}
+
+		// Under a_throttle.lock
+		void ReportSuppressed(Throttle& a_throttle, std::chrono::steady_clock::time_point a_now)
+		{
+			if (a_throttle.suppressed) {
+				auto file = a_throttle.file.substr(a_throttle.file.find_last_of("/\\") + 1);
+				auto seconds = std::chrono::duration<double>(a_now - a_throttle.window_start).count();
+				Emit(a_throttle.level, a_throttle.target,
+					std::format("Suppressed {} times in {:.1f} s ({}:{}): {}", a_throttle.suppressed, seconds, file, a_throttle.line, a_throttle.fmt));
+			}
+			a_throttle.window_start = a_now;
+			a_throttle.passed = 0;
+			a_throttle.suppressed = 0;
+		}
+
+		// Reports the sites whose period ended with messages suppressed and no message since
+		void SweepThrottles()
+		{
+			const auto now = std::chrono::steady_clock::now();
+			const auto period = std::chrono::milliseconds(g_period_ms.load(std::memory_order_relaxed));
+			for (auto& [key, throttle] : g_throttles) {
+				std::lock_guard lock(throttle.lock);
+				if (throttle.suppressed && now - throttle.window_start >= period) {
+					ReportSuppressed(throttle, now);
+				}
+			}
+		}
+
+		void SinkThread()
+		{
+			std::unique_ptr<detail::Record> record;
+			auto                            last_sweep = std::chrono::steady_clock::now();
+			while (true) {
+				if (auto now = std::chrono::steady_clock::now(); now - last_sweep >= std::chrono::seconds(1)) {
+					SweepThrottles();
+					last_sweep = now;
+				}
+
+				uint64_t written = 0;
+				while (g_queue.try_pop(record)) {
+					detail::write(record->level, record->target, record->time, record->Format());
+					++written;
+				}
+				if (written) {
+					g_logger->flush();
+					g_written.fetch_add(written);
+				}
+
+				g_sink_waiting.store(true);
+				if (!g_queue.empty() && g_sink_waiting.exchange(false)) {
+					continue;
+				}
+				g_wake.try_acquire_for(std::chrono::seconds(1));  // Wakes to sweep the throttles
+			}
+		}
+	}
+
+	void StartAsync()
+	{
+		static std::once_flag started;
+		std::call_once(started, [] {
+			std::thread sink(SinkThread);
+			g_sink_id.store(sink.get_id());
+			sink.detach();  // Never joined, joining from a static destructor deadlocks on DLL unload
+			g_async.store(true);
+		});
+	}
+
+	bool Flush(std::chrono::milliseconds a_timeout)
+	{
+		if (std::this_thread::get_id() == g_sink_id.load()) {
+			return false;
+		}
+
+		// Polled, std::atomic::wait has no timeout
+		const uint64_t target = g_enqueued.load();
+		const auto     deadline = std::chrono::steady_clock::now() + a_timeout;
+		while (g_written.load() < target) {
+			if (std::chrono::steady_clock::now() >= deadline) {
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}
+
+	void SetRateLimit(uint32_t a_burst, std::chrono::milliseconds a_period)
+	{
+		g_burst.store(a_burst);
+		g_period_ms.store(a_period.count());
+	}
+
+	bool detail::allow(const std::source_location& a_location, std::string_view a_fmt, LogLevel a_level, LogTarget a_target)
+	{
+		const ThrottleKey key{ a_location.file_name(), a_fmt.data(), a_location.line(), a_location.column() };
+
+		auto it = g_throttles.find(key);
+		if (it == g_throttles.end()) {
+			it = g_throttles.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first;
+		}
+
+		auto&           throttle = it->second;
+		const auto      now = std::chrono::steady_clock::now();
+		std::lock_guard lock(throttle.lock);
+		if (!throttle.line) {  // First message of the site
+			throttle.fmt = a_fmt;
+			throttle.file = a_location.file_name();
+			throttle.line = a_location.line();
+			throttle.level = a_level;
+			throttle.target = a_target;
+			throttle.window_start = now;
+		}
+
+		if (now - throttle.window_start >= std::chrono::milliseconds(g_period_ms.load(std::memory_order_relaxed))) {
+			ReportSuppressed(throttle, now);
+		}
+
+		if (throttle.passed < g_burst.load(std::memory_order_relaxed)) {
+			++throttle.passed;
+			return true;
+		}
+		++throttle.suppressed;
+		return false;
+	}
+
+	bool detail::is_async()
+	{
+		return g_async.load(std::memory_order_relaxed);
+	}
+
+	void detail::enqueue(std::unique_ptr<Record> a_record, LogLevel a_level, LogTarget a_target, std::chrono::system_clock::time_point a_time)
+	{
+		a_record->level = a_level;
+		a_record->target = a_target;
+		a_record->time = a_time;
+		g_queue.push(std::move(a_record));
+		g_enqueued.fetch_add(1);
+
+		if (g_sink_waiting.load() && g_sink_waiting.exchange(false)) {
+			g_wake.release();
+		}
+	}
+
+	void detail::write(LogLevel a_level, LogTarget a_target, std::chrono::system_clock::time_point a_time, std::string_view a_str)
+	{
+		if (a_target == LogTarget::kFile) {
+			switch (a_level) {
+			case LogLevel::kWARN:
+				g_logger->log(a_time, spdlog::source_loc{}, spdlog::level::warn, a_str);
+				break;
+			case LogLevel::kERROR:
+				g_logger->log(a_time, spdlog::source_loc{}, spdlog::level::err, a_str);
+				break;
+			default:
+				g_logger->log(a_time, spdlog::source_loc{}, spdlog::level::info, a_str);
+				break;
+			}
+			return;
+		}
+
+		std::string log_str;
+		switch (a_level) {
+		case LogLevel::kINFO:
+			log_str = std::format("INFO [{}]: {}", timestamp(a_time), a_str);
+			break;
+		case LogLevel::kWARN:
+			log_str = std::format("WARN [{}]: {}", timestamp(a_time), a_str);
+			break;
+		case LogLevel::kERROR:
+			log_str = std::format("ERROR [{}]: {}", timestamp(a_time), a_str);
+			break;
+		default:
+			log_str = a_str;
+			break;
+		}
+
+		{
+			std::lock_guard lock(g_console_logger_mutex);
+			RE::ConsoleLog::GetSingleton()->PrintLine(log_str.c_str());
+		}
+	}
+
+	const std::string& detail::timestamp(std::chrono::system_clock::time_point a_time)
+	{
+		thread_local std::time_t second = -1;
+		thread_local std::string str;
+
+		const std::time_t now = std::chrono::system_clock::to_time_t(a_time);
+		if (now != second) {
+			second = now;
+			char buffer[32];
+			str.assign(buffer, std::strftime(buffer, sizeof(buffer), "%d.%m.%Y %H:%M:%S", std::localtime(&now)));
+		}
+		return str;
+	}
+
 	void c_printf(const char* fmt, ...)
 	{
 		va_list args;
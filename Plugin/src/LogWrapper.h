@@ -3,6 +3,11 @@
 #include "spdlog/sinks/basic_file_sink.h"
 #include "spdlog/spdlog.h"
 
+// File messages under this level compile to nothing: 1 info, 2 warnings, 3 errors. Console messages always pass.
+#ifndef EC_LOG_MIN_LEVEL
+#	define EC_LOG_MIN_LEVEL 1
+#endif
+
 namespace logger
 {
 	enum class LogLevel : uint8_t
@@ -13,36 +18,192 @@ namespace logger
 		kERROR
 	};
 
+	enum class LogTarget : uint8_t
+	{
+		kFile,     // Log file next to the plugin
+		kConsole,  // In-game console
+	};
+
+	inline constexpr LogLevel g_min_level = static_cast<LogLevel>(EC_LOG_MIN_LEVEL);
+
+	// Console messages are replies to commands and player facing, only the log file is filtered
+	template <LogLevel _Log_LVL, LogTarget _Target>
+	inline constexpr bool is_enabled = _Target == LogTarget::kConsole || _Log_LVL == LogLevel::kNone || _Log_LVL >= g_min_level;
+
 	extern std::shared_ptr<spdlog::logger> g_logger;
 	extern std::recursive_mutex			 g_console_logger_mutex;
 
+	// Hands messages to a background thread from now on, which formats and writes them. Safe to log from hot paths
+	// then: a call only copies its arguments into the queue. Arguments must own what they print, strings and
+	// string views are copied, other references and pointers are formatted once the caller may be long gone.
+	void StartAsync();
+
+	// Waits until every message logged before the call is written, at most a_timeout as the sink thread may be
+	// the one that crashed. False if it timed out, or immediately if called from the sink thread.
+	bool Flush(std::chrono::milliseconds a_timeout);
+
+	// How long crash and termination handlers wait for the queued messages
+	inline constexpr std::chrono::milliseconds CrashFlushTimeout{ 2000 };
+
+	// Rate limited messages: each call site and format passes a_burst times per a_period, the rest are counted and
+	// reported as one "suppressed N times" message when the period ends, by the next message of the site or, when
+	// async, by the sink thread within a second
+	void SetRateLimit(uint32_t a_burst, std::chrono::milliseconds a_period);
+
+	// A format string and the call site logging it, the key of rate limited messages
+	template <class... Args>
+	struct located_format_string
+	{
+		template <class _String>
+		consteval located_format_string(const _String& a_fmt, std::source_location a_location = std::source_location::current()) :
+			fmt(a_fmt),
+			location(a_location)
+		{}
+
+		std::format_string<Args...> fmt;
+		std::source_location        location;
+	};
+
+	namespace detail
+	{
+		// A message waiting for the sink thread
+		struct Record
+		{
+			virtual ~Record() = default;
+
+			virtual std::string Format() const = 0;
+
+			LogLevel                              level;
+			LogTarget                             target;
+			std::chrono::system_clock::time_point time;
+		};
+
+		// Strings and anything viewing one are copied, the rest is kept as is
+		template <class T>
+		using capture_t = std::conditional_t<
+			std::is_convertible_v<std::decay_t<T>, std::string_view> && !std::is_same_v<std::decay_t<T>, std::string>,
+			std::string,
+			std::decay_t<T>>;
+
+		template <class... Args>
+		struct FormatRecord : Record
+		{
+			template <class... _Args>
+			FormatRecord(std::string_view a_fmt, _Args&&... a_args) :
+				fmt(a_fmt),
+				args(std::forward<_Args>(a_args)...)
+			{}
+
+			std::string Format() const override
+			{
+				return std::apply([this](const auto&... a_args) { return std::vformat(fmt, std::make_format_args(a_args...)); }, args);
+			}
+
+			std::string_view               fmt;  // Of a std::format_string, so a literal
+			std::tuple<capture_t<Args>...> args;
+		};
+
+		struct StringRecord : Record
+		{
+			explicit StringRecord(std::string a_str) :
+				str(std::move(a_str))
+			{}
+
+			std::string Format() const override
+			{
+				return str;
+			}
+
+			std::string str;
+		};
+
+		bool is_async();
+
+		void enqueue(std::unique_ptr<Record> a_record, LogLevel a_level, LogTarget a_target, std::chrono::system_clock::time_point a_time);
+
+		// Writes to the sink of a_target, on the sink thread when async
+		void write(LogLevel a_level, LogTarget a_target, std::chrono::system_clock::time_point a_time, std::string_view a_str);
+
+		// "%d.%m.%Y %H:%M:%S" of a_time, formatted once per second and thread
+		const std::string& timestamp(std::chrono::system_clock::time_point a_time);
+
+		// Counts a message of a rate limited call site, false if it is over the limit
+		bool allow(const std::source_location& a_location, std::string_view a_fmt, LogLevel a_level, LogTarget a_target);
+
+		template <LogLevel _Log_LVL, LogTarget _Target, class... Args>
+		void submit(const std::format_string<Args...> a_fmt, Args&&... a_args)
+		{
+			if constexpr (is_enabled<_Log_LVL, _Target>) {
+				const auto time = std::chrono::system_clock::now();
+				if (is_async()) {
+					enqueue(std::make_unique<FormatRecord<Args...>>(a_fmt.get(), std::forward<Args>(a_args)...), _Log_LVL, _Target, time);
+				} else {
+					write(_Log_LVL, _Target, time, std::vformat(a_fmt.get(), std::make_format_args(a_args...)));
+				}
+			}
+		}
+
+		template <LogLevel _Log_LVL, LogTarget _Target>
+		void submit(const char* a_str)
+		{
+			if constexpr (is_enabled<_Log_LVL, _Target>) {
+				const auto time = std::chrono::system_clock::now();
+				if (is_async()) {
+					enqueue(std::make_unique<StringRecord>(a_str), _Log_LVL, _Target, time);
+				} else {
+					write(_Log_LVL, _Target, time, a_str);
+				}
+			}
+		}
+	}
+
+	// Rate limited output, see SetRateLimit. Arguments aren't evaluated any cheaper, but suppressed messages are
+	// neither formatted nor queued.
+	template <LogLevel _Log_LVL, LogTarget _Target, class... Args>
+	void log_limited(const located_format_string<std::type_identity_t<Args>...> a_fmt, Args&&... a_args)
+	{
+		if constexpr (is_enabled<_Log_LVL, _Target>) {
+			if (detail::allow(a_fmt.location, a_fmt.fmt.get(), _Log_LVL, _Target)) {
+				detail::submit<_Log_LVL, _Target>(a_fmt.fmt, std::forward<Args>(a_args)...);
+			}
+		}
+	}
+
+	template <class... Args>
+	void warn_limited(const located_format_string<std::type_identity_t<Args>...> a_fmt, Args&&... a_args)
+	{
+		log_limited<LogLevel::kWARN, LogTarget::kFile>(a_fmt, std::forward<Args>(a_args)...);
+	}
+
+	template <class... Args>
+	void error_limited(const located_format_string<std::type_identity_t<Args>...> a_fmt, Args&&... a_args)
+	{
+		log_limited<LogLevel::kERROR, LogTarget::kFile>(a_fmt, std::forward<Args>(a_args)...);
+	}
+
+	template <class... Args>
+	void c_warn_limited(const located_format_string<std::type_identity_t<Args>...> a_fmt, Args&&... a_args)
+	{
+		log_limited<LogLevel::kWARN, LogTarget::kConsole>(a_fmt, std::forward<Args>(a_args)...);
+	}
+
+	template <class... Args>
+	void c_error_limited(const located_format_string<std::type_identity_t<Args>...> a_fmt, Args&&... a_args)
+	{
+		log_limited<LogLevel::kERROR, LogTarget::kConsole>(a_fmt, std::forward<Args>(a_args)...);
+	}
+
 	// Output to log file next to the plugin
 	template <LogLevel _Log_LVL, class... Args>
 	void log(const std::format_string<Args...> a_fmt, Args&&... a_args)
 	{
-		std::string log_str = std::vformat(a_fmt.get(), std::make_format_args(a_args...));
-
-		if constexpr (_Log_LVL == LogLevel::kINFO)
-			g_logger->info(log_str);
-		else if constexpr (_Log_LVL == LogLevel::kWARN)
-			g_logger->warn(log_str);
-		else if constexpr (_Log_LVL == LogLevel::kERROR)
-			g_logger->error(log_str);
-		else
-			g_logger->info(log_str);
+		detail::submit<_Log_LVL, LogTarget::kFile>(a_fmt, std::forward<Args>(a_args)...);
 	}
 
 	template <LogLevel _Log_LVL>
 	void log(const char* a_str)
 	{
-		if constexpr (_Log_LVL == LogLevel::kINFO)
-			g_logger->info(a_str);
-		else if constexpr (_Log_LVL == LogLevel::kWARN)
-			g_logger->warn(a_str);
-		else if constexpr (_Log_LVL == LogLevel::kERROR)
-			g_logger->error(a_str);
-		else
-			g_logger->info(a_str);
+		detail::submit<_Log_LVL, LogTarget::kFile>(a_str);
 	}
 
 	template <class... Args>
@@ -82,43 +243,13 @@ namespace logger
 	template <LogLevel _Log_LVL, class... Args>
 	void c_log(const std::format_string<Args...> a_fmt, Args&&... a_args)
 	{
-		auto        time_str = utils::GetCurrentTimeString();
-		std::string log_str;
-
-		if constexpr (_Log_LVL == LogLevel::kINFO)
-			log_str = "INFO [" + time_str + "]: " + std::vformat(a_fmt.get(), std::make_format_args(a_args...));
-		else if constexpr (_Log_LVL == LogLevel::kWARN)
-			log_str = "WARN [" + time_str + "]: " + std::vformat(a_fmt.get(), std::make_format_args(a_args...));
-		else if constexpr (_Log_LVL == LogLevel::kERROR)
-			log_str = "ERROR [" + time_str + "]: " + std::vformat(a_fmt.get(), std::make_format_args(a_args...));
-		else
-			log_str = std::vformat(a_fmt.get(), std::make_format_args(a_args...));
-
-		{
-			std::lock_guard lock(g_console_logger_mutex);
-			RE::ConsoleLog::GetSingleton()->PrintLine(log_str.c_str());
-		}
+		detail::submit<_Log_LVL, LogTarget::kConsole>(a_fmt, std::forward<Args>(a_args)...);
 	}
 
 	template <LogLevel _Log_LVL>
 	void c_log(const char* a_str)
 	{
-		auto        time_str = utils::GetCurrentTimeString();
-		std::string log_str;
-
-		if constexpr (_Log_LVL == LogLevel::kINFO)
-			log_str = "INFO [" + time_str + "]: " + a_str;
-		else if constexpr (_Log_LVL == LogLevel::kWARN)
-			log_str = "WARN [" + time_str + "]: " + a_str;
-		else if constexpr (_Log_LVL == LogLevel::kERROR)
-			log_str = "ERROR [" + time_str + "]: " + a_str;
-		else
-			log_str = a_str;
-
-		{
-			std::lock_guard lock(g_console_logger_mutex);
-			RE::ConsoleLog::GetSingleton()->PrintLine(log_str.c_str());
-		}
+		detail::submit<_Log_LVL, LogTarget::kConsole>(a_str);
 	}
 
 	template <class... Args>
@@ -0,0 +1,36 @@
+#include "MorphWriter.h"
+
+void chargen::MorphWriter::Write(RE::Actor* a_actor, std::span<const std::pair<RE::BSFixedStringCS, float>> a_morphs, bool a_replace)
+{
+	auto npc = a_actor->GetNPC();
+	if (!npc) {
+		return;
+	}
+
+	if (a_replace && npc->shapeBlendData) {
+		npc->shapeBlendData->clear();
+	}
+	for (auto& [morph_name, value] : a_morphs) {
+		std::string_view name = morph_name;
+		if (name == FatName) {
+			npc->morphWeight.fat = value;
+		} else if (name == MuscularName) {
+			npc->morphWeight.muscular = value;
+		} else if (name == ThinName) {
+			npc->morphWeight.thin = value;
+		} else {
+			if (!npc->shapeBlendData) {
+				npc->shapeBlendData = new RE::BSTHashMap<RE::BSFixedStringCS, float>();
+			}
+			(*npc->shapeBlendData)[morph_name] = value;
+		}
+	}
+
+	if (HasListeners()) {
+		MorphsWrittenEvent event;
+		event.actor = a_actor;
+		event.morphs = a_morphs;
+		event.replaced = a_replace;
+		Dispatch(std::move(event));
+	}
+}
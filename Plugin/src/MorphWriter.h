@@ -0,0 +1,43 @@
+#pragma once
+#include "EventDispatcher.h"
+#include "SingletonBase.h"
+
+namespace chargen
+{
+	// Dispatched after the plugin wrote morphs of an NPC, on the thread that wrote them
+	class MorphsWrittenEvent : public events::EventBase
+	{
+	public:
+		RE::Actor*                                             actor{ nullptr };
+		std::span<const std::pair<RE::BSFixedStringCS, float>> morphs;
+		bool                                                   replaced{ false };  // Every other shape blend was removed first
+	};
+
+	// The morph writes of the plugin itself: UI sliders, presets and deferred appearances. Listeners mirroring the
+	// morphs of NPCs are told what changed instead of detecting it. Must run where the NPC is safe to write.
+	class MorphWriter :
+		public utils::SingletonBase<MorphWriter>,
+		public events::EventDispatcher<MorphsWrittenEvent>
+	{
+		friend class utils::SingletonBase<MorphWriter>;
+
+	public:
+		// Morphs stored as the weights of the NPC rather than as shape blends
+		static constexpr std::string_view FatName{ "Overweight" };
+		static constexpr std::string_view MuscularName{ "Strong" };
+		static constexpr std::string_view ThinName{ "Thin" };
+
+		// Writes a_morphs, shape blends or weights by name, to the NPC of a_actor. With a_replace, the shape blends
+		// not in a_morphs are removed first.
+		void Write(RE::Actor* a_actor, std::span<const std::pair<RE::BSFixedStringCS, float>> a_morphs, bool a_replace = false);
+
+		void Write(RE::Actor* a_actor, std::string_view a_name, float a_value)
+		{
+			const std::pair<RE::BSFixedStringCS, float> morph{ RE::BSFixedStringCS(a_name), a_value };
+			Write(a_actor, { &morph, 1 });
+		}
+
+	private:
+		MorphWriter() = default;
+	};
+}
@@ -0,0 +1,156 @@
+#include "PendingAppearance.h"
+#include "MorphWriter.h"
+
+bool chargen::is3DLoaded(RE::Actor* actor)
+{
+	auto actorLoadedData = actor->loadedData.lock_read();
+	return actorLoadedData->data3D != nullptr;
+}
+
+void chargen::PendingAppearance::Register()
+{
+	events::ActorReferenceSet3dEventDispatcher::GetSingleton()->AddStaticListener(this);
+	events::ActorLoadedEventDispatcher::GetSingleton()->AddStaticListener(this);
+}
+
+void chargen::PendingAppearance::SetSettings(const Settings& a_settings)
+{
+	std::lock_guard lock(m_lock);
+	m_settings = a_settings;
+	_evict();
+}
+
+bool chargen::PendingAppearance::Defer(RE::Actor* a_actor, std::span<const std::pair<std::string_view, float>> a_morphs, std::optional<telemetry::RebuildType> a_rebuild)
+{
+	if (is3DLoaded(a_actor)) {
+		return false;
+	}
+
+	{
+		std::lock_guard lock(m_lock);
+		_insert(a_actor, a_morphs, a_rebuild);
+	}
+
+	// The 3D may have been set since the check above, before the insert, whose event then found nothing to flush
+	if (is3DLoaded(a_actor)) {
+		_flush(a_actor);
+	}
+	return true;
+}
+
+void chargen::PendingAppearance::_insert(RE::Actor* a_actor, std::span<const std::pair<std::string_view, float>> a_morphs, std::optional<telemetry::RebuildType> a_rebuild)
+{
+	auto [it, inserted] = m_changes.try_emplace(a_actor->formID);
+	auto& changes = it->second;
+	if (inserted) {
+		changes.actor = RE::NiPointer<RE::Actor>(a_actor);
+		m_lru.push_front(a_actor->formID);
+		changes.lru = m_lru.begin();
+	} else {
+		m_lru.splice(m_lru.begin(), m_lru, changes.lru);
+		m_bytes -= changes.Bytes();
+	}
+
+	for (auto& [name, value] : a_morphs) {
+		RE::BSFixedStringCS morph_name(name);
+		auto                morph = std::find_if(changes.morphs.begin(), changes.morphs.end(), [&](const auto& a_morph) { return a_morph.first == morph_name; });
+		if (morph != changes.morphs.end()) {
+			morph->second = value;
+		} else {
+			changes.morphs.emplace_back(morph_name, value);
+		}
+	}
+
+	if (a_rebuild) {
+		changes.chargen |= *a_rebuild == telemetry::RebuildType::kChargen;
+		changes.full |= *a_rebuild != telemetry::RebuildType::kChargen;
+		changes.body |= *a_rebuild == telemetry::RebuildType::kAppearanceBody;
+		changes.race |= *a_rebuild == telemetry::RebuildType::kAppearanceRace;
+	}
+
+	m_bytes += changes.Bytes();
+	trace::Write(trace::Event::kAppearanceDeferred, a_actor->formID, static_cast<uint32_t>(changes.morphs.size()), a_rebuild ? static_cast<uint32_t>(*a_rebuild) + 1 : 0);
+	_evict();
+}
+
+size_t chargen::PendingAppearance::GetNumActors()
+{
+	std::lock_guard lock(m_lock);
+	return m_changes.size();
+}
+
+size_t chargen::PendingAppearance::GetNumBytes()
+{
+	std::lock_guard lock(m_lock);
+	return m_bytes;
+}
+
+void chargen::PendingAppearance::OnEvent(const events::ActorReferenceSet3dEvent& a_event, events::EventDispatcher<events::ActorReferenceSet3dEvent>* a_dispatcher)
+{
+	_flush(a_event.actor);
+}
+
+void chargen::PendingAppearance::OnEvent(const events::ActorLoadedEvent& a_event, events::EventDispatcher<events::ActorLoadedEvent>* a_dispatcher)
+{
+	if (a_event.loaded) {
+		_flush(a_event.actor);
+	}
+}
+
+void chargen::PendingAppearance::_flush(RE::Actor* a_actor)
+{
+	ChangeSet changes;
+	{
+		std::lock_guard lock(m_lock);
+		auto            it = m_changes.find(a_actor->formID);
+		if (it == m_changes.end()) {
+			return;
+		}
+		m_bytes -= it->second.Bytes();
+		m_lru.erase(it->second.lru);
+		changes = std::move(it->second);
+		m_changes.erase(it);
+	}
+	auto rebuild = changes.Rebuild();
+	trace::Write(trace::Event::kAppearanceApplied, a_actor->formID, static_cast<uint32_t>(changes.morphs.size()), rebuild ? static_cast<uint32_t>(*rebuild) + 1 : 0);
+	_apply(std::move(changes), true);
+}
+
+void chargen::PendingAppearance::_evict()
+{
+	while (!m_lru.empty() && (m_bytes > m_settings.max_bytes || m_changes.size() > m_settings.max_actors)) {
+		auto it = m_changes.find(m_lru.back());
+		m_lru.pop_back();
+		m_bytes -= it->second.Bytes();
+		trace::Write(trace::Event::kAppearanceEvicted, it->first, static_cast<uint32_t>(it->second.morphs.size()));
+		_apply(std::move(it->second), false);
+		m_changes.erase(it);
+	}
+}
+
+void chargen::PendingAppearance::_apply(ChangeSet&& a_changes, bool a_rebuild)
+{
+	SFSE::GetTaskInterface()->AddTask([changes = std::move(a_changes), a_rebuild, queued = telemetry::RebuildTelemetry::Clock::now()]() {
+		if (!changes.actor->GetNPC()) {
+			return;
+		}
+
+		MorphWriter::GetSingleton().Write(changes.actor.get(), changes.morphs);
+
+		if (!a_rebuild || !is3DLoaded(changes.actor.get())) {
+			return;
+		}
+
+		auto& telemetry = telemetry::RebuildTelemetry::GetSingleton();
+		auto  type = changes.Rebuild();
+		if (type == telemetry::RebuildType::kChargen) {
+			telemetry.Execute(*type, changes.actor->formID, queued, [&]() {
+				changes.actor->UpdateChargenAppearance();
+			});
+		} else if (type) {
+			telemetry.Execute(*type, changes.actor->formID, queued, [&]() {
+				changes.actor->UpdateAppearance(changes.body, 0u, changes.race);
+			});
+		}
+	});
+}
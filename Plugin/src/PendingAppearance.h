@@ -0,0 +1,97 @@
+#pragma once
+#include "SFEventHandler.h"
+#include "SingletonBase.h"
+#include "RebuildTelemetry.h"
+
+namespace chargen
+{
+	// Whether the 3D of an actor is loaded, rebuilding the appearance of an actor without it does nothing
+	bool is3DLoaded(RE::Actor* actor);
+
+	// Morph changes and appearance rebuilds of actors without loaded 3D, by formID.
+	// Each actor keeps the last value of every morph and the strongest rebuild asked for, which are applied
+	// in one game thread task, with a single rebuild, once its 3D is set or it is reported loaded.
+	// Past the memory caps, the actor left untouched the longest is evicted: its morphs are written to its NPC
+	// without a rebuild, which the game does itself when it loads the actor.
+	class PendingAppearance :
+		public utils::SingletonBase<PendingAppearance>,
+		public events::EventDispatcher<events::ActorReferenceSet3dEvent>::Listener,
+		public events::EventDispatcher<events::ActorLoadedEvent>::Listener
+	{
+		friend class utils::SingletonBase<PendingAppearance>;
+
+	public:
+		struct Settings
+		{
+			size_t max_bytes{ 1 << 20 };  // Every change set together
+			size_t max_actors{ 2048 };
+		};
+
+		void Register();
+
+		void SetSettings(const Settings& a_settings);
+
+		// Keeps a_morphs (shape blends or weights by name) and a_rebuild of a_actor until its 3D is ready,
+		// false if its 3D is loaded and the caller should apply them itself. Safe on any thread.
+		bool Defer(RE::Actor* a_actor, std::span<const std::pair<std::string_view, float>> a_morphs, std::optional<telemetry::RebuildType> a_rebuild);
+
+		bool DeferRebuild(RE::Actor* a_actor, telemetry::RebuildType a_rebuild)
+		{
+			return Defer(a_actor, {}, a_rebuild);
+		}
+
+		size_t GetNumActors();
+		size_t GetNumBytes();
+
+		void OnEvent(const events::ActorReferenceSet3dEvent& a_event, events::EventDispatcher<events::ActorReferenceSet3dEvent>* a_dispatcher) override;
+		void OnEvent(const events::ActorLoadedEvent& a_event, events::EventDispatcher<events::ActorLoadedEvent>* a_dispatcher) override;
+
+	private:
+		struct ChangeSet
+		{
+			RE::NiPointer<RE::Actor>                           actor;
+			std::vector<std::pair<RE::BSFixedStringCS, float>> morphs;  // One entry per name
+			bool                                               chargen{ false };
+			bool                                               full{ false };  // UpdateAppearance, taking over chargen
+			bool                                               body{ false };
+			bool                                               race{ false };
+			std::list<RE::TESFormID>::iterator                 lru;
+
+			size_t Bytes() const
+			{
+				return sizeof(ChangeSet) + morphs.capacity() * sizeof(morphs[0]);
+			}
+
+			// The strongest rebuild asked for, chargen if morphs changed without one
+			std::optional<telemetry::RebuildType> Rebuild() const
+			{
+				if (full) {
+					return race ? telemetry::RebuildType::kAppearanceRace :
+					       body ? telemetry::RebuildType::kAppearanceBody :
+					              telemetry::RebuildType::kAppearance;
+				}
+				if (chargen || !morphs.empty()) {
+					return telemetry::RebuildType::kChargen;
+				}
+				return std::nullopt;
+			}
+		};
+
+		PendingAppearance() = default;
+
+		// Queues a game thread task applying a_changes, rebuilding if a_rebuild
+		static void _apply(ChangeSet&& a_changes, bool a_rebuild);
+
+		void _flush(RE::Actor* a_actor);
+
+		// Under m_lock
+		void _insert(RE::Actor* a_actor, std::span<const std::pair<std::string_view, float>> a_morphs, std::optional<telemetry::RebuildType> a_rebuild);
+		void _evict();
+
+		Settings                                     m_settings;
+		std::mutex                                   m_lock;
+		std::unordered_map<RE::TESFormID, ChangeSet> m_changes;
+		std::list<RE::TESFormID>                     m_lru;  // Most recently deferred first
+		size_t                                       m_bytes{ 0 };
+	};
+}
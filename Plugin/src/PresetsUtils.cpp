@@ -1,4 +1,5 @@
 #include "PresetsUtils.h"
+#include "MorphWriter.h"
 
 //
 // Getting data from NPC
@@ -153,8 +154,10 @@ nlohmann::json presets::getPresetData(RE::TESNPC* npc)
 // Preset data loaders
 //
 
-void presets::applyDataMorphs(RE::TESNPC* npc, nlohmann::json morphdata, bool additive)
+void presets::applyDataMorphs(RE::Actor* actor, nlohmann::json morphdata, bool additive)
 {
+	RE::TESNPC* npc = actor->GetNPC();
+
 	// Face morph regions
 	RE::BSTHashMap<RE::BSFixedStringCS, float>* npcMorphDefinitions = chargen::availableMorphDefinitions(npc);
 	
@@ -198,34 +201,32 @@ void presets::applyDataMorphs(RE::TESNPC* npc, nlohmann::json morphdata, bool ad
 		}
 	}
 	
-	// Shape-Blends
+	// Shape-Blends and weights, written at once
+	std::vector<std::pair<RE::BSFixedStringCS, float>> morphs;
+	bool                                               replace = false;
+
 	auto shapeBlends = chargen::availableShapeBlends(npc);
 
 	if (shapeBlends != nullptr && morphdata.contains("ShapeBlends")) {
 		nlohmann::json j_shapeBlends = morphdata["ShapeBlends"];
 
-		if (!additive)
-		{
-			shapeBlends->clear();
-		}
+		replace = !additive;
 
 		for (const auto& sb : j_shapeBlends.items()) {
-			if (shapeBlends->contains(sb.key()))
-			{
-				shapeBlends->find(sb.key())->value = (float)sb.value();
-			}
-			else {
-				shapeBlends->insert(std::make_pair(RE::BSFixedStringCS(sb.key()), (float)sb.value()));
-			}
+			morphs.emplace_back(RE::BSFixedStringCS(sb.key()), (float)sb.value());
 		}
 	}
 
 	// Weights
 	if (morphdata.contains("Weights")) {
 		nlohmann::json j_weight = morphdata["Weights"];
-		npc->morphWeight.fat = j_weight["Overweight"];
-		npc->morphWeight.thin = j_weight["Thin"];
-		npc->morphWeight.muscular = j_weight["Strong"];
+		morphs.emplace_back(RE::BSFixedStringCS(chargen::MorphWriter::FatName), j_weight["Overweight"].get<float>());
+		morphs.emplace_back(RE::BSFixedStringCS(chargen::MorphWriter::ThinName), j_weight["Thin"].get<float>());
+		morphs.emplace_back(RE::BSFixedStringCS(chargen::MorphWriter::MuscularName), j_weight["Strong"].get<float>());
+	}
+
+	if (!morphs.empty() || replace) {
+		chargen::MorphWriter::GetSingleton().Write(actor, morphs, replace);
 	}
 }
 
@@ -375,7 +376,7 @@ void presets::loadPresetData(RE::Actor* actor, nlohmann::json j, bool additive)
 
 	// Morphs
 	if (j["Morphs"].size() >= 1) {
-		applyDataMorphs(npc, j["Morphs"], additive);
+		applyDataMorphs(actor, j["Morphs"], additive);
 	}
 
 	// Race
@@ -37,8 +37,8 @@ namespace presets
 	// Setters
 	//
 
-	// Applies morph data to an actor
-	void applyDataMorphs(RE::TESNPC* npc, nlohmann::json morphdata, bool additive);
+	// Applies morph data to an actor, shape blends and weights through chargen::MorphWriter
+	void applyDataMorphs(RE::Actor* actor, nlohmann::json morphdata, bool additive);
 
 	// Applies AVM data to actor
 	void applyDataAVM(RE::TESNPC* npc, nlohmann::json avmdata, bool additive);
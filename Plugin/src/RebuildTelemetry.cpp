@@ -0,0 +1,200 @@
+#include "RebuildTelemetry.h"
+#include "Utils.h"
+
+uint32_t telemetry::DurationHistogram::BucketOf(uint64_t a_ns)
+{
+	if (a_ns < (uint64_t(1) << MinExponent)) {
+		return static_cast<uint32_t>(a_ns >> (MinExponent - SubBucketBits));
+	}
+	const uint32_t exponent = static_cast<uint32_t>(std::bit_width(a_ns)) - 1;
+	if (exponent > MaxExponent) {
+		return NumBuckets - 1;
+	}
+	const auto sub_bucket = static_cast<uint32_t>(a_ns >> (exponent - SubBucketBits)) - SubBuckets;
+	return (exponent - MinExponent + 1) * SubBuckets + sub_bucket;
+}
+
+uint64_t telemetry::DurationHistogram::BucketLow(uint32_t a_bucket)
+{
+	if (a_bucket < SubBuckets) {
+		return uint64_t(a_bucket) << (MinExponent - SubBucketBits);
+	}
+	const uint32_t exponent = a_bucket / SubBuckets - 1 + MinExponent;
+	return uint64_t(SubBuckets + a_bucket % SubBuckets) << (exponent - SubBucketBits);
+}
+
+uint64_t telemetry::DurationHistogram::BucketWidth(uint32_t a_bucket)
+{
+	const uint32_t exponent = a_bucket < SubBuckets ? MinExponent : a_bucket / SubBuckets - 1 + MinExponent;
+	return uint64_t(1) << (exponent - SubBucketBits);
+}
+
+uint64_t telemetry::DurationHistogram::Percentile(double a_percentile) const
+{
+	const uint64_t count = Count();
+	if (!count) {
+		return 0;
+	}
+
+	const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(a_percentile / 100.0 * count)));
+	uint64_t   seen = 0;
+	for (uint32_t bucket = 0; bucket < NumBuckets; ++bucket) {
+		seen += m_buckets[bucket].load(std::memory_order_relaxed);
+		if (seen >= rank) {
+			return std::min(BucketLow(bucket) + BucketWidth(bucket), Max());
+		}
+	}
+	return Max();
+}
+
+void telemetry::DurationHistogram::Reset()
+{
+	for (auto& bucket : m_buckets) {
+		bucket.store(0, std::memory_order_relaxed);
+	}
+	m_count = 0;
+	m_sum = 0;
+	m_max = 0;
+}
+
+const char* telemetry::GetRebuildTypeName(RebuildType a_type)
+{
+	switch (a_type) {
+	case RebuildType::kChargen:
+		return "UpdateChargenAppearance";
+	case RebuildType::kAppearance:
+		return "UpdateAppearance";
+	case RebuildType::kAppearanceBody:
+		return "UpdateAppearance (body)";
+	case RebuildType::kAppearanceRace:
+		return "UpdateAppearance (race)";
+	default:
+		return "Unknown";
+	}
+}
+
+void telemetry::RebuildTelemetry::Skip(RebuildType a_type, RE::TESFormID a_formID, bool a_merged)
+{
+	trace::Write(trace::Event::kRebuildSkipped, a_formID, static_cast<uint32_t>(a_type), a_merged);
+
+	auto& stats = m_stats[static_cast<size_t>(a_type)];
+	(a_merged ? stats.merged : stats.dropped).fetch_add(1, std::memory_order_relaxed);
+}
+
+void telemetry::RebuildTelemetry::_record(RebuildType a_type, RE::TESFormID a_formID, Clock::duration a_queued, Clock::duration a_execution)
+{
+	const auto queued_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(a_queued).count();
+	const auto execution_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(a_execution).count();
+	trace::Write(trace::Event::kRebuildExecuted, a_formID, static_cast<uint32_t>(a_type), static_cast<uint32_t>(queued_ns / 1000), static_cast<uint32_t>(execution_ns / 1000));
+
+	auto& stats = m_stats[static_cast<size_t>(a_type)];
+	stats.queue_latency.Record(queued_ns);
+	stats.execution.Record(execution_ns);
+
+	if (auto slot = _find_actor(a_formID)) {
+		slot->counts[static_cast<size_t>(a_type)].fetch_add(1, std::memory_order_relaxed);
+	} else {
+		m_untracked.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+telemetry::RebuildTelemetry::ActorSlot* telemetry::RebuildTelemetry::_find_actor(RE::TESFormID a_formID)
+{
+	if (!a_formID) {
+		return nullptr;
+	}
+
+	// Fibonacci hashing, then linear probing. A failed claim leaves the actor that won it in current.
+	uint32_t index = (a_formID * 0x9E3779B1u) >> (32 - MaxActorsBits);
+	for (uint32_t probe = 0; probe < MaxProbes; ++probe, index = (index + 1) & (MaxActors - 1)) {
+		auto&         slot = m_actors[index];
+		RE::TESFormID current = slot.formID.load(std::memory_order_acquire);
+		if (!current && slot.formID.compare_exchange_strong(current, a_formID, std::memory_order_acq_rel)) {
+			return &slot;
+		}
+		if (current == a_formID) {
+			return &slot;
+		}
+	}
+	return nullptr;
+}
+
+std::vector<std::pair<RE::TESFormID, telemetry::RebuildTelemetry::ActorCounts>> telemetry::RebuildTelemetry::GetTopActors(size_t a_count) const
+{
+	std::vector<std::pair<RE::TESFormID, ActorCounts>> actors;
+	for (auto& slot : m_actors) {
+		if (auto formID = slot.formID.load(std::memory_order_acquire)) {
+			ActorCounts counts{};
+			for (size_t type = 0; type < counts.size(); ++type) {
+				counts[type] = slot.counts[type].load(std::memory_order_relaxed);
+			}
+			actors.emplace_back(formID, counts);
+		}
+	}
+
+	auto total = [](const ActorCounts& a_counts) { return std::accumulate(a_counts.begin(), a_counts.end(), uint64_t(0)); };
+	a_count = std::min(a_count, actors.size());
+	std::partial_sort(actors.begin(), actors.begin() + a_count, actors.end(), [&](const auto& a_lhs, const auto& a_rhs) {
+		return total(a_lhs.second) > total(a_rhs.second);
+	});
+	actors.resize(a_count);
+	return actors;
+}
+
+// One row per value: counters, then histogram buckets, then actors, untracked ones last
+std::string telemetry::RebuildTelemetry::DumpCSV()
+{
+	std::string folder = utils::GetPluginFolder() + "\\Telemetry";
+	if (!std::filesystem::exists(folder)) {
+		std::filesystem::create_directories(folder);
+	}
+	std::string path = folder + "\\rebuilds_" + utils::GetCurrentTimeString("%Y%m%d_%H%M%S") + ".csv";
+
+	std::ofstream file(path);
+	file << "kind,type,key,low_ns,high_ns,count\n";
+	for (size_t type = 0; type < m_stats.size(); ++type) {
+		auto  name = GetRebuildTypeName(static_cast<RebuildType>(type));
+		auto& stats = m_stats[type];
+		file << std::format("counter,{},submitted,,,{}\n", name, stats.submitted.load());
+		file << std::format("counter,{},executed,,,{}\n", name, stats.execution.Count());
+		if (IsCoalesced(static_cast<RebuildType>(type))) {
+			file << std::format("counter,{},dropped,,,{}\n", name, stats.dropped.load());
+			file << std::format("counter,{},merged,,,{}\n", name, stats.merged.load());
+		}
+		stats.queue_latency.ForEachBucket([&](uint64_t a_low, uint64_t a_high, uint64_t a_count) {
+			file << std::format("queue_latency,{},,{},{},{}\n", name, a_low, a_high, a_count);
+		});
+		stats.execution.ForEachBucket([&](uint64_t a_low, uint64_t a_high, uint64_t a_count) {
+			file << std::format("execution,{},,{},{},{}\n", name, a_low, a_high, a_count);
+		});
+	}
+
+	for (auto& [formID, counts] : GetTopActors(MaxActors)) {
+		for (size_t type = 0; type < counts.size(); ++type) {
+			if (counts[type]) {
+				file << std::format("actor,{},{:08X},,,{}\n", GetRebuildTypeName(static_cast<RebuildType>(type)), formID, counts[type]);
+			}
+		}
+	}
+	file << std::format("counter,,untracked,,,{}\n", GetNumUntracked());
+	return path;
+}
+
+void telemetry::RebuildTelemetry::Reset()
+{
+	for (auto& stats : m_stats) {
+		stats.queue_latency.Reset();
+		stats.execution.Reset();
+		stats.submitted = 0;
+		stats.dropped = 0;
+		stats.merged = 0;
+	}
+
+	for (auto& slot : m_actors) {
+		for (auto& count : slot.counts) {
+			count.store(0, std::memory_order_relaxed);
+		}
+		slot.formID.store(0, std::memory_order_release);
+	}
+	m_untracked = 0;
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include "SingletonBase.h"
+#include "TraceBuffer.h"
+
+namespace telemetry
+{
+	// Log-linear histogram of durations in nanoseconds, HDR style: each power of two is split in SubBuckets linear
+	// buckets, so every value is known to within 1/SubBuckets of itself, from 1 us to about a minute.
+	// Record is lock free and may run on any thread.
+	class DurationHistogram
+	{
+	public:
+		static constexpr uint32_t SubBucketBits = 4;
+		static constexpr uint32_t SubBuckets = 1 << SubBucketBits;
+		static constexpr uint32_t MinExponent = 10;  // Values under 2^MinExponent ns share SubBuckets linear buckets
+		static constexpr uint32_t MaxExponent = 35;  // Values from 2^(MaxExponent + 1) ns on land in the last bucket
+		static constexpr uint32_t NumBuckets = (MaxExponent - MinExponent + 2) * SubBuckets;
+
+		void Record(uint64_t a_ns)
+		{
+			m_buckets[BucketOf(a_ns)].fetch_add(1, std::memory_order_relaxed);
+			m_count.fetch_add(1, std::memory_order_relaxed);
+			m_sum.fetch_add(a_ns, std::memory_order_relaxed);
+
+			uint64_t max = m_max.load(std::memory_order_relaxed);
+			while (a_ns > max && !m_max.compare_exchange_weak(max, a_ns, std::memory_order_relaxed)) {}
+		}
+
+		uint64_t Count() const { return m_count.load(std::memory_order_relaxed); }
+		uint64_t Max() const { return m_max.load(std::memory_order_relaxed); }
+		double   Mean() const { return Count() ? static_cast<double>(m_sum.load(std::memory_order_relaxed)) / Count() : 0.0; }
+
+		// Upper bound of the bucket holding the a_percentile (0 to 100) percentile, 0 if empty
+		uint64_t Percentile(double a_percentile) const;
+
+		// Calls a_func(low_ns, high_ns, count) for every bucket holding a value
+		template <class _Func>
+		void ForEachBucket(_Func&& a_func) const
+		{
+			for (uint32_t bucket = 0; bucket < NumBuckets; ++bucket) {
+				if (auto count = m_buckets[bucket].load(std::memory_order_relaxed); count) {
+					a_func(BucketLow(bucket), BucketLow(bucket) + BucketWidth(bucket), count);
+				}
+			}
+		}
+
+		void Reset();
+
+		static uint32_t BucketOf(uint64_t a_ns);
+		static uint64_t BucketLow(uint32_t a_bucket);
+		static uint64_t BucketWidth(uint32_t a_bucket);
+
+	private:
+		std::array<std::atomic<uint64_t>, NumBuckets> m_buckets{};
+		std::atomic<uint64_t>                         m_count{ 0 };
+		std::atomic<uint64_t>                         m_sum{ 0 };
+		std::atomic<uint64_t>                         m_max{ 0 };
+	};
+
+	enum class RebuildType : uint8_t
+	{
+		kChargen,         // Actor::UpdateChargenAppearance
+		kAppearance,      // Actor::UpdateAppearance
+		kAppearanceBody,  // Actor::UpdateAppearance with updateBody
+		kAppearanceRace,  // Actor::UpdateAppearance with raceChange
+		kTotal
+	};
+
+	const char* GetRebuildTypeName(RebuildType a_type);
+
+	// Whether requests of a_type are skipped while one is queued, the others are always submitted and have no
+	// dropped or merged counts
+	constexpr bool IsCoalesced(RebuildType a_type)
+	{
+		return a_type == RebuildType::kChargen;
+	}
+
+	struct RebuildStats
+	{
+		DurationHistogram     queue_latency;  // From AddTask to the start of the rebuild
+		DurationHistogram     execution;
+		std::atomic<uint64_t> submitted{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };  // Skipped while a rebuild of another actor was queued, see IsCoalesced
+		std::atomic<uint64_t> merged{ 0 };   // Skipped while a rebuild of the same actor was queued
+	};
+
+	// Costs and counts of appearance rebuilds, shown in the Debug tab. Every rebuild queued with
+	// SFSE::GetTaskInterface()->AddTask goes through Submit, or Execute if its task runs more than one.
+	//
+	// Recording takes no lock. Per-actor counts live in a fixed table of MaxActors slots, claimed by the actors
+	// rebuilt first since the last Reset; rebuilds of actors that find no slot are only counted as untracked.
+	class RebuildTelemetry : public utils::SingletonBase<RebuildTelemetry>
+	{
+		friend class utils::SingletonBase<RebuildTelemetry>;
+
+	public:
+		using Clock = std::chrono::steady_clock;
+		using ActorCounts = std::array<uint64_t, static_cast<size_t>(RebuildType::kTotal)>;  // By RebuildType
+
+		static constexpr uint32_t MaxActorsBits = 10;
+		static constexpr uint32_t MaxActors = 1 << MaxActorsBits;
+		static constexpr uint32_t MaxProbes = 64;  // Slots looked at for an actor before counting it as untracked
+
+		// Queues a_rebuild of a_actor on the game thread, timing its wait in the queue and its execution
+		template <class _Func>
+		void Submit(RebuildType a_type, RE::Actor* a_actor, _Func&& a_rebuild)
+		{
+			m_stats[static_cast<size_t>(a_type)].submitted.fetch_add(1, std::memory_order_relaxed);
+			trace::Write(trace::Event::kRebuildSubmitted, a_actor->formID, static_cast<uint32_t>(a_type));
+			SFSE::GetTaskInterface()->AddTask([this, a_type, formID = a_actor->formID, queued = Clock::now(), rebuild = std::forward<_Func>(a_rebuild)]() mutable {
+				this->_execute(a_type, formID, queued, rebuild);
+			});
+		}
+
+		// Runs a_rebuild of a_formID now, from a task queued at a_queued
+		template <class _Func>
+		void Execute(RebuildType a_type, RE::TESFormID a_formID, Clock::time_point a_queued, _Func&& a_rebuild)
+		{
+			m_stats[static_cast<size_t>(a_type)].submitted.fetch_add(1, std::memory_order_relaxed);
+			_execute(a_type, a_formID, a_queued, a_rebuild);
+		}
+
+		// Counts a rebuild request of a_formID skipped because one is already queued, merged if it is for the same actor
+		void Skip(RebuildType a_type, RE::TESFormID a_formID, bool a_merged);
+
+		const RebuildStats& GetStats(RebuildType a_type) const
+		{
+			return m_stats[static_cast<size_t>(a_type)];
+		}
+
+		// The a_count actors rebuilt most often, with their rebuild count of every type
+		std::vector<std::pair<RE::TESFormID, ActorCounts>> GetTopActors(size_t a_count) const;
+
+		// Rebuilds of actors that found no slot in the per-actor table
+		uint64_t GetNumUntracked() const
+		{
+			return m_untracked.load(std::memory_order_relaxed);
+		}
+
+		// Writes counters, histogram buckets and per-actor counts to <plugin folder>\Telemetry, returns the file path
+		std::string DumpCSV();
+
+		// Counts recorded while it runs may be lost
+		void Reset();
+
+	private:
+		struct ActorSlot
+		{
+			std::atomic<RE::TESFormID>                                                   formID{ 0 };  // 0 while free
+			std::array<std::atomic<uint64_t>, static_cast<size_t>(RebuildType::kTotal)> counts{};
+		};
+
+		RebuildTelemetry() = default;
+
+		template <class _Func>
+		void _execute(RebuildType a_type, RE::TESFormID a_formID, Clock::time_point a_queued, _Func& a_rebuild)
+		{
+			const auto start = Clock::now();
+			a_rebuild();
+			const auto end = Clock::now();
+			_record(a_type, a_formID, start - a_queued, end - start);
+		}
+
+		void _record(RebuildType a_type, RE::TESFormID a_formID, Clock::duration a_queued, Clock::duration a_execution);
+
+		// Slot of a_formID, claimed if it has none yet, null if none of its MaxProbes slots is free
+		ActorSlot* _find_actor(RE::TESFormID a_formID);
+
+		std::array<RebuildStats, static_cast<size_t>(RebuildType::kTotal)> m_stats;
+
+		std::array<ActorSlot, MaxActors> m_actors;  // Open addressing, slots are only freed by Reset
+		std::atomic<uint64_t>            m_untracked{ 0 };
+	};
+}
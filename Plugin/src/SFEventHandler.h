@@ -235,6 +235,7 @@ namespace events
 	};
 
 	class ActorInitializedEventDispatcher :
+		public hooks::ActorInitializerFuncHook::Listener,
 		public EventDispatcher<ActorInitializedEvent>
 	{
 	public:
@@ -243,7 +244,17 @@ namespace events
 			static ActorInitializedEventDispatcher singleton;
 			return &singleton;
 		}
-	
+
+		void OnEvent(const event_type& a_vfunc_event, dispatcher_type* a_vfunc_dispatcher) override
+		{
+			this->Dispatch({ a_vfunc_event.GetArg<0>(), a_vfunc_event.GetArg<1>(), a_vfunc_event.GetArg<2>() });
+		}
+
+		// Subscribing installs the ActorInitializer hook, which stays out of the game until then
+		void Register()
+		{
+			hooks::ActorInitializerFuncHook::GetSingleton()->AddStaticListener(this);
+		}
 	};
 
 	class ActorUpdatedEventDispatcher :
@@ -270,7 +281,7 @@ namespace events
 					this->WatchInstance(actor_form);
 					
 					if (this->NumWatching() > 512) {
-						logger::c_warn("ActorLoadedEventDispatcher::ProcessEvent(): watch list is too large! (instance count > 512)");
+						logger::c_warn_limited("ActorLoadedEventDispatcher::ProcessEvent(): watch list is too large! (instance count {} > 512)", this->NumWatching());
 					}
 				}
 				else {
@@ -0,0 +1,183 @@
+#include "TraceBuffer.h"
+#include "LogWrapper.h"
+#include "RebuildTelemetry.h"
+#include "Utils.h"
+
+namespace trace
+{
+	namespace
+	{
+		enum class ArgType : uint8_t
+		{
+			kNone,
+			kNumber,
+			kRebuildType,
+			kOptionalRebuildType,  // RebuildType + 1, 0 if none
+		};
+
+		struct Arg
+		{
+			const char* name{ nullptr };
+			ArgType     type{ ArgType::kNone };
+		};
+
+		struct EventInfo
+		{
+			const char*        name;
+			std::array<Arg, 4> args;
+		};
+
+		constexpr std::array<EventInfo, static_cast<size_t>(Event::kTotal)> g_events{ {
+			{ "RebuildSubmitted", { { { "type", ArgType::kRebuildType } } } },
+			{ "RebuildExecuted", { { { "type", ArgType::kRebuildType }, { "queued_us", ArgType::kNumber }, { "execution_us", ArgType::kNumber } } } },
+			{ "RebuildSkipped", { { { "type", ArgType::kRebuildType }, { "merged", ArgType::kNumber } } } },
+			{ "HookDispatched", { { { "hook", ArgType::kNumber }, { "dispatch_ns", ArgType::kNumber } } } },
+			{ "AppearanceDeferred", { { { "morphs", ArgType::kNumber }, { "rebuild", ArgType::kOptionalRebuildType } } } },
+			{ "AppearanceApplied", { { { "morphs", ArgType::kNumber }, { "rebuild", ArgType::kOptionalRebuildType } } } },
+			{ "AppearanceEvicted", { { { "morphs", ArgType::kNumber } } } },
+			{ "ReevaluationGathered", { { { "force", ArgType::kNumber } } } },
+			{ "ReevaluationSkipped", {} },
+			{ "ReevaluationStaged", { { { "diff_milli", ArgType::kNumber }, { "needs_update", ArgType::kNumber } } } },
+		} };
+
+		// Ticks of Now() and the steady clock at load, to convert ticks to seconds when dumping
+		const uint64_t                              g_epoch_ticks = Now();
+		const std::chrono::steady_clock::time_point g_epoch_time = std::chrono::steady_clock::now();
+
+		std::array<std::atomic<Ring*>, Ring::MaxRings> g_rings{};
+		std::atomic<uint32_t>                          g_num_rings{ 0 };
+
+		LPTOP_LEVEL_EXCEPTION_FILTER g_previous_filter{ nullptr };
+
+		LONG WINAPI OnUnhandledException(EXCEPTION_POINTERS* a_info)
+		{
+			static std::atomic_flag dumped;
+			if (!dumped.test_and_set()) {
+				try {
+					Dump(std::format("crash, exception {:08X} at {}", a_info->ExceptionRecord->ExceptionCode, a_info->ExceptionRecord->ExceptionAddress));
+				} catch (...) {
+				}
+				logger::Flush(logger::CrashFlushTimeout);
+			}
+			return g_previous_filter ? g_previous_filter(a_info) : EXCEPTION_CONTINUE_SEARCH;
+		}
+	}
+}
+
+const char* trace::GetEventName(Event a_event)
+{
+	return a_event < Event::kTotal ? g_events[static_cast<size_t>(a_event)].name : "Unknown";
+}
+
+trace::Ring* trace::Ring::Acquire()
+{
+	const uint32_t index = g_num_rings.fetch_add(1, std::memory_order_relaxed);
+	if (index >= MaxRings) {
+		return nullptr;
+	}
+	auto ring = new Ring(static_cast<uint16_t>(index));
+	g_rings[index].store(ring, std::memory_order_release);
+	return ring;
+}
+
+uint32_t trace::Ring::Snapshot(Record* a_out) const
+{
+	const uint64_t head = m_head.load(std::memory_order_acquire);
+	const uint64_t first = head > Capacity ? head - Capacity : 0;
+	for (uint64_t i = first; i < head; ++i) {
+		a_out[i - first] = m_records[i & (Capacity - 1)];
+	}
+
+	// The writer went on during the copy: the records it moved past, and the one it may be writing, are torn
+	std::atomic_thread_fence(std::memory_order_acquire);
+	const uint64_t written = m_head.load(std::memory_order_relaxed);
+	const uint64_t valid = std::max(first, written + 1 > Capacity ? written + 1 - Capacity : 0);
+	if (valid >= head) {
+		return 0;
+	}
+	std::memmove(a_out, a_out + (valid - first), (head - valid) * sizeof(Record));
+	return static_cast<uint32_t>(head - valid);
+}
+
+trace::Ring* trace::GetRing(uint32_t a_index)
+{
+	return a_index < Ring::MaxRings ? g_rings[a_index].load(std::memory_order_acquire) : nullptr;
+}
+
+uint32_t trace::GetNumRings()
+{
+	return std::min(g_num_rings.load(std::memory_order_relaxed), Ring::MaxRings);
+}
+
+void trace::Dump(std::ostream& a_stream, std::string_view a_reason)
+{
+	const uint64_t now_ticks = Now();
+	const auto     elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - g_epoch_time).count();
+	const double   ticks_per_s = elapsed > 0.001 ? (now_ticks - g_epoch_ticks) / elapsed : 1e9;
+
+	a_stream << std::format("Extended Chargen trace, {}, {}\n", a_reason, utils::GetCurrentTimeString());
+
+	std::vector<Record> records;
+	std::vector<Record> ring_records(Ring::Capacity);
+	for (uint32_t i = 0; i < GetNumRings(); ++i) {
+		auto ring = GetRing(i);
+		if (!ring) {
+			continue;  // Being allocated
+		}
+		const uint32_t count = ring->Snapshot(ring_records.data());
+		records.insert(records.end(), ring_records.begin(), ring_records.begin() + count);
+
+		std::ostringstream thread_id;
+		thread_id << ring->GetThreadID();
+		a_stream << std::format("Thread {} (id {}): {} records kept of {} written\n", i, thread_id.str(), count, ring->GetNumWritten());
+	}
+
+	std::sort(records.begin(), records.end(), [](const Record& a_lhs, const Record& a_rhs) { return a_lhs.time < a_rhs.time; });
+
+	// Seconds before the dump, thread, event, formID, then the arguments by name
+	std::string line;
+	for (auto& record : records) {
+		const double seconds = (static_cast<int64_t>(record.time - now_ticks)) / ticks_per_s;
+		line = std::format("{:14.6f} T{:<3} {:<22} {:08X}", seconds, record.thread, GetEventName(record.event), record.formID);
+		if (record.event < Event::kTotal) {
+			auto& info = g_events[static_cast<size_t>(record.event)];
+			for (size_t arg = 0; arg < info.args.size(); ++arg) {
+				const uint32_t value = record.args[arg];
+				switch (info.args[arg].type) {
+				case ArgType::kNumber:
+					line += std::format(" {}={}", info.args[arg].name, value);
+					break;
+				case ArgType::kRebuildType:
+					line += std::format(" {}={}", info.args[arg].name, telemetry::GetRebuildTypeName(static_cast<telemetry::RebuildType>(value)));
+					break;
+				case ArgType::kOptionalRebuildType:
+					line += std::format(" {}={}", info.args[arg].name, value ? telemetry::GetRebuildTypeName(static_cast<telemetry::RebuildType>(value - 1)) : "none");
+					break;
+				default:
+					break;
+				}
+			}
+		}
+		line += '\n';
+		a_stream << line;
+	}
+}
+
+std::string trace::Dump(std::string_view a_reason)
+{
+	std::string folder = utils::GetPluginFolder() + "\\Traces";
+	if (!std::filesystem::exists(folder)) {
+		std::filesystem::create_directories(folder);
+	}
+	std::string path = folder + "\\trace_" + utils::GetCurrentTimeString("%Y%m%d_%H%M%S") + ".txt";
+
+	std::ofstream file(path);
+	Dump(file, a_reason);
+	return path;
+}
+
+void trace::InstallCrashHandler()
+{
+	static std::once_flag installed;
+	std::call_once(installed, []() { g_previous_filter = SetUnhandledExceptionFilter(OnUnhandledException); });
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#if defined(_M_X64)
+#	include <intrin.h>
+#	define EC_TRACE_RDTSC
+#elif defined(__x86_64__)
+#	include <x86intrin.h>
+#	define EC_TRACE_RDTSC
+#else
+#	include <chrono>
+#endif
+
+// Binary trace of the high frequency events logging can't keep up with. Every thread writes fixed size records
+// to its own ring buffer, overwriting its oldest ones, without locks or formatting: a timestamp and a few integers.
+// Records are decoded to text only when dumped, from the Debug tab, the ECTrace console command or a crash.
+namespace trace
+{
+	enum class Event : uint16_t
+	{
+		kRebuildSubmitted,      // type
+		kRebuildExecuted,       // type, queued_us, execution_us
+		kRebuildSkipped,        // type, merged
+		kHookDispatched,        // hook, dispatch_ns
+		kAppearanceDeferred,    // morphs, rebuild (type + 1, 0 if none)
+		kAppearanceApplied,     // morphs, rebuild (type + 1, 0 if none)
+		kAppearanceEvicted,     // morphs
+		kReevaluationGathered,  // force
+		kReevaluationSkipped,   // Inputs unchanged
+		kReevaluationStaged,    // diff_milli (diff of the morphs x 1000), needs_update
+		kTotal
+	};
+
+	const char* GetEventName(Event a_event);
+
+	struct Record
+	{
+		uint64_t                time;  // Ticks of Now()
+		uint32_t                formID;
+		Event                   event;
+		uint16_t                thread;  // Index of the ring buffer
+		std::array<uint32_t, 4> args;
+	};
+	static_assert(sizeof(Record) == 32);
+
+	inline uint64_t Now()
+	{
+#ifdef EC_TRACE_RDTSC
+		return __rdtsc();
+#else
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	}
+
+	// Records of a single thread, only that thread writes. Dumps copy them while they are written and drop the
+	// ones overwritten during the copy.
+	class Ring
+	{
+	public:
+		static constexpr uint32_t Capacity = 8192;  // 256 KiB
+		static constexpr uint32_t MaxRings = 256;   // Threads past it write nothing
+
+		// Ring of the calling thread, allocated on its first record and never freed. Null past MaxRings.
+		static Ring* Local()
+		{
+			thread_local Ring* ring = Acquire();
+			return ring;
+		}
+
+		void Push(Event a_event, uint32_t a_formID, uint32_t a_arg0, uint32_t a_arg1, uint32_t a_arg2, uint32_t a_arg3)
+		{
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			auto&          record = m_records[head & (Capacity - 1)];
+			record.time = Now();
+			record.formID = a_formID;
+			record.event = a_event;
+			record.thread = m_index;
+			record.args = { a_arg0, a_arg1, a_arg2, a_arg3 };
+			m_head.store(head + 1, std::memory_order_release);
+		}
+
+		// Copies the records still in the ring, oldest first, into a_out (Capacity records), returns their count
+		uint32_t Snapshot(Record* a_out) const;
+
+		uint16_t        GetIndex() const { return m_index; }
+		std::thread::id GetThreadID() const { return m_thread_id; }
+		uint64_t        GetNumWritten() const { return m_head.load(std::memory_order_acquire); }
+
+	private:
+		explicit Ring(uint16_t a_index) :
+			m_index(a_index), m_thread_id(std::this_thread::get_id())
+		{}
+
+		static Ring* Acquire();
+
+		alignas(64) std::atomic<uint64_t> m_head{ 0 };  // Records written, the next one goes to m_head % Capacity
+		uint16_t                          m_index;
+		std::thread::id                   m_thread_id;
+		std::array<Record, Capacity>      m_records;
+	};
+
+	// Every ring buffer, in order of their first record, safe to read while threads keep writing or crash
+	Ring* GetRing(uint32_t a_index);
+	uint32_t GetNumRings();
+
+	inline void Write(Event a_event, uint32_t a_formID, uint32_t a_arg0 = 0, uint32_t a_arg1 = 0, uint32_t a_arg2 = 0, uint32_t a_arg3 = 0)
+	{
+		if (auto ring = Ring::Local()) [[likely]] {
+			ring->Push(a_event, a_formID, a_arg0, a_arg1, a_arg2, a_arg3);
+		}
+	}
+
+	// Decodes the records of every thread to a_stream as text, merged by time, a_reason first
+	void Dump(std::ostream& a_stream, std::string_view a_reason);
+
+	// Dumps to <plugin folder>\Traces, returns the file path
+	std::string Dump(std::string_view a_reason);
+
+	// Dumps the trace and flushes the log before the game crashes, then lets the previous handler, if any, report the crash
+	void InstallCrashHandler();
+}
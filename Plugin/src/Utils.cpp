@@ -2,14 +2,17 @@
 
 std::string utils::GetPluginFolder()
 {
-	char    path[MAX_PATH];
-	HMODULE hModule = nullptr;  // nullptr == current DLL
+	// The DLL doesn't move, computed on the first call only
+	static const std::string folder = []() {
+		char    path[MAX_PATH];
+		HMODULE hModule = nullptr;  // nullptr == current DLL
 
-	GetModuleFileNameA(hModule, path, MAX_PATH);
+		GetModuleFileNameA(hModule, path, MAX_PATH);
 
-	std::string fullPath = path;
-	size_t      lastSlash = fullPath.find_last_of("\\/");
-	std::string folder = fullPath.substr(0, lastSlash) + "\\Data\\SFSE\\Plugins\\" + std::string(GetPluginName());
+		std::string fullPath = path;
+		size_t      lastSlash = fullPath.find_last_of("\\/");
+		return fullPath.substr(0, lastSlash) + "\\Data\\SFSE\\Plugins\\" + std::string(GetPluginName());
+	}();
 
 	return folder;
 }
@@ -112,32 +115,3 @@ bool utils::caseInsensitiveCompare(const std::string& str, const char* cstr)
 	}
 	return true;
 }
-
-std::vector<nlohmann::json> utils::getJsonConfigs(std::string subfolderName)
-{
-	auto plugin_folder = utils::GetPluginFolder();
-	auto chargen_configs = plugin_folder + "\\" + subfolderName + "\\";
-
-	std::vector<nlohmann::json> configs;
-
-	if (!std::filesystem::exists(chargen_configs)) {
-		std::filesystem::create_directories(chargen_configs);
-	}
-
-	for (const auto& entry : std::filesystem::directory_iterator(chargen_configs)) {
-		std::ifstream ifs(entry.path());
-		std::string   path = entry.path().string();
-		try {
-			nlohmann::json chargen_data = nlohmann::json::parse(ifs);
-			configs.push_back(chargen_data);
-
-		} catch (nlohmann::json::parse_error& ex) {
-			nlohmann::json dummy_data;
-			dummy_data["Name"] = path.substr(path.find_last_of("/\\") + 1) + " PARSING ERROR";
-
-			configs.push_back(dummy_data);
-		}
-	}
-
-	return configs;
-}
@@ -64,6 +64,4 @@ namespace utils
 	}
 
 	bool caseInsensitiveCompare(const std::string& str, const char* cstr);
-
-	std::vector<nlohmann::json> getJsonConfigs(std::string subfolderName);
 }
\ No newline at end of file
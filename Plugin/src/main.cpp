@@ -16,6 +16,13 @@
 #include "LogWrapper.h"
 #include "SFEventHandler.h"
 #include "HookManager.h"
+#include "RebuildTelemetry.h"
+#include "PendingAppearance.h"
+#include "ExpressionBlender.h"
+#include "ExpressionTimeline.h"
+#include "TraceBuffer.h"
+#include "ConfigService.h"
+#include "MorphWriter.h"
 
 //#include "ConditionalMorphManager.h"
 
@@ -40,8 +47,25 @@ static LogBufferHandle             LogHandle = 0;
 static auto                        lastExecutionTime = std::chrono::steady_clock::now();
 
 static std::atomic<bool> hasLoaded = false;
-static nlohmann::json customConfig;
-static nlohmann::json customPresets;
+
+static std::terminate_handler previousTerminateHandler = nullptr;
+
+// Uncaught exceptions end here rather than in the crash handler, write what is still queued before aborting
+static void OnTerminate()
+{
+	logger::error("Terminating on an uncaught exception");
+	logger::Flush(logger::CrashFlushTimeout);
+	if (previousTerminateHandler) {
+		previousTerminateHandler();
+	}
+	std::abort();
+}
+
+// ECTrace: dumps the trace of recent rebuilds, reevaluations and hook calls to <plugin folder>\Traces
+static void TraceCommand(const CCF::simple_array<CCF::simple_string_view>& a_args, const char* a_fullString, CCF::ConsoleInterface* a_intfc)
+{
+	a_intfc->PrintLn(std::format("Trace written to '{}'", trace::Dump("console command")));
+}
 
 void MessageCallback(SFSE::MessagingInterface::Message* a_msg) noexcept
 {
@@ -50,16 +74,23 @@ void MessageCallback(SFSE::MessagingInterface::Message* a_msg) noexcept
 	switch (a_msg->type) {
 	case SFSE::MessagingInterface::kPostDataLoad:
 		{
+			config::ConfigService::GetSingleton().Start();  // ExpressionBlender loads its poses from the Expressions folder
 			hasLoaded = true;
-			customConfig = utils::getJsonConfigs("Chargen");
-			customPresets = utils::getJsonConfigs("Presets");
+			chargen::ExpressionTimeline::GetSingleton().LoadClips();
 		}
 		break;
 	case SFSE::MessagingInterface::kPostLoad:
 		{
 			events::RegisterHandlers();
+			chargen::PendingAppearance::GetSingleton().Register();
+			chargen::ExpressionBlender::GetSingleton().Register();
+			chargen::ExpressionTimeline::GetSingleton().Register();
 			
 			hooks::InstallHooks();
+
+			if (!CCF::RegisterCommand("ECTrace", TraceCommand)) {
+				logger::info("Custom Command Framework not found, dump the trace from the Debug tab");
+			}
 		}
 		break;
 	default:
@@ -215,14 +246,20 @@ namespace ExtendedChargen
 			UI->Text("Weight");
 			auto* weights = chargen::availableMorphWeight(actorNpc);
 
-			for (const auto& [str, weightData] : *weights) {
+			// Morph names of the weights, in the order of availableMorphWeight
+			static constexpr std::string_view weightNames[] = { chargen::MorphWriter::FatName, chargen::MorphWriter::ThinName, chargen::MorphWriter::MuscularName };
+
+			for (size_t i = 0; i < weights->size(); i++) {
+				const auto& [str, weightData] = (*weights)[i];
+				float       value = *weightData;
 				if (UI->SliderFloat(
 						str.c_str(),
-						weightData,
+						&value,
 						0.0f,
 						1.0f,
 						NULL))
 				{
+					chargen::MorphWriter::GetSingleton().Write(actor, weightNames[i], value);
 					chargen::updateActorAppearance(actor);
 				}
 			}
@@ -235,13 +272,15 @@ namespace ExtendedChargen
 				UI->Text("Shape Blends (Morphs)");
 
 				for (const auto& pair : *shapeBlends) {
+					float value = pair.value;
 					if (UI->SliderFloat(
 							pair.key.c_str(),
-							(float*)&pair.value,
+							&value,
 							0.0f,
 							1.0f,
 							NULL))
 					{
+						chargen::MorphWriter::GetSingleton().Write(actor, pair.key.c_str(), value);  // Existing key, the map isn't resized
 						chargen::updateActorAppearance(actor);
 					}
 				}
@@ -313,8 +352,10 @@ namespace ExtendedChargen
 			*/
 
 		} else if (activeTab == 5) { // Custom morphs
-			customPresets = utils::getJsonConfigs("Presets");
-			customConfig = utils::getJsonConfigs("Chargen");
+			// Snapshots of the config folders, loaded before hasLoaded is set and kept up to date by the service
+			auto& configs = config::ConfigService::GetSingleton();
+			auto  customConfig = configs.Get(config::Folder::kChargen);
+			auto  customPresets = configs.Get(config::Folder::kPresets);
 
 			std::vector<float> minMax;
 			std::set<std::string> morphList;
@@ -324,7 +365,8 @@ namespace ExtendedChargen
 				actorNpc = actor->GetNPC();
 			}
 
-			auto actorMorphs = chargen::availableShapeBlends(actorNpc);
+			// Morph writes go through chargen::MorphWriter, sliders only edit copies
+			auto& morphWriter = chargen::MorphWriter::GetSingleton();
 
 			void (*customConfigTabs)(const char* const* const, uint32_t, int*) = UI->TabBar;
 			int customConfigActiveTab = 1;
@@ -332,8 +374,8 @@ namespace ExtendedChargen
 			// Parsing for tab headers
 			std::vector<std::string> customConfigTabHeaders;
 
-			for (nlohmann::json config : customConfig) {
-				std::string configName = config.value("Name", "");
+			for (auto& configFile : customConfig->files) {
+				std::string configName = configFile->data.value("Name", "");
 
 				customConfigTabHeaders.push_back(configName.c_str());
 			}
@@ -352,8 +394,8 @@ namespace ExtendedChargen
 
 				delete[] configTabHeaders;
 
-				if (customConfigActiveTab <= headersSize) {
-					auto& currentConfig = customConfig[customConfigActiveTab];
+				if (customConfigActiveTab < headersSize) {
+					auto& currentConfig = (*customConfig)[customConfigActiveTab];
 					bool  saveWeights = currentConfig.value("SaveWeightsWithPreset", false);
 					
 					UI->VboxTop(0.9f, 0.9f);
@@ -365,8 +407,13 @@ namespace ExtendedChargen
 						}
 					}
 
-					for (int i = 0; i < currentConfig["Layout"].size(); i++) {
-						nlohmann::json& layoutPart = currentConfig["Layout"][i];
+					static const nlohmann::json noLayout = nlohmann::json::array();
+					static const nlohmann::json noGender;
+
+					auto& layout = currentConfig.contains("Layout") ? currentConfig["Layout"] : noLayout;
+					for (int i = 0; i < layout.size(); i++) {
+						const nlohmann::json& layoutPart = layout[i];
+						const nlohmann::json& gender = layoutPart.contains("Gender") ? layoutPart["Gender"] : noGender;
 
 						// Text parsing
 						if (layoutPart.value("Type", "") == "Text") {
@@ -382,25 +429,28 @@ namespace ExtendedChargen
 						// 
 						// Regular morph slider parsing
 						if (layoutPart.value("Type", "") == "Morph" &&
-							(layoutPart["Gender"] == 0 ||
-							layoutPart["Gender"] != 0 && layoutPart["Gender"] == actorNpc->IsFemale() + 1))
+							(gender == 0 ||
+							gender != 0 && gender == actorNpc->IsFemale() + 1))
 						{
 							if (layoutPart.value("Morph", "") != "") {
 								std::string morphName = layoutPart.value("Morph", "");
 								morphList.emplace(morphName);
 
-								if (!actorMorphs->contains(morphName)) {
-									actorMorphs->insert({ morphName, 0.0 });
+								auto actorMorphs = chargen::availableShapeBlends(actorNpc);
+								if (!actorMorphs || !actorMorphs->contains(morphName)) {
+									morphWriter.Write(actor, morphName, 0.0f);
+									actorMorphs = chargen::availableShapeBlends(actorNpc);
 								}
 
-								auto shapeBlend = actorMorphs->find(morphName.c_str());
+								float value = actorMorphs->find(morphName.c_str())->value;
 
 								if (UI->SliderFloat(
 										layoutPart.value("Name", " ").c_str(),
-										(float*)&shapeBlend->value,
+										&value,
 										0.0f,
 										1.0f,
 										NULL)) {
+									morphWriter.Write(actor, morphName, value);
 									chargen::updateActorAppearance(actor);
 								}
 
@@ -417,12 +467,12 @@ namespace ExtendedChargen
 								morphList.emplace(morphMinName);
 								morphList.emplace(morphMaxName);
 
-								if (!actorMorphs->contains(morphMinName)) {
-									actorMorphs->insert({ morphMinName, 0.0 });
-								}
-
-								if (!actorMorphs->contains(morphMaxName)) {
-									actorMorphs->insert({ morphMaxName, 0.0 });
+								auto actorMorphs = chargen::availableShapeBlends(actorNpc);
+								for (auto& name : { morphMinName, morphMaxName }) {
+									if (!actorMorphs || !actorMorphs->contains(name)) {
+										morphWriter.Write(actor, name, 0.0f);
+										actorMorphs = chargen::availableShapeBlends(actorNpc);
+									}
 								}
 
 								auto shapeBlendMin = actorMorphs->find(morphMinName.c_str());
@@ -441,8 +491,11 @@ namespace ExtendedChargen
 										1.0f,
 										NULL))
 								{
-									shapeBlendMax->value = (minMax[i] > 0.0) ? minMax[i] : 0.0;
-									shapeBlendMin->value = (minMax[i] < 0.0) ? abs(minMax[i]) : 0.0;
+									const std::pair<RE::BSFixedStringCS, float> morphs[] = {
+										{ RE::BSFixedStringCS(morphMaxName), (minMax[i] > 0.0f) ? minMax[i] : 0.0f },
+										{ RE::BSFixedStringCS(morphMinName), (minMax[i] < 0.0f) ? std::abs(minMax[i]) : 0.0f },
+									};
+									morphWriter.Write(actor, morphs);
 
 									chargen::updateActorAppearance(actor);
 								}
@@ -453,8 +506,9 @@ namespace ExtendedChargen
 					std::vector<std::string> presetNames;
 					uint32_t                 selPreset = 0;
 
-					for (auto& preset : customPresets)
+					for (auto& presetFile : customPresets->files)
 					{
+						auto& preset = presetFile->data;
 						if (preset.value("Name", "") != "") {
 							presetNames.push_back(preset["Name"]);
 						}
@@ -471,8 +525,8 @@ namespace ExtendedChargen
 					// Load preset
 					if (UI->SelectionList(&selPreset, &presetNames, presetNames.size(), GUI::selectionListCallback))
 					{
-						if (morphList.size() != 0 && selPreset < morphList.size() && presetNames[selPreset] != "ERROR") {
-							nlohmann::json preset = customPresets[selPreset];
+						if (morphList.size() != 0 && selPreset < morphList.size() && selPreset < presetNames.size() && presetNames[selPreset] != "ERROR") {
+							nlohmann::json preset = (*customPresets)[selPreset];
 							nlohmann::json filteredPreset;
 
 							filteredPreset["Name"] = preset["Name"];
@@ -524,7 +578,7 @@ namespace ExtendedChargen
 							utils::saveDataJSON(filteredPreset, "Presets", bufstr + ".json");
 
 							memset(&buf, 0, sizeof(buf));
-							customPresets = utils::getJsonConfigs("Presets");
+							configs.Reload(config::Folder::kPresets);
 						}
 					}
 				}
@@ -553,6 +607,94 @@ namespace ExtendedChargen
 				chargen::updateActorAppearanceFully(actor, false, true);
 			}
 
+			// Hook call counters
+			UI->Separator();
+			UI->Text("Hooks");
+			for (auto hook : hooks::g_hooks) {
+				if (!hook->IsHooked()) {
+					UI->Text("%s: not installed until subscribed", hook->GetName());
+					continue;
+				}
+				auto counters = hook->GetCounters();
+				auto avg_us = counters.dispatches ? counters.dispatch_ns / 1000.0 / counters.dispatches : 0.0;
+				UI->Text("%s: listeners %u, calls %llu, dispatched %llu, avg dispatch %.2f us, threads %zu",
+					hook->GetName(), hook->NumListeners(), counters.calls, counters.dispatches, avg_us, counters.threads);
+			}
+			UI->Separator();
+
+			// Appearance rebuilds, latencies in ms
+			auto& rebuilds = telemetry::RebuildTelemetry::GetSingleton();
+			UI->Text("Appearance rebuilds");
+			for (size_t i = 0; i < static_cast<size_t>(telemetry::RebuildType::kTotal); ++i) {
+				auto  type = static_cast<telemetry::RebuildType>(i);
+				auto& stats = rebuilds.GetStats(type);
+				if (!stats.submitted && !stats.dropped && !stats.merged) {
+					continue;
+				}
+				if (telemetry::IsCoalesced(type)) {
+					UI->Text("%s: submitted %llu, executed %llu, dropped %llu, merged %llu",
+						telemetry::GetRebuildTypeName(type), stats.submitted.load(), stats.execution.Count(), stats.dropped.load(), stats.merged.load());
+				} else {
+					UI->Text("%s: submitted %llu, executed %llu, never coalesced",
+						telemetry::GetRebuildTypeName(type), stats.submitted.load(), stats.execution.Count());
+				}
+				UI->Text("    queued p50 %.2f, p99 %.2f, max %.2f | execution p50 %.2f, p99 %.2f, max %.2f, mean %.2f",
+					stats.queue_latency.Percentile(50) / 1e6, stats.queue_latency.Percentile(99) / 1e6, stats.queue_latency.Max() / 1e6,
+					stats.execution.Percentile(50) / 1e6, stats.execution.Percentile(99) / 1e6, stats.execution.Max() / 1e6, stats.execution.Mean() / 1e6);
+			}
+			for (auto& [formID, counts] : rebuilds.GetTopActors(5)) {
+				UI->Text("    %08X: chargen %llu, appearance %llu, body %llu, race %llu", formID, counts[0], counts[1], counts[2], counts[3]);
+			}
+			if (auto untracked = rebuilds.GetNumUntracked()) {
+				UI->Text("    %llu rebuilds of actors past the first %u", untracked, telemetry::RebuildTelemetry::MaxActors);
+			}
+			if (UI->Button("Dump rebuild telemetry to CSV")) {
+				logger::info("Rebuild telemetry written to '{}'", rebuilds.DumpCSV());
+			}
+			if (UI->Button("Reset rebuild telemetry")) {
+				rebuilds.Reset();
+			}
+			auto& pending = chargen::PendingAppearance::GetSingleton();
+			UI->Text("Waiting for 3D: %zu actors, %zu bytes", pending.GetNumActors(), pending.GetNumBytes());
+			if (UI->Button("Dump trace")) {
+				logger::info("Trace written to '{}'", trace::Dump("Debug tab"));
+			}
+			UI->Separator();
+
+			// Expressions, blended into the performance morphs below on every update
+			auto& expressions = chargen::ExpressionBlender::GetSingleton();
+			auto  poseNames = expressions.GetPoseNames();
+			UI->Text("Expressions (%zu actors)", expressions.GetNumActors());
+			for (chargen::ExpressionBlender::PoseID pose = 0; pose < poseNames.size(); ++pose) {
+				float weight = expressions.GetWeight(actor, pose);
+				if (UI->SliderFloat(poseNames[pose].c_str(), &weight, 0.0f, 1.0f, NULL)) {
+					expressions.SetWeight(actor, pose, weight);
+				}
+			}
+			if (!poseNames.empty() && UI->Button("Clear expressions")) {
+				expressions.Clear(actor);
+			}
+
+			// Expression clips, recorded from and played on the performance morphs
+			auto& timeline = chargen::ExpressionTimeline::GetSingleton();
+			UI->Text("Expression clips (%zu actors playing)", timeline.GetNumPlaying());
+			if (!timeline.IsRecording(actor)) {
+				if (UI->Button("Record expression clip")) {
+					timeline.StartRecording(actor);
+				}
+			} else if (UI->Button("Stop recording")) {
+				timeline.StopRecording(actor, "Recording_" + utils::GetCurrentTimeString("%Y%m%d_%H%M%S"));
+			}
+			for (auto& clipName : timeline.GetClipNames()) {
+				if (UI->Button(("Play " + clipName).c_str())) {
+					timeline.Play(actor, clipName, false);
+				}
+			}
+			if (UI->Button("Stop clip")) {
+				timeline.Stop(actor);
+			}
+			UI->Separator();
+
 			auto facegenMorphs = chargen::getPerformanceMorphs(actor);
 
 			if (facegenMorphs != nullptr) {
@@ -596,7 +738,10 @@ DLLEXPORT bool SFSEAPI SFSEPlugin_Load(const SFSE::LoadInterface* a_sfse)
 	//#ifndef NDEBUG
 	//	MessageBoxA(NULL, "EXTENDED CHARGEN LOADED. SORRY FOR THE INTERRUPTION...", Plugin::NAME.data(), NULL);
 	//#endif
+	logger::StartAsync();
 	logger::info("Extended Chargen loaded.");
+	trace::InstallCrashHandler();
+	previousTerminateHandler = std::set_terminate(OnTerminate);
 
 	SFSE::Init(a_sfse, false);
 	SFSE::GetMessagingInterface()->RegisterListener(MessageCallback);